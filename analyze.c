@@ -13,11 +13,24 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "ftp.h"
 #include "zs.h"
 #include "util.h"
 #include "analyze.h"
+#include "profile.h"
+#include "stats.h"
+
+enum {
+    OPT_STATS = 256
+};
+
+static struct option longopts[] = {
+    {"stats", required_argument, NULL, OPT_STATS},
+    {NULL, 0, NULL, 0}
+};
 
 static int      getobjects(struct ctx *ctx, struct object *obj);
 
@@ -35,80 +48,13 @@ print_help(void)
 	   "  -m tries      set maximum tries for source to respond\n"
 	   "  -c file       source config file\n"
 	   "\n"
+	   "  --stats file  write the time of every step to file as JSON\n"
+	   "\n"
 	   "  -v            level of verbosity, can be set multiple times\n"
 	   "  -h            show this help message and exit\n"
 	   "\n" "See zs-analyze(1) for more information\n", program_name);
 }
 
-/*
- * get fd with output of cmd, returns -1 on error
- */
-static int
-freadcmd(struct ftp *ftp, char *cmd, char *fromfile)
-{
-    int             rc;
-    int             fd;
-    char            localname[PATH_MAX];
-    char            remotename[PATH_MAX];
-
-    rc = ftp_cmd(ftp, cmd);
-    if (ftp_dfthandle(ftp, rc, 250) != 0) {
-	print_error("failed to run command: %s\n", ftp_strerror(ftp));
-	return -1;
-    }
-
-    /*
-     * FIXME: ensure unique file on remote
-     */
-    snprintf(remotename, sizeof(remotename), "/tmp/zs-readcmd");
-    rc = ftp_cmd(ftp,
-		 "RCMD CPYTOIMPF FROMFILE(%s) TOSTMF('%s') MBROPT(*REPLACE) STMFCCSID(1208) RCDDLM(*LF) DTAFMT(*FIXED)\r\n",
-		 fromfile, remotename);
-    if (ftp_dfthandle(ftp, rc, 250) != 0) {
-	print_error("failed to copy to import-file: %s\n",
-		    ftp_strerror(ftp));
-	return -1;
-    }
-
-    /*
-     * create local file
-     */
-    strcpy(localname, "/tmp/zs-XXXXXX");
-    fd = mkstemp(localname);
-    if (fd == -1) {
-	print_error("failed to create output file: %s\n", strerror(errno));
-	return -1;
-    }
-
-    /*
-     * download
-     */
-    if (ftp_get(ftp, localname, remotename) != 0) {
-	print_error("failed to get file: %s\n", ftp_strerror(ftp));
-	unlink(localname);
-	close(fd);
-	return -1;
-    }
-
-    /*
-     * delete the "localname"-file already,
-     * as it is then GC'd when "close(fd)" is called
-     */
-    unlink(localname);
-
-    /*
-     * delete remote
-     */
-    rc = ftp_cmd(ftp, "DELETE %s\n", remotename);
-    if (ftp_dfthandle(ftp, rc, 250) != 0) {
-	print_error("failed to remove tempfile: %s\n", ftp_strerror(ftp));
-	close(fd);
-	return -1;
-    }
-
-    return fd;
-}
-
 static int
 processobj(struct ctx *ctx, struct object *obj)
 {
@@ -164,11 +110,17 @@ getobjects(struct ctx *ctx, struct object *obj)
     char            cmd[BUFSIZ];
     struct object   wobj;
     char           *p;
+    char            name[STATS_NAMESIZ];
+    double          seconds[3];
+    struct timespec start;
+    struct stat     st;
 
     rc = 0;
     fd = 0;
     memset(cmd, 0, sizeof(cmd));
     memset(&(wobj), 0, sizeof(struct object));
+    memset(seconds, 0, sizeof(seconds));
+    snprintf(name, sizeof(name), "%s/%s%s", obj->lib, obj->obj, obj->type);
 
     /*
      * DSPPGMREF
@@ -177,16 +129,27 @@ getobjects(struct ctx *ctx, struct object *obj)
 	     "RCMD DSPPGMREF PGM(%s/%s) OBJTYPE(%s) OUTPUT(*OUTFILE) OUTFILE(QTEMP/REF)\r\n",
 	     obj->lib, obj->obj, obj->type);
 
-    fd = freadcmd(&ctx->ftp, cmd, "QTEMP/REF");
+    fd = util_freadcmd(&ctx->ftp, cmd, "QTEMP/REF", seconds);
     if (fd == -1)
 	return 1;
+    if (fstat(fd, &st) == -1)
+	st.st_size = 0;
+    stats_record(ctx->stats, name, STATS_DSPPGMREF, seconds[0], 0);
+    stats_record(ctx->stats, name, STATS_CPYTOIMPF, seconds[1], 0);
+    stats_record(ctx->stats, name, STATS_DOWNLOAD, seconds[2], st.st_size);
 
+    /*
+     * a new session has an empty QTEMP
+     */
+    clock_gettime(CLOCK_MONOTONIC, &start);
     rc = ftp_cmd(&ctx->ftp, "RCMD DLTF FILE(QTEMP/REF)\r\n");
-    if (ftp_dfthandle(&ctx->ftp, rc, 250) == -1) {
+    if (ftp_dfthandle(&ctx->ftp, rc, 250) == -1 && !ftp_replay(&ctx->ftp)) {
 	print_error("failed to remove DSPPGMREF file: %s\n",
 		    ftp_strerror(&ctx->ftp));
 	return 1;
     }
+    stats_record(ctx->stats, name, STATS_CLEANUP, profile_elapsed(&start),
+		 0);
 
     while (read(fd, &reftab, sizeof(struct dsppgmref))
 	   == sizeof(struct dsppgmref)) {
@@ -241,6 +204,9 @@ main_analyze(int argc, char **argv)
     int             rc;
     int             exit_code;
     struct object   obj;
+    struct profile  profile;
+    struct stats    stats;
+    char           *statspath;
 
     memset(&ctx, 0, sizeof(struct ctx));
     ctx.tab = malloc(sizeof(struct object) * INIT_TAB_SIZE);
@@ -252,8 +218,10 @@ main_analyze(int argc, char **argv)
     ctx.tabsiz = INIT_TAB_SIZE;
 
     ftp_init(&ctx.ftp);
+    statspath = NULL;
 
-    while ((c = getopt(argc, argv, "hvs:u:p:l:m:c:")) != -1) {
+    while ((c = getopt_long(argc, argv, "hvs:u:p:l:m:c:", longopts, NULL))
+	   != -1) {
 	switch (c) {
 	case 'h':		/* help */
 	    print_help();
@@ -285,6 +253,9 @@ main_analyze(int argc, char **argv)
 		print_error("failed to parse config file: %s\n",
 			    util_strerror(rc));
 	    break;
+	case OPT_STATS:	/* statistics file */
+	    statspath = optarg;
+	    break;
 	default:
 	    return 2;
 	}
@@ -295,18 +266,41 @@ main_analyze(int argc, char **argv)
 	return 2;
     }
 
+    /*
+     * every step is timed from here on
+     */
+    if (statspath != NULL) {
+	if (stats_open(&stats, statspath) != 0) {
+	    print_error("failed to open stats: %s\n", strerror(errno));
+	    return 1;
+	}
+	ctx.stats = &stats;
+    }
+
     if (ftp_connect(&ctx.ftp) == -1) {
 	print_error("failed to connect to server: %s\n",
 		    ftp_strerror(&ctx.ftp));
 	return 1;
     }
 
+    /*
+     * the outfiles are compressed on a link that copies found slow
+     */
+    if (ctx.ftp.deflate.want == FTP_DEFLATE_AUTO
+	&& profile_load(&profile, ctx.ftp.server.host) == 0
+	&& profile_slowlink(&profile)
+	&& ftp_deflate(&ctx.ftp, 1) != 0) {
+	print_error("failed to set transfer mode: %s\n",
+		    ftp_strerror(&ctx.ftp));
+	return 1;
+    }
+
     for (int i = 0; i < Z_LIBLMAX; i++) {
 	if (*ctx.libl[i] == '\0')
 	    break;
 
-	rc = ftp_cmd(&ctx.ftp, "RCMD ADDLIBLE %s\r\n", ctx.libl[i]);
-	if (ftp_dfthandle(&ctx.ftp, rc, 250) == -1) {
+	if (ftp_cmdkeep(&ctx.ftp, 250, "RCMD ADDLIBLE %s\r\n", ctx.libl[i])
+	    == -1) {
 	    print_error("failed to add %s to library list: %s\n",
 			ctx.libl[i], ftp_strerror(&ctx.ftp));
 	    return 1;
@@ -325,6 +319,13 @@ main_analyze(int argc, char **argv)
 	}
     }
 
+    if (ctx.stats != NULL) {
+	stats_ftp(ctx.stats, &ctx.ftp);
+	if (stats_write(ctx.stats, "analyze") != 0)
+	    print_error("failed to write stats: %s\n", strerror(errno));
+	stats_close(ctx.stats);
+    }
+
     free(ctx.tab);
     ftp_close(&ctx.ftp);
     return exit_code;
@@ -14,6 +14,7 @@ struct ctx {
     unsigned int    tabsiz;
     struct ftp      ftp;
     char            libl[Z_LIBLMAX][Z_LIBSIZ];
+    struct stats   *stats;	/* NULL without "--stats" */
 };
 
 struct dsppgmref {
@@ -0,0 +1,295 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "zs.h"
+#include "cache.h"
+
+struct cachefile {
+    char            name[NAME_MAX + 1];
+    off_t           size;
+    time_t          mtime;
+};
+
+/*
+ * the cache is content-addressed, every save file is stored under a hash
+ * of its key. FNV-1a is plenty for a handful of thousand keys
+ */
+static int
+cachepath(struct cache *cache, char *key, char *path, size_t pathsiz)
+{
+    unsigned long long hash;
+    unsigned char  *p;
+
+    hash = 14695981039346656037ULL;
+    for (p = (unsigned char *) key; *p; p++) {
+	hash ^= *p;
+	hash *= 1099511628211ULL;
+    }
+
+    if ((size_t) snprintf(path, pathsiz, "%s/%016llx.savf", cache->dir,
+			  hash) >= pathsiz) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * copy the file open as "fromfd" to "to", from its start
+ */
+static int
+copyfd(int fromfd, char *to)
+{
+    char            buf[BUFSIZ];
+    ssize_t         len;
+    off_t           offset;
+    int             tofd;
+    int             errno_;
+
+    tofd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (tofd == -1)
+	return -1;
+
+    offset = 0;
+    while ((len = pread(fromfd, buf, sizeof(buf), offset)) > 0) {
+	if (write(tofd, buf, len) != len) {
+	    len = -1;
+	    break;
+	}
+	offset += len;
+    }
+
+    errno_ = errno;
+    close(tofd);
+    errno = errno_;
+
+    return len == 0 ? 0 : -1;
+}
+
+/*
+ * copy "from" to "to", used when a hard link can't be made
+ */
+static int
+copyfile(char *from, char *to)
+{
+    int             fromfd;
+    int             errno_;
+    int             rc;
+
+    fromfd = open(from, O_RDONLY);
+    if (fromfd == -1)
+	return -1;
+
+    rc = copyfd(fromfd, to);
+
+    errno_ = errno;
+    close(fromfd);
+    errno = errno_;
+
+    return rc;
+}
+
+/*
+ * link "from" to "to", or copy it when they are on different file systems
+ */
+static int
+linkfile(char *from, char *to)
+{
+    if (link(from, to) == 0)
+	return 0;
+    if (errno != EXDEV && errno != EPERM)
+	return -1;
+    return copyfile(from, to);
+}
+
+static int
+cmpmtime(const void *a, const void *b)
+{
+    const struct cachefile *fa = a;
+    const struct cachefile *fb = b;
+
+    return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+/*
+ * remove least recently used save files until the cache is within
+ * "cache->maxsize"
+ */
+static int
+evict(struct cache *cache)
+{
+    DIR            *dir;
+    struct dirent  *dent;
+    struct stat     st;
+    struct cachefile *files;
+    struct cachefile *pfiles;
+    size_t          nfiles;
+    size_t          filessiz;
+    size_t          i;
+    long long       total;
+    char            path[PATH_MAX];
+    size_t          len;
+
+    if (cache->maxsize == 0)
+	return 0;
+
+    dir = opendir(cache->dir);
+    if (dir == NULL)
+	return -1;
+
+    files = NULL;
+    nfiles = 0;
+    filessiz = 0;
+    total = 0;
+
+    while ((dent = readdir(dir)) != NULL) {
+	len = strlen(dent->d_name);
+	if (len < 5 || strcmp(dent->d_name + len - 5, ".savf") != 0)
+	    continue;
+
+	if ((size_t) snprintf(path, sizeof(path), "%s/%s", cache->dir,
+			      dent->d_name) >= sizeof(path)
+	    || stat(path, &st) == -1)
+	    continue;
+
+	if (nfiles == filessiz) {
+	    filessiz = filessiz ? filessiz * 2 : 64;
+	    pfiles = realloc(files, sizeof(struct cachefile) * filessiz);
+	    if (pfiles == NULL) {
+		free(files);
+		closedir(dir);
+		return -1;
+	    }
+	    files = pfiles;
+	}
+
+	strcpy(files[nfiles].name, dent->d_name);
+	files[nfiles].size = st.st_size;
+	files[nfiles].mtime = st.st_mtime;
+	total += st.st_size;
+	nfiles++;
+    }
+    closedir(dir);
+
+    qsort(files, nfiles, sizeof(struct cachefile), cmpmtime);
+
+    for (i = 0; i < nfiles && total > cache->maxsize; i++) {
+	if ((size_t) snprintf(path, sizeof(path), "%s/%s", cache->dir,
+			      files[i].name) < sizeof(path)
+	    && unlink(path) == 0)
+	    total -= files[i].size;
+    }
+
+    free(files);
+    return 0;
+}
+
+/*
+ * look up "key" in the cache, on a hit the cached save file replaces
+ * "localname".
+ * the return value is:
+ * - 0 on a hit,
+ * - 1 on a miss,
+ * - and -1 on error
+ */
+int
+cache_lookup(struct cache *cache, char *key, char *localname)
+{
+    char            path[PATH_MAX];
+    char            tmppath[PATH_MAX];
+
+    if (cachepath(cache, key, path, sizeof(path)) == -1)
+	return -1;
+
+    if (access(path, R_OK) == -1)
+	return errno == ENOENT ? 1 : -1;
+
+    /*
+     * touch, the modification time is what the LRU eviction goes by
+     */
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    if ((size_t) snprintf(tmppath, sizeof(tmppath), "%s.cache",
+			  localname) >= sizeof(tmppath)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    unlink(tmppath);
+    if (linkfile(path, tmppath) == -1)
+	return -1;
+    if (rename(tmppath, localname) == -1) {
+	unlink(tmppath);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * store "localname", or the file open as "fd" when "localname" is NULL, in
+ * the cache under "key", and evict old entries
+ */
+static int
+store(struct cache *cache, char *key, char *localname, int fd)
+{
+    char            path[PATH_MAX];
+    char            tmppath[PATH_MAX];
+
+    if (mkdir(cache->dir, 0700) == -1 && errno != EEXIST)
+	return -1;
+
+    if (cachepath(cache, key, path, sizeof(path)) == -1)
+	return -1;
+    if ((size_t) snprintf(tmppath, sizeof(tmppath), "%s.%ld", path,
+			  (long) getpid()) >= sizeof(tmppath)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+
+    /*
+     * rename(2) makes the new entry visible atomically
+     */
+    unlink(tmppath);
+    if ((localname != NULL ? linkfile(localname, tmppath)
+	 : copyfd(fd, tmppath)) == -1) {
+	unlink(tmppath);
+	return -1;
+    }
+    if (rename(tmppath, path) == -1) {
+	unlink(tmppath);
+	return -1;
+    }
+
+    return evict(cache);
+}
+
+/*
+ * store "localname" in the cache under "key"
+ */
+int
+cache_store(struct cache *cache, char *key, char *localname)
+{
+    return store(cache, key, localname, -1);
+}
+
+/*
+ * store the save file in memory "fd" in the cache under "key"
+ */
+int
+cache_storefd(struct cache *cache, char *key, int fd)
+{
+    return store(cache, key, NULL, fd);
+}
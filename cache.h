@@ -0,0 +1,20 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef CACHE_H
+#define CACHE_H 1
+
+#define CACHE_KEYSIZ	512
+
+struct cache {
+    char            dir[PATH_MAX];
+    long long       maxsize;	/* bytes, 0 = unbounded */
+};
+
+int             cache_lookup(struct cache *, char *, char *);
+int             cache_store(struct cache *, char *, char *);
+int             cache_storefd(struct cache *, char *, int);
+
+#endif
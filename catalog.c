@@ -0,0 +1,309 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdarg.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "util.h"
+#include "catalog.h"
+
+/*
+ * copy a fixed width field from an outfile record, trailing blanks are
+ * stripped
+ */
+static void
+copyfield(char *dest, size_t destsiz, char *src, size_t srclen)
+{
+    if (srclen > destsiz - 1)
+	srclen = destsiz - 1;
+    while (srclen > 0 && src[srclen - 1] == ' ')
+	srclen--;
+
+    memcpy(dest, src, srclen);
+    dest[srclen] = '\0';
+}
+
+/*
+ * append to "buf" at offset "len", the returned length can exceed "siz" in
+ * which case the buffer was too small, see "snprintf(3)"
+ */
+static size_t
+appendf(char *buf, size_t siz, size_t len, char *format, ...)
+{
+    va_list         ap;
+
+    if (len >= siz)
+	return len + 1;
+
+    va_start(ap, format);
+    len += vsnprintf(buf + len, siz - len, format, ap);
+    va_end(ap);
+
+    return len;
+}
+
+static int
+addentry(struct catalog *cat, struct catrec *rec)
+{
+    struct catentry *ptab;
+    struct catentry *ent;
+    unsigned int    size;
+    char            num[sizeof(rec->size) + 1];
+
+    if (cat->tablen == cat->tabsiz) {
+	size = cat->tabsiz ? cat->tabsiz * 2 : INIT_CAT_SIZE;
+	ptab = realloc(cat->tab, sizeof(struct catentry) * size);
+	if (ptab == NULL) {
+	    print_error("failed to re-allocate catalog\n");
+	    return 1;
+	}
+	cat->tabsiz = size;
+	cat->tab = ptab;
+    }
+
+    ent = &cat->tab[cat->tablen++];
+    memset(ent, 0, sizeof(struct catentry));
+
+    copyfield(ent->obj.lib, sizeof(ent->obj.lib), rec->lib,
+	      sizeof(rec->lib));
+    copyfield(ent->obj.obj, sizeof(ent->obj.obj), rec->obj,
+	      sizeof(rec->obj));
+    copyfield(ent->obj.type, sizeof(ent->obj.type), rec->type,
+	      sizeof(rec->type));
+    copyfield(num, sizeof(num), rec->size, sizeof(rec->size));
+    ent->size = atoll(num);
+    copyfield(ent->changed, sizeof(ent->changed), rec->changed,
+	      sizeof(rec->changed));
+    copyfield(ent->created, sizeof(ent->created), rec->created,
+	      sizeof(rec->created));
+    copyfield(ent->srclib, sizeof(ent->srclib), rec->srclib,
+	      sizeof(rec->srclib));
+    copyfield(ent->srcfile, sizeof(ent->srcfile), rec->srcfile,
+	      sizeof(rec->srcfile));
+    copyfield(ent->srcmbr, sizeof(ent->srcmbr), rec->srcmbr,
+	      sizeof(rec->srcmbr));
+    copyfield(ent->srcchanged, sizeof(ent->srcchanged), rec->srcchanged,
+	      sizeof(rec->srcchanged));
+
+    return 0;
+}
+
+/*
+ * list objects in the libraries "libl" through a single catalog query on
+ * the server, the result is downloaded as one outfile and appended to "cat".
+ * "obj" limits the result to one object name or a generic name, NULL lists
+ * every object.
+ * "types" limits the result to the given types, an empty list means all
+ */
+int
+catalog_query(struct catalog *cat, struct ftp *ftp,
+	      char libl[Z_LIBLMAX][Z_LIBSIZ], char *obj,
+	      char types[Z_TYPEMAX][Z_TYPESIZ])
+{
+    struct catrec   rec;
+    char            cmd[BUFSIZ];
+    char            typelist[Z_TYPEMAX * Z_TYPESIZ];
+    size_t          len;
+    int             fd;
+    int             rc;
+    int             i;
+
+    /*
+     * $typelist = *type1 *type2 ...
+     */
+    *typelist = '\0';
+    for (i = 0; i < Z_TYPEMAX && *types[i] != '\0'; i++) {
+	if (i > 0)
+	    strcat(typelist, " ");
+	strcat(typelist, types[i]);
+    }
+    if (*typelist == '\0')
+	strcpy(typelist, "*ALL");
+
+    len = snprintf(cmd, sizeof(cmd),
+		   "RCMD RUNSQL SQL('CREATE TABLE QTEMP/ZSCAT AS (SELECT"
+		   " CAST(ZLIB AS CHAR(10)) AS ZLIB,"
+		   " CAST(OBJNAME AS CHAR(10)) AS ZOBJ,"
+		   " CAST(OBJTYPE AS CHAR(8)) AS ZTYPE,"
+		   " DIGITS(CAST(COALESCE(OBJSIZE, 0) AS DECIMAL(15, 0))) AS ZSIZE,"
+		   " CAST(COALESCE(CHAR(CHANGE_TIMESTAMP), '''') AS CHAR(26)) AS ZCHG,"
+		   " CAST(COALESCE(CHAR(OBJCREATED), '''') AS CHAR(26)) AS ZCRT,"
+		   " CAST(COALESCE(SOURCE_LIBRARY, '''') AS CHAR(10)) AS ZSRCLIB,"
+		   " CAST(COALESCE(SOURCE_FILE, '''') AS CHAR(10)) AS ZSRCF,"
+		   " CAST(COALESCE(SOURCE_MEMBER, '''') AS CHAR(10)) AS ZSRCM,"
+		   " CAST(COALESCE(CHAR(SOURCE_TIMESTAMP), '''') AS CHAR(26)) AS ZSRCCHG"
+		   " FROM (");
+
+    for (i = 0; i < Z_LIBLMAX && *libl[i] != '\0'; i++) {
+	len = appendf(cmd, sizeof(cmd), len,
+		      "%sSELECT ''%s'' AS ZLIB, X.* FROM"
+		      " TABLE(QSYS2/OBJECT_STATISTICS(''%s'', ''%s'')) X",
+		      i > 0 ? " UNION ALL " : "", libl[i], libl[i],
+		      typelist);
+    }
+
+    /*
+     * a generic name "abc*" turns into LIKE 'abc%', a special value like
+     * *ALL does not limit the result
+     */
+    if (obj != NULL && *obj == '*') {
+	len = appendf(cmd, sizeof(cmd), len, ") Y");
+    } else if (obj != NULL && obj[strlen(obj) - 1] == '*') {
+	len = appendf(cmd, sizeof(cmd), len,
+		      ") Y WHERE OBJNAME LIKE ''%.*s%%''",
+		      (int) strlen(obj) - 1, obj);
+    } else if (obj != NULL) {
+	len = appendf(cmd, sizeof(cmd), len,
+		      ") Y WHERE OBJNAME = ''%s''", obj);
+    } else {
+	len = appendf(cmd, sizeof(cmd), len, ") Y");
+    }
+
+    len = appendf(cmd, sizeof(cmd), len,
+		  ") WITH DATA') COMMIT(*NONE) NAMING(*SYS)\r\n");
+    if (len >= sizeof(cmd)) {
+	print_error("catalog query is too long\n");
+	return 1;
+    }
+
+    fd = util_freadcmd(ftp, cmd, "QTEMP/ZSCAT", NULL);
+    if (fd == -1)
+	return 1;
+
+    rc = ftp_cmd(ftp, "RCMD DLTF FILE(QTEMP/ZSCAT)\r\n");
+    if (ftp_dfthandle(ftp, rc, 250) == -1) {
+	print_error("failed to remove catalog file: %s\n",
+		    ftp_strerror(ftp));
+	close(fd);
+	return 1;
+    }
+
+    while (read(fd, &rec, sizeof(struct catrec)) == sizeof(struct catrec)) {
+	if (addentry(cat, &rec) != 0) {
+	    close(fd);
+	    return 1;
+	}
+    }
+    close(fd);
+
+    return 0;
+}
+
+/*
+ * match an object name against "pattern", which can be a generic name
+ */
+static int
+matchname(char *pattern, char *name)
+{
+    size_t          len;
+
+    if (strcmp(pattern, "*ALL") == 0)
+	return 1;
+
+    len = strlen(pattern);
+    if (len > 0 && pattern[len - 1] == '*')
+	return strncmp(pattern, name, len - 1) == 0;
+
+    return strcmp(pattern, name) == 0;
+}
+
+/*
+ * pick the entry named "obj" that the library list and type list would
+ * resolve to, libraries are searched first and types second.
+ * NULL when nothing matches
+ */
+struct catentry *
+catalog_resolve(struct catalog *cat, char *obj,
+		char libl[Z_LIBLMAX][Z_LIBSIZ],
+		char types[Z_TYPEMAX][Z_TYPESIZ])
+{
+    struct catentry *best;
+    unsigned int    i;
+    int             rank;
+    int             bestrank;
+    int             l;
+    int             t;
+
+    best = NULL;
+    bestrank = 0;
+    for (i = 0; i < cat->tablen; i++) {
+	if (!matchname(obj, cat->tab[i].obj.obj))
+	    continue;
+
+	for (l = 0; l < Z_LIBLMAX && *libl[l] != '\0'; l++) {
+	    if (strcmp(libl[l], cat->tab[i].obj.lib) == 0)
+		break;
+	}
+	if (l == Z_LIBLMAX || *libl[l] == '\0')
+	    continue;
+
+	for (t = 0; t < Z_TYPEMAX && *types[t] != '\0'; t++) {
+	    if (strcmp(types[t], "*ALL") == 0
+		|| strcmp(types[t], cat->tab[i].obj.type) == 0)
+		break;
+	}
+	if (t == Z_TYPEMAX)
+	    continue;
+	if (*types[t] == '\0' && t > 0)
+	    continue;
+
+	rank = l * Z_TYPEMAX + t;
+	if (best == NULL || rank < bestrank) {
+	    best = &cat->tab[i];
+	    bestrank = rank;
+	}
+    }
+
+    return best;
+}
+
+/*
+ * get the current time of the server, "ts" must be at least Z_TSSIZ large
+ */
+int
+catalog_now(struct ftp *ftp, char *ts)
+{
+    char            rec[Z_TSSIZ];
+    int             fd;
+    int             rc;
+
+    fd = util_freadcmd(ftp,
+		       "RCMD RUNSQL SQL('CREATE TABLE QTEMP/ZSNOW AS (SELECT CHAR(CURRENT TIMESTAMP) AS ZNOW FROM SYSIBM/SYSDUMMY1) WITH DATA') COMMIT(*NONE) NAMING(*SYS)\r\n",
+		       "QTEMP/ZSNOW", NULL);
+    if (fd == -1)
+	return 1;
+
+    rc = ftp_cmd(ftp, "RCMD DLTF FILE(QTEMP/ZSNOW)\r\n");
+    if (ftp_dfthandle(ftp, rc, 250) == -1) {
+	print_error("failed to remove timestamp file: %s\n",
+		    ftp_strerror(ftp));
+	close(fd);
+	return 1;
+    }
+
+    if (read(fd, rec, sizeof(rec)) != sizeof(rec)) {
+	print_error("failed to read server time\n");
+	close(fd);
+	return 1;
+    }
+    close(fd);
+
+    copyfield(ts, Z_TSSIZ, rec, sizeof(rec) - 1);
+    return 0;
+}
+
+void
+catalog_free(struct catalog *cat)
+{
+    free(cat->tab);
+    cat->tab = NULL;
+    cat->tablen = 0;
+    cat->tabsiz = 0;
+}
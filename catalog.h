@@ -0,0 +1,54 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef CATALOG_H
+#define CATALOG_H 1
+
+#define INIT_CAT_SIZE	64
+
+struct catentry {
+    struct object   obj;
+    long long       size;
+    char            changed[Z_TSSIZ];
+    char            created[Z_TSSIZ];
+    char            srclib[Z_LIBSIZ];
+    char            srcfile[Z_OBJSIZ];
+    char            srcmbr[Z_OBJSIZ];
+    char            srcchanged[Z_TSSIZ];
+};
+
+struct catalog {
+    struct catentry *tab;
+    unsigned int    tablen;
+    unsigned int    tabsiz;
+};
+
+/*
+ * record layout of the outfile produced by "catalog_query"
+ */
+struct catrec {
+    char            lib[10];
+    char            obj[10];
+    char            type[8];
+    char            size[15];	/* numeric 15 */
+    char            changed[26];
+    char            created[26];
+    char            srclib[10];
+    char            srcfile[10];
+    char            srcmbr[10];
+    char            srcchanged[26];
+    char            __nl[1];	/* trailing newline */
+} __attribute__ ((packed));
+
+int             catalog_query(struct catalog *, struct ftp *,
+			      char[Z_LIBLMAX][Z_LIBSIZ], char *,
+			      char[Z_TYPEMAX][Z_TYPESIZ]);
+struct catentry *catalog_resolve(struct catalog *, char *,
+				 char[Z_LIBLMAX][Z_LIBSIZ],
+				 char[Z_TYPEMAX][Z_TYPESIZ]);
+int             catalog_now(struct ftp *, char *);
+void            catalog_free(struct catalog *);
+
+#endif
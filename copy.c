@@ -4,18 +4,64 @@
  * See LICENSE
  */
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <getopt.h>
+#include <time.h>
 
 #include "ftp.h"
 #include "zs.h"
 #include "util.h"
+#include "catalog.h"
+#include "cache.h"
+#include "job.h"
+#include "qsh.h"
+#include "pool.h"
+#include "profile.h"
+#include "journal.h"
+#include "stage.h"
+#include "stats.h"
+
+enum {
+    OPT_CACHE = 256,
+    OPT_CACHESIZE,
+    OPT_JOBQ,
+    OPT_WORKLIB,
+    OPT_COMPRESS,
+    OPT_RESUME,
+    OPT_STAGEDIR,
+    OPT_STAGESIZE,
+    OPT_STAGEMEMORY,
+    OPT_RATELIMIT,
+    OPT_URGENT,
+    OPT_STATS
+};
+
+static struct option longopts[] = {
+    {"cache", required_argument, NULL, OPT_CACHE},
+    {"cache-size", required_argument, NULL, OPT_CACHESIZE},
+    {"jobq", required_argument, NULL, OPT_JOBQ},
+    {"worklib", required_argument, NULL, OPT_WORKLIB},
+    {"compress", required_argument, NULL, OPT_COMPRESS},
+    {"resume", no_argument, NULL, OPT_RESUME},
+    {"stage-dir", required_argument, NULL, OPT_STAGEDIR},
+    {"stage-size", required_argument, NULL, OPT_STAGESIZE},
+    {"stage-memory", required_argument, NULL, OPT_STAGEMEMORY},
+    {"rate-limit", required_argument, NULL, OPT_RATELIMIT},
+    {"urgent", required_argument, NULL, OPT_URGENT},
+    {"stats", required_argument, NULL, OPT_STATS},
+    {NULL, 0, NULL, 0}
+};
 
 static void
 print_help(void)
@@ -41,39 +87,805 @@ print_help(void)
 	   "  -M tries      set maximum tries for target to respond\n"
 	   "  -C file       source config file\n"
 	   "\n"
+	   "  --cache dir   cache save files locally in dir\n"
+	   "  --cache-size size\n"
+	   "                maximum size of the cache, default is 1G\n"
+	   "  --jobq jobq   save and restore in batch jobs submitted to jobq\n"
+	   "  --worklib lib library for save files on both systems,\n"
+	   "                default is QGPL\n"
+	   "  --compress level\n"
+	   "                save compression, one of no, low, medium, high\n"
+	   "                or auto, default is auto\n"
+	   "  --resume      continue the last run to the same target library\n"
+	   "  --stage-dir dir\n"
+	   "                keep local save files in dir, can be set multiple\n"
+	   "                times, default is /tmp\n"
+	   "  --stage-size size\n"
+	   "                maximum size of the local save files at once\n"
+	   "  --stage-memory size\n"
+	   "                keep local save files in memory while they fit in\n"
+	   "                size, default is 64M\n"
+	   "  --rate-limit size\n"
+	   "                bytes per second of all transfers together\n"
+	   "  --urgent object\n"
+	   "                copy object first, ahead of the others, can be\n"
+	   "                set multiple times\n"
+	   "  --stats file  write the time of every phase to file as JSON\n"
+	   "\n"
 	   "  -v            level of verbosity, can be set multiple times\n"
 	   "  -h            show this help message and exit\n"
 	   "\n" "See zs-copy(1) for more information\n", program_name);
 }
 
+static void
+print_synchelp(void)
+{
+    printf("Usage %s sync [OPTION]... LIBRARY\n"
+	   "Copy objects changed since the last sync from one AS/400 to another\n"
+	   "\n"
+	   "  -s host       set source host\n"
+	   "  -u user       set source user\n"
+	   "  -p port       set source port\n"
+	   "  -t types      set type list\n"
+	   "                comma separated list of types\n"
+	   "  -m tries      set maximum tries for source to respond\n"
+	   "  -r release    set target release\n"
+	   "  -c file       source config file\n"
+	   "\n"
+	   "  -S host       set target host\n"
+	   "  -U user       set target user\n"
+	   "  -P port       set target port\n"
+	   "  -L lib        set target destination library\n"
+	   "                defaults to LIBRARY\n"
+	   "  -M tries      set maximum tries for target to respond\n"
+	   "  -C file       source config file\n"
+	   "\n"
+	   "  --stage-dir dir\n"
+	   "                keep local save files in dir, can be set multiple\n"
+	   "                times, default is /tmp\n"
+	   "  --rate-limit size\n"
+	   "                bytes per second of all transfers together\n"
+	   "  --stats file  write the time of every phase to file as JSON\n"
+	   "\n"
+	   "  -v            level of verbosity, can be set multiple times\n"
+	   "  -h            show this help message and exit\n"
+	   "\n" "See zs-sync(1) for more information\n", program_name);
+}
+
+/*
+ * the name of the object "name" saved from "lib" in the statistics, the
+ * library for "zs sync"
+ */
+static char    *
+statsname(char *name, char *lib)
+{
+    return *name != '\0' ? name : lib;
+}
+
+/*
+ * join the type list for an OBJTYPE parameter
+ * $types = *type1 *type2 ...
+ */
+static void
+jointypes(char *buf, char types[Z_TYPEMAX][Z_TYPESIZ])
+{
+    int             i;
+
+    *buf = '\0';
+    for (i = 0; i < Z_TYPEMAX && *types[i] != '\0'; i++) {
+	if (i > 0)
+	    strcat(buf, " ");
+	strcat(buf, types[i]);
+    }
+}
+
+/*
+ * get the DTACPR value of the next save, the compression profile of the
+ * source chooses it unless it was given
+ */
+static char    *
+choosedtacpr(struct sourceopt *sourceopt)
+{
+    if (*sourceopt->dtacpr != '\0')
+	return sourceopt->dtacpr;
+
+    return profile_choose(sourceopt->profile);
+}
+
+/*
+ * hand a downloaded save file of the object "name" over to the target
+ * process, it is "localname" or the file in memory "fd" when it is not -1.
+ * the target uploads it with the priority of the object.
+ * an empty "localname" without "fd" makes the target restore the save file
+ * it already has from an earlier run
+ */
+static int
+handoff(struct sourceopt *sourceopt, char *name, char *lib, char *localname,
+	int fd)
+{
+    char            buf[BUFSIZ];
+    int             len;
+
+    len = snprintf(buf, sizeof(buf), "%s:%s:%d:%s\n", name, lib,
+		   sourceopt->priority, localname);
+    if (len < 0 || (size_t) len >= sizeof(buf)
+	|| stage_send(sourceopt->pipe, buf, len, fd) == -1) {
+	print_error("failed to write to target process\n");
+	return 1;
+    }
+
+    if (*localname != '\0' || fd != -1)
+	stage_handoff(sourceopt->stage, localname, fd);
+    return 0;
+}
+
+/*
+ * get the libraries and types searched for "obj", the object's own library
+ * and type take precedence over the library and type list
+ */
+static void
+searchlists(struct sourceopt *sourceopt, struct object *obj,
+	    char libl[Z_LIBLMAX][Z_LIBSIZ], char types[Z_TYPEMAX][Z_TYPESIZ])
+{
+    memset(libl, 0, sizeof(char[Z_LIBLMAX][Z_LIBSIZ]));
+    memset(types, 0, sizeof(char[Z_TYPEMAX][Z_TYPESIZ]));
+
+    if (*obj->lib)
+	strcpy(libl[0], obj->lib);
+    else
+	memcpy(libl, sourceopt->libl, sizeof(char[Z_LIBLMAX][Z_LIBSIZ]));
+
+    if (*obj->type)
+	strcpy(types[0], obj->type);
+    else
+	memcpy(types, sourceopt->types, sizeof(char[Z_TYPEMAX][Z_TYPESIZ]));
+}
+
+/*
+ * resolve "obj" through the catalog, "resobj" is set to the resolved object,
+ * "key" to its cache key and "size" to its size unless it is NULL.
+ * the return value is:
+ * - 0 when the object was resolved,
+ * - 1 when it could not be resolved, "resobj" is then a copy of "obj" and
+ *   "key" is empty,
+ * - and -1 on error
+ */
+static int
+resolveobj(struct sourceopt *sourceopt, struct ftp *ftp,
+	   struct object *obj, struct object *resobj, char *key,
+	   size_t keysiz, long long *size)
+{
+    struct catalog  cat;
+    struct catentry *ent;
+    char            libl[Z_LIBLMAX][Z_LIBSIZ];
+    char            types[Z_TYPEMAX][Z_TYPESIZ];
+
+    memcpy(resobj, obj, sizeof(struct object));
+    *key = '\0';
+
+    memset(&cat, 0, sizeof(struct catalog));
+    searchlists(sourceopt, obj, libl, types);
+
+    if (catalog_query(&cat, ftp, libl, obj->obj, types) != 0)
+	return -1;
+
+    ent = catalog_resolve(&cat, obj->obj, libl, types);
+    if (ent == NULL) {
+	catalog_free(&cat);
+	return 1;
+    }
+
+    memcpy(resobj, &ent->obj, sizeof(struct object));
+    if (size != NULL)
+	*size = ent->size;
+    snprintf(key, keysiz, "%s:%d|%s/%s%s|%s|%s", ftp->server.host,
+	     ftp->server.port, ent->obj.lib, ent->obj.obj, ent->obj.type,
+	     ent->changed, sourceopt->release);
+    catalog_free(&cat);
+
+    return 0;
+}
+
+/*
+ * look the resolved object "obj" up in the save file cache, a cached save
+ * file is handed to the target right away.
+ * the return value is 0 on a cache hit, 1 on a miss, and -1 on error
+ */
+static int
+lookupcache(struct sourceopt *sourceopt, struct ftp *ftp,
+	    struct object *obj, char *key, char *name)
+{
+    char            localname[PATH_MAX];
+    int             rc;
+
+    /*
+     * a hit is linked to the cache unless it is on another file system, its
+     * size is not known until then
+     */
+    if (stage_create(sourceopt->stage, localname, sizeof(localname), 0)
+	!= 0) {
+	print_error("failed to create output file: %s\n", strerror(errno));
+	return -1;
+    }
+
+    rc = cache_lookup(sourceopt->cache, key, localname);
+    if (rc != 0) {
+	unlink(localname);
+	if (rc == -1)
+	    print_error("failed to read cache: %s\n", strerror(errno));
+	return 1;
+    }
+
+    if (ftp->verbosity >= FTP_VERBOSE_SOME)
+	fprintf(stderr, "CACHE: %s/%s%s\n", obj->lib, obj->obj, obj->type);
+
+    if (handoff(sourceopt, name, obj->lib, localname, -1) != 0) {
+	unlink(localname);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * move the stream file "remotename", holding the object "name" saved from
+ * "lib", to the local system and hand it to the target process. the stream
+ * file is stored in the cache under "key" unless it is empty. "part" is
+ * the local file an earlier download of it broke off in, or NULL
+ */
+static int
+downloadstmf(struct sourceopt *sourceopt, struct ftp *ftp, char *remotename,
+	     char *lib, char *key, char *name, char *part,
+	     long long *savfsize)
+{
+    int             rc;
+    int             fd;
+    char            localname[PATH_MAX];
+    long long       size;
+    struct timespec start;
+    struct stat     st;
+
+    size = ftp_size(ftp, remotename);
+    if (size == -1) {
+	print_error("failed to get size: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+
+    /*
+     * a download that broke off goes on in its file, else a small save
+     * file is kept in memory, else wait for room on disk
+     */
+    *localname = '\0';
+    fd = -1;
+    if (part != NULL && *part != '\0' && access(part, W_OK) == 0)
+	snprintf(localname, sizeof(localname), "%s", part);
+    else
+	fd = stage_memfd(sourceopt->stage, size);
+    if (fd == -1 && *localname == '\0'
+	&& stage_create(sourceopt->stage, localname, sizeof(localname),
+			size) != 0) {
+	print_error("failed to create output file: %s\n", strerror(errno));
+	return 1;
+    }
+
+    if (journal_saved(sourceopt->journal, name, lib, remotename,
+		      localname) != 0) {
+	print_error("failed to write journal: %s\n", strerror(errno));
+	goto error;
+    }
+
+    /*
+     * the transfer is compressed on a slow link
+     */
+    if (ftp->deflate.want == FTP_DEFLATE_AUTO
+	&& ftp_deflate(ftp, profile_slowlink(sourceopt->profile)) != 0) {
+	print_error("failed to set transfer mode: %s\n", ftp_strerror(ftp));
+	goto error;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((fd != -1 ? ftp_getfd(ftp, fd, remotename)
+	 : ftp_get(ftp, localname, remotename)) != 0) {
+	print_error("failed to get file: %s\n", ftp_strerror(ftp));
+
+	/*
+	 * a journaled download is left with the journal of how far it got,
+	 * a resumed run goes on from there
+	 */
+	if (fd != -1)
+	    close(fd);
+	else if (sourceopt->journal == NULL)
+	    ftp_unlink(localname);
+	return 1;
+    }
+
+    /*
+     * every transfer tells how fast the link is, by the bytes on the wire
+     * when it was compressed
+     */
+    if ((fd != -1 ? fstat(fd, &st) : stat(localname, &st)) == -1)
+	st.st_size = 0;
+    if (sourceopt->profile != NULL)
+	profile_linksample(sourceopt->profile, ftp->deflate.wire > 0
+			   ? ftp->deflate.wire : st.st_size,
+			   profile_elapsed(&start));
+    stats_record(sourceopt->stats, statsname(name, lib), STATS_DOWNLOAD,
+		 profile_elapsed(&start), st.st_size);
+    if (savfsize != NULL)
+	*savfsize = st.st_size;
+
+    /*
+     * a save file in memory is gone with the process, a resumed run saves
+     * the object again
+     */
+    if (fd == -1
+	&& journal_record(sourceopt->journal, JOURNAL_FETCHED, name, lib,
+			  localname) != 0) {
+	print_error("failed to write journal: %s\n", strerror(errno));
+	goto error;
+    }
+
+    /*
+     * the stream file outlives the session, the delete is sent again after
+     * a reconnect. when that fails too the local copy goes, so a step that
+     * runs again starts over with no stale file staged
+     */
+    rc = ftp_cmd(ftp, "DELETE %s\n", remotename);
+    rc = ftp_dfthandle(ftp, rc, 250);
+    if (rc == -1 && ftp_replay(ftp)) {
+	rc = ftp_cmd(ftp, "DELETE %s\n", remotename);
+	rc = ftp_dfthandle(ftp, rc, 250);
+    }
+    if (rc == -1) {
+	print_error("failed to remove tempfile: %s\n", ftp_strerror(ftp));
+	goto error;
+    }
+
+    if (*key && (fd != -1 ? cache_storefd(sourceopt->cache, key, fd)
+		 : cache_store(sourceopt->cache, key, localname)) != 0)
+	print_error("failed to store save file in cache: %s\n",
+		    strerror(errno));
+
+    /*
+     * the target process has its own copy of the descriptor
+     */
+    rc = handoff(sourceopt, name, lib, localname, fd);
+    if (fd != -1)
+	close(fd);
+    return rc;
+
+  error:
+    if (fd != -1)
+	close(fd);
+    else
+	ftp_unlink(localname);
+    return 1;
+}
+
+/*
+ * move the save file "savflib/savf", holding objects saved from "lib", to
+ * the local system and hand it to the target process. the save file is
+ * stored in the cache under "key" unless it is empty, it is left on the
+ * server
+ */
+static int
+downloadsavf(struct sourceopt *sourceopt, struct ftp *ftp, char *savflib,
+	     char *savf, char *lib, char *key, char *name)
+{
+    int             rc;
+    int             dltries;
+    char            remotename[PATH_MAX];
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (dltries = 0; dltries < 50; dltries++) {
+	snprintf(remotename, sizeof(remotename), "/tmp/zs-get%d", dltries);
+	rc = ftp_cmd(ftp,
+		     "RCMD CPYTOSTMF FROMMBR('/QSYS.LIB/%s.LIB/%s.FILE') TOSTMF('%s')\r\n",
+		     savflib, savf, remotename);
+	if (ftp_dfthandle(ftp, rc, 250) == 0)
+	    break;
+    }
+    if (dltries == 50) {
+	print_error("failed to copy to stream file: %s\n",
+		    ftp_strerror(ftp));
+	return 1;
+    }
+    stats_record(sourceopt->stats, statsname(name, lib), STATS_CPYTOSTMF,
+		 profile_elapsed(&start), 0);
+
+    return downloadstmf(sourceopt, ftp, remotename, lib, key, name, NULL,
+			NULL);
+}
+
+/*
+ * remove a save file in QTEMP created after "logins" logins of the session,
+ * it is already gone when the session was logged in again since, as it is
+ * by a transfer that resumed
+ */
+static int
+removesavf(struct ftp *ftp, char *savflib, char *savf, int logins)
+{
+    int             rc;
+
+    if (ftp->keep.logins != logins)
+	return 0;
+
+    rc = ftp_cmd(ftp, "RCMD DLTF FILE(%s/%s)\r\n", savflib, savf);
+    if (ftp_dfthandle(ftp, rc, 250) == -1 && !ftp_replay(ftp)) {
+	print_error("failed to remove savf: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * get the number of objects restored from the messages of RSTOBJ
+ */
+static int
+restoredcount(char *msgs)
+{
+    char           *p,
+                   *q;
+    int             n;
+
+    for (p = msgs; (p = strstr(p, " objects restored")) != NULL; p++) {
+	for (q = p; q > msgs && isdigit((unsigned char) q[-1]); q--);
+	if (q < p && sscanf(q, "%d", &n) == 1)
+	    return n;
+    }
+
+    return 0;
+}
+
+/*
+ * save "obj" to the pooled save file "savf" with one script, the save file
+ * is copied to the stream file "remotename" unless it is NULL. "lib" is set
+ * to the library of the object, it is read from the log when the script had
+ * more than one to choose from. "seconds" is how long the script ran.
+ * the return value is 0 on success, 1 on error, and 2 when the script is
+ * too long for QSH
+ */
+static int
+savescript(struct sourceopt *sourceopt, struct ftp *ftp, struct object *obj,
+	   char *dtacpr, struct poolsavf *savf, char *remotename, char **lib,
+	   double *seconds)
+{
+    struct qsh      qsh;
+    struct qshstatus status[QSH_STEPMAX];
+    char            msgs[BUFSIZ];
+    char            types[Z_TYPEMAX * Z_TYPESIZ];
+    char            savobj[BUFSIZ];
+    char           *libs[Z_LIBLMAX * Z_TYPEMAX];
+    char           *type;
+    struct timespec start;
+    int             savstep;
+    int             nalts;
+    int             i,
+                    y;
+    int             rc;
+
+    jointypes(types, sourceopt->types);
+
+    /*
+     * a save file left behind by an earlier run is cleared
+     */
+    qsh_init(&qsh, savf->name);
+    savstep = 1;
+    if (!savf->created) {
+	qsh_step(&qsh, "CLRSAVF FILE(%s/%s)", sourceopt->worklib,
+		 savf->name);
+	qsh_alt(&qsh, "CRTSAVF FILE(%s/%s)", sourceopt->worklib,
+		savf->name);
+	savstep = 2;
+    }
+
+    /*
+     * every library and type is tried in the same step, the status line
+     * tells which one was saved
+     */
+    nalts = 0;
+    for (i = 0; i < Z_LIBLMAX; i++) {
+	*lib = *obj->lib ? obj->lib : sourceopt->libl[i];
+	if (**lib == '\0')
+	    break;
+
+	for (y = 0; y < Z_TYPEMAX; y++) {
+	    if (*obj->type)
+		type = obj->type;
+	    else if (util_isgeneric(obj))
+		type = types;
+	    else
+		type = sourceopt->types[y];
+	    if (*type == '\0')
+		break;
+
+	    snprintf(savobj, sizeof(savobj),
+		     "SAVOBJ OBJ(%s) OBJTYPE(%s) LIB(%s) TGTRLS(%s) DEV(*SAVF) SAVF(%s/%s) DTACPR(%s) CLEAR(*ALL)",
+		     obj->obj, type, *lib, sourceopt->release,
+		     sourceopt->worklib, savf->name, dtacpr);
+	    if (nalts == 0)
+		qsh_step(&qsh, "%s", savobj);
+	    else
+		qsh_alt(&qsh, "%s", savobj);
+	    libs[nalts++] = *lib;
+
+	    if (*obj->type || util_isgeneric(obj))
+		break;
+	}
+
+	if (*obj->lib)
+	    break;
+    }
+
+    /*
+     * no library to save from, the library list is empty
+     */
+    if (nalts == 0) {
+	print_error("failed to save object '%s'\n", obj->obj);
+	return 1;
+    }
+
+    if (remotename != NULL)
+	qsh_step(&qsh,
+		 "CPYTOSTMF FROMMBR('/QSYS.LIB/%s.LIB/%s.FILE') TOSTMF('%s') STMFOPT(*REPLACE)",
+		 sourceopt->worklib, savf->name, remotename);
+
+    if (qsh.overflow)
+	return 2;
+
+    /*
+     * every step can run again in a new session
+     */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+	rc = qsh_run(ftp, &qsh, nalts > 1);
+    while (rc == -1 && ftp_replay(ftp));
+    *seconds = profile_elapsed(&start);
+    if (rc == -1) {
+	print_error("failed to save object: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+
+    /*
+     * the save file can exist even when the script failed
+     */
+    savf->created = 1;
+
+    *lib = libs[0];
+    if (rc == 1 || nalts > 1) {
+	memset(status, 0, sizeof(status));
+	if (qsh_status(ftp, &qsh, status, msgs, sizeof(msgs)) == -1)
+	    return 1;
+
+	if (rc == 1 || status[qsh.nsteps - 1].step != qsh.nsteps
+	    || status[qsh.nsteps - 1].rc != 0) {
+	    print_error("failed to save object '%s'\n%s", obj->obj, msgs);
+	    return 1;
+	}
+
+	if (status[savstep - 1].alt >= 1
+	    && status[savstep - 1].alt <= nalts)
+	    *lib = libs[status[savstep - 1].alt - 1];
+    }
+
+    return 0;
+}
+
+/*
+ * save "obj" and copy it to a stream file with one script, the save file is
+ * taken from the pool of the session.
+ * the save is measured for the compression profile when "size" is known.
+ * the return value is 0 on success, 1 on error, and 2 when the script is
+ * too long for QSH
+ */
+static int
+saveobjscript(struct sourceopt *sourceopt, struct ftp *ftp,
+	      struct object *obj, char *key, char *name, char *dtacpr,
+	      long long size)
+{
+    struct poolsavf *savf;
+    char            remotename[PATH_MAX];
+    char           *lib;
+    double          seconds;
+    long long       savfsize;
+    int             rc;
+
+    savf = pool_get(sourceopt->pool);
+    if (savf == NULL) {
+	print_error("too many save files in use\n");
+	return 1;
+    }
+    snprintf(remotename, sizeof(remotename), "/tmp/zs-%s.savf",
+	     savf->name);
+
+    rc = savescript(sourceopt, ftp, obj, dtacpr, savf, remotename, &lib,
+		    &seconds);
+    pool_put(savf);
+    if (rc != 0)
+	return rc;
+    stats_record(sourceopt->stats, name, STATS_SAVE, seconds, 0);
+
+    if (downloadstmf(sourceopt, ftp, remotename, lib, key, name, NULL,
+		     &savfsize) != 0)
+	return 1;
+
+    if (sourceopt->profile != NULL && size > 0)
+	profile_savesample(sourceopt->profile, dtacpr, size, savfsize,
+			   seconds);
+
+    return 0;
+}
+
+/*
+ * restore the save file "savflib/savf" holding objects saved from "lib"
+ * into the target library, which is on the same system as the source, so
+ * nothing is transferred
+ */
+static int
+restorelocal(struct sourceopt *sourceopt, struct ftp *ftp, char *name,
+	     char *savflib, char *savf, char *lib)
+{
+    struct qsh      qsh;
+    struct qshstatus status[QSH_STEPMAX];
+    char            msgs[BUFSIZ];
+    struct timespec start;
+    int             rc;
+
+    qsh_init(&qsh, savf);
+    qsh_step(&qsh,
+	     "RSTOBJ OBJ(*ALL) SAVLIB(%s) DEV(*SAVF) SAVF(%s/%s) MBROPT(*ALL) RSTLIB(%s)",
+	     lib, savflib, savf, sourceopt->restorelib);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = qsh_run(ftp, &qsh, 0);
+    stats_record(sourceopt->stats, statsname(name, lib), STATS_RESTORE,
+		 profile_elapsed(&start), 0);
+    if (rc == -1) {
+	print_error("failed to restore object: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+
+    /*
+     * objects can be restored even when RSTOBJ failed, see "uploadfile"
+     */
+    if (rc == 1) {
+	memset(status, 0, sizeof(status));
+	if (qsh_status(ftp, &qsh, status, msgs, sizeof(msgs)) == -1)
+	    return 1;
+	if (status[0].step != 1 || restoredcount(msgs) < 1) {
+	    print_error("failed to restore object\n%s", msgs);
+	    return 1;
+	}
+    }
+
+    if (journal_record(sourceopt->journal, JOURNAL_RESTORED, name, lib,
+		       NULL) != 0) {
+	print_error("failed to write journal: %s\n", strerror(errno));
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * save "obj" and restore it on the same system
+ */
+static int
+copyobjlocal(struct sourceopt *sourceopt, struct ftp *ftp,
+	     struct object *obj, char *name)
+{
+    struct poolsavf *savf;
+    char           *lib;
+    double          seconds;
+    int             rc;
+
+    savf = pool_get(sourceopt->pool);
+    if (savf == NULL) {
+	print_error("too many save files in use\n");
+	return 1;
+    }
+
+    /*
+     * there is no network to spare, so nothing is compressed unless asked
+     */
+    rc = savescript(sourceopt, ftp, obj,
+		    *sourceopt->dtacpr ? sourceopt->dtacpr : "*NO", savf, NULL,
+		    &lib, &seconds);
+    if (rc == 2)
+	print_error("failed to save object '%s': too many libraries and types\n",
+		    obj->obj);
+    if (rc == 0) {
+	stats_record(sourceopt->stats, name, STATS_SAVE, seconds, 0);
+	rc = restorelocal(sourceopt, ftp, name, sourceopt->worklib,
+			  savf->name, lib);
+    }
+
+    pool_put(savf);
+    return rc != 0;
+}
+
 static int
 downloadobj(struct sourceopt *sourceopt, struct ftp *ftp,
-	    struct object *obj)
+	    struct object *obj, char *name)
 {
     int             rc;
     int             i;
     int             n;
     int             y;
-    int             dltries;
+    int             logins;
     char           *lib,
                    *type;
+    struct object   resobj;
+    char            key[CACHE_KEYSIZ];
+    char            types[Z_TYPEMAX * Z_TYPESIZ];
+    char           *dtacpr;
+    long long       size;
+    int             sample;
+    struct timespec start;
 
-    char            remotename[PATH_MAX];
-    char            localname[PATH_MAX];
-    int             destfd;
-    char            buf[BUFSIZ];
-    int             len;
+    if (*sourceopt->restorelib != '\0')
+	return copyobjlocal(sourceopt, ftp, obj, name);
+
+    /*
+     * a generic name is expanded by SAVOBJ, every type is saved at once
+     */
+    jointypes(types, sourceopt->types);
+
+    /*
+     * measuring a save needs the size of the object
+     */
+    dtacpr = choosedtacpr(sourceopt);
+    sample = sourceopt->profile != NULL && !util_isgeneric(obj)
+	&& profile_sample(sourceopt->profile, dtacpr);
+
+    *key = '\0';
+    size = 0;
+    if ((sourceopt->cache != NULL || sample) && !util_isgeneric(obj)) {
+	switch (resolveobj(sourceopt, ftp, obj, &resobj, key, sizeof(key),
+			   &size)) {
+	case 0:
+	    if (sourceopt->cache == NULL)
+		*key = '\0';
+	    else
+		switch (lookupcache(sourceopt, ftp, &resobj, key, name)) {
+		case 0:
+		    return 0;
+		case -1:
+		    return 1;
+		}
+	    break;
+	case -1:
+	    return 1;
+	}
+	obj = &resobj;
+    }
+
+    /*
+     * fall back to one command at a time when the script is too long
+     */
+    rc = saveobjscript(sourceopt, ftp, obj, key, name, dtacpr, size);
+    if (rc != 2)
+	return rc;
 
     rc = ftp_cmd(ftp, "RCMD CRTSAVF FILE(QTEMP/ZS)\r\n");
     if (ftp_dfthandle(ftp, rc, 250) == -1) {
 	print_error("failed to create save file: %s\n", ftp_strerror(ftp));
 	return 1;
     }
+    logins = ftp->keep.logins;
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
     for (i = 0, n = 0; i < Z_LIBLMAX; i++) {
 	for (y = 0; y < Z_TYPEMAX; y++, n++) {
 	    lib = *obj->lib ? obj->lib : sourceopt->libl[i];
-	    type = *obj->type ? obj->type : sourceopt->types[y];
+	    if (*obj->type)
+		type = obj->type;
+	    else if (util_isgeneric(obj))
+		type = types;
+	    else
+		type = sourceopt->types[y];
 
 	    if (*lib == '\0' || *type == '\0')
 		break;
@@ -82,8 +894,8 @@ downloadobj(struct sourceopt *sourceopt, struct ftp *ftp,
 	     * try to save the object located in $lib
 	     */
 	    rc = ftp_cmd(ftp,
-			 "RCMD SAVOBJ OBJ(%s) OBJTYPE(%s) LIB(%s) TGTRLS(%s) DEV(*SAVF) SAVF(QTEMP/ZS) DTACPR(*HIGH)\r\n",
-			 obj->obj, type, lib, sourceopt->release);
+			 "RCMD SAVOBJ OBJ(%s) OBJTYPE(%s) LIB(%s) TGTRLS(%s) DEV(*SAVF) SAVF(QTEMP/ZS) DTACPR(%s)\r\n",
+			 obj->obj, type, lib, sourceopt->release, dtacpr);
 	    while (rc != 250 && rc != 550) {
 		switch (rc) {
 		case 0:
@@ -99,13 +911,19 @@ downloadobj(struct sourceopt *sourceopt, struct ftp *ftp,
 	    /*
 	     * object was copied
 	     */
-	    if (rc == 250)
-		goto download;
+	    if (rc == 250) {
+		stats_record(sourceopt->stats, name, STATS_SAVE,
+			     profile_elapsed(&start), 0);
+		if (downloadsavf(sourceopt, ftp, "QTEMP", "ZS", lib, key,
+				 name) != 0)
+		    return 1;
+		return removesavf(ftp, "QTEMP", "ZS", logins);
+	    }
 
 	    /*
 	     * don't check all provided types, (object have own)
 	     */
-	    if (*obj->type)
+	    if (*obj->type || util_isgeneric(obj))
 		break;
 	}
 
@@ -124,85 +942,143 @@ downloadobj(struct sourceopt *sourceopt, struct ftp *ftp,
 
     print_error("failed to save object '%s'\n", obj->obj);
     return 1;
+}
 
-  download:
-    for (dltries = 0; dltries < 50; dltries++) {
-	snprintf(remotename, sizeof(remotename), "/tmp/zs-get%d", dltries);
-	rc = ftp_cmd(ftp,
-		     "RCMD CPYTOSTMF FROMMBR('/QSYS.LIB/QTEMP.LIB/ZS.FILE') TOSTMF('%s')\r\n",
-		     remotename);
-	if (ftp_dfthandle(ftp, rc, 250) == 0)
-	    break;
-    }
-    if (dltries == 50) {
-	print_error("failed to copy to stream file: %s\n",
-		    ftp_strerror(ftp));
-	return 1;
-    }
+/*
+ * save the objects in "sourceopt->synclib" that changed since
+ * "sourceopt->refts", everything is saved when there is no reference
+ */
+static int
+downloadlib(struct sourceopt *sourceopt, struct ftp *ftp)
+{
+    struct ftpansbuf ftpans;
+    char            types[Z_TYPEMAX * Z_TYPESIZ];
+    char           *ts;
+    struct timespec start;
+    int             rc;
+    int             logins;
+
+    jointypes(types, sourceopt->types);
 
-    rc = ftp_cmd(ftp, "RCMD DLTF FILE(QTEMP/ZS)\r\n");
+    rc = ftp_cmd(ftp, "RCMD CRTSAVF FILE(QTEMP/ZS)\r\n");
     if (ftp_dfthandle(ftp, rc, 250) == -1) {
-	print_error("failed to remove savf: %s\n", ftp_strerror(ftp));
+	print_error("failed to create save file: %s\n", ftp_strerror(ftp));
 	return 1;
     }
+    logins = ftp->keep.logins;
 
-    /*
-     * only the guarantee that "localname" is unique is important
-     * discard the opened file descriptor
-     */
-    strcpy(localname, "/tmp/zs-XXXXXX");
-    destfd = mkstemp(localname);
-    if (destfd == -1) {
-	print_error("failed to create output file: %s\n", strerror(errno));
-	return 1;
-    }
-    close(destfd);
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (*sourceopt->refts == '\0') {
+	rc = ftp_cmd_r(ftp, &ftpans,
+		       "RCMD SAVOBJ OBJ(*ALL) OBJTYPE(%s) LIB(%s) TGTRLS(%s) DEV(*SAVF) SAVF(QTEMP/ZS) DTACPR(%s)\r\n",
+		       types, sourceopt->synclib, sourceopt->release,
+		       choosedtacpr(sourceopt));
+    } else {
+	/*
+	 * REFDATE is read in the date format of the job
+	 */
+	rc = ftp_cmd(ftp, "RCMD CHGJOB DATFMT(*YMD)\r\n");
+	if (ftp_dfthandle(ftp, rc, 250) == -1) {
+	    print_error("failed to change date format: %s\n",
+			ftp_strerror(ftp));
+	    return 1;
+	}
 
-    if (ftp_get(ftp, localname, remotename) != 0) {
-	unlink(localname);
-	print_error("failed to get file: %s\n", ftp_strerror(ftp));
-	return 1;
+	/*
+	 * ts = YYYY-MM-DD-HH.MM.SS.NNNNNN
+	 */
+	ts = sourceopt->refts;
+	rc = ftp_cmd_r(ftp, &ftpans,
+		       "RCMD SAVCHGOBJ OBJ(*ALL) OBJTYPE(%s) LIB(%s) REFDATE(%.2s%.2s%.2s) REFTIME(%.2s%.2s%.2s) TGTRLS(%s) DEV(*SAVF) SAVF(QTEMP/ZS) DTACPR(%s)\r\n",
+		       types, sourceopt->synclib, ts + 2, ts + 5, ts + 8,
+		       ts + 11, ts + 14, ts + 17, sourceopt->release,
+		       choosedtacpr(sourceopt));
     }
 
-    rc = ftp_cmd(ftp, "DELETE %s\n", remotename);
-    if (ftp_dfthandle(ftp, rc, 250) == -1) {
-	print_error("failed to remove tempfile: %s\n", ftp_strerror(ftp));
-	return 1;
-    }
+    if (ftp_dfthandle_r(ftp, &ftpans, rc, 250) == -1) {
+	/*
+	 * CPF3778, nothing changed since last time
+	 */
+	if (ftpans.reply == 550
+	    && (strstr(ftpans.buffer, "CPF3778") != NULL
+		|| strstr(ftpans.buffer, "No objects saved") != NULL)) {
+	    rc = ftp_cmd(ftp, "RCMD DLTF FILE(QTEMP/ZS)\r\n");
+	    if (ftp_dfthandle(ftp, rc, 250) == -1) {
+		print_error("failed to remove savf: %s\n",
+			    ftp_strerror(ftp));
+		return 1;
+	    }
+	    return 0;
+	}
 
-    len = snprintf(buf, sizeof(buf), "%s:%s\n", lib, localname);
-    if (write(sourceopt->pipe, buf, len) == -1) {
-	print_error("failed to write to target process\n");
+	print_error("failed to save library: %s\n", ftpans.buffer);
 	return 1;
     }
+    stats_record(sourceopt->stats, sourceopt->synclib, STATS_SAVE,
+		 profile_elapsed(&start), 0);
 
-    return 0;
+    if (*sourceopt->restorelib != '\0')
+	rc = restorelocal(sourceopt, ftp, "", "QTEMP", "ZS",
+			  sourceopt->synclib);
+    else
+	rc = downloadsavf(sourceopt, ftp, "QTEMP", "ZS", sourceopt->synclib,
+			  "", "");
+    if (rc != 0)
+	return 1;
+    return removesavf(ftp, "QTEMP", "ZS", logins);
 }
 
+/*
+ * upload "localname", or the file in memory "fd" when it is not -1, to a
+ * new stream file named in "remotename". the local file of a journaled
+ * object "name" is kept when the upload fails
+ */
 static int
-uploadfile(struct targetopt *targetopt, struct ftp *ftp,
-	   char *lib, char *localname)
+putlocal(struct ftp *ftp, char *name, char *localname, int fd,
+	 char *remotename)
 {
-    char            remotename[PATH_MAX];
-    struct ftpansbuf ftpans;
-    int             rstcnt;
-    int             rc;
-
     /*
      * ftp_put can change remotename
      */
     strcpy(remotename, "/tmp/zs-put");
 
+    if (fd != -1) {
+	if (ftp_putfd(ftp, fd, remotename) != 0) {
+	    print_error("failed to put file: %s\n", ftp_strerror(ftp));
+	    return 1;
+	}
+	return 0;
+    }
+
     if (ftp_put(ftp, localname, remotename) != 0) {
-	unlink(localname);
 	print_error("failed to put file: %s\n", ftp_strerror(ftp));
+	if (*name == '\0')
+	    ftp_unlink(localname);
 	return 1;
     }
     unlink(localname);
 
+    return 0;
+}
+
+/*
+ * move "localname", or the file in memory "fd", into the save file
+ * "savflib/savf" on the target
+ */
+static int
+putsavf(struct ftp *ftp, char *name, char *localname, int fd,
+	char *savflib, char *savf)
+{
+    char            remotename[PATH_MAX];
+    int             rc;
+
+    if (putlocal(ftp, name, localname, fd, remotename) != 0)
+	return 1;
+
     rc = ftp_cmd(ftp,
-		 "RCMD CPYFRMSTMF FROMSTMF('%s') TOMBR('/QSYS.LIB/QTEMP.LIB/ZS.FILE')\r\n",
-		 remotename);
+		 "RCMD CPYFRMSTMF FROMSTMF('%s') TOMBR('/QSYS.LIB/%s.LIB/%s.FILE') MBROPT(*REPLACE)\r\n",
+		 remotename, savflib, savf);
     if (ftp_dfthandle(ftp, rc, 250) == -1) {
 	print_error("failed to copy from stream file: %s\n",
 		    ftp_strerror(ftp));
@@ -216,99 +1092,801 @@ uploadfile(struct targetopt *targetopt, struct ftp *ftp,
 	return 1;
     }
 
-    memset(&ftpans, 0, sizeof(struct ftpansbuf));
-    rc = ftp_cmd_r(ftp, &ftpans,
-		   "RCMD RSTOBJ OBJ(*ALL) SAVLIB(%s) DEV(*SAVF) SAVF(QTEMP/ZS) MBROPT(*ALL) RSTLIB(%s)\r\n",
-		   lib, targetopt->lib);
-    if (ftp_dfthandle_r(ftp, &ftpans, rc, 250) == -1) {
+    return 0;
+}
+
+/*
+ * upload "localname", or the file in memory "fd", and restore it with one
+ * script. an empty "localname" without "fd" restores the stream file
+ * uploaded for "name" by an earlier run.
+ * the local file and the stream file of a journaled object are kept when
+ * the upload or restore fails, the next run continues with them
+ */
+static int
+uploadfile(struct targetopt *targetopt, struct ftp *ftp, char *name,
+	   char *lib, char *localname, int fd)
+{
+    struct qsh      qsh;
+    struct qshstatus status[QSH_STEPMAX];
+    struct poolsavf *savf;
+    struct journalentry *ent;
+    char            msgs[BUFSIZ];
+    char            remotename[PATH_MAX];
+    struct timespec start;
+    struct stat     st;
+    int             rc;
+
+    if (*localname == '\0' && fd == -1) {
+	ent = NULL;
+	if (targetopt->journal != NULL)
+	    ent = journal_find(targetopt->journal, name);
+	if (ent == NULL || ent->phase != JOURNAL_PUSHED) {
+	    print_error("failed to resume '%s': nothing was uploaded\n",
+			name);
+	    return 1;
+	}
+	strcpy(remotename, ent->path);
+    } else {
+	if ((fd != -1 ? fstat(fd, &st) : stat(localname, &st)) == -1)
+	    st.st_size = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (putlocal(ftp, name, localname, fd, remotename) != 0)
+	    return 1;
+	stats_record(targetopt->stats, statsname(name, lib), STATS_UPLOAD,
+		     profile_elapsed(&start), st.st_size);
+
+	if (journal_record(targetopt->journal, JOURNAL_PUSHED, name, lib,
+			   remotename) != 0) {
+	    print_error("failed to write journal: %s\n", strerror(errno));
+	    return 1;
+	}
+    }
+
+    savf = pool_get(targetopt->pool);
+    if (savf == NULL) {
+	print_error("too many save files in use\n");
+	return 1;
+    }
+
+    /*
+     * CPYFRMSTMF creates the save file the first time
+     */
+    qsh_init(&qsh, savf->name);
+    qsh_step(&qsh,
+	     "CPYFRMSTMF FROMSTMF('%s') TOMBR('/QSYS.LIB/%s.LIB/%s.FILE') MBROPT(*REPLACE)",
+	     remotename, targetopt->worklib, savf->name);
+    qsh_step(&qsh,
+	     "RSTOBJ OBJ(*ALL) SAVLIB(%s) DEV(*SAVF) SAVF(%s/%s) MBROPT(*ALL) RSTLIB(%s)",
+	     lib, targetopt->worklib, savf->name, targetopt->lib);
+    if (*name == '\0')
+	qsh_cleanup(&qsh, "RMVLNK OBJLNK('%s')", remotename);
+    else
+	qsh_cleanupok(&qsh, "RMVLNK OBJLNK('%s')", remotename);
+
+    /*
+     * the script is run again in a new session as long as the stream file
+     * is there to restore from
+     */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+	rc = qsh_run(ftp, &qsh, 0);
+    while (rc == -1 && ftp_replay(ftp) && ftp_size(ftp, remotename) != -1);
+    stats_record(targetopt->stats, statsname(name, lib), STATS_RESTORE,
+		 profile_elapsed(&start), 0);
+    if (rc == -1) {
+	pool_put(savf);
+	print_error("failed to restore object: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+    savf->created = 1;
+    pool_put(savf);
+    if (rc == 0)
+	goto restored;
+
+    memset(status, 0, sizeof(status));
+    if (qsh_status(ftp, &qsh, status, msgs, sizeof(msgs)) == -1)
+	return 1;
+
+    /*
+     * RSTOBJ failed but objects were still restored, this can be due to
+     * authentication on the object, etc.
+     * a save file from "zs sync" can hold more than one object
+     */
+    if (status[1].step == 2 && restoredcount(msgs) >= 1) {
+	if (*name != '\0') {
+	    rc = ftp_cmd(ftp, "DELETE %s\r\n", remotename);
+	    if (ftp_dfthandle(ftp, rc, 250) == -1) {
+		print_error("failed to remove remote tempfile: %s\n",
+			    ftp_strerror(ftp));
+		return 1;
+	    }
+	}
+	goto restored;
+    }
+
+    print_error("failed to restore object\n%s", msgs);
+    return 1;
+
+  restored:
+    if (journal_record(targetopt->journal, JOURNAL_RESTORED, name, lib,
+		       NULL) != 0) {
+	print_error("failed to write journal: %s\n", strerror(errno));
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * upload "localname", or the file in memory "fd", into the pooled save file
+ * "savf" and restore it in the batch job "job", the job is named after the
+ * save file
+ */
+static int
+submitrestore(struct targetopt *targetopt, struct ftp *ftp,
+	      struct job *job, struct poolsavf *savf, char *name, char *lib,
+	      char *localname, int fd)
+{
+    char            rstobj[BUFSIZ];
+    char           *cmds[2];
+    struct timespec start;
+    struct stat     st;
+
+    if (*localname == '\0' && fd == -1) {
+	print_error("failed to resume '%s': not with a batch restore\n",
+		    name);
+	return 1;
+    }
+
+    strcpy(job->name, savf->name);
+    if ((fd != -1 ? fstat(fd, &st) : stat(localname, &st)) == -1)
+	st.st_size = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (putsavf(ftp, name, localname, fd, targetopt->worklib, savf->name)
+	!= 0)
+	return 1;
+    savf->created = 1;
+    stats_record(targetopt->stats, statsname(name, lib), STATS_UPLOAD,
+		 profile_elapsed(&start), st.st_size);
+
+    snprintf(rstobj, sizeof(rstobj),
+	     "RSTOBJ OBJ(*ALL) SAVLIB(%s) DEV(*SAVF) SAVF(%s/%s) MBROPT(*ALL) RSTLIB(%s)",
+	     lib, targetopt->worklib, savf->name, targetopt->lib);
+    cmds[0] = rstobj;
+    cmds[1] = NULL;
+
+    strcpy(job->lib, lib);
+    strcpy(job->obj, "*ALL");
+    job->state = JOB_RUNNING;
+
+    if (job_submit(ftp, targetopt->jobq, job->name, cmds) == -1) {
+	print_error("failed to submit job: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * wait for the restore jobs to end, their save files go back to the pool.
+ * "names" are the objects restored by the jobs, submitted at "submitted"
+ */
+static int
+waitrestores(struct targetopt *targetopt, struct ftp *ftp, struct job *jobs,
+	     struct poolsavf **savfs, char names[][JOURNAL_KEYSIZ],
+	     struct timespec *submitted, int njobs)
+{
+    int             returncode;
+    int             pending;
+    int             i;
+
+    returncode = 0;
+    for (pending = njobs; pending > 0; pending--) {
+	i = job_next(ftp, jobs, njobs);
+	if (i == -1) {
+	    print_error("failed to wait for job: %s\n", ftp_strerror(ftp));
+	    return 1;
+	}
+	pool_put(savfs[i]);
+	stats_record(targetopt->stats, statsname(names[i], jobs[i].lib),
+		     STATS_RESTORE, profile_elapsed(&submitted[i]), 0);
+
+	if (jobs[i].state == JOB_FAILED) {
+	    print_error("failed to restore objects from '%s', see job %s\n",
+			jobs[i].lib, jobs[i].name);
+	    returncode = 1;
+	} else if (journal_record(targetopt->journal, JOURNAL_RESTORED,
+				  names[i], jobs[i].lib, NULL) != 0) {
+	    print_error("failed to write journal: %s\n", strerror(errno));
+	    returncode = 1;
+	}
+    }
+
+    return returncode;
+}
+
+/*
+ * save "obj" from "lib" into the pooled save file "savf" in a batch job,
+ * the job is named after the save file
+ */
+static int
+submitsave(struct sourceopt *sourceopt, struct ftp *ftp, struct job *job,
+	   struct poolsavf *savf, struct object *obj, char *lib)
+{
+    char            types[Z_TYPEMAX * Z_TYPESIZ];
+    char            crtsavf[BUFSIZ];
+    char            savobj[BUFSIZ];
+    char           *cmds[3];
+    int             n;
+
+    if (*obj->type)
+	strcpy(types, obj->type);
+    else
+	jointypes(types, sourceopt->types);
+
+    n = 0;
+    if (!savf->created) {
+	snprintf(crtsavf, sizeof(crtsavf), "CRTSAVF FILE(%s/%s)",
+		 sourceopt->worklib, savf->name);
+	cmds[n++] = crtsavf;
+    }
+    snprintf(savobj, sizeof(savobj),
+	     "SAVOBJ OBJ(%s) OBJTYPE(%s) LIB(%s) TGTRLS(%s) DEV(*SAVF) SAVF(%s/%s) DTACPR(%s) CLEAR(*ALL)",
+	     obj->obj, types, lib, sourceopt->release, sourceopt->worklib,
+	     savf->name, choosedtacpr(sourceopt));
+    cmds[n++] = savobj;
+    cmds[n] = NULL;
+
+    strcpy(job->name, savf->name);
+    savf->created = 1;
+
+    strcpy(job->lib, lib);
+    strcpy(job->obj, obj->obj);
+    job->state = JOB_RUNNING;
+
+    if (job_submit(ftp, sourceopt->jobq, job->name, cmds) == -1) {
+	print_error("failed to submit job: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * continue the object "name" from the phase the journal of an earlier run
+ * left it in.
+ * the return value is 0 when the source is done with the object, 1 when it
+ * has to be saved again, and -1 on error
+ */
+static int
+resumeobj(struct sourceopt *sourceopt, struct ftp *ftp, char *name)
+{
+    struct journalentry *ent;
+    struct journalentry saved;
+
+    if (sourceopt->journal == NULL)
+	return 1;
+    ent = journal_find(sourceopt->journal, name);
+    if (ent == NULL)
+	return 1;
+
+    if (ftp->verbosity >= FTP_VERBOSE_SOME && ent->phase != JOURNAL_NONE)
+	fprintf(stderr, "RESUME: %s %s\n", name, ent->path);
+
+    /*
+     * a copy on the same system has nothing halfway to continue with
+     */
+    if (*sourceopt->restorelib != '\0')
+	return ent->phase == JOURNAL_RESTORED ? 0 : 1;
+
+    switch (ent->phase) {
+    case JOURNAL_RESTORED:
+	return 0;
+    case JOURNAL_PUSHED:
 	/*
-	 * reply = 550 but the object is still still restored, this can
-	 * be due to authentication on the object, etc.
+	 * a batch restore does not keep the stream file
 	 */
-	if (ftpans.reply != 550
-	    || sscanf(ftpans.buffer, "%d objects restored.",
-		      &rstcnt) != 1 || rstcnt != 1) {
-	    print_error("failed to restore object: %s", ftpans.buffer);
+	if (*sourceopt->jobq != '\0')
 	    return 1;
+	return handoff(sourceopt, name, ent->lib, "", -1) != 0 ? -1 : 0;
+    case JOURNAL_FETCHED:
+	if (access(ent->path, R_OK) == -1)
+	    return 1;
+	return handoff(sourceopt, name, ent->lib, ent->path, -1) != 0 ?
+	    -1 : 0;
+    case JOURNAL_SAVED:
+	if (ftp_size(ftp, ent->path) == -1) {
+	    if (ftp->errnum == EFTP_NOFILE)
+		return 1;
+	    print_error("failed to get size: %s\n", ftp_strerror(ftp));
+	    return -1;
+	}
+
+	/*
+	 * the entry moves on with the download
+	 */
+	saved = *ent;
+	return downloadstmf(sourceopt, ftp, saved.path, saved.lib, "", name,
+			    saved.part, NULL) != 0 ? -1 : 0;
+    default:
+	return 1;
+    }
+}
+
+/*
+ * copy the object "i" of the object list with its priority, the urgent
+ * objects come first
+ */
+static void
+objpriority(struct sourceopt *sourceopt, struct ftp *ftp, int i)
+{
+    sourceopt->priority = i < sourceopt->nurgent ? FTP_PRIORITY_URGENT
+	: FTP_PRIORITY_BULK;
+    ftp_priority(ftp, sourceopt->priority);
+}
+
+/*
+ * save every object in a batch job of its own, all jobs are submitted up
+ * front and the save files are downloaded in the order the jobs end
+ */
+static int
+sourcemainjobs(struct sourceopt *sourceopt, struct ftp *ftp)
+{
+    struct job      jobs[Z_OBJMAX];
+    struct poolsavf *savfs[Z_OBJMAX];
+    char            keys[Z_OBJMAX][CACHE_KEYSIZ];
+    char            names[Z_OBJMAX][JOURNAL_KEYSIZ];
+    int             objs[Z_OBJMAX];	/* index of the object of a job */
+    struct timespec submitted[Z_OBJMAX];
+    struct object  *obj;
+    struct object   resobj;
+    int             returncode;
+    int             njobs;
+    int             pending;
+    int             i;
+
+    returncode = 0;
+    pending = 0;
+    for (i = 0, njobs = 0; i < Z_OBJMAX; i++) {
+	obj = &(sourceopt->objects[i]);
+	if (*obj->obj == '\0')
+	    break;
+
+	objpriority(sourceopt, ftp, i);
+	journal_key(names[njobs], obj);
+	switch (resumeobj(sourceopt, ftp, names[njobs])) {
+	case 0:
+	    continue;
+	case -1:
+	    returncode = 1;
+	    goto exit;
+	}
+
+	/*
+	 * the library has to be known before the job is submitted
+	 */
+	switch (resolveobj(sourceopt, ftp, obj, &resobj, keys[njobs],
+			   CACHE_KEYSIZ, NULL)) {
+	case 1:
+	    print_error("failed to save object '%s'\n", obj->obj);
+	    returncode = 1;
+	    goto exit;
+	case -1:
+	    returncode = 1;
+	    goto exit;
+	}
+
+	if (util_isgeneric(obj)) {
+	    *keys[njobs] = '\0';
+	    strcpy(resobj.obj, obj->obj);
+	    strcpy(resobj.type, obj->type);
+	} else if (sourceopt->cache != NULL) {
+	    switch (lookupcache(sourceopt, ftp, &resobj, keys[njobs],
+				names[njobs])) {
+	    case 0:
+		continue;
+	    case -1:
+		returncode = 1;
+		goto exit;
+	    }
+	}
+	if (sourceopt->cache == NULL)
+	    *keys[njobs] = '\0';
+
+	savfs[njobs] = pool_get(sourceopt->pool);
+	if (savfs[njobs] == NULL) {
+	    print_error("too many save files in use\n");
+	    returncode = 1;
+	    goto exit;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &submitted[njobs]);
+	if (submitsave(sourceopt, ftp, &jobs[njobs], savfs[njobs], &resobj,
+		       resobj.lib) != 0) {
+	    pool_put(savfs[njobs]);
+	    returncode = 1;
+	    goto exit;
+	}
+	objs[njobs] = i;
+	njobs++;
+	pending++;
+    }
+
+    while (pending > 0) {
+	i = job_next(ftp, jobs, njobs);
+	if (i == -1) {
+	    print_error("failed to wait for job: %s\n", ftp_strerror(ftp));
+	    returncode = 1;
+	    goto exit;
+	}
+	pending--;
+
+	if (jobs[i].state == JOB_FAILED) {
+	    print_error("failed to save object '%s', see job %s\n",
+			jobs[i].obj, jobs[i].name);
+	    returncode = 1;
+	    goto exit;
+	}
+	stats_record(sourceopt->stats, names[i], STATS_SAVE,
+		     profile_elapsed(&submitted[i]), 0);
+
+	objpriority(sourceopt, ftp, objs[i]);
+	if (downloadsavf(sourceopt, ftp, sourceopt->worklib, jobs[i].name,
+			 jobs[i].lib, keys[i], names[i]) != 0) {
+	    returncode = 1;
+	    goto exit;
 	}
     }
 
-    rc = ftp_cmd(ftp, "RCMD DLTF FILE(QTEMP/ZS)\r\n");
-    if (ftp_dfthandle(ftp, rc, 250) == -1) {
-	print_error("failed to remove savf: %s\n", ftp_strerror(ftp));
-	return 1;
+  exit:
+    /*
+     * the jobs still running hold their save files, they are waited for
+     * even after an error so the save files can be deleted
+     */
+    for (; pending > 0; pending--) {
+	if (job_next(ftp, jobs, njobs) == -1) {
+	    print_error("failed to wait for job: %s\n", ftp_strerror(ftp));
+	    break;
+	}
     }
+    for (i = 0; i < njobs; i++)
+	pool_put(savfs[i]);
 
-    return 0;
+    return returncode;
 }
 
 static int
-sourcemain(struct sourceopt *sourceopt, struct ftp *ftp)
+sourcemainobjs(struct sourceopt *sourceopt, struct ftp *ftp)
 {
     struct object  *obj;
+    char            name[JOURNAL_KEYSIZ];
+    int             rc;
     int             i;
 
+    if (qsh_setup(ftp) == -1) {
+	print_error("failed to set up QSH: %s\n", ftp_strerror(ftp));
+	return 1;
+    }
+
     for (i = 0; i < Z_OBJMAX; i++) {
 	obj = &(sourceopt->objects[i]);
 	if (*obj->obj == '\0')
 	    break;
 
-	if (downloadobj(sourceopt, ftp, obj) != 0)
+	objpriority(sourceopt, ftp, i);
+	journal_key(name, obj);
+	switch (resumeobj(sourceopt, ftp, name)) {
+	case 0:
+	    continue;
+	case -1:
 	    return 1;
+	}
+
+	/*
+	 * a save in QTEMP starts over when the session is logged in again,
+	 * a save file that made it to a stream file is only downloaded again
+	 */
+	while (downloadobj(sourceopt, ftp, obj, name) != 0) {
+	    if (!ftp_replay(ftp))
+		return 1;
+	    rc = resumeobj(sourceopt, ftp, name);
+	    if (rc == 0)
+		break;
+	    if (rc == -1)
+		return 1;
+	}
     }
 
     return 0;
 }
 
+static int
+sourcemain(struct sourceopt *sourceopt, struct ftp *ftp)
+{
+    struct pool     pool;
+    int             returncode;
+
+    if (*sourceopt->synclib != '\0') {
+	if (*sourceopt->restorelib != '\0' && qsh_setup(ftp) == -1) {
+	    print_error("failed to set up QSH: %s\n", ftp_strerror(ftp));
+	    return 1;
+	}
+	while ((returncode = downloadlib(sourceopt, ftp)) != 0)
+	    if (!ftp_replay(ftp))
+		break;
+	return returncode;
+    }
+
+    pool_init(&pool, sourceopt->worklib);
+    sourceopt->pool = &pool;
+
+    if (*sourceopt->jobq != '\0' && *sourceopt->restorelib == '\0')
+	returncode = sourcemainjobs(sourceopt, ftp);
+    else
+	returncode = sourcemainobjs(sourceopt, ftp);
+
+    /*
+     * the save files are only deleted once, when the session ends
+     */
+    if (pool_free(ftp, &pool) != 0) {
+	print_error("failed to remove save files: %s\n", ftp_strerror(ftp));
+	returncode = 1;
+    }
+    sourceopt->pool = NULL;
+
+    return returncode;
+}
+
 static int
 targetmain(struct targetopt *targetopt, struct ftp *ftp)
 {
     int             returncode;
     int             fd;
-    FILE           *fp;
-    char           *line;
+    char            line[BUFSIZ];
+    char           *name;
     char           *lib;
+    char           *priority;
     char           *localname;
-    char           *saveptr;
-    size_t          linesiz;
+    ssize_t         len;
+    struct stat     st;
+    struct job      jobs[Z_OBJMAX];
+    struct poolsavf *savfs[Z_OBJMAX];
+    char            names[Z_OBJMAX][JOURNAL_KEYSIZ];
+    struct timespec submitted[Z_OBJMAX];
+    struct pool     pool;
+    int             njobs;
 
     returncode = 0;
+    njobs = 0;
+    pool_init(&pool, targetopt->worklib);
+    targetopt->pool = &pool;
 
-    fd = dup(targetopt->pipe);
-    if (fd == -1) {
-	print_error("failed to dup pipe: %s\n", strerror(errno));
+    if (*targetopt->jobq == '\0' && qsh_setup(ftp) == -1) {
+	print_error("failed to set up QSH: %s\n", ftp_strerror(ftp));
 	return 1;
     }
 
-    fp = fdopen(fd, "r");
-    line = NULL;
-    linesiz = 0;
-
-    while (getline(&line, &linesiz, fp) > 0) {
-	lib = strtok_r(line, ":", &saveptr);
-	localname = strtok_r(NULL, "\n", &saveptr);
+    fd = -1;
+    while ((len = stage_recv(targetopt->pipe, line, sizeof(line), &fd)) > 0) {
+	/*
+	 * name:lib:priority:localname, the name is empty for "zs sync" and
+	 * the local name is empty for a save file in memory, sent along as
+	 * "fd", and for an object uploaded by an earlier run
+	 */
+	name = line;
+	lib = strchr(name, ':');
+	priority = lib != NULL ? strchr(lib + 1, ':') : NULL;
+	localname = priority != NULL ? strchr(priority + 1, ':') : NULL;
 
-	if (lib == NULL || localname == NULL) {
+	if (localname == NULL) {
+	    print_error("failed to understand payload\n");
+	    returncode = 1;
+	    goto exit;
+	}
+	*lib++ = '\0';
+	*priority++ = '\0';
+	*localname++ = '\0';
+	ftp_priority(ftp, atoi(priority) == FTP_PRIORITY_URGENT
+		     ? FTP_PRIORITY_URGENT : FTP_PRIORITY_BULK);
+	localname[strcspn(localname, "\n")] = '\0';
+	if (strlen(name) >= JOURNAL_KEYSIZ) {
 	    print_error("failed to understand payload\n");
 	    returncode = 1;
 	    goto exit;
 	}
+	if ((fd != -1 ? fstat(fd, &st)
+	     : *localname != '\0' ? stat(localname, &st) : -1) == -1)
+	    st.st_size = 0;
 
-	if (uploadfile(targetopt, ftp, lib, localname) != 0) {
+	if (*targetopt->jobq != '\0') {
+	    if (njobs == Z_OBJMAX) {
+		print_error("maximum of %d jobs reached\n", Z_OBJMAX);
+		returncode = 1;
+		goto exit;
+	    }
+	    savfs[njobs] = pool_get(&pool);
+	    if (savfs[njobs] == NULL) {
+		print_error("too many save files in use\n");
+		returncode = 1;
+		goto exit;
+	    }
+	    memcpy(names[njobs], name, strlen(name) + 1);
+	    if (submitrestore(targetopt, ftp, &jobs[njobs], savfs[njobs],
+			      name, lib, localname, fd) != 0) {
+		returncode = 1;
+		goto exit;
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &submitted[njobs]);
+	    njobs++;
+	} else if (uploadfile(targetopt, ftp, name, lib, localname, fd) != 0) {
+	    returncode = 1;
+	    goto exit;
+	}
+
+	/*
+	 * the local save file is gone, the source can stage another
+	 */
+	if ((*localname != '\0' || fd != -1)
+	    && stage_ack(targetopt->ack, st.st_size, fd != -1) != 0) {
+	    print_error("failed to write to source process\n");
 	    returncode = 1;
 	    goto exit;
 	}
+	if (fd != -1)
+	    close(fd);
+	fd = -1;
+    }
+    if (len == -1) {
+	print_error("failed to read from source process: %s\n",
+		    strerror(errno));
+	returncode = 1;
     }
 
   exit:
-    free(line);
-    fclose(fp);
+    /*
+     * jobs already submitted are waited for, even after an error
+     */
+    if (waitrestores(targetopt, ftp, jobs, savfs, names, submitted, njobs)
+	!= 0)
+	returncode = 1;
+    if (pool_free(ftp, &pool) != 0) {
+	print_error("failed to remove save files: %s\n", ftp_strerror(ftp));
+	returncode = 1;
+    }
+    targetopt->pool = NULL;
+    if (fd != -1)
+	close(fd);
 
     return returncode;
 }
 
-int
-main_copy(int argc, char **argv)
+/*
+ * get the path of the file holding the watermark of a "zs sync", there is
+ * one per source, library and target
+ */
+static int
+watermarkpath(char *path, size_t pathsiz, struct ftp *sourceftp,
+	      char *lib, struct ftp *targetftp, char *targetlib)
+{
+    char            dir[PATH_MAX];
+    int             rc;
+
+    rc = util_statedir(dir, sizeof(dir));
+    if (rc != 0)
+	return rc;
+
+    if ((size_t) snprintf(path, pathsiz, "%s/sync-%s-%s-%s-%s", dir,
+			  sourceftp->server.host, lib,
+			  targetftp->server.host, targetlib) >= pathsiz) {
+	errno = ENAMETOOLONG;
+	return EUTIL_SYSTEM;
+    }
+
+    return 0;
+}
+
+/*
+ * read the watermark into "ts", "ts" is empty when there is none
+ */
+static int
+readwatermark(char *path, char *ts)
+{
+    FILE           *fp;
+
+    *ts = '\0';
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+	return errno == ENOENT ? 0 : -1;
+
+    if (fgets(ts, Z_TSSIZ, fp) == NULL)
+	*ts = '\0';
+    ts[strcspn(ts, "\n")] = '\0';
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * replace the watermark with "ts"
+ */
+static int
+writewatermark(char *path, char *ts)
+{
+    FILE           *fp;
+    char            tmppath[PATH_MAX];
+
+    if ((size_t) snprintf(tmppath, sizeof(tmppath), "%s.tmp", path)
+	>= sizeof(tmppath)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+
+    fp = fopen(tmppath, "w");
+    if (fp == NULL)
+	return -1;
+
+    if (fprintf(fp, "%s\n", ts) < 0 || fclose(fp) == EOF) {
+	unlink(tmppath);
+	return -1;
+    }
+
+    if (rename(tmppath, path) == -1) {
+	unlink(tmppath);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * parse a compression level, an empty "dtacpr" means auto
+ */
+static int
+parsedtacpr(char *dtacpr, char *optlevel)
+{
+    static char    *levels[] = { "no", "low", "medium", "high", NULL };
+    int             i;
+
+    if (*optlevel == '*')
+	optlevel++;
+
+    if (strcasecmp(optlevel, "auto") == 0) {
+	*dtacpr = '\0';
+	return 0;
+    }
+
+    for (i = 0; levels[i] != NULL; i++) {
+	if (strcasecmp(optlevel, levels[i]) == 0) {
+	    snprintf(dtacpr, Z_DTACPRSIZ, "*%s", levels[i]);
+	    for (; *dtacpr != '\0'; dtacpr++)
+		*dtacpr = toupper((unsigned char) *dtacpr);
+	    return 0;
+	}
+    }
+
+    return -1;
+}
+
+/*
+ * whether the source and target are the same system logged in as the same
+ * user, the system is told by the host or the welcome message
+ */
+static int
+samesystem(struct ftp *sourceftp, struct ftp *targetftp)
+{
+    if (strcasecmp(sourceftp->server.user, targetftp->server.user) != 0)
+	return 0;
+
+    if (strcmp(sourceftp->server.host, targetftp->server.host) == 0
+	&& sourceftp->server.port == targetftp->server.port)
+	return 1;
+
+    return *sourceftp->sysname != '\0'
+	&& strcasecmp(sourceftp->sysname, targetftp->sysname) == 0;
+}
+
+static int
+copymain(int argc, char **argv, int sync)
 {
     int             c;
     int             rc;
@@ -317,23 +1895,55 @@ main_copy(int argc, char **argv)
     int             i;
     int             childrc;
     int             pipefd[2];
+    int             ackfd[2];
     pid_t           childpid = -1;
     struct ftp      sourceftp;
     struct ftp      targetftp;
+    struct ftp     *ftps[2];
     struct sourceopt sourceopt;
     struct targetopt targetopt;
+    struct cache    cache;
+    struct profile  profile;
+    struct journal  journal;
+    struct stage    stage;
+    struct ftpshape *shape;
+    long long       ratelimit;
+    struct stats    stats;
+    char           *statspath;
+    int             resume;
+    int             local;
+    char            watermark[PATH_MAX];
+    char            now[Z_TSSIZ];
 
     ftp_init(&sourceftp);
     ftp_init(&targetftp);
 
     memset(&sourceopt, 0, sizeof(sourceopt));
     memset(&targetopt, 0, sizeof(targetopt));
+    memset(&cache, 0, sizeof(cache));
+    cache.maxsize = 1024LL * 1024 * 1024;
+    stage_init(&stage);
+    stage.memsize = 64LL * 1024 * 1024;
+    sourceopt.stage = &stage;
+    strcpy(sourceopt.worklib, "QGPL");
+    strcpy(targetopt.worklib, "QGPL");
+    sourceopt.priority = FTP_PRIORITY_BULK;
+    shape = NULL;
+    ratelimit = 0;
+    statspath = NULL;
+    stats.shared = NULL;
+    resume = 0;
+    local = 0;
 
-    while ((c = getopt(argc, argv,
-		       "hvs:u:p:l:t:m:r:c:S:U:P:L:M:C:")) != -1) {
+    while ((c = getopt_long(argc, argv,
+			    "hvs:u:p:l:t:m:r:c:S:U:P:L:M:C:", longopts,
+			    NULL)) != -1) {
 	switch (c) {
 	case 'h':		/* help */
-	    print_help();
+	    if (sync)
+		print_synchelp();
+	    else
+		print_help();
 	    return 0;
 	case 'v':		/* verbosity */
 	    ftp_set_variable(&sourceftp, FTP_VAR_VERBOSE, "+1");
@@ -395,47 +2005,189 @@ main_copy(int argc, char **argv)
 		print_error("failed to parse config file: %s\n",
 			    util_strerror(rc));
 	    break;
+	case OPT_CACHE:	/* save file cache */
+	    strncpy(cache.dir, optarg, PATH_MAX);
+	    cache.dir[PATH_MAX - 1] = '\0';
+	    sourceopt.cache = &cache;
+	    break;
+	case OPT_CACHESIZE:	/* save file cache size */
+	    rc = util_parsesize(&cache.maxsize, optarg);
+	    if (rc != 0) {
+		print_error("failed to parse cache size: %s\n",
+			    util_strerror(rc));
+		exit_status = 2;
+		goto exit;
+	    }
+	    break;
+	case OPT_JOBQ:		/* batch job queue */
+	    strncpy(sourceopt.jobq, optarg, Z_JOBQSIZ);
+	    sourceopt.jobq[Z_JOBQSIZ - 1] = '\0';
+	    strcpy(targetopt.jobq, sourceopt.jobq);
+	    break;
+	case OPT_COMPRESS:	/* save compression */
+	    if (parsedtacpr(sourceopt.dtacpr, optarg) != 0) {
+		print_error("invalid compression level '%s'\n", optarg);
+		exit_status = 2;
+		goto exit;
+	    }
+	    break;
+	case OPT_RESUME:	/* continue the last run */
+	    resume = 1;
+	    break;
+	case OPT_STAGEDIR:	/* local save file directory */
+	    if (stage_adddir(&stage, optarg) != 0) {
+		print_error("maximum of %d staging directories reached\n",
+			    STAGE_DIRMAX);
+		exit_status = 2;
+		goto exit;
+	    }
+	    break;
+	case OPT_STAGESIZE:	/* local save file budget */
+	    rc = util_parsesize(&stage.budget, optarg);
+	    if (rc != 0) {
+		print_error("failed to parse staging size: %s\n",
+			    util_strerror(rc));
+		exit_status = 2;
+		goto exit;
+	    }
+	    break;
+	case OPT_STAGEMEMORY:	/* in memory save file budget */
+	    rc = util_parsesize(&stage.memsize, optarg);
+	    if (rc != 0) {
+		print_error("failed to parse staging memory: %s\n",
+			    util_strerror(rc));
+		exit_status = 2;
+		goto exit;
+	    }
+	    break;
+	case OPT_RATELIMIT:	/* limit of all transfers */
+	    rc = util_parsesize(&ratelimit, optarg);
+	    if (rc != 0) {
+		print_error("failed to parse rate limit: %s\n",
+			    util_strerror(rc));
+		exit_status = 2;
+		goto exit;
+	    }
+	    break;
+	case OPT_STATS:	/* statistics file */
+	    statspath = optarg;
+	    break;
+	case OPT_URGENT:	/* urgent object */
+	    if (sourceopt.nurgent == Z_OBJMAX) {
+		print_error("maximum of %d objects reached\n", Z_OBJMAX);
+		break;
+	    }
+	    rc = util_parseobj(&sourceopt.objects[sourceopt.nurgent], optarg);
+	    if (rc != 0)
+		print_error("failed to parse object: %s\n",
+			    util_strerror(rc));
+	    else
+		sourceopt.nurgent++;
+	    break;
+	case OPT_WORKLIB:	/* batch work library */
+	    strncpy(sourceopt.worklib, optarg, Z_LIBSIZ);
+	    sourceopt.worklib[Z_LIBSIZ - 1] = '\0';
+	    strcpy(targetopt.worklib, sourceopt.worklib);
+	    break;
 	default:
 	    exit_status = 2;
 	    goto exit;
 	}
     }
 
+    if (sync) {
+	if (optind >= argc) {
+	    print_error("missing library\n");
+	    exit_status = 2;
+	    goto exit;
+	}
+	if (argc - optind > 1) {
+	    print_error("too many libraries\n");
+	    exit_status = 2;
+	    goto exit;
+	}
+	strncpy(sourceopt.synclib, argv[optind], Z_LIBSIZ);
+	sourceopt.synclib[Z_LIBSIZ - 1] = '\0';
+
+	/*
+	 * restore into the same library by default
+	 */
+	if (*targetopt.lib == '\0')
+	    strcpy(targetopt.lib, sourceopt.synclib);
+    } else {
+	/*
+	 * slurp objects, after the urgent ones
+	 */
+	for (argind = optind, i = sourceopt.nurgent; argind < argc;
+	     argind++, i++) {
+	    if (i == Z_OBJMAX) {
+		print_error("maximum of %d objects reached\n", Z_OBJMAX);
+		break;
+	    }
+	    rc = util_parseobj(&sourceopt.objects[i], argv[argind]);
+	    if (rc != 0)
+		print_error("failed to parse object: %s\n",
+			    util_strerror(rc));
+	}
+
+	if (*sourceopt.objects[0].obj == '\0') {
+	    print_error("missing object\n");
+	    exit_status = 2;
+	    goto exit;
+	}
+    }
+
     /*
-     * slurp objects
+     * every phase of both processes is timed from here on
      */
-    for (argind = optind, i = 0; argind < argc; argind++, i++) {
-	if (i == Z_OBJMAX) {
-	    print_error("maximum of %d objects reached\n", Z_OBJMAX);
-	    break;
+    if (statspath != NULL) {
+	if (stats_open(&stats, statspath) != 0) {
+	    print_error("failed to open stats: %s\n", strerror(errno));
+	    exit_status = 1;
+	    goto exit;
 	}
-	rc = util_parseobj(&sourceopt.objects[i], argv[argind]);
-	if (rc != 0)
-	    print_error("failed to parse object: %s\n", util_strerror(rc));
+	sourceopt.stats = &stats;
+	targetopt.stats = &stats;
     }
 
-    if (*sourceopt.objects[0].obj == '\0') {
-	print_error("missing object\n");
-	exit_status = 2;
-	goto exit;
+    /*
+     * the source and target take their transfers out of one limit, an
+     * urgent transfer in one of them holds up the other
+     */
+    if (ratelimit > 0) {
+	shape = ftp_shapenew(ratelimit);
+	if (shape == NULL) {
+	    print_error("failed to share rate limit: %s\n", strerror(errno));
+	    exit_status = 1;
+	    goto exit;
+	}
+	ftp_shape(&sourceftp, shape, 0);
+	ftp_shape(&targetftp, shape, 1);
     }
 
-    if (pipe(pipefd) != 0) {
+    /*
+     * the save files in memory are passed as descriptors on the socket
+     */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pipefd) != 0
+	|| pipe(ackfd) != 0) {
 	print_error("failed to create pipe: %s\n", strerror(errno));
 	exit_status = 1;
 	goto exit;
     }
 
-    if (ftp_connect(&sourceftp) == -1) {
-	print_error("failed to connect to source: %s\n",
-		    ftp_strerror(&sourceftp));
-	exit_status = 1;
-	goto exit;
-    }
-
-    if (ftp_connect(&targetftp) == -1) {
-	print_error("failed to connect to target: %s\n",
-		    ftp_strerror(&targetftp));
+    /*
+     * both log in at the same time, the target is only told of once the
+     * source is connected as when they logged in one after the other
+     */
+    ftps[0] = &sourceftp;
+    ftps[1] = &targetftp;
+    if (ftp_connectall(ftps, 2) == -1) {
+	if (sourceftp.sock == -1)
+	    print_error("failed to connect to source: %s\n",
+			ftp_strerror(&sourceftp));
+	else
+	    print_error("failed to connect to target: %s\n",
+			ftp_strerror(&targetftp));
 	exit_status = 1;
 	goto exit;
     }
@@ -460,21 +2212,104 @@ main_copy(int argc, char **argv)
 	strcpy(sourceopt.types[0], "*ALL");
     }
 
-    switch ((childpid = fork())) {
-    case -1:
-	print_error("failed to fork: %s\n", strerror(errno));
-	exit_status = 1;
-	goto exit;
-    case 0:
-	targetopt.pipe = pipefd[0];
+    /*
+     * the compression is chosen from what is known about the source
+     */
+    if (*sourceopt.dtacpr == '\0') {
+	rc = profile_load(&profile, sourceftp.server.host);
+	if (rc != 0)
+	    print_error("failed to load profile: %s\n", util_strerror(rc));
+	sourceopt.profile = &profile;
+    }
+
+    /*
+     * objects changed after "now" are picked up by the next sync
+     */
+    if (sync) {
+	rc = watermarkpath(watermark, sizeof(watermark), &sourceftp,
+			   sourceopt.synclib, &targetftp, targetopt.lib);
+	if (rc != 0) {
+	    print_error("failed to locate watermark: %s\n",
+			util_strerror(rc));
+	    exit_status = 1;
+	    goto exit;
+	}
+	if (readwatermark(watermark, sourceopt.refts) != 0) {
+	    print_error("failed to read watermark: %s\n", strerror(errno));
+	    exit_status = 1;
+	    goto exit;
+	}
+	if (catalog_now(&sourceftp, now) != 0) {
+	    exit_status = 1;
+	    goto exit;
+	}
+    }
+
+    /*
+     * every object is recorded as it moves along, so a failed copy can be
+     * resumed
+     */
+    if (!sync) {
+	rc = journal_open(&journal, &sourceftp, &targetftp, targetopt.lib,
+			  resume);
+	if (rc != 0) {
+	    print_error("failed to open journal: %s\n", util_strerror(rc));
+	    exit_status = 1;
+	    goto exit;
+	}
+	sourceopt.journal = &journal;
+	targetopt.journal = &journal;
+    }
+
+    /*
+     * the source session restores the objects itself when the target is
+     * the same system, there is no target process. it restores to the
+     * target library, without one the target process restores as always
+     */
+    local = *targetopt.lib != '\0' && samesystem(&sourceftp, &targetftp);
+    if (local) {
+	if (sourceftp.verbosity >= FTP_VERBOSE_SOME)
+	    fprintf(stderr, "LOCAL: %s\n", *sourceftp.sysname
+		    ? sourceftp.sysname : sourceftp.server.host);
+	strcpy(sourceopt.restorelib, targetopt.lib);
+	close(pipefd[0]);
 	close(pipefd[1]);
-	exit_status = targetmain(&targetopt, &targetftp);
+	close(ackfd[0]);
+	close(ackfd[1]);
+
+	exit_status = sourcemain(&sourceopt, &sourceftp);
+    } else {
+	/*
+	 * a target process that failed is seen as an error writing to it,
+	 * instead of ending the source before it recorded what it did
+	 */
+	signal(SIGPIPE, SIG_IGN);
+
+	switch ((childpid = fork())) {
+	case -1:
+	    print_error("failed to fork: %s\n", strerror(errno));
+	    exit_status = 1;
+	    goto exit;
+	case 0:
+	    targetopt.pipe = pipefd[0];
+	    targetopt.ack = ackfd[1];
+	    stats.slot = 1;
+	    close(pipefd[1]);
+	    close(ackfd[0]);
+	    exit_status = targetmain(&targetopt, &targetftp);
+	    stats_ftp(targetopt.stats, &targetftp);
+
+	    close(targetopt.pipe);
+	    close(targetopt.ack);
+	    if (targetopt.journal != NULL)
+		journal_close(targetopt.journal, 0);
+	    goto exit;
+	}
 
-	close(targetopt.pipe);
-	break;
-    default:
 	sourceopt.pipe = pipefd[1];
+	stage.ack = ackfd[0];
 	close(pipefd[0]);
+	close(ackfd[1]);
 	exit_status = sourcemain(&sourceopt, &sourceftp);
 
 	/*
@@ -482,6 +2317,7 @@ main_copy(int argc, char **argv)
 	 */
 	close(sourceopt.pipe);
 	wait(&childrc);
+	close(stage.ack);
 	if (WIFEXITED(childrc)) {
 	    if (exit_status == 0) {
 		exit_status = WEXITSTATUS(childrc);
@@ -489,15 +2325,50 @@ main_copy(int argc, char **argv)
 	} else {
 	    exit_status = 1;
 	}
-	break;
     }
 
+    if (sourceopt.profile != NULL && profile_save(sourceopt.profile) != 0)
+	print_error("failed to save profile: %s\n", strerror(errno));
+
+    /*
+     * the target process is done, its records are all there
+     */
+    stats_ftp(sourceopt.stats, &sourceftp);
+    if (sourceopt.stats != NULL
+	&& stats_write(sourceopt.stats, sync ? "sync" : "copy") != 0)
+	print_error("failed to write stats: %s\n", strerror(errno));
+
+    /*
+     * only advance the watermark once everything is restored
+     */
+    if (sync && exit_status == 0 && writewatermark(watermark, now) != 0) {
+	print_error("failed to write watermark: %s\n", strerror(errno));
+	exit_status = 1;
+    }
+
+    if (sourceopt.journal != NULL)
+	journal_close(sourceopt.journal, exit_status == 0);
+
   exit:
-    if (childpid > 0 && sourceftp.verbosity >= FTP_VERBOSE_SOME) {
+    if ((childpid > 0 || local) && sourceftp.verbosity >= FTP_VERBOSE_SOME) {
 	printf("\nEXIT_STATUS = %d\n", exit_status);
     }
 
     ftp_close(&sourceftp);
     ftp_close(&targetftp);
+    ftp_shapefree(shape);
+    stats_close(&stats);
     return exit_status;
 }
+
+int
+main_copy(int argc, char **argv)
+{
+    return copymain(argc, argv, 0);
+}
+
+int
+main_sync(int argc, char **argv)
+{
+    return copymain(argc, argv, 1);
+}
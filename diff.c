@@ -0,0 +1,372 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "util.h"
+#include "catalog.h"
+
+enum diffset {
+    DIFF_ADDED = 1 << 0,
+    DIFF_REMOVED = 1 << 1,
+    DIFF_CHANGED = 1 << 2
+};
+
+struct difftab {
+    struct catentry **slots;
+    unsigned int    size;	/* power of two */
+    struct catentry *base;	/* the target catalog */
+    unsigned char  *matched;	/* per entry of "base" */
+};
+
+static void
+print_help(void)
+{
+    printf("Usage %s diff [OPTION]... LIBRARY\n"
+	   "Compare the objects of a library on two AS/400s\n"
+	   "\n"
+	   "  -s host       set source host\n"
+	   "  -u user       set source user\n"
+	   "  -p port       set source port\n"
+	   "  -t types      set type list\n"
+	   "                comma separated list of types\n"
+	   "  -m tries      set maximum tries for source to respond\n"
+	   "  -c file       source config file\n"
+	   "\n"
+	   "  -S host       set target host\n"
+	   "  -U user       set target user\n"
+	   "  -P port       set target port\n"
+	   "  -L lib        set target library\n"
+	   "                defaults to LIBRARY\n"
+	   "  -M tries      set maximum tries for target to respond\n"
+	   "  -C file       source config file\n"
+	   "\n"
+	   "  -i sets       sets to print, comma separated list of\n"
+	   "                added, removed and changed\n"
+	   "                default is added,changed\n"
+	   "  -e            prefix each object with the set it is in\n"
+	   "  -v            level of verbosity, can be set multiple times\n"
+	   "  -h            show this help message and exit\n"
+	   "\n" "See zs-diff(1) for more information\n", program_name);
+}
+
+/*
+ * parse sets
+ * split the input sets on comma
+ * $sets = set1,set2
+ * $set  = added | removed | changed
+ */
+static int
+parsesets(int *sets, char *optsets)
+{
+    char           *saveptr;
+    char           *p;
+
+    *sets = 0;
+    for (p = strtok_r(optsets, ",", &saveptr); p != NULL;
+	 p = strtok_r(NULL, ",", &saveptr)) {
+	if (strcmp(p, "added") == 0)
+	    *sets |= DIFF_ADDED;
+	else if (strcmp(p, "removed") == 0)
+	    *sets |= DIFF_REMOVED;
+	else if (strcmp(p, "changed") == 0)
+	    *sets |= DIFF_CHANGED;
+	else {
+	    print_error("failed to parse sets: unknown set '%s'\n", p);
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+static unsigned int
+hashobj(char *obj, char *type)
+{
+    unsigned int    hash;
+    unsigned char  *p;
+
+    hash = 2166136261U;
+    for (p = (unsigned char *) obj; *p; p++) {
+	hash ^= *p;
+	hash *= 16777619U;
+    }
+    hash ^= '*';
+    for (p = (unsigned char *) type; *p; p++) {
+	hash ^= *p;
+	hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/*
+ * build the hash table of the target inventory, keyed on object and type
+ */
+static int
+buildtab(struct difftab *tab, struct catalog *cat)
+{
+    unsigned int    i;
+    unsigned int    h;
+
+    for (tab->size = 64; tab->size < cat->tablen * 2; tab->size *= 2);
+
+    tab->slots = calloc(tab->size, sizeof(struct catentry *));
+    tab->matched = calloc(cat->tablen + 1, sizeof(unsigned char));
+    tab->base = cat->tab;
+    if (tab->slots == NULL || tab->matched == NULL)
+	return -1;
+
+    for (i = 0; i < cat->tablen; i++) {
+	h = hashobj(cat->tab[i].obj.obj, cat->tab[i].obj.type);
+	while (tab->slots[h & (tab->size - 1)] != NULL)
+	    h++;
+	tab->slots[h & (tab->size - 1)] = &cat->tab[i];
+    }
+
+    return 0;
+}
+
+/*
+ * find the target entry matching "ent", NULL if there is none
+ */
+static struct catentry *
+probetab(struct difftab *tab, struct catentry *ent)
+{
+    struct catentry *slot;
+    unsigned int    h;
+
+    h = hashobj(ent->obj.obj, ent->obj.type);
+    while ((slot = tab->slots[h & (tab->size - 1)]) != NULL) {
+	if (strcmp(slot->obj.obj, ent->obj.obj) == 0
+	    && strcmp(slot->obj.type, ent->obj.type) == 0) {
+	    tab->matched[slot - tab->base] = 1;
+	    return slot;
+	}
+	h++;
+    }
+
+    return NULL;
+}
+
+/*
+ * a restore keeps the size, the creation time and the source information of
+ * an object, but sets the change time. an object is changed if any of the
+ * kept attributes differ, or if the source was changed after the target
+ */
+static int
+ischanged(struct catentry *source, struct catentry *target)
+{
+    return source->size != target->size
+	|| strcmp(source->created, target->created) != 0
+	|| strcmp(source->srclib, target->srclib) != 0
+	|| strcmp(source->srcfile, target->srcfile) != 0
+	|| strcmp(source->srcmbr, target->srcmbr) != 0
+	|| strcmp(source->srcchanged, target->srcchanged) != 0
+	|| strcmp(source->changed, target->changed) > 0;
+}
+
+static void
+printobj(struct object *obj, char *lib, char mark, int explain)
+{
+    if (explain)
+	printf("%c ", mark);
+    printf("%s/%s%s\n", lib, obj->obj, obj->type);
+}
+
+static int
+getinventory(struct catalog *cat, struct ftp *ftp, char *lib,
+	     char types[Z_TYPEMAX][Z_TYPESIZ])
+{
+    char            libl[Z_LIBLMAX][Z_LIBSIZ];
+
+    memset(libl, 0, sizeof(libl));
+    strcpy(libl[0], lib);
+
+    return catalog_query(cat, ftp, libl, NULL, types);
+}
+
+int
+main_diff(int argc, char **argv)
+{
+    int             c;
+    int             rc;
+    int             exit_status;
+    int             sets;
+    int             explain;
+    unsigned int    i;
+    struct ftp      sourceftp;
+    struct ftp      targetftp;
+    struct ftp     *ftps[2];
+    struct catalog  sourcecat;
+    struct catalog  targetcat;
+    struct catentry *ent;
+    struct difftab  tab;
+    char            sourcelib[Z_LIBSIZ];
+    char            targetlib[Z_LIBSIZ];
+    char            types[Z_TYPEMAX][Z_TYPESIZ];
+    struct sourceopt typeopt;
+
+    ftp_init(&sourceftp);
+    ftp_init(&targetftp);
+
+    memset(&sourcecat, 0, sizeof(struct catalog));
+    memset(&targetcat, 0, sizeof(struct catalog));
+    memset(&tab, 0, sizeof(struct difftab));
+    memset(&typeopt, 0, sizeof(struct sourceopt));
+    *targetlib = '\0';
+    sets = DIFF_ADDED | DIFF_CHANGED;
+    explain = 0;
+
+    while ((c = getopt(argc, argv, "hves:u:p:t:m:c:S:U:P:L:M:C:i:")) != -1) {
+	switch (c) {
+	case 'h':		/* help */
+	    print_help();
+	    return 0;
+	case 'v':		/* verbosity */
+	    ftp_set_variable(&sourceftp, FTP_VAR_VERBOSE, "+1");
+	    ftp_set_variable(&targetftp, FTP_VAR_VERBOSE, "+1");
+	    break;
+	case 'e':		/* explain */
+	    explain = 1;
+	    break;
+	case 's':		/* source host */
+	    ftp_set_variable(&sourceftp, FTP_VAR_HOST, optarg);
+	    break;
+	case 'u':		/* source user */
+	    ftp_set_variable(&sourceftp, FTP_VAR_USER, optarg);
+	    break;
+	case 'p':		/* source port */
+	    ftp_set_variable(&sourceftp, FTP_VAR_PORT, optarg);
+	    break;
+	case 't':		/* types */
+	    rc = util_parsetypes(&typeopt, optarg);
+	    if (rc != 0) {
+		print_error("failed to parse types: %s\n",
+			    util_strerror(rc));
+		return 2;
+	    }
+	    break;
+	case 'm':		/* source max tries */
+	    ftp_set_variable(&sourceftp, FTP_VAR_MAXTRIES, optarg);
+	    break;
+	case 'c':		/* source config */
+	    rc = util_parsecfg(&sourceftp, optarg);
+	    if (rc != 0)
+		print_error("failed to parse config file: %s\n",
+			    util_strerror(rc));
+	    break;
+	case 'S':		/* target host */
+	    ftp_set_variable(&targetftp, FTP_VAR_HOST, optarg);
+	    break;
+	case 'U':		/* target user */
+	    ftp_set_variable(&targetftp, FTP_VAR_USER, optarg);
+	    break;
+	case 'P':		/* target port */
+	    ftp_set_variable(&targetftp, FTP_VAR_PORT, optarg);
+	    break;
+	case 'L':		/* target lib */
+	    strncpy(targetlib, optarg, Z_LIBSIZ);
+	    targetlib[Z_LIBSIZ - 1] = '\0';
+	    break;
+	case 'M':		/* target max tries */
+	    ftp_set_variable(&targetftp, FTP_VAR_MAXTRIES, optarg);
+	    break;
+	case 'C':		/* target config */
+	    rc = util_parsecfg(&targetftp, optarg);
+	    if (rc != 0)
+		print_error("failed to parse config file: %s\n",
+			    util_strerror(rc));
+	    break;
+	case 'i':		/* sets */
+	    if (parsesets(&sets, optarg) != 0)
+		return 2;
+	    break;
+	default:
+	    return 2;
+	}
+    }
+
+    if (optind >= argc) {
+	print_error("missing library\n");
+	return 2;
+    }
+    if (argc - optind > 1) {
+	print_error("too many libraries\n");
+	return 2;
+    }
+
+    strncpy(sourcelib, argv[optind], Z_LIBSIZ);
+    sourcelib[Z_LIBSIZ - 1] = '\0';
+    if (*targetlib == '\0')
+	strcpy(targetlib, sourcelib);
+    memcpy(types, typeopt.types, sizeof(types));
+
+    exit_status = 1;
+
+    /*
+     * both log in at the same time, the target is only told of once the
+     * source is connected as when they logged in one after the other
+     */
+    ftps[0] = &sourceftp;
+    ftps[1] = &targetftp;
+    if (ftp_connectall(ftps, 2) == -1) {
+	if (sourceftp.sock == -1)
+	    print_error("failed to connect to source: %s\n",
+			ftp_strerror(&sourceftp));
+	else
+	    print_error("failed to connect to target: %s\n",
+			ftp_strerror(&targetftp));
+	goto exit;
+    }
+
+    if (getinventory(&sourcecat, &sourceftp, sourcelib, types) != 0)
+	goto exit;
+    if (getinventory(&targetcat, &targetftp, targetlib, types) != 0)
+	goto exit;
+
+    if (buildtab(&tab, &targetcat) != 0) {
+	print_error("failed to allocate table\n");
+	goto exit;
+    }
+
+    for (i = 0; i < sourcecat.tablen; i++) {
+	ent = probetab(&tab, &sourcecat.tab[i]);
+	if (ent == NULL) {
+	    if (sets & DIFF_ADDED)
+		printobj(&sourcecat.tab[i].obj, sourcelib, '+', explain);
+	} else if (ischanged(&sourcecat.tab[i], ent)) {
+	    if (sets & DIFF_CHANGED)
+		printobj(&sourcecat.tab[i].obj, sourcelib, '~', explain);
+	}
+    }
+
+    /*
+     * in the order of the target catalog, as the added and changed are in
+     * the order of the source
+     */
+    if (sets & DIFF_REMOVED) {
+	for (i = 0; i < targetcat.tablen; i++) {
+	    if (!tab.matched[i])
+		printobj(&targetcat.tab[i].obj, targetlib, '-', explain);
+	}
+    }
+
+    exit_status = 0;
+
+  exit:
+    free(tab.slots);
+    free(tab.matched);
+    catalog_free(&sourcecat);
+    catalog_free(&targetcat);
+    ftp_close(&sourceftp);
+    ftp_close(&targetftp);
+    return exit_status;
+}
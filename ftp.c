@@ -3,17 +3,38 @@
  * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
  * See LICENSE
  */
+
+/*
+ * for sync_file_range, fdatasync is used where it is missing
+ */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <stdarg.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <limits.h>
+#include <signal.h>
+#include <zlib.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
 #include "ftp.h"
+#include "uring.h"
 
 /*
  * error message follow the index of "enum ftp_errors"
@@ -28,7 +49,13 @@ static const char *ftp_error_messages[] = {
     [EFTP_NOLOGIN] = "Not Logged In",
     [EFTP_WOULDBLOCK] = "Reading from socket would block",
     [EFTP_BADVAR] = "Unknown variable",
-    [EFTP_NOHOST] = "Missing host"
+    [EFTP_NOHOST] = "Missing host",
+    [EFTP_NOFILE] = "No such file",
+    [EFTP_SHORT] = "Transfer ended early",
+    [EFTP_DISCONNECTED] = "Connection to server lost",
+    [EFTP_INFLATE] = "Compressed data is corrupt",
+    [EFTP_NOTLS] = "Server refused TLS",
+    [EFTP_TLS] = "TLS failed"
 };
 
 /*
@@ -49,6 +76,321 @@ print_debug(struct ftp *ftp, enum ftp_verbosity verbosity,
     }
 }
 
+/*
+ * whether "errnum" from a socket call means the connection is gone
+ */
+static int
+ftp_lost(int errnum)
+{
+    switch (errnum) {
+    case EPIPE:
+    case ECONNRESET:
+    case ECONNABORTED:
+    case ENOTCONN:
+    case ETIMEDOUT:
+    case EBADF:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/*
+ * set up the TLS context once, kTLS is asked for so the kernel takes over
+ * the records after the handshake where it can
+ */
+static int
+ftp_tlsinit(struct ftp *ftp)
+{
+    SSL_CTX        *ctx;
+    struct sigaction sa;
+
+    if (ftp->tls.ctx != NULL)
+	return 0;
+
+    /*
+     * OpenSSL writes without MSG_NOSIGNAL, a connection closed by the
+     * server is an error and not the end of the process
+     */
+    if (sigaction(SIGPIPE, NULL, &sa) == 0 && sa.sa_handler == SIG_DFL) {
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+    }
+
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL)
+	goto fail;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    if (ftp->tls.verify) {
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+	if ((*ftp->tls.cafile != '\0'
+	     ? SSL_CTX_load_verify_locations(ctx, ftp->tls.cafile, NULL)
+	     : SSL_CTX_set_default_verify_paths(ctx)) != 1)
+	    goto fail;
+    }
+
+    ftp->tls.ctx = ctx;
+    return 0;
+
+  fail:
+    SSL_CTX_free(ctx);
+    ftp->errnum = EFTP_TLS;
+    return -1;
+}
+
+/*
+ * the poll events the socket of "ssl" waits for before the call that
+ * returned "rc" is made again.
+ * the return value is POLLIN or POLLOUT, or -1 on error
+ */
+static int
+ftp_tlsevents(struct ftp *ftp, SSL *ssl, int rc)
+{
+    switch (SSL_get_error(ssl, rc)) {
+    case SSL_ERROR_WANT_READ:
+	return POLLIN;
+    case SSL_ERROR_WANT_WRITE:
+	return POLLOUT;
+    case SSL_ERROR_SYSCALL:
+	if (errno == 0)
+	    errno = ECONNRESET;
+	ftp->errnum = ftp_lost(errno) ? EFTP_DISCONNECTED : EFTP_SYSTEM;
+	return -1;
+    default:
+	ftp->errnum = EFTP_TLS;
+	return -1;
+    }
+}
+
+/*
+ * wait until the socket of "ssl" is ready for the call that returned "rc"
+ * to be made again.
+ * the return value is 0, or -1 on error
+ */
+static int
+ftp_tlswait(struct ftp *ftp, SSL *ssl, int rc)
+{
+    struct pollfd   pfd;
+
+    pfd.events = ftp_tlsevents(ftp, ssl, rc);
+    if (pfd.events == -1)
+	return -1;
+
+    pfd.fd = SSL_get_fd(ssl);
+    switch (poll(&pfd, 1, FTP_TLSWAIT)) {
+    case -1:
+	if (errno == EINTR)
+	    return 0;
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    case 0:
+	ftp->errnum = EFTP_TIMEDOUT;
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * set up TLS on "sock" to check the certificate is for the host. a data
+ * connection resumes the session of the control connection "resume", as
+ * servers may ask for to know both are of the same client.
+ * the return value is the SSL, or NULL on error
+ */
+static SSL     *
+ftp_tlsnew(struct ftp *ftp, int sock, SSL *resume)
+{
+    SSL            *ssl;
+    SSL_SESSION    *sess;
+    X509_VERIFY_PARAM *param;
+    int             isip;
+
+    ssl = SSL_new(ftp->tls.ctx);
+    if (ssl == NULL || SSL_set_fd(ssl, sock) != 1)
+	goto fail;
+
+    param = SSL_get0_param(ssl);
+    isip = X509_VERIFY_PARAM_set1_ip_asc(param, ftp->server.host) == 1;
+    ERR_clear_error();
+    if (!isip) {
+	if (X509_VERIFY_PARAM_set1_host(param, ftp->server.host, 0) != 1
+	    || SSL_set_tlsext_host_name(ssl, ftp->server.host) != 1)
+	    goto fail;
+    }
+
+    if (resume != NULL) {
+	sess = SSL_get1_session(resume);
+	if (sess != NULL) {
+	    SSL_set_session(ssl, sess);
+	    SSL_SESSION_free(sess);
+	}
+    }
+
+    return ssl;
+
+  fail:
+    SSL_free(ssl);
+    ftp->errnum = EFTP_TLS;
+    return NULL;
+}
+
+/*
+ * run the TLS handshake on "sock", see "ftp_tlsnew".
+ * the return value is the SSL, or NULL on error
+ */
+static SSL     *
+ftp_tlsopen(struct ftp *ftp, int sock, SSL *resume)
+{
+    SSL            *ssl;
+    int             rc;
+
+    ssl = ftp_tlsnew(ftp, sock, resume);
+    if (ssl == NULL)
+	return NULL;
+
+    for (;;) {
+	ERR_clear_error();
+	errno = 0;
+	rc = SSL_connect(ssl);
+	if (rc == 1)
+	    break;
+	if (ftp_tlswait(ftp, ssl, rc) == -1) {
+	    SSL_free(ssl);
+	    return NULL;
+	}
+    }
+
+    return ssl;
+}
+
+/*
+ * read from "ssl" like "recv(2)", the end of the TLS session or of the
+ * connection reads as the end of the data
+ */
+static ssize_t
+ftp_tlsread(SSL *ssl, void *buf, size_t len)
+{
+    int             rc;
+
+    ERR_clear_error();
+    errno = 0;
+    rc = SSL_read(ssl, buf, len > INT_MAX ? INT_MAX : len);
+    if (rc > 0)
+	return rc;
+
+    switch (SSL_get_error(ssl, rc)) {
+    case SSL_ERROR_ZERO_RETURN:
+	return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+	errno = EWOULDBLOCK;
+	return -1;
+    case SSL_ERROR_SYSCALL:
+	return errno == 0 ? 0 : -1;
+    default:
+	errno = EPROTO;
+	return -1;
+    }
+}
+
+/*
+ * write all "len" bytes of "buf" to "ssl", a socket that is not ready is
+ * waited for
+ */
+static ssize_t
+ftp_tlswrite(struct ftp *ftp, SSL *ssl, const void *buf, size_t len)
+{
+    int             rc;
+
+    if (len == 0)
+	return 0;
+
+    for (;;) {
+	ERR_clear_error();
+	errno = 0;
+	rc = SSL_write(ssl, buf, len > INT_MAX ? INT_MAX : len);
+	if (rc > 0)
+	    return rc;
+	if (ftp_tlswait(ftp, ssl, rc) == -1) {
+	    if (ftp->errnum == EFTP_TLS)
+		errno = EPROTO;
+	    return -1;
+	}
+    }
+}
+
+/*
+ * end TLS on the data connection, "ok" tells the server first. the close
+ * alert of the server is waited for, as whatever it sent that is not read,
+ * such as session tickets, resets the connection when it is closed and
+ * may cut off the data sent
+ */
+static void
+ftp_tlsdataclose(struct ftp *ftp, int ok)
+{
+    if (ftp->tls.data == NULL)
+	return;
+
+    if (ok && !(SSL_get_shutdown(ftp->tls.data) & SSL_RECEIVED_SHUTDOWN)
+	&& SSL_shutdown(ftp->tls.data) == 0)
+	SSL_shutdown(ftp->tls.data);
+    SSL_free(ftp->tls.data);
+    ftp->tls.data = NULL;
+    ftp->tls.datasock = -1;
+    ftp->tls.ktlssend = 0;
+    ftp->tls.ktlsrecv = 0;
+}
+
+/*
+ * end TLS on the connections of "ftp", the context is kept for the next
+ * connect
+ */
+static void
+ftp_tlsclose(struct ftp *ftp)
+{
+    ftp_tlsdataclose(ftp, 0);
+    SSL_free(ftp->tls.ssl);
+    ftp->tls.ssl = NULL;
+}
+
+/*
+ * set the options of "net" on "sock" before it connects, the buffer sizes
+ * are then part of the window offered. an option the kernel refuses, such
+ * as a congestion control that is not loaded, leaves its default
+ */
+static void
+ftp_tune(struct ftp *ftp, int sock, int control)
+{
+    int             on;
+
+    on = 1;
+    if (control && ftp->net.nodelay
+	&& setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
+	print_debug(ftp, FTP_VERBOSE_MORE, "TUNE: TCP_NODELAY: %s\n",
+		    strerror(errno));
+    if (ftp->net.sndbuf > 0
+	&& setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &ftp->net.sndbuf,
+		      sizeof(ftp->net.sndbuf)) == -1)
+	print_debug(ftp, FTP_VERBOSE_MORE, "TUNE: SO_SNDBUF: %s\n",
+		    strerror(errno));
+    if (ftp->net.rcvbuf > 0
+	&& setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &ftp->net.rcvbuf,
+		      sizeof(ftp->net.rcvbuf)) == -1)
+	print_debug(ftp, FTP_VERBOSE_MORE, "TUNE: SO_RCVBUF: %s\n",
+		    strerror(errno));
+#ifdef TCP_CONGESTION
+    if (*ftp->net.congestion != '\0'
+	&& setsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, ftp->net.congestion,
+		      strlen(ftp->net.congestion)) == -1)
+	print_debug(ftp, FTP_VERBOSE_SOME, "TUNE: TCP_CONGESTION %s: %s\n",
+		    ftp->net.congestion, strerror(errno));
+#endif
+}
+
 /*
  * initialize the ftp struct, should always be called before anything else
  */
@@ -60,6 +402,20 @@ ftp_init(struct ftp *ftp)
     ftp->recvline.buffer = NULL;
     ftp->server.port = FTP_PORT;
     ftp->server.maxtries = 100;
+    ftp->stripe.count = 1;
+    ftp->stripe.minsize = 64LL * 1024 * 1024;
+    ftp->uncached.minsize = 64LL * 1024 * 1024;
+    ftp->block.want = 1;
+    ftp->block.sock = -1;
+    ftp->deflate.want = FTP_DEFLATE_AUTO;
+    strcpy(ftp->deflate.helper, FTP_DEFLATEHELPER);
+    ftp->tls.verify = 1;
+    ftp->tls.datasock = -1;
+    ftp->pipeline = 1;
+    ftp->net.nodelay = 1;
+    ftp->net.bufsiz = FTP_BUFSIZ;
+    ftp->rate.priority = FTP_PRIORITY_BULK;
+    ftp->cmd.verb = -1;
 }
 
 /*
@@ -68,10 +424,31 @@ ftp_init(struct ftp *ftp)
 void
 ftp_close(struct ftp *ftp)
 {
+    int             i;
+
+    for (i = 0; i < ftp->stripe.nsessions; i++)
+	ftp_close(&ftp->stripe.sessions[i]);
+    free(ftp->stripe.sessions);
+    ftp->stripe.sessions = NULL;
+    ftp->stripe.nsessions = 0;
+
+    ftp_tlsclose(ftp);
+    SSL_CTX_free(ftp->tls.ctx);
+    ftp->tls.ctx = NULL;
+
+    if (ftp->block.sock != -1)
+	close(ftp->block.sock);
+    ftp->block.sock = -1;
+
     if (ftp->sock != -1)
 	close(ftp->sock);
     ftp->sock = -1;
 
+    if (ftp->ring != NULL)
+	uring_free(ftp->ring);
+    free(ftp->ring);
+    ftp->ring = NULL;
+
     free(ftp->recvline.buffer);
     ftp->recvline.buffer = NULL;
 }
@@ -124,6 +501,78 @@ ftp_set_variable(struct ftp *ftp, enum ftp_variable var, char *val)
 	    ftp->server.maxtries = atoi(val);
 	}
 	return 0;
+    case FTP_VAR_STRIPES:
+	ftp->stripe.count = atoi(val);
+	if (ftp->stripe.count < 1)
+	    ftp->stripe.count = 1;
+	if (ftp->stripe.count > FTP_STRIPEMAX)
+	    ftp->stripe.count = FTP_STRIPEMAX;
+	return 0;
+    case FTP_VAR_STRIPEMIN:
+	ftp->stripe.minsize = atoll(val);
+	return 0;
+    case FTP_VAR_UNCACHEDMIN:
+	ftp->uncached.minsize = atoll(val);
+	return 0;
+    case FTP_VAR_BLOCKMODE:
+	ftp->block.want = strcmp(val, "no") != 0 && strcmp(val, "0") != 0;
+	return 0;
+    case FTP_VAR_DEFLATE:
+	if (strcmp(val, "auto") == 0)
+	    ftp->deflate.want = FTP_DEFLATE_AUTO;
+	else if (strcmp(val, "no") == 0 || strcmp(val, "0") == 0)
+	    ftp->deflate.want = FTP_DEFLATE_NO;
+	else
+	    ftp->deflate.want = FTP_DEFLATE_YES;
+	ftp->deflate.use = ftp->deflate.want == FTP_DEFLATE_YES;
+	return 0;
+    case FTP_VAR_DEFLATEHELPER:
+	strncpy(ftp->deflate.helper, val, FTP_HELPERSIZ);
+	ftp->deflate.helper[FTP_HELPERSIZ - 1] = '\0';
+	return 0;
+    case FTP_VAR_TLS:
+	if (strcmp(val, "try") == 0)
+	    ftp->tls.want = FTP_TLS_TRY;
+	else if (strcmp(val, "no") == 0 || strcmp(val, "0") == 0)
+	    ftp->tls.want = FTP_TLS_NO;
+	else
+	    ftp->tls.want = FTP_TLS_YES;
+	return 0;
+    case FTP_VAR_TLSCA:
+	strncpy(ftp->tls.cafile, val, FTP_CAFILESIZ);
+	ftp->tls.cafile[FTP_CAFILESIZ - 1] = '\0';
+	return 0;
+    case FTP_VAR_TLSVERIFY:
+	ftp->tls.verify = strcmp(val, "no") != 0 && strcmp(val, "0") != 0;
+	return 0;
+    case FTP_VAR_PIPELINE:
+	ftp->pipeline = strcmp(val, "no") != 0 && strcmp(val, "0") != 0;
+	return 0;
+    case FTP_VAR_NODELAY:
+	ftp->net.nodelay = strcmp(val, "no") != 0 && strcmp(val, "0") != 0;
+	return 0;
+    case FTP_VAR_SNDBUF:
+	ftp->net.sndbuf = atoll(val) > INT_MAX ? INT_MAX : atoi(val);
+	return 0;
+    case FTP_VAR_RCVBUF:
+	ftp->net.rcvbuf = atoll(val) > INT_MAX ? INT_MAX : atoi(val);
+	return 0;
+    case FTP_VAR_CONGESTION:
+	strncpy(ftp->net.congestion, val, FTP_CONGESTIONSIZ);
+	ftp->net.congestion[FTP_CONGESTIONSIZ - 1] = '\0';
+	return 0;
+    case FTP_VAR_BUFSIZE:
+	ftp->net.bufsiz = atoll(val);
+	if (ftp->net.bufsiz < FTP_BUFMIN)
+	    ftp->net.bufsiz = FTP_BUFMIN;
+	if (ftp->net.bufsiz > FTP_BUFMAX)
+	    ftp->net.bufsiz = FTP_BUFMAX;
+	return 0;
+    case FTP_VAR_RATELIMIT:
+	ftp->rate.limit = atoll(val);
+	if (ftp->rate.limit < 0)
+	    ftp->rate.limit = 0;
+	return 0;
     }
 
     ftp->errnum = EFTP_BADVAR;
@@ -131,17 +580,219 @@ ftp_set_variable(struct ftp *ftp, enum ftp_variable var, char *val)
 }
 
 /*
- * connect to the ftp server.
- * host, user, etc. should already be set using "ftp_set_variable"
+ * agree on the transfer mode with the server: MODE Z while the transfers
+ * are compressed, else block mode. block mode marks the end of a file in
+ * the data, so one data connection carries every transfer. stream mode is
+ * kept when the server knows neither
  */
-int
-ftp_connect(struct ftp *ftp)
+static int
+ftp_mode(struct ftp *ftp)
 {
-    struct addrinfo hints;
-    struct addrinfo *res;
-    struct addrinfo *ressave;
     int             rc;
-    int             errno_;
+    int             was;
+
+    was = ftp->block.on || ftp->deflate.on;
+    if (ftp->block.sock != -1) {
+	ftp_tlsdataclose(ftp, 0);
+	close(ftp->block.sock);
+    }
+    ftp->block.sock = -1;
+    ftp->block.on = 0;
+    ftp->deflate.on = 0;
+
+    if (ftp->deflate.use) {
+	rc = ftp_cmd(ftp, "MODE Z\r\n");
+	while (rc == 0)
+	    rc = ftp_cmdcontinue(ftp);
+	if (rc == -1)
+	    return -1;
+	ftp->deflate.on = rc == 200;
+    }
+
+    if (!ftp->deflate.on && ftp->block.want) {
+	rc = ftp_cmd(ftp, "MODE B\r\n");
+	while (rc == 0)
+	    rc = ftp_cmdcontinue(ftp);
+	if (rc == -1)
+	    return -1;
+	ftp->block.on = rc == 200;
+    }
+
+    if (was && !ftp->block.on && !ftp->deflate.on) {
+	rc = ftp_cmd(ftp, "MODE S\r\n");
+	return ftp_dfthandle(ftp, rc, 200);
+    }
+
+    return 0;
+}
+
+/*
+ * a login in progress, see "ftp_connectall"
+ */
+enum ftp_loginstate {
+    FTP_LOGIN_CONNECT,		/* the addresses are connected to */
+    FTP_LOGIN_GREET,		/* waiting for 220 */
+    FTP_LOGIN_AUTH,		/* waiting for the reply to AUTH TLS */
+    FTP_LOGIN_HANDSHAKE,
+    FTP_LOGIN_STEPS,		/* the commands of the login */
+    FTP_LOGIN_DONE,
+    FTP_LOGIN_FAILED
+};
+
+struct ftplogin {
+    struct ftp     *ftp;
+    enum ftp_loginstate state;
+    struct addrinfo *res;
+    struct addrinfo *addrs[FTP_ADDRMAX];	/* in the order tried */
+    int             naddrs;
+    int             socks[FTP_ADDRMAX];	/* connects in progress, or -1 */
+    int             tried;	/* addresses connected to so far */
+    int             error;	/* errno of the last connect that failed */
+    int             events;	/* poll events waited for on "ftp->sock" */
+    struct timespec since;	/* of the last connect, or of the state */
+    long            wait;	/* milliseconds the state may take */
+    char            cmds[FTP_LOGINMAX][FTP_KEEPSIZ];
+    int             replies[FTP_LOGINMAX];	/* expected, 0 takes any */
+    int             got[FTP_LOGINMAX];
+    int             nsteps;
+    int             sent;
+    int             done;
+    int             block;	/* step of MODE B, or -1 */
+    int             deflate;	/* step of MODE Z, or -1 */
+    char            out[FTP_LOGINMAX * FTP_KEEPSIZ];	/* not written yet */
+    size_t          outlen;
+    struct ftpansbuf ans;
+    int             polled;	/* boolean, run this round of poll */
+};
+
+/*
+ * milliseconds left of "wait" from "since", none left is 0
+ */
+static long
+ftp_msleft(struct timespec *since, long wait)
+{
+    struct timespec now;
+    long            ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = wait - ((now.tv_sec - since->tv_sec) * 1000
+		 + (now.tv_nsec - since->tv_nsec) / 1000000);
+    return ms < 0 ? 0 : ms;
+}
+
+/*
+ * the CLOCK_MONOTONIC seconds of now
+ */
+static double
+ftp_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * the index in "stats.verbs" of the command "cmd", named by its first word
+ * or by the first two of RCMD and SITE. a name not seen before is added.
+ * the return value is -1 when there is no room
+ */
+static int
+ftp_verb(struct ftp *ftp, const char *cmd)
+{
+    struct ftpstats *stats;
+    char            name[FTP_VERBSIZ];
+    size_t          len;
+    int             words;
+    int             i;
+
+    words = strncasecmp(cmd, "RCMD ", 5) == 0
+	|| strncasecmp(cmd, "SITE ", 5) == 0 ? 2 : 1;
+    for (len = 0; len < sizeof(name) - 1; len++) {
+	if (cmd[len] == '\0' || cmd[len] == '\r' || cmd[len] == '\n'
+	    || (cmd[len] == ' ' && --words == 0))
+	    break;
+	name[len] = toupper((unsigned char) cmd[len]);
+    }
+    name[len] = '\0';
+
+    stats = &ftp->stats;
+    for (i = 0; i < stats->nverbs; i++) {
+	if (strcmp(stats->verbs[i].name, name) == 0)
+	    return i;
+    }
+    if (stats->nverbs == FTP_VERBMAX)
+	return -1;
+
+    strcpy(stats->verbs[stats->nverbs].name, name);
+    return stats->nverbs++;
+}
+
+/*
+ * add a reply that took "seconds" to "lat"
+ */
+static void
+ftp_latency(struct ftplatency *lat, double seconds)
+{
+    long            ms;
+    int             i;
+
+    ms = (long) (seconds * 1000);
+    for (i = 0; ms > 0 && i < FTP_LATENCYMAX - 1; i++)
+	ms >>= 1;
+
+    lat->count++;
+    lat->seconds += seconds;
+    lat->buckets[i]++;
+}
+
+/*
+ * the command "cmd" was sent, its replies are timed from now
+ */
+static void
+ftp_cmdstart(struct ftp *ftp, const char *cmd)
+{
+    ftp->cmd.verb = ftp_verb(ftp, cmd);
+    ftp->cmd.first = 0;
+    ftp->cmd.since = ftp_now();
+}
+
+/*
+ * a line of the reply to the command sent last came in "ans"
+ */
+static void
+ftp_cmdreplied(struct ftp *ftp, struct ftpansbuf *ans)
+{
+    struct ftpverb *verb;
+    double          seconds;
+
+    if (ftp->cmd.verb == -1)
+	return;
+
+    verb = &ftp->stats.verbs[ftp->cmd.verb];
+    seconds = ftp_now() - ftp->cmd.since;
+    if (!ftp->cmd.first) {
+	ftp_latency(&verb->first, seconds);
+	ftp->cmd.first = 1;
+    }
+
+    /*
+     * a reply of 1xx is preliminary, the final one follows the transfer
+     */
+    if (!ans->continues && ans->reply >= 200) {
+	ftp_latency(&verb->final, seconds);
+	ftp->cmd.verb = -1;
+    }
+}
+
+/*
+ * look up the addresses of the host.
+ * the return value is 0, or -1 on error
+ */
+static int
+ftp_resolve(struct ftp *ftp, struct addrinfo **res)
+{
+    struct addrinfo hints;
     char            sport[6];	/* connection port */
 
     snprintf(sport, sizeof(sport), "%d", ftp->server.port);
@@ -161,7 +812,9 @@ ftp_connect(struct ftp *ftp)
 		"CONNECT: getaddrinfo(\"%s\", \"%s\", ..., ...)\n",
 		ftp->server.host, sport);
 
-    switch (getaddrinfo(ftp->server.host, sport, &hints, &res)) {
+    switch (getaddrinfo(ftp->server.host, sport, &hints, res)) {
+    case 0:
+	return 0;
     case EAI_SYSTEM:
 	ftp->errnum = EFTP_SYSTEM;
 	return -1;
@@ -192,525 +845,2814 @@ ftp_connect(struct ftp *ftp)
     case EAI_OVERFLOW:
 	ftp->errnum = EFTP_GAI_OVERFLOW;
 	return -1;
+    default:
+	ftp->errnum = EFTP_GAI_FAIL;
+	return -1;
+    }
+}
+
+/*
+ * give up the login, "ftp->errnum" tells why
+ */
+static void
+ftp_loginfail(struct ftplogin *lg)
+{
+    int             i;
+
+    if (lg->ftp->errnum == EFTP_SYSTEM)
+	lg->ftp->syserr = errno;
+    for (i = 0; i < lg->naddrs; i++) {
+	if (lg->socks[i] != -1)
+	    close(lg->socks[i]);
+	lg->socks[i] = -1;
     }
+    ftp_tlsclose(lg->ftp);
+    if (lg->ftp->sock != -1)
+	close(lg->ftp->sock);
+    lg->ftp->sock = -1;
+    free(lg->ftp->recvline.buffer);
+    lg->ftp->recvline.buffer = NULL;
+    lg->state = FTP_LOGIN_FAILED;
+}
+
+/*
+ * move on to "state", where a reply is waited for
+ */
+static void
+ftp_loginstate(struct ftplogin *lg, enum ftp_loginstate state)
+{
+    lg->state = state;
+    lg->events = POLLIN;
+    lg->wait = lg->ftp->server.maxtries * 250L;
+    clock_gettime(CLOCK_MONOTONIC, &lg->since);
+    memset(&lg->ans, 0, sizeof(struct ftpansbuf));
+}
+
+/*
+ * connect to the next address, the connects made before are not given up
+ * on. a connect that fails at once moves on to the address after it
+ */
+static void
+ftp_loginattempt(struct ftplogin *lg)
+{
+    struct addrinfo *res;
+    struct ftp     *ftp;
+    int             sock;
+    int             i;
+
+    ftp = lg->ftp;
+    while (lg->tried < lg->naddrs) {
+	i = lg->tried++;
+	res = lg->addrs[i];
+	clock_gettime(CLOCK_MONOTONIC, &lg->since);
 
-    errno_ = errno;
-    for (ftp->sock = -1, ressave = res; res; res = res->ai_next) {
 	print_debug(ftp, FTP_VERBOSE_DEBUG,
 		    "CONNECT: socket(%d, %d, %d)\n",
 		    res->ai_family, res->ai_socktype, res->ai_protocol);
-	if ((ftp->sock = socket(res->ai_family, res->ai_socktype,
-				res->ai_protocol)) < 0)
-	    continue;		/* ignore */
+	if ((sock = socket(res->ai_family, res->ai_socktype,
+			   res->ai_protocol)) < 0) {
+	    lg->error = errno;
+	    continue;
+	}
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+	ftp_tune(ftp, sock, 1);
+
 	print_debug(ftp, FTP_VERBOSE_DEBUG,
 		    "CONNECT: connect(%d, %u, %d)\n",
-		    ftp->sock, res->ai_addr, res->ai_addrlen);
-	if (connect(ftp->sock, res->ai_addr, res->ai_addrlen) == 0)
-	    break;		/* success */
-	errno_ = errno;
-	close(ftp->sock);
+		    sock, res->ai_addr, res->ai_addrlen);
+	if (connect(sock, res->ai_addr, res->ai_addrlen) == 0
+	    || errno == EINPROGRESS) {
+	    lg->socks[i] = sock;
+	    return;
+	}
+	lg->error = errno;
+	close(sock);
+    }
+
+    /*
+     * every address failed
+     */
+    for (i = 0; i < lg->naddrs; i++) {
+	if (lg->socks[i] != -1)
+	    return;
+    }
+    errno = lg->error;
+    ftp->errnum = EFTP_SYSTEM;
+    ftp_loginfail(lg);
+}
+
+/*
+ * the connect of address "i" ended, the first one to succeed is used and
+ * the others are given up on
+ */
+static void
+ftp_loginconnected(struct ftplogin *lg, int i)
+{
+    socklen_t       len;
+    int             error;
+    int             j;
+
+    len = sizeof(error);
+    if (getsockopt(lg->socks[i], SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+	error = errno;
+    if (error != 0) {
+	lg->error = error;
+	close(lg->socks[i]);
+	lg->socks[i] = -1;
+	ftp_loginattempt(lg);
+	return;
+    }
+
+    lg->ftp->sock = lg->socks[i];
+    lg->socks[i] = -1;
+    for (j = 0; j < lg->naddrs; j++) {
+	if (lg->socks[j] != -1)
+	    close(lg->socks[j]);
+	lg->socks[j] = -1;
+    }
+
+    *lg->ftp->sysname = '\0';
+    lg->ftp->cmd.tries = 0;
+    ftp_loginstate(lg, FTP_LOGIN_GREET);
+    ftp_cmdstart(lg->ftp, "CONNECT");
+}
+
+/*
+ * start the login of "lg->ftp". a host with more than one address has them
+ * tried the way of happy eyeballs: the families take turns, and the next
+ * address is connected to as well when the one before has not answered in
+ * FTP_EYEBALLWAIT milliseconds
+ */
+static void
+ftp_loginstart(struct ftplogin *lg)
+{
+    struct addrinfo *res;
+    struct addrinfo *first[FTP_ADDRMAX];
+    struct addrinfo *other[FTP_ADDRMAX];
+    int             nfirst;
+    int             nother;
+    int             i;
+    int             j;
+
+    lg->ftp->sock = -1;
+    lg->ftp->syserr = 0;
+    lg->ftp->block.on = 0;
+    lg->ftp->deflate.on = 0;
+    if (lg->ftp->block.sock != -1)
+	close(lg->ftp->block.sock);
+    lg->ftp->block.sock = -1;
+
+    lg->state = FTP_LOGIN_CONNECT;
+    lg->naddrs = 0;
+    lg->tried = 0;
+    lg->error = ECONNREFUSED;
+    for (i = 0; i < FTP_ADDRMAX; i++)
+	lg->socks[i] = -1;
+
+    if (lg->res == NULL && ftp_resolve(lg->ftp, &lg->res) == -1) {
+	lg->res = NULL;
+	ftp_loginfail(lg);
+	return;
+    }
+
+    nfirst = nother = 0;
+    for (res = lg->res; res != NULL && nfirst + nother < FTP_ADDRMAX;
+	 res = res->ai_next) {
+	if (res->ai_family == lg->res->ai_family)
+	    first[nfirst++] = res;
+	else
+	    other[nother++] = res;
+    }
+    for (i = j = 0; i < nfirst || j < nother;) {
+	if (i < nfirst)
+	    lg->addrs[lg->naddrs++] = first[i++];
+	if (j < nother)
+	    lg->addrs[lg->naddrs++] = other[j++];
+    }
+
+    ftp_loginattempt(lg);
+}
+
+/*
+ * the commands of the login after the greeting and TLS. MODE B goes before
+ * MODE Z, so block mode is left when the server refuses to compress
+ */
+static void
+ftp_loginsteps(struct ftplogin *lg)
+{
+    struct ftp     *ftp;
+
+    ftp = lg->ftp;
+    lg->nsteps = lg->sent = lg->done = 0;
+    lg->block = lg->deflate = -1;
+    lg->outlen = 0;
+
+#define FTP_LOGINSTEP(reply, ...) do { \
+	snprintf(lg->cmds[lg->nsteps], FTP_KEEPSIZ, __VA_ARGS__); \
+	lg->replies[lg->nsteps++] = (reply); \
+    } while (0)
+
+    if (*ftp->server.user) {
+	FTP_LOGINSTEP(331, "USER %s\r\n", ftp->server.user);
+	FTP_LOGINSTEP(230, "PASS %s\r\n", ftp->server.password);
+    }
+
+    /*
+     * the data connections are protected as well
+     */
+    if (ftp->tls.ssl != NULL) {
+	FTP_LOGINSTEP(200, "PBSZ 0\r\n");
+	FTP_LOGINSTEP(200, "PROT P\r\n");
+    }
+
+    /*
+     * binary mode
+     */
+    FTP_LOGINSTEP(200, "type I\r\n");
+
+    if (ftp->block.want) {
+	lg->block = lg->nsteps;
+	FTP_LOGINSTEP(0, "MODE B\r\n");
+    }
+    if (ftp->deflate.use) {
+	lg->deflate = lg->nsteps;
+	FTP_LOGINSTEP(0, "MODE Z\r\n");
+    }
+
+#undef FTP_LOGINSTEP
+
+    /*
+     * a server that threw away the pipelined commands is not waited for
+     * as long
+     */
+    ftp_loginstate(lg, FTP_LOGIN_STEPS);
+    if (ftp->pipeline && lg->wait > FTP_PIPELINEWAIT)
+	lg->wait = FTP_PIPELINEWAIT;
+}
+
+/*
+ * send the commands of the login that may go now: all of them when they
+ * are pipelined, else the next one once the one before is answered. what
+ * the socket did not take is kept for the next call.
+ * the return value is 0, or -1 on error
+ */
+static int
+ftp_loginsend(struct ftplogin *lg)
+{
+    ssize_t         rc;
+    int             from;
+
+    from = lg->sent;
+    while (lg->sent < lg->nsteps
+	   && (lg->ftp->pipeline || lg->sent == lg->done)) {
+	strcpy(lg->out + lg->outlen, lg->cmds[lg->sent]);
+	lg->outlen += strlen(lg->cmds[lg->sent++]);
+    }
+    if (lg->outlen == 0)
+	return 0;
+
+    /*
+     * a socket that takes only part of the commands gets the rest once it
+     * is ready again
+     */
+    rc = ftp_write(lg->ftp, lg->out, lg->outlen);
+    if (rc == -1 && errno != EWOULDBLOCK && errno != EAGAIN) {
+	lg->ftp->errnum = ftp_lost(errno) ? EFTP_DISCONNECTED : EFTP_SYSTEM;
+	return -1;
+    }
+    if (rc > 0) {
+	lg->outlen -= rc;
+	memmove(lg->out, lg->out + rc, lg->outlen);
+    }
+    lg->events = lg->outlen > 0 ? POLLIN | POLLOUT : POLLIN;
+
+    if (from < lg->sent && from == lg->done)
+	ftp_cmdstart(lg->ftp, lg->cmds[from]);
+    return 0;
+}
+
+/*
+ * read the reply of the state, the first lines of the greeting of IBM i
+ * names the system:
+ *   220-QTCP at NAME.
+ * the return value is the reply, 0 when it is not all there, or -1 on error
+ */
+static int
+ftp_loginreply(struct ftplogin *lg)
+{
+    struct ftp     *ftp;
+    size_t          len;
+
+    ftp = lg->ftp;
+    ftp->stats.polls++;
+    for (;;) {
+	if (ftp_recvans(ftp, &lg->ans) == -1)
+	    return ftp->errnum == EFTP_WOULDBLOCK ? 0 : -1;
+	ftp_cmdreplied(ftp, &lg->ans);
+
+	if (lg->state == FTP_LOGIN_GREET && *ftp->sysname == '\0'
+	    && sscanf(lg->ans.buffer, "QTCP at %255s", ftp->sysname) == 1) {
+	    len = strlen(ftp->sysname);
+	    if (len > 0 && ftp->sysname[len - 1] == '.')
+		ftp->sysname[len - 1] = '\0';
+	}
+	if (!lg->ans.continues)
+	    return lg->ans.reply;
+    }
+}
+
+/*
+ * the TLS handshake of the control connection went on as far as it can.
+ * the return value is 0, or -1 on error
+ */
+static int
+ftp_loginhandshake(struct ftplogin *lg)
+{
+    struct ftp     *ftp;
+    int             rc;
+
+    ftp = lg->ftp;
+    ERR_clear_error();
+    errno = 0;
+    rc = SSL_connect(ftp->tls.ssl);
+    if (rc != 1) {
+	lg->events = ftp_tlsevents(ftp, ftp->tls.ssl, rc);
+	return lg->events == -1 ? -1 : 0;
+    }
+
+    print_debug(ftp, FTP_VERBOSE_MORE, "TLS: %s\n",
+		SSL_get_version(ftp->tls.ssl));
+    ftp_loginsteps(lg);
+    return ftp_loginsend(lg);
+}
+
+/*
+ * go on with the login of "lg->ftp" after its socket became ready.
+ * the return value is 0, or -1 on error
+ */
+static int
+ftp_loginrun(struct ftplogin *lg)
+{
+    struct ftp     *ftp;
+    int             rc;
+
+    ftp = lg->ftp;
+    switch (lg->state) {
+    case FTP_LOGIN_GREET:
+	rc = ftp_loginreply(lg);
+	if (rc <= 0)
+	    return rc;
+	if (rc != 220) {
+	    ftp->errnum = EFTP_BADRPLY;
+	    return -1;
+	}
+
+	/*
+	 * explicit TLS, the login is protected from here on once the server
+	 * agreed
+	 */
+	if (ftp->tls.want != FTP_TLS_NO) {
+	    ftp_loginstate(lg, FTP_LOGIN_AUTH);
+	    if (ftp_write(ftp, "AUTH TLS\r\n", 10) == -1) {
+		ftp->errnum = ftp_lost(errno) ? EFTP_DISCONNECTED
+		    : EFTP_SYSTEM;
+		return -1;
+	    }
+	    ftp_cmdstart(ftp, "AUTH TLS");
+	    return 0;
+	}
+	ftp_loginsteps(lg);
+	return ftp_loginsend(lg);
+
+    case FTP_LOGIN_AUTH:
+	rc = ftp_loginreply(lg);
+	if (rc <= 0)
+	    return rc;
+	if (rc == 234) {
+	    if (ftp_tlsinit(ftp) == -1)
+		return -1;
+	    ftp->tls.ssl = ftp_tlsnew(ftp, ftp->sock, NULL);
+	    if (ftp->tls.ssl == NULL)
+		return -1;
+	    ftp_loginstate(lg, FTP_LOGIN_HANDSHAKE);
+	    lg->wait = FTP_TLSWAIT;
+	    return ftp_loginhandshake(lg);
+	}
+	if (ftp->tls.want == FTP_TLS_YES) {
+	    ftp->errnum = EFTP_NOTLS;
+	    return -1;
+	}
+	ftp_loginsteps(lg);
+	return ftp_loginsend(lg);
+
+    case FTP_LOGIN_HANDSHAKE:
+	return ftp_loginhandshake(lg);
+
+    case FTP_LOGIN_STEPS:
+	if (lg->outlen > 0 && ftp_loginsend(lg) == -1)
+	    return -1;
+	while (lg->done < lg->sent) {
+	    rc = ftp_loginreply(lg);
+	    if (rc <= 0)
+		return rc;
+	    if (lg->replies[lg->done] != 0 && rc != lg->replies[lg->done]) {
+		ftp->errnum = rc == 530 ? EFTP_NOLOGIN : EFTP_BADRPLY;
+		return -1;
+	    }
+	    lg->got[lg->done++] = rc;
+	    clock_gettime(CLOCK_MONOTONIC, &lg->since);
+	    memset(&lg->ans, 0, sizeof(struct ftpansbuf));
+
+	    /*
+	     * a pipelined command is timed from the reply before it, as the
+	     * server answers them in turn
+	     */
+	    if (lg->done < lg->sent)
+		ftp_cmdstart(ftp, lg->cmds[lg->done]);
+	    if (ftp_loginsend(lg) == -1)
+		return -1;
+	}
+	if (lg->done < lg->nsteps)
+	    return 0;
+
+	ftp->deflate.on = lg->deflate != -1 && lg->got[lg->deflate] == 200;
+	ftp->block.on = !ftp->deflate.on && lg->block != -1
+	    && lg->got[lg->block] == 200;
+	lg->state = FTP_LOGIN_DONE;
+	return 0;
+
+    default:
+	return 0;
+    }
+}
+
+/*
+ * the login failed, a pipelined login that was not refused is tried once
+ * more one command at a time, as some servers throw away what is sent
+ * ahead of the reply
+ */
+static void
+ftp_loginfailed(struct ftplogin *lg)
+{
+    struct ftp     *ftp;
+    int             again;
+
+    ftp = lg->ftp;
+    again = lg->state == FTP_LOGIN_STEPS && ftp->pipeline
+	&& ftp->errnum != EFTP_NOLOGIN;
+    ftp_loginfail(lg);
+    if (again) {
+	print_debug(ftp, FTP_VERBOSE_MORE, "LOGIN: %s, not pipelined\n",
+		    ftp_strerror(ftp));
+	ftp->pipeline = 0;
+	ftp_loginstart(lg);
+    }
+}
+
+/*
+ * connect to the ftp servers of "ftps" at the same time.
+ * host, user, etc. should already be set using "ftp_set_variable".
+ * the return value is 0, or -1 when a connect failed. the sessions that
+ * failed have "sock" -1 and "errnum" set
+ */
+int
+ftp_connectall(struct ftp **ftps, int n)
+{
+    struct ftplogin *logins;
+    struct ftplogin *lg;
+    struct pollfd  *pfds;
+    int            *who;	/* login of each poll entry */
+    int            *which;	/* address of a connect, or -1 */
+    int             npfds;
+    int             timeout;
+    long            left;
+    int             rc;
+    int             i;
+    int             j;
+
+    logins = calloc(n, sizeof(struct ftplogin));
+    pfds = calloc(n * FTP_ADDRMAX, sizeof(struct pollfd));
+    who = calloc(n * FTP_ADDRMAX, sizeof(int));
+    which = calloc(n * FTP_ADDRMAX, sizeof(int));
+    if (logins == NULL || pfds == NULL || who == NULL || which == NULL) {
+	for (i = 0; i < n; i++) {
+	    ftps[i]->sock = -1;
+	    ftps[i]->errnum = EFTP_SYSTEM;
+	}
+	free(logins);
+	free(pfds);
+	free(who);
+	free(which);
+	return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+	logins[i].ftp = ftps[i];
+	ftp_loginstart(&logins[i]);
+    }
+
+    for (;;) {
+	/*
+	 * what each login waits for, and for how long
+	 */
+	npfds = 0;
+	timeout = -1;
+	for (i = 0; i < n; i++) {
+	    lg = &logins[i];
+	    lg->polled = 0;
+	    if (lg->state == FTP_LOGIN_CONNECT) {
+		for (j = 0; j < lg->naddrs; j++) {
+		    if (lg->socks[j] == -1)
+			continue;
+		    pfds[npfds].fd = lg->socks[j];
+		    pfds[npfds].events = POLLOUT;
+		    who[npfds] = i;
+		    which[npfds++] = j;
+		}
+		if (lg->tried == lg->naddrs)
+		    continue;
+		left = ftp_msleft(&lg->since, FTP_EYEBALLWAIT);
+	    } else if (lg->state != FTP_LOGIN_DONE
+		       && lg->state != FTP_LOGIN_FAILED) {
+		pfds[npfds].fd = lg->ftp->sock;
+		pfds[npfds].events = lg->events;
+		who[npfds] = i;
+		which[npfds++] = -1;
+		left = ftp_msleft(&lg->since, lg->wait);
+	    } else {
+		continue;
+	    }
+	    if (timeout == -1 || left < timeout)
+		timeout = left;
+	}
+	if (npfds == 0)
+	    break;
+
+	rc = poll(pfds, npfds, timeout);
+	if (rc == -1 && errno != EINTR) {
+	    for (i = 0; i < n; i++) {
+		if (logins[i].state == FTP_LOGIN_DONE
+		    || logins[i].state == FTP_LOGIN_FAILED)
+		    continue;
+		logins[i].ftp->errnum = EFTP_SYSTEM;
+		ftp_loginfail(&logins[i]);
+	    }
+	    break;
+	}
+
+	/*
+	 * a login is run once a round, the sockets it closes may come back
+	 * as new ones under the same descriptor
+	 */
+	for (i = 0; rc > 0 && i < npfds; i++) {
+	    lg = &logins[who[i]];
+	    if (pfds[i].revents == 0 || lg->polled)
+		continue;
+	    lg->polled = 1;
+	    if (which[i] != -1)
+		ftp_loginconnected(lg, which[i]);
+	    else if (ftp_loginrun(lg) == -1)
+		ftp_loginfailed(lg);
+	}
+
+	/*
+	 * the next address is tried, or the reply waited for too long
+	 */
+	for (i = 0; i < n; i++) {
+	    lg = &logins[i];
+	    if (lg->state == FTP_LOGIN_CONNECT) {
+		if (lg->tried < lg->naddrs
+		    && ftp_msleft(&lg->since, FTP_EYEBALLWAIT) == 0)
+		    ftp_loginattempt(lg);
+	    } else if (lg->state != FTP_LOGIN_DONE
+		       && lg->state != FTP_LOGIN_FAILED
+		       && ftp_msleft(&lg->since, lg->wait) == 0) {
+		lg->ftp->errnum = EFTP_TIMEDOUT;
+		ftp_loginfailed(lg);
+	    }
+	}
+    }
+
+    rc = 0;
+    for (i = 0; i < n; i++) {
+	if (logins[i].state != FTP_LOGIN_DONE)
+	    rc = -1;
+	if (logins[i].res != NULL)
+	    freeaddrinfo(logins[i].res);
+    }
+
+    free(logins);
+    free(pfds);
+    free(who);
+    free(which);
+    return rc;
+}
+
+/*
+ * connect to the ftp server.
+ * host, user, etc. should already be set using "ftp_set_variable"
+ */
+int
+ftp_connect(struct ftp *ftp)
+{
+    return ftp_connectall(&ftp, 1);
+}
+
+/*
+ * compress the transfers that follow when "use" is set, with MODE Z when
+ * the server has it, else downloads are compressed by "deflate.helper".
+ * the return value is 0, or -1 on error
+ */
+int
+ftp_deflate(struct ftp *ftp, int use)
+{
+    if (ftp->deflate.use == use)
+	return 0;
+
+    ftp->deflate.use = use;
+    if (ftp->sock == -1)
+	return 0;
+
+    print_debug(ftp, FTP_VERBOSE_MORE, "DEFLATE: %s\n", use ? "on" : "off");
+    return ftp_mode(ftp);
+}
+
+/*
+ * create a rate limit of "limit" bytes per second, shared with the
+ * processes forked after. see "ftp_shape".
+ * the return value is the shape, or NULL on error
+ */
+struct ftpshape *
+ftp_shapenew(long long limit)
+{
+    struct ftpshape *shape;
+    int             i;
+
+    shape = mmap(NULL, sizeof(struct ftpshape), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shape == MAP_FAILED)
+	return NULL;
+
+    shape->limit = limit;
+    for (i = 0; i < FTP_SHAPEMAX; i++)
+	shape->active[i] = -1;
+    return shape;
+}
+
+void
+ftp_shapefree(struct ftpshape *shape)
+{
+    if (shape != NULL)
+	munmap(shape, sizeof(struct ftpshape));
+}
+
+/*
+ * take part in the rate limit "shape" as its slot "slot", every process
+ * sharing it has a slot of its own
+ */
+void
+ftp_shape(struct ftp *ftp, struct ftpshape *shape, int slot)
+{
+    ftp->rate.shape = shape;
+    ftp->rate.slot = slot;
+}
+
+/*
+ * set the class of the transfers that follow, a transfer waits while one
+ * of a more urgent class goes on in a process sharing "rate.shape"
+ */
+void
+ftp_priority(struct ftp *ftp, enum ftp_priority priority)
+{
+    ftp->rate.priority = priority;
+}
+
+/*
+ * add the statistics "from" to "to", the commands by name
+ */
+static void
+ftp_statsadd(struct ftpstats *to, struct ftpstats *from)
+{
+    struct ftpverb *verb;
+    int             i,
+                    j,
+                    b;
+
+    for (i = 0; i < from->nverbs; i++) {
+	for (j = 0; j < to->nverbs; j++) {
+	    if (strcmp(to->verbs[j].name, from->verbs[i].name) == 0)
+		break;
+	}
+	if (j == FTP_VERBMAX)
+	    continue;
+	verb = &to->verbs[j];
+	if (j == to->nverbs) {
+	    memset(verb, 0, sizeof(struct ftpverb));
+	    strcpy(verb->name, from->verbs[i].name);
+	    to->nverbs++;
+	}
+
+	verb->first.count += from->verbs[i].first.count;
+	verb->first.seconds += from->verbs[i].first.seconds;
+	verb->final.count += from->verbs[i].final.count;
+	verb->final.seconds += from->verbs[i].final.seconds;
+	for (b = 0; b < FTP_LATENCYMAX; b++) {
+	    verb->first.buckets[b] += from->verbs[i].first.buckets[b];
+	    verb->final.buckets[b] += from->verbs[i].final.buckets[b];
+	}
+    }
+
+    to->polls += from->polls;
+    to->wouldblocks += from->wouldblocks;
+    to->reconnects += from->reconnects;
+    to->cmdsent += from->cmdsent;
+    to->cmdrecv += from->cmdrecv;
+    to->datasent += from->datasent;
+    to->datarecv += from->datarecv;
+}
+
+/*
+ * get the statistics of the session into "stats", with those of the extra
+ * sessions of a striped download. they are kept whatever the verbosity
+ */
+void
+ftp_stats(struct ftp *ftp, struct ftpstats *stats)
+{
+    int             i;
+
+    memcpy(stats, &ftp->stats, sizeof(struct ftpstats));
+    for (i = 0; i < ftp->stripe.nsessions; i++)
+	ftp_statsadd(stats, &ftp->stripe.sessions[i].stats);
+}
+
+/*
+ * run a command that changes the state of the session, such as the library
+ * list, and run it again whenever the session is logged in again.
+ * the return value is 0 when the server replied with "reply", or -1 on
+ * error
+ */
+int
+ftp_cmdkeep(struct ftp *ftp, int reply, char *format, ...)
+{
+    char           *cmd;
+    int             len;
+    int             rc;
+    va_list         ap;
+
+    if (ftp->keep.n == FTP_KEEPMAX) {
+	ftp->errnum = EFTP_OVERFLOW;
+	return -1;
+    }
+    cmd = ftp->keep.cmds[ftp->keep.n];
+
+    va_start(ap, format);
+    len = vsnprintf(cmd, FTP_KEEPSIZ, format, ap);
+    va_end(ap);
+    if (len < 0 || len >= FTP_KEEPSIZ) {
+	ftp->errnum = EFTP_OVERFLOW;
+	return -1;
+    }
+
+    rc = ftp_cmd(ftp, "%s", cmd);
+    if (ftp_dfthandle(ftp, rc, reply) == -1)
+	return -1;
+
+    ftp->keep.replies[ftp->keep.n++] = reply;
+    return 0;
+}
+
+/*
+ * log in again on a new control connection and run the commands kept by
+ * "ftp_cmdkeep". a failed try is tried again after 1, 2, 4, ... seconds
+ */
+int
+ftp_reconnect(struct ftp *ftp)
+{
+    int             replays;
+    int             tries;
+    int             rc;
+    int             i;
+
+    replays = ftp->keep.replays;
+    for (tries = 0; tries < FTP_RECONNECTMAX; tries++) {
+	if (tries > 0)
+	    sleep(1 << (tries - 1));
+	ftp->stats.reconnects++;
+
+	ftp_tlsclose(ftp);
+	if (ftp->sock != -1)
+	    close(ftp->sock);
 	ftp->sock = -1;
+	if (ftp->block.sock != -1)
+	    close(ftp->block.sock);
+	ftp->block.sock = -1;
+	free(ftp->recvline.buffer);
+	ftp->recvline.buffer = NULL;
+
+	print_debug(ftp, FTP_VERBOSE_SOME, "RECONNECT: %s\n",
+		    ftp->server.host);
+	if (ftp_connect(ftp) == -1)
+	    continue;
+
+	for (i = 0; i < ftp->keep.n; i++) {
+	    rc = ftp_cmd(ftp, "%s", ftp->keep.cmds[i]);
+	    if (ftp_dfthandle(ftp, rc, ftp->keep.replies[i]) == -1)
+		break;
+	}
+	if (i == ftp->keep.n) {
+	    ftp->keep.replays = replays;
+	    ftp->keep.logins++;
+	    return 0;
+	}
+    }
+
+    return -1;
+}
+
+/*
+ * whether the step that just failed should run again: the connection was
+ * lost and the session is logged in again. QTEMP and everything else the
+ * step left in the old session is gone, so a step must start over from
+ * the beginning to be run again
+ */
+int
+ftp_replay(struct ftp *ftp)
+{
+    if (ftp->errnum != EFTP_DISCONNECTED
+	|| ftp->keep.replays == FTP_REPLAYMAX)
+	return 0;
+
+    ftp->keep.replays++;
+    return ftp_reconnect(ftp) == 0;
+}
+
+/*
+ * run a ftp command, note each command should be terminated with "\r\n"
+ */
+int
+ftp_cmd(struct ftp *ftp, char *format, ...)
+{
+    char            cmd[BUFSIZ];
+    int             len;
+    va_list         ap;
+
+    va_start(ap, format);
+    len = vsnprintf(cmd, sizeof(cmd), format, ap);
+    va_end(ap);
+
+    if (ftp_write(ftp, cmd, len) == -1) {
+	ftp->errnum = ftp_lost(errno) ? EFTP_DISCONNECTED : EFTP_SYSTEM;
+	return -1;
+    }
+
+    ftp_cmdstart(ftp, cmd);
+    ftp->cmd.tries = 0;
+
+    return ftp_cmdcontinue(ftp);
+}
+
+/*
+ * same as "ftp_cmd" but a re-entrant interface that supports reading the
+ * response
+ */
+int
+ftp_cmd_r(struct ftp *ftp, struct ftpansbuf *ftpans, char *format, ...)
+{
+    char            cmd[BUFSIZ];
+    int             len;
+    va_list         ap;
+
+    va_start(ap, format);
+    len = vsnprintf(cmd, sizeof(cmd), format, ap);
+    va_end(ap);
+
+    if (ftp_write(ftp, cmd, len) == -1) {
+	ftp->errnum = ftp_lost(errno) ? EFTP_DISCONNECTED : EFTP_SYSTEM;
+	return -1;
+    }
+
+    ftp_cmdstart(ftp, cmd);
+    ftp->cmd.tries = 0;
+
+    return ftp_cmdcontinue_r(ftp, ftpans);
+}
+
+/*
+ * pull the server for a response to "ftp_cmd".
+ * the return value is:
+ * - 0 when no data is available,
+ * - -1 on error,
+ * - and the ftp reply code on success
+ */
+int
+ftp_cmdcontinue(struct ftp *ftp)
+{
+    struct ftpansbuf ftpans;
+
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+
+    return ftp_cmdcontinue_r(ftp, &ftpans);
+}
+
+/*
+ * same as "ftp_cmdcontinue", but with the same re-entrant properties as
+ * "ftp_cmd_r"
+ */
+int
+ftp_cmdcontinue_r(struct ftp *ftp, struct ftpansbuf *ansbuf)
+{
+    struct timespec sleeper;
+
+    sleeper.tv_sec = 0;
+    sleeper.tv_nsec = 250L * 1000L * 1000L;
+    nanosleep(&sleeper, NULL);
+
+    if (ftp->cmd.tries++ < ftp->server.maxtries) {
+	ftp->stats.polls++;
+	if (ftp_recvans(ftp, ansbuf) == 0) {
+	    ftp_cmdreplied(ftp, ansbuf);
+	    if (ansbuf->continues) {
+		ftp->errnum = EFTP_CONTRESP;
+		return 0;
+	    }
+	    ftp->keep.replays = 0;
+	    return ansbuf->reply;
+	}
+
+	/*
+	 * waiting longer does not help a closed connection
+	 */
+	if (ftp->errnum == EFTP_DISCONNECTED)
+	    return -1;
+	return 0;
+    }
+
+    ftp->errnum = EFTP_TIMEDOUT;
+    return -1;
+}
+
+/*
+ * default handler for "ftp_cmd".
+ * the return value is:
+ * - 0 if the expected reply is received,
+ * - or -1 on error
+ */
+int
+ftp_dfthandle(struct ftp *ftp, int rc, int reply)
+{
+    struct ftpansbuf ftpans;
+
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+
+    return ftp_dfthandle_r(ftp, &ftpans, rc, reply);
+}
+
+/*
+ * same as "ftp_dfthandle", but with the same re-entrant properties as
+ * "ftp_cmd_r"
+ */
+int
+ftp_dfthandle_r(struct ftp *ftp, struct ftpansbuf *ftpans,
+		int rc, int reply)
+{
+    while (rc != reply) {
+	switch (rc) {
+	case 0:
+	    rc = ftp_cmdcontinue_r(ftp, ftpans);
+	    break;
+	case 530:
+	    ftp->errnum = EFTP_NOLOGIN;
+	    return -1;
+	case -1:		/* timeout, lost connection */
+	    return -1;
+	default:
+	    ftp->errnum = EFTP_BADRPLY;
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * lower level interface to write to the ftp socket, works like "write(2)"
+ */
+ssize_t
+ftp_write(struct ftp * ftp, void *buf, size_t count)
+{
+    ssize_t         rc;
+    char           *cmd;
+    char           *next;
+
+    if (ftp->tls.ssl != NULL)
+	rc = ftp_tlswrite(ftp, ftp->tls.ssl, buf, count);
+    else
+	rc = send(ftp->sock, buf, count, MSG_NOSIGNAL);
+    switch (rc) {
+    case 0:
+	print_debug(ftp, FTP_VERBOSE_MORE, "WRITE: [NOTHING]");
+	break;
+    case -1:
+	print_debug(ftp, FTP_VERBOSE_MORE, "WRITE: %s", strerror(errno));
+	break;
+    default:
+	ftp->stats.cmdsent += rc;
+
+	/*
+	 * a pipelined login is written as one
+	 */
+	for (cmd = buf; cmd < (char *) buf + rc; cmd = next) {
+	    next = memchr(cmd, '\n', (char *) buf + rc - cmd);
+	    next = next == NULL ? (char *) buf + rc : next + 1;
+	    if (strncmp(cmd, "PASS ", 5) == 0) {
+		print_debug(ftp, FTP_VERBOSE_SOME, "WRITE: PASS ******\n");
+	    } else {
+		print_debug(ftp, FTP_VERBOSE_SOME, "WRITE: %.*s",
+			    (int) (next - cmd), cmd);
+	    }
+	}
+    }
+
+    return rc;
+}
+
+/*
+ * lower level interface to read from the ftp socket, works like "recv(2)"
+ */
+ssize_t
+ftp_recv(struct ftp * ftp, void *buf, size_t len, int flags)
+{
+    ssize_t         rc;
+    int             errno_;
+
+    if (ftp->tls.ssl != NULL)
+	rc = ftp_tlsread(ftp->tls.ssl, buf, len);
+    else
+	rc = recv(ftp->sock, buf, len, flags);
+    errno_ = errno;
+
+    switch (rc) {
+    case 0:
+	print_debug(ftp, FTP_VERBOSE_MORE, "RECV: [NOTHING]\n");
+	break;
+    case -1:
+	print_debug(ftp, FTP_VERBOSE_MORE, "RECV: [%s]\n",
+		    strerror(errno));
+	break;
+    default:
+	ftp->stats.cmdrecv += rc;
+    }
+
+    errno = errno_;
+    return rc;
+}
+
+/*
+ * lower level interface used by "ftp_continue" and "ftp_continue_r"
+ */
+int
+ftp_recvans(struct ftp *ftp, struct ftpansbuf *ansbuf)
+{
+    char            buf[BUFSIZ];
+    ssize_t         recvlen;
+    int             rc;
+
+    recvlen = ftp_recvline(ftp, buf, sizeof(buf));
+    if (recvlen <= 0)
+	return -1;
+    if (recvlen < 4) {
+	ftp->errnum = EFTP_BADRPLY;
+	return -1;
+    }
+    /*
+     * assume that ftpansbuf.buffer is of size BUFSIZ
+     */
+
+    rc = sscanf(buf, "%d", &ansbuf->reply);
+    if (rc == 0 || rc == EOF) {
+	ftp->errnum = EFTP_BADRESP;
+	return -1;
+    }
+    /*
+     * buf = NNNIMMM
+     * NNN = reply status
+     * I   = inditator, "-" for more lines, and " " (space) for single line
+     * MMM = message
+     */
+    ansbuf->continues = (buf[3] == '-');
+    memcpy(ansbuf->buffer, buf + 4, recvlen - 4);
+    ansbuf->buffer[recvlen - 4] = '\0';
+
+    return 0;
+}
+
+/*
+ * read line from ftp socket
+ */
+ssize_t
+ftp_recvline(struct ftp * ftp, char *resbuf, size_t ressiz)
+{
+    char            recvbuf[BUFSIZ];
+    char           *pbufnl;
+    char           *ptmp;
+    size_t          nloffset;
+    ssize_t         recvlen;
+
+    /*
+     * allocate temporary storage
+     */
+    if (!ftp->recvline.buffer) {
+	ftp->recvline.size = BUFSIZ;
+	ftp->recvline.buffer = malloc(ftp->recvline.size);
+	if (!ftp->recvline.buffer) {
+	    ftp->errnum = EFTP_SYSTEM;
+	    return -1;
+	}
+	ftp->recvline.buffer[0] = '\0';
+	ftp->recvline.end = ftp->recvline.buffer;
+    }
+
+    while ((pbufnl = strstr(ftp->recvline.buffer, "\r\n")) == NULL) {
+	recvlen = ftp_recv(ftp, recvbuf, sizeof(recvbuf), 0);
+	if (recvlen == -1) {
+	    /*
+	     * no line ready just yet
+	     */
+	    if (errno == EWOULDBLOCK) {
+		ftp->stats.wouldblocks++;
+		ftp->errnum = EFTP_WOULDBLOCK;
+		return 0;
+	    } else {
+		ftp->errnum = ftp_lost(errno) ? EFTP_DISCONNECTED : EFTP_SYSTEM;
+		return -1;
+	    }
+	}
+
+	/*
+	 * the server closed the connection
+	 */
+	if (recvlen == 0) {
+	    ftp->errnum = EFTP_DISCONNECTED;
+	    return -1;
+	}
+
+	/*
+	 * realloc if needed
+	 */
+	while (ftp->recvline.end - ftp->recvline.buffer +
+	       recvlen >= (ssize_t) ftp->recvline.size) {
+	    ftp->recvline.size *= 2;
+	    ptmp = realloc(ftp->recvline.buffer, ftp->recvline.size);
+	    if (!ptmp) {
+		ftp->errnum = EFTP_SYSTEM;
+		return -1;
+	    }
+	    ftp->recvline.end =
+		ptmp + (ftp->recvline.end - ftp->recvline.buffer);
+	    ftp->recvline.buffer = ptmp;
+	}
+
+	strncpy(ftp->recvline.end, recvbuf, recvlen);
+	ftp->recvline.end[recvlen] = '\0';
+	ftp->recvline.end += recvlen;
+    }
+
+    nloffset = pbufnl - ftp->recvline.buffer;	/* CR NL */
+    if (nloffset + 1 > ressiz) {
+	ftp->errnum = EFTP_OVERFLOW;
+	return -1;
+    }
+
+    strncpy(resbuf, ftp->recvline.buffer, nloffset);
+    resbuf[nloffset] = '\n';	/* CR */
+    resbuf[nloffset + 1] = '\0';	/* NL */
+
+    memmove(ftp->recvline.buffer, pbufnl + 2,
+	    ftp->recvline.end - (pbufnl + 1));
+    if (*ftp->recvline.buffer == '\0') {
+	free(ftp->recvline.buffer);
+	ftp->recvline.buffer = 0;
+    } else {
+	ftp->recvline.end =
+	    ftp->recvline.buffer + (ftp->recvline.end - (pbufnl + 2));
+    }
+
+    print_debug(ftp, FTP_VERBOSE_SOME, "RECVLINE: %s", resbuf);
+    return nloffset + 1;
+}
+
+/*
+ * whether the data connection kept open in block mode is still there, the
+ * server may have closed it after the last transfer
+ */
+static int
+ftp_blockalive(struct ftp *ftp)
+{
+    struct pollfd   pfd;
+    char            c;
+
+    pfd.fd = ftp->block.sock;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) == 0)
+	return 1;
+
+    /*
+     * nothing but the close alert comes between transfers over TLS
+     */
+    if (ftp->block.sock == ftp->tls.datasock)
+	return 0;
+
+    return recv(ftp->block.sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+/*
+ * enter passive mode and connect to the data port of the server. in block
+ * mode the data connection of the last transfer is used again.
+ * the return value is the data socket, or -1 on error
+ */
+static int
+ftp_pasv(struct ftp *ftp)
+{
+    int             rc;
+    struct ftpansbuf ftpans;
+    int             hostp[4];	/* host IP */
+    int             portp[2];	/* host port */
+    int             pasvfd;
+    struct sockaddr_in addr;
+    int             errno_;
+
+    if (ftp->block.on && ftp->block.sock != -1) {
+	if (ftp_blockalive(ftp))
+	    return ftp->block.sock;
+	ftp_tlsdataclose(ftp, 0);
+	close(ftp->block.sock);
+	ftp->block.sock = -1;
+    }
+
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    rc = ftp_cmd_r(ftp, &ftpans, "PASV\r\n");
+    if (ftp_dfthandle_r(ftp, &ftpans, rc, 227) == -1)
+	return -1;
+
+    if (sscanf(ftpans.buffer,
+	       "Entering Passive Mode (%d,%d,%d,%d,%d,%d).",
+	       &hostp[0], &hostp[1], &hostp[2], &hostp[3], &portp[0],
+	       &portp[1]) != 6) {
+	ftp->errnum = EFTP_BADRESP;
+	return -1;
+    }
+
+    pasvfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (pasvfd == -1) {
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr =
+	(hostp[3] << 24) + (hostp[2] << 16) + (hostp[1] << 8) + hostp[0];
+    addr.sin_port = htons(portp[0] * 256 + portp[1]);
+
+    ftp_tune(ftp, pasvfd, 0);
+    if (connect(pasvfd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+	errno_ = errno;
+	close(pasvfd);
+	errno = errno_;
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    }
+
+    if (ftp->block.on)
+	ftp->block.sock = pasvfd;
+    return pasvfd;
+}
+
+/*
+ * done with the data connection "fd", it is kept for the next transfer in
+ * block mode unless the transfer failed
+ */
+static void
+ftp_dataclose(struct ftp *ftp, int fd, int ok)
+{
+    if (ok && ftp->block.on && fd == ftp->block.sock)
+	return;
+
+    if (fd == ftp->tls.datasock)
+	ftp_tlsdataclose(ftp, ok);
+    close(fd);
+    if (fd == ftp->block.sock)
+	ftp->block.sock = -1;
+}
+
+/*
+ * protect the data connection "sock" once the server is ready for it
+ * after the transfer command, the data connection of block mode is only
+ * set up once. with kTLS the kernel has the keys after the handshake, so
+ * the data can still be moved on the socket itself
+ */
+static int
+ftp_tlsdata(struct ftp *ftp, int sock)
+{
+    if (ftp->tls.ssl == NULL || ftp->tls.datasock == sock)
+	return 0;
+
+    ftp_tlsdataclose(ftp, 0);
+    ftp->tls.data = ftp_tlsopen(ftp, sock, ftp->tls.ssl);
+    if (ftp->tls.data == NULL)
+	return -1;
+    ftp->tls.datasock = sock;
+#ifndef OPENSSL_NO_KTLS
+    ftp->tls.ktlssend = BIO_get_ktls_send(SSL_get_wbio(ftp->tls.data)) > 0;
+    ftp->tls.ktlsrecv = BIO_get_ktls_recv(SSL_get_rbio(ftp->tls.data)) > 0;
+#endif
+
+    print_debug(ftp, FTP_VERBOSE_MORE, "TLS: data, kTLS send %s, recv %s\n",
+		ftp->tls.ktlssend ? "yes" : "no",
+		ftp->tls.ktlsrecv ? "yes" : "no");
+    return 0;
+}
+
+/*
+ * whether the socket itself can be used for the data connection "fd", in
+ * the direction told by "recv"
+ */
+static int
+ftp_dataraw(struct ftp *ftp, int fd, int recv)
+{
+    if (fd != ftp->tls.datasock)
+	return 1;
+
+    return recv ? ftp->tls.ktlsrecv : ftp->tls.ktlssend;
+}
+
+/*
+ * send on the data connection "fd" like "send(2)", through TLS when it is
+ * protected
+ */
+static ssize_t
+ftp_datasend(struct ftp *ftp, int fd, const void *buf, size_t len)
+{
+    if (fd == ftp->tls.datasock)
+	return ftp_tlswrite(ftp, ftp->tls.data, buf, len);
+
+    return send(fd, buf, len, MSG_NOSIGNAL);
+}
+
+/*
+ * receive from the data connection "fd" like "recv(2)", through TLS when
+ * it is protected
+ */
+static ssize_t
+ftp_datarecv(struct ftp *ftp, int fd, void *buf, size_t len)
+{
+    if (fd == ftp->tls.datasock)
+	return ftp_tlsread(ftp->tls.data, buf, len);
+
+    return recv(fd, buf, len, 0);
+}
+
+/*
+ * whether TLS holds data of "fd" already read from the socket, which poll
+ * does not tell
+ */
+static int
+ftp_datapending(struct ftp *ftp, int fd)
+{
+    return fd == ftp->tls.datasock && SSL_pending(ftp->tls.data) > 0;
+}
+
+/*
+ * go back to stream mode for the rest of the session, or until
+ * "ftp_deflate" changes it. a restarted or striped transfer gives a byte
+ * offset with REST and cuts the data off before the end, neither of which
+ * block mode or MODE Z has
+ */
+static int
+ftp_stream(struct ftp *ftp)
+{
+    int             rc;
+
+    if (!ftp->block.on && !ftp->deflate.on)
+	return 0;
+
+    if (ftp->block.sock != -1) {
+	ftp_tlsdataclose(ftp, 0);
+	close(ftp->block.sock);
+    }
+    ftp->block.sock = -1;
+    ftp->block.on = 0;
+    ftp->deflate.on = 0;
+
+    rc = ftp_cmd(ftp, "MODE S\r\n");
+    return ftp_dfthandle(ftp, rc, 200);
+}
+
+/*
+ * the state of a file received in block mode
+ */
+struct ftpblock {
+    long            left;	/* bytes left in the block */
+    int             last;	/* boolean, the block ends the file */
+};
+
+/*
+ * receive exactly "len" bytes from the data connection "fd".
+ * the return value is 0, or -1 when it ended or failed
+ */
+static int
+ftp_recvall(struct ftp *ftp, int fd, void *buf, size_t len)
+{
+    ssize_t         rc;
+    size_t          got;
+
+    for (got = 0; got < len; got += rc) {
+	rc = ftp_datarecv(ftp, fd, (char *) buf + got, len - got);
+	if (rc <= 0) {
+	    if (rc == 0)
+		errno = ECONNRESET;
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * receive the data of a file sent in block mode, every block starts with a
+ * descriptor and a 16 bit count. restart markers are skipped.
+ * the return value is the number of bytes put in "buf", 0 at the end of
+ * the file, or -1 on error
+ */
+static ssize_t
+ftp_blockrecv(struct ftp *ftp, int fd, struct ftpblock *blk, void *buf,
+	      size_t siz)
+{
+    unsigned char   hdr[3];
+    char            mark[FTP_BLOCKMAX];
+    ssize_t         rc;
+
+    while (blk->left == 0) {
+	if (blk->last)
+	    return 0;
+	if (ftp_recvall(ftp, fd, hdr, sizeof(hdr)) == -1)
+	    return -1;
+
+	blk->left = (hdr[1] << 8) | hdr[2];
+	blk->last = (hdr[0] & FTP_BLOCKEOF) != 0;
+	if (hdr[0] & FTP_BLOCKMARK) {
+	    if (ftp_recvall(ftp, fd, mark, blk->left) == -1)
+		return -1;
+	    blk->left = 0;
+	}
+    }
+
+    if ((size_t) blk->left < siz)
+	siz = blk->left;
+    rc = ftp_datarecv(ftp, fd, buf, siz);
+    if (rc == 0) {
+	errno = ECONNRESET;
+	return -1;
+    }
+    if (rc > 0)
+	blk->left -= rc;
+    return rc;
+}
+
+/*
+ * send "len" bytes of "buf" as one block, the data is preceded by the
+ * three bytes of the header in "buf". a "len" of 0 ends the file
+ */
+static int
+ftp_blocksend(struct ftp *ftp, int fd, unsigned char *buf, size_t len)
+{
+    buf[0] = len == 0 ? FTP_BLOCKEOF : 0;
+    buf[1] = len >> 8;
+    buf[2] = len & 0xff;
+
+    if (ftp_datasend(ftp, fd, buf, len + 3) != (ssize_t) (len + 3))
+	return -1;
+    return 0;
+}
+
+/*
+ * compress "len" bytes of "buf" and send what deflate gives out. a "len"
+ * of 0 ends the compressed data
+ */
+static int
+ftp_deflatesend(struct ftp *ftp, int fd, z_stream * zs, void *buf,
+		size_t len, unsigned char *out, size_t outsiz)
+{
+    size_t          n;
+
+    zs->next_in = buf;
+    zs->avail_in = len;
+    do {
+	zs->next_out = out;
+	zs->avail_out = outsiz;
+	if (deflate(zs, len == 0 ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) {
+	    errno = EINVAL;
+	    return -1;
+	}
+	n = outsiz - zs->avail_out;
+	if (n > 0 && ftp_datasend(ftp, fd, out, n) != (ssize_t) n)
+	    return -1;
+    } while (zs->avail_out == 0);
+
+    return 0;
+}
+
+/*
+ * inflate the "len" received bytes of "buf" through "out" and write them
+ * to "fd" at "*offset", which is moved past them. "*end" is set once the
+ * compressed data ended
+ */
+static int
+ftp_inflatewrite(struct ftp *ftp, z_stream * zs, int fd, void *buf,
+		 size_t len, unsigned char *out, size_t outsiz,
+		 long long *offset, int *end)
+{
+    ssize_t         n;
+    int             rc;
+
+    zs->next_in = buf;
+    zs->avail_in = len;
+    while (!*end) {
+	zs->next_out = out;
+	zs->avail_out = outsiz;
+	rc = inflate(zs, Z_NO_FLUSH);
+	if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+	    ftp->errnum = EFTP_INFLATE;
+	    return -1;
+	}
+	*end = rc == Z_STREAM_END;
+
+	n = outsiz - zs->avail_out;
+	if (n > 0 && pwrite(fd, out, n, *offset) != n) {
+	    ftp->errnum = EFTP_SYSTEM;
+	    return -1;
+	}
+	*offset += n;
+	if (zs->avail_in == 0 && zs->avail_out > 0)
+	    break;
     }
 
-    freeaddrinfo(ressave);
+    return 0;
+}
+
+/*
+ * the journal of a partial transfer is kept next to the local file as one
+ * line "<dir> <size> <offset> <remotename>". <dir> is "get" or "put",
+ * <size> is the size of the whole file, and <offset> the bytes of a get
+ * that are in the local file. the offset of a put is asked with SIZE. the
+ * remote name is the rest of the line
+ */
+static void
+ftp_partname(char *partname, size_t partsiz, char *localname)
+{
+    snprintf(partname, partsiz, "%s.part", localname);
+}
+
+/*
+ * read the journal of "localname" if it is of a transfer in direction
+ * "dir", "remotename" must hold PATH_MAX bytes. a transfer without a local
+ * name has no journal.
+ * the return value is 0 on success, or -1 if there is no such journal
+ */
+static int
+ftp_partread(char *localname, char *dir, long long *size,
+	     long long *offset, char *remotename)
+{
+    FILE           *fp;
+    char            partname[PATH_MAX];
+    char            pdir[4];
+    int             rc;
+
+    if (localname == NULL)
+	return -1;
+    ftp_partname(partname, sizeof(partname), localname);
+    fp = fopen(partname, "r");
+    if (fp == NULL)
+	return -1;
+    rc = fscanf(fp, "%3s %lld %lld ", pdir, size, offset);
+    if (rc == 3 && fgets(remotename, PATH_MAX, fp) == NULL)
+	rc = -1;
+    fclose(fp);
+
+    if (rc != 3 || strcmp(pdir, dir) != 0)
+	return -1;
+    remotename[strcspn(remotename, "\n")] = '\0';
+    return 0;
+}
+
+static int
+ftp_partwrite(char *localname, char *dir, long long size, long long offset,
+	      char *remotename)
+{
+    FILE           *fp;
+    char            partname[PATH_MAX];
+
+    if (localname == NULL)
+	return 0;
+    ftp_partname(partname, sizeof(partname), localname);
+    fp = fopen(partname, "w");
+    if (fp == NULL)
+	return -1;
+    fprintf(fp, "%s %lld %lld %s\n", dir, size, offset, remotename);
+    return fclose(fp);
+}
+
+/*
+ * remove a local file together with the journal of a partial transfer to
+ * or from it, "errno" is kept when there is no journal
+ */
+int
+ftp_unlink(char *localname)
+{
+    char            partname[PATH_MAX];
+    int             errno_;
 
-    if (ftp->sock == -1) {
+    errno_ = errno;
+    ftp_partname(partname, sizeof(partname), localname);
+    if (unlink(partname) == -1)
 	errno = errno_;
+    return unlink(localname);
+}
+
+/*
+ * whether a failed transfer can be resumed on a new session. a system error
+ * only is when "errno" came from the network, a local file that cannot be
+ * read or written fails the same way again
+ */
+static int
+ftp_resumable(struct ftp *ftp)
+{
+    switch (ftp->errnum) {
+    case EFTP_TIMEDOUT:
+    case EFTP_SHORT:
+    case EFTP_DISCONNECTED:
+	return 1;
+    case EFTP_SYSTEM:
+	switch (errno) {
+	case ENETDOWN:
+	case ENETUNREACH:
+	case ENETRESET:
+	case EHOSTDOWN:
+	case EHOSTUNREACH:
+	case ECONNREFUSED:
+	    return 1;
+	case EBADF:		/* as likely the local file */
+	    return 0;
+	default:
+	    return ftp_lost(errno);
+	}
+    default:
+	return 0;
+    }
+}
+
+/*
+ * a large file is written once and read once, so it is let out of the page
+ * cache behind the transfer instead of pushing everything else out. the
+ * writeback of the bytes written is started every "FTP_UNCACHESTEP", and
+ * the step before is waited for and dropped. "fd" is -1 when the file is
+ * kept in the cache
+ */
+struct ftpuncache {
+    int             fd;
+    int             writing;
+    long long       dropped;	/* first byte still in the cache */
+    long long       flushed;	/* first byte not being written back */
+};
+
+static void
+ftp_uncachestart(struct ftp *ftp, struct ftpuncache *uc, int fd,
+		 long long offset, long long size, int writing)
+{
+    uc->fd = -1;
+    if (ftp->uncached.minsize == 0 || size < ftp->uncached.minsize)
+	return;
+
+    uc->fd = fd;
+    uc->writing = writing;
+    uc->dropped = offset;
+    uc->flushed = offset;
+    posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+/*
+ * let the file before "pos" out of the cache, a step at a time unless
+ * "done" is set. errors are ignored, the file is then only cached
+ */
+static void
+ftp_uncache(struct ftpuncache *uc, long long pos, int done)
+{
+    if (uc->fd == -1 || (!done && pos - uc->flushed < FTP_UNCACHESTEP))
+	return;
+
+    if (uc->writing) {
+#ifdef SYNC_FILE_RANGE_WRITE
+	sync_file_range(uc->fd, uc->flushed, pos - uc->flushed,
+			SYNC_FILE_RANGE_WRITE);
+	if (done)
+	    uc->flushed = pos;
+	sync_file_range(uc->fd, uc->dropped, uc->flushed - uc->dropped,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+			| SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+	if (done)
+	    uc->flushed = pos;
+	fdatasync(uc->fd);
+#endif
+    } else {
+	uc->flushed = pos;
+    }
+
+    /*
+     * dirty pages are not dropped, hence the writeback first
+     */
+    if (uc->flushed > uc->dropped)
+	posix_fadvise(uc->fd, uc->dropped, uc->flushed - uc->dropped,
+		      POSIX_FADV_DONTNEED);
+    uc->dropped = uc->flushed;
+    uc->flushed = pos;
+}
+
+/*
+ * mark the transfer of "rate.priority" as going on, or as done when "on"
+ * is cleared, for the processes sharing "rate.shape"
+ */
+static void
+ftp_rateactive(struct ftp *ftp, int on)
+{
+    if (ftp->rate.shape != NULL)
+	ftp->rate.shape->active[ftp->rate.slot] = on ?
+	    (int) ftp->rate.priority : -1;
+}
+
+/*
+ * get the bytes per second a transfer may move now, 0 is no limit. the
+ * limit of "rate.shape" is split between the transfers of the most urgent
+ * class going on, a transfer of a less urgent class waits until they are
+ * done
+ */
+static double
+ftp_ratenow(struct ftp *ftp)
+{
+    struct ftpshape *shape;
+    struct timespec sleeper;
+    double          rate;
+    int             sharing;
+    int             waited;
+    int             i;
+
+    rate = ftp->rate.limit;
+    shape = ftp->rate.shape;
+    if (shape == NULL || shape->limit == 0)
+	return rate;
+
+    sleeper.tv_sec = 0;
+    sleeper.tv_nsec = FTP_SHAPEWAIT * 1000L * 1000L;
+    for (waited = 0;; waited = 1) {
+	sharing = 0;
+	for (i = 0; i < FTP_SHAPEMAX; i++) {
+	    if (shape->active[i] == -1)
+		continue;
+	    if (shape->active[i] < (int) ftp->rate.priority)
+		break;
+	    if (shape->active[i] == (int) ftp->rate.priority)
+		sharing++;
+	}
+	if (i == FTP_SHAPEMAX)
+	    break;
+
+	if (!waited)
+	    print_debug(ftp, FTP_VERBOSE_MORE,
+			"SHAPE: waiting for an urgent transfer\n");
+	nanosleep(&sleeper, NULL);
+    }
+
+    if (sharing == 0)
+	sharing = 1;
+    if (rate == 0 || (double) shape->limit / sharing < rate)
+	rate = (double) shape->limit / sharing;
+    return rate;
+}
+
+/*
+ * take the "len" bytes moved by a transfer out of the token bucket, and
+ * sleep until the bucket is no longer short of them. the bucket fills at
+ * the rate and holds "FTP_RATEBURST" of it
+ */
+static void
+ftp_throttle(struct ftp *ftp, size_t len)
+{
+    struct timespec now;
+    struct timespec sleeper;
+    double          rate;
+    double          burst;
+    double          secs;
+
+    rate = ftp_ratenow(ftp);
+    if (rate == 0)
+	return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    secs = now.tv_sec + now.tv_nsec / 1e9;
+    burst = rate * FTP_RATEBURST / 1000;
+    ftp->rate.tokens += (secs - ftp->rate.last) * rate;
+    if (ftp->rate.tokens > burst)
+	ftp->rate.tokens = burst;
+    ftp->rate.last = secs;
+
+    ftp->rate.tokens -= len;
+    if (ftp->rate.tokens >= 0)
+	return;
+
+    secs = -ftp->rate.tokens / rate;
+    sleeper.tv_sec = (time_t) secs;
+    sleeper.tv_nsec = (long) ((secs - sleeper.tv_sec) * 1e9);
+    nanosleep(&sleeper, NULL);
+}
+
+/*
+ * allocate the buffers of a transfer: "*buf" of "net.bufsiz" bytes with
+ * room for a block header before them, and "*zbuf" for zlib to put out
+ * into when "packed".
+ * the return value is 0, or -1 on error
+ */
+static int
+ftp_bufalloc(struct ftp *ftp, unsigned char **buf, unsigned char **zbuf,
+	     int packed)
+{
+    *buf = malloc(3 + ftp->net.bufsiz);
+    *zbuf = packed ? malloc(ftp->net.bufsiz) : NULL;
+    if (*buf == NULL || (packed && *zbuf == NULL)) {
+	free(*buf);
+	free(*zbuf);
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * the io_uring of the transfers of "ftp", it is set up by the first one
+ * and not at connect as "zs copy" forks after it. there are slots enough
+ * for a striped download.
+ * the return value is NULL when io_uring cannot be used
+ */
+static struct uring *
+ftp_uring(struct ftp *ftp)
+{
+    int             nslots;
+
+    if (ftp->ring == NULL) {
+	ftp->ring = malloc(sizeof(struct uring));
+	if (ftp->ring == NULL)
+	    return NULL;
+	nslots = ftp->stripe.count > FTP_URINGSLOTS ? ftp->stripe.count
+	    : FTP_URINGSLOTS;
+	uring_init(ftp->ring, nslots, ftp->net.bufsiz);
+    }
+
+    return ftp->ring->fd != -1 ? ftp->ring : NULL;
+}
+
+/*
+ * send "localfd", the file "localname" or NULL, from "offset" to the
+ * server. with "*unique" set the file is stored with STOU, "remotename" is
+ * updated with the stored name and "*unique" cleared once the server told
+ * it, else the transfer continues "remotename" at "offset"
+ */
+static int
+ftp_send(struct ftp *ftp, int localfd, char *localname, char *remotename,
+	 long long size, long long offset, int *unique)
+{
+    int             rc;
+    struct ftpansbuf ftpans;
+    int             pasvfd;
+    unsigned char  *resbuf;	/* after room for a block header */
+    unsigned char  *zbuf;
+    ssize_t         reslen;
+    size_t          blocksiz;
+    struct ftpuncache uc;
+    struct uring   *ring;
+    z_stream        zs;
+    int             errno_;
+
+    ftp_uncachestart(ftp, &uc, localfd, offset, size, 0);
+
+    if (!*unique && offset > 0 && ftp_stream(ftp) == -1)
+	return -1;
+
+    if (ftp_bufalloc(ftp, &resbuf, &zbuf, ftp->deflate.on) == -1)
+	return -1;
+    blocksiz = ftp->net.bufsiz < FTP_BLOCKMAX ? ftp->net.bufsiz
+	: FTP_BLOCKMAX;
+
+    memset(&zs, 0, sizeof(z_stream));
+    if (ftp->deflate.on && deflateInit(&zs, FTP_DEFLATELEVEL) != Z_OK) {
+	free(resbuf);
+	free(zbuf);
+	errno = ENOMEM;
 	ftp->errnum = EFTP_SYSTEM;
 	return -1;
     }
 
-    fcntl(ftp->sock, F_SETFL, O_NONBLOCK);
+    pasvfd = ftp_pasv(ftp);
+    if (pasvfd == -1) {
+	free(resbuf);
+	free(zbuf);
+	deflateEnd(&zs);
+	return -1;
+    }
+
+    ring = NULL;
+    if (!*unique && offset > 0) {
+	rc = ftp_cmd(ftp, "REST %lld\r\n", offset);
+	if (ftp_dfthandle(ftp, rc, 350) == -1)
+	    goto fail;
+    }
+
+    /*
+     * read STOU/STOR ack. reply
+     */
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    rc = ftp_cmd_r(ftp, &ftpans, "%s %s\r\n", *unique ? "STOU" : "STOR",
+		   remotename);
+    if (ftp_dfthandle_r(ftp, &ftpans, rc, 150) == -1)
+	goto fail;
+    if (*unique) {
+	if (sscanf(ftpans.buffer, "Sending file to %s", remotename) != 1) {
+	    ftp->errnum = EFTP_BADRESP;
+	    goto fail;
+	}
+	ftp_partwrite(localname, "put", size, 0, remotename);
+	*unique = 0;
+    }
+
+    /*
+     * io_uring sends on the socket itself, without it the data is read and
+     * sent here, as is every block of block mode and all data compressed
+     * for MODE Z
+     */
+    if (ftp_tlsdata(ftp, pasvfd) == -1)
+	goto fail;
+    if (!ftp->block.on && !ftp->deflate.on && ftp_dataraw(ftp, pasvfd, 0)) {
+	ring = ftp_uring(ftp);
+	if (ring != NULL
+	    && uring_stream(ring, 0, pasvfd, localfd, offset,
+			    size - offset) == -1)
+	    ring = NULL;
+    }
+
+    for (;;) {
+	if (ring != NULL && offset < size) {
+	    if (uring_next(ring, &reslen) == -1) {
+		ftp->errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	} else if (ftp->block.on) {
+	    reslen = pread(localfd, resbuf + 3, blocksiz, offset);
+	    if (reslen == -1
+		|| ftp_blocksend(ftp, pasvfd, resbuf, reslen) == -1) {
+		ftp->errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	} else if (ftp->deflate.on) {
+	    reslen = pread(localfd, resbuf, ftp->net.bufsiz, offset);
+	    if (reslen == -1
+		|| ftp_deflatesend(ftp, pasvfd, &zs, resbuf, reslen, zbuf,
+				   ftp->net.bufsiz) == -1) {
+		ftp->errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	} else {
+	    reslen = pread(localfd, resbuf, ftp->net.bufsiz, offset);
+	    if (reslen == -1
+		|| ftp_datasend(ftp, pasvfd, resbuf, reslen) != reslen) {
+		ftp->errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	}
+	if (reslen == 0)
+	    break;
+	offset += reslen;
+	ftp->stats.datasent += reslen;
+	ftp_uncache(&uc, offset, 0);
+	ftp_throttle(ftp, reslen);
+    }
+    ftp_uncache(&uc, offset, 1);
+
+    if (ring != NULL)
+	uring_drain(ring);
+    deflateEnd(&zs);
+    free(resbuf);
+    free(zbuf);
+    ftp_dataclose(ftp, pasvfd, 1);
 
     /*
-     * read welcome message
+     * read STOR ok reply, a transfer aborted by the server is continued
      */
     ftp->cmd.tries = 0;
     rc = ftp_cmdcontinue(ftp);
-    if (ftp_dfthandle(ftp, rc, 220) == -1)
+    if (rc == 426 || rc == 451) {
+	ftp->errnum = EFTP_SHORT;
 	return -1;
-
-    /*
-     * FIXME: AUTH TLS | AUTH SSL
-     */
-
-    /*
-     * login
-     */
-    if (*ftp->server.user) {
-	rc = ftp_cmd(ftp, "USER %s\r\n", ftp->server.user);
-	if (ftp_dfthandle(ftp, rc, 331) == -1)
-	    return -1;
-
-	rc = ftp_cmd(ftp, "PASS %s\r\n", ftp->server.password);
-	if (ftp_dfthandle(ftp, rc, 230) == -1)
-	    return -1;
     }
-
-    /*
-     * binary mode
-     */
-    rc = ftp_cmd(ftp, "type I\r\n");
-    if (ftp_dfthandle(ftp, rc, 200) == -1)
+    if (ftp_dfthandle(ftp, rc, 226) == -1)
 	return -1;
 
     return 0;
+
+  fail:
+    errno_ = errno;
+    if (ring != NULL)
+	uring_drain(ring);
+    deflateEnd(&zs);
+    free(resbuf);
+    free(zbuf);
+    ftp_dataclose(ftp, pasvfd, 0);
+    errno = errno_;
+    return -1;
 }
 
 /*
- * run a ftp command, note each command should be terminated with "\r\n"
+ * store "localfd" as a unique file on the server, see "ftp_put". only a
+ * transfer of a "localname" is journaled
  */
-int
-ftp_cmd(struct ftp *ftp, char *format, ...)
+static int
+ftp_putfile(struct ftp *ftp, int localfd, char *localname, char *remotename)
 {
-    char            cmd[BUFSIZ];
-    int             len;
-    va_list         ap;
-
-    va_start(ap, format);
-    len = vsnprintf(cmd, sizeof(cmd), format, ap);
-    va_end(ap);
-
-    ftp_write(ftp, cmd, len);
-
-    ftp->cmd.tries = 0;
+    struct stat     st;
+    char            partremote[PATH_MAX];
+    long long       partsize;
+    long long       offset;
+    int             unique;
+    int             tries;
+
+    if (fstat(localfd, &st) == -1) {
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    }
 
-    return ftp_cmdcontinue(ftp);
-}
+    /*
+     * continue the file left by an earlier put of "localname" when the
+     * server still has no more of it than we do
+     */
+    unique = 1;
+    offset = 0;
+    if (ftp_partread(localname, "put", &partsize, &offset, partremote) == 0
+	&& partsize == st.st_size) {
+	offset = ftp_size(ftp, partremote);
+	if (offset >= 0 && offset <= st.st_size) {
+	    strcpy(remotename, partremote);
+	    unique = 0;
+	} else {
+	    offset = 0;
+	}
+    }
 
-/*
- * same as "ftp_cmd" but a re-entrant interface that supports reading the
- * response
- */
-int
-ftp_cmd_r(struct ftp *ftp, struct ftpansbuf *ftpans, char *format, ...)
-{
-    char            cmd[BUFSIZ];
-    int             len;
-    va_list         ap;
+    for (tries = 0;; tries++) {
+	if (offset > 0)
+	    print_debug(ftp, FTP_VERBOSE_SOME, "RESUME: %s at %lld\n",
+			remotename, offset);
 
-    va_start(ap, format);
-    len = vsnprintf(cmd, sizeof(cmd), format, ap);
-    va_end(ap);
+	if (ftp_send(ftp, localfd, localname, remotename, st.st_size, offset,
+		     &unique) == 0)
+	    break;
 
-    ftp_write(ftp, cmd, len);
+	if (!ftp_resumable(ftp) || tries == FTP_RESUMEMAX
+	    || ftp_reconnect(ftp) == -1)
+	    return -1;
 
-    ftp->cmd.tries = 0;
+	/*
+	 * the stored name is known once the server acknowledged STOU
+	 */
+	if (!unique) {
+	    offset = ftp_size(ftp, remotename);
+	    if (offset < 0 || offset > st.st_size)
+		offset = 0;
+	}
+    }
 
-    return ftp_cmdcontinue_r(ftp, ftpans);
+    if (localname != NULL) {
+	ftp_partname(partremote, sizeof(partremote), localname);
+	unlink(partremote);
+    }
+    return 0;
 }
 
 /*
- * pull the server for a response to "ftp_cmd".
- * the return value is:
- * - 0 when no data is available,
- * - -1 on error,
- * - and the ftp reply code on success
+ * store unique file on ftp server. a transfer that breaks off is continued
+ * with REST on a new session, also when it was left by an earlier call.
+ * NOTE: remotename can be updated with the actual stored name
  */
 int
-ftp_cmdcontinue(struct ftp *ftp)
+ftp_put(struct ftp *ftp, char *localname, char *remotename)
 {
-    struct ftpansbuf ftpans;
+    int             localfd;
+    int             rc;
+    int             errno_;
 
-    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    localfd = open(localname, O_RDONLY);
+    if (localfd == -1) {
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    }
 
-    return ftp_cmdcontinue_r(ftp, &ftpans);
+    ftp_rateactive(ftp, 1);
+    rc = ftp_putfile(ftp, localfd, localname, remotename);
+    errno_ = errno;
+    ftp_rateactive(ftp, 0);
+    close(localfd);
+    errno = errno_;
+    return rc;
 }
 
 /*
- * same as "ftp_cmdcontinue", but with the same re-entrant properties as
- * "ftp_cmd_r"
+ * like "ftp_put", but store the open file "localfd" from its start. the
+ * file is not journaled, so it is only continued within the call
  */
 int
-ftp_cmdcontinue_r(struct ftp *ftp, struct ftpansbuf *ansbuf)
+ftp_putfd(struct ftp *ftp, int localfd, char *remotename)
 {
-    struct timespec sleeper;
-
-    sleeper.tv_sec = 0;
-    sleeper.tv_nsec = 250L * 1000L * 1000L;
-    nanosleep(&sleeper, NULL);
-
-    if (ftp->cmd.tries++ < ftp->server.maxtries) {
-	if (ftp_recvans(ftp, ansbuf) == 0) {
-	    if (ansbuf->continues) {
-		ftp->errnum = EFTP_CONTRESP;
-		return 0;
-	    }
-	    return ansbuf->reply;
-	}
-	return 0;
-    }
+    int             rc;
 
-    ftp->errnum = EFTP_TIMEDOUT;
-    return -1;
+    ftp_rateactive(ftp, 1);
+    rc = ftp_putfile(ftp, localfd, NULL, remotename);
+    ftp_rateactive(ftp, 0);
+    return rc;
 }
 
 /*
- * default handler for "ftp_cmd".
- * the return value is:
- * - 0 if the expected reply is received,
- * - or -1 on error
+ * make sure "count" sessions besides "ftp" are logged in for striped
+ * downloads, they are kept until "ftp" is closed
  */
-int
-ftp_dfthandle(struct ftp *ftp, int rc, int reply)
+static int
+ftp_openstripes(struct ftp *ftp, int count)
 {
-    struct ftpansbuf ftpans;
+    struct ftp     *sessions;
+    struct ftp     *sess;
+    struct ftp     *opened[FTP_STRIPEMAX];
+    int             n;
+    int             i;
 
-    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    if (ftp->stripe.nsessions >= count)
+	return 0;
 
-    return ftp_dfthandle_r(ftp, &ftpans, rc, reply);
-}
+    sessions = realloc(ftp->stripe.sessions, count * sizeof(struct ftp));
+    if (sessions == NULL) {
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    }
+    ftp->stripe.sessions = sessions;
+
+    for (n = 0; ftp->stripe.nsessions + n < count; n++) {
+	sess = &ftp->stripe.sessions[ftp->stripe.nsessions + n];
+	ftp_init(sess);
+	sess->sock = -1;
+	sess->verbosity = ftp->verbosity;
+	sess->pipeline = ftp->pipeline;
+	sess->block.want = 0;
+	sess->tls.want = ftp->tls.want;
+	sess->tls.verify = ftp->tls.verify;
+	memcpy(sess->tls.cafile, ftp->tls.cafile, FTP_CAFILESIZ);
+	memcpy(&sess->server, &ftp->server, sizeof(struct ftpserver));
+	memcpy(&sess->net, &ftp->net, sizeof(sess->net));
+	opened[n] = sess;
+    }
 
-/*
- * same as "ftp_dfthandle", but with the same re-entrant properties as
- * "ftp_cmd_r"
- */
-int
-ftp_dfthandle_r(struct ftp *ftp, struct ftpansbuf *ftpans,
-		int rc, int reply)
-{
-    while (rc != reply) {
-	switch (rc) {
-	case 0:
-	    rc = ftp_cmdcontinue_r(ftp, ftpans);
-	    break;
-	case 530:
-	    ftp->errnum = EFTP_NOLOGIN;
-	    return -1;
-	case -1:		/* timeout */
-	    return -1;
-	default:
-	    ftp->errnum = EFTP_BADRPLY;
-	    return -1;
+    /*
+     * the sessions log in at the same time
+     */
+    if (ftp_connectall(opened, n) == -1) {
+	for (i = 0; i < n; i++) {
+	    if (opened[i]->sock == -1)
+		ftp->errnum = opened[i]->errnum;
+	    ftp_statsadd(&ftp->stats, &opened[i]->stats);
+	    ftp_close(opened[i]);
 	}
+	return -1;
     }
+    ftp->stripe.nsessions += n;
+
     return 0;
 }
 
 /*
- * lower level interface to write to the ftp socket, works like "write(2)"
+ * read the reply that ends a RETR. a RETR whose data connection was closed
+ * by us before the end of the file ends with 426 or 451
  */
-ssize_t
-ftp_write(struct ftp * ftp, void *buf, size_t count)
+static int
+ftp_retrend(struct ftp *ftp)
 {
-    ssize_t         rc;
+    struct ftpansbuf ftpans;
+    int             rc;
 
-    rc = write(ftp->sock, buf, count);
-    switch (rc) {
-    case 0:
-	print_debug(ftp, FTP_VERBOSE_MORE, "WRITE: [NOTHING]");
-	break;
-    case -1:
-	print_debug(ftp, FTP_VERBOSE_MORE, "WRITE: %s", strerror(errno));
-	break;
-    default:
-	if (strncmp(buf, "PASS ", 5) == 0) {
-	    print_debug(ftp, FTP_VERBOSE_SOME, "WRITE: PASS ******\n");
-	} else {
-	    print_debug(ftp, FTP_VERBOSE_SOME, "WRITE: %*s",
-			(int) rc, (char *) buf);
+    ftp->cmd.tries = 0;
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    rc = ftp_cmdcontinue_r(ftp, &ftpans);
+    if (ftp_dfthandle_r(ftp, &ftpans, rc, 226) == -1) {
+	switch (ftpans.reply) {
+	case 250:
+	case 426:
+	case 451:
+	    ftp->errnum = FTP_SUCCESS;
+	    return 0;
 	}
+	return -1;
     }
 
-    return rc;
+    return 0;
 }
 
 /*
- * lower level interface to read from the ftp socket, works like "recv(2)"
+ * allocate the local file up to "size" before it is written, so it is not
+ * fragmented and a full disk is found before the transfer. file systems
+ * that cannot are left to allocate as the file is written
  */
-ssize_t
-ftp_recv(struct ftp * ftp, void *buf, size_t len, int flags)
+static int
+ftp_allocate(struct ftp *ftp, int fd, long long offset, long long size)
 {
-    ssize_t         rc;
-    int             errno_;
+    int             rc;
 
-    rc = recv(ftp->sock, buf, len, flags);
-    errno_ = errno;
+    if (size <= offset)
+	return 0;
 
-    switch (rc) {
-    case 0:
-	print_debug(ftp, FTP_VERBOSE_MORE, "RECV: [NOTHING]\n");
-	break;
-    case -1:
-	print_debug(ftp, FTP_VERBOSE_MORE, "RECV: [%s]\n",
-		    strerror(errno));
-	break;
-    }
+    rc = posix_fallocate(fd, offset, size - offset);
+    if (rc == 0 || rc == EOPNOTSUPP || rc == EINVAL)
+	return 0;
 
-    errno = errno_;
-    return rc;
+    errno = rc;
+    ftp->errnum = EFTP_SYSTEM;
+    return -1;
 }
 
 /*
- * lower level interface used by "ftp_continue" and "ftp_continue_r"
+ * download "remotename" of "size" bytes as one byte range per session, the
+ * ranges are read at the same time and written at their offset in
+ * "localfd"
  */
-int
-ftp_recvans(struct ftp *ftp, struct ftpansbuf *ansbuf)
+static int
+ftp_getstriped(struct ftp *ftp, int localfd, char *remotename,
+	       long long size)
 {
-    char            buf[BUFSIZ];
-    ssize_t         recvlen;
+    struct ftp     *sess[FTP_STRIPEMAX];
+    struct pollfd   pfd[FTP_STRIPEMAX];
+    long long       offset[FTP_STRIPEMAX];
+    long long       left[FTP_STRIPEMAX];
+    struct ftpuncache uc[FTP_STRIPEMAX];
+    struct uring   *ring;
+    long long       total;
+    char           *resbuf;
+    ssize_t         reslen;
+    size_t          len;
+    int             nstripes;
+    int             active;
+    int             raw;
+    int             timeout;
+    int             errnum;
+    int             errno_;
     int             rc;
+    int             i;
 
-    recvlen = ftp_recvline(ftp, buf, sizeof(buf));
-    if (recvlen <= 0)
+    nstripes = ftp->stripe.count;
+    if (ftp_openstripes(ftp, nstripes - 1) == -1)
 	return -1;
-    if (recvlen < 4) {
-	ftp->errnum = EFTP_BADRPLY;
-	return -1;
-    }
+
     /*
-     * assume that ftpansbuf.buffer is of size BUFSIZ
+     * the ranges are cut off before the end of the file, so stream mode
+     * it is
      */
+    if (ftp_stream(ftp) == -1)
+	return -1;
 
-    rc = sscanf(buf, "%d", &ansbuf->reply);
-    if (rc == 0 || rc == EOF) {
-	ftp->errnum = EFTP_BADRESP;
+    sess[0] = ftp;
+    for (i = 1; i < nstripes; i++)
+	sess[i] = &ftp->stripe.sessions[i - 1];
+    ring = NULL;
+
+    if (ftp_allocate(ftp, localfd, 0, size) == -1)
+	return -1;
+    resbuf = malloc(ftp->net.bufsiz);
+    if (resbuf == NULL) {
+	ftp->errnum = EFTP_SYSTEM;
 	return -1;
     }
+
     /*
-     * buf = NNNIMMM
-     * NNN = reply status
-     * I   = inditator, "-" for more lines, and " " (space) for single line
-     * MMM = message
+     * the last range takes the remainder
      */
-    ansbuf->continues = (buf[3] == '-');
-    memcpy(ansbuf->buffer, buf + 4, recvlen - 4);
-    ansbuf->buffer[recvlen - 4] = '\0';
+    for (i = 0; i < nstripes; i++) {
+	offset[i] = i * (size / nstripes);
+	left[i] = i == nstripes - 1 ? size - offset[i] : size / nstripes;
+	ftp_uncachestart(ftp, &uc[i], localfd, offset[i], size, 1);
+	pfd[i].fd = -1;
+	pfd[i].events = POLLIN;
+    }
 
-    return 0;
-}
+    errnum = FTP_SUCCESS;
+    raw = 1;
+    for (i = 0; i < nstripes; i++) {
+	pfd[i].fd = ftp_pasv(sess[i]);
+	if (pfd[i].fd == -1)
+	    goto fail;
+
+	rc = ftp_cmd(sess[i], "REST %lld\r\n", offset[i]);
+	if (ftp_dfthandle(sess[i], rc, 350) == -1)
+	    goto fail;
+
+	rc = ftp_cmd(sess[i], "RETR %s\r\n", remotename);
+	if (ftp_dfthandle(sess[i], rc, 150) == -1)
+	    goto fail;
+
+	if (ftp_tlsdata(sess[i], pfd[i].fd) == -1)
+	    goto fail;
+	if (!ftp_dataraw(sess[i], pfd[i].fd, 1))
+	    raw = 0;
+    }
 
-/*
- * read line from ftp socket
- */
-ssize_t
-ftp_recvline(struct ftp * ftp, char *resbuf, size_t ressiz)
-{
-    char            recvbuf[BUFSIZ];
-    char           *pbufnl;
-    char           *ptmp;
-    size_t          nloffset;
-    ssize_t         recvlen;
+    print_debug(ftp, FTP_VERBOSE_SOME, "STRIPE: %s, %lld bytes, %d ways\n",
+		remotename, size, nstripes);
 
     /*
-     * allocate temporary storage
+     * with io_uring every range has a receive and write in flight, they
+     * are all waited for at once. it receives on the sockets themselves
      */
-    if (!ftp->recvline.buffer) {
-	ftp->recvline.size = BUFSIZ;
-	ftp->recvline.buffer = malloc(ftp->recvline.size);
-	if (!ftp->recvline.buffer) {
-	    ftp->errnum = EFTP_SYSTEM;
-	    return -1;
+    total = 0;
+    active = nstripes;
+    if (raw)
+	ring = ftp_uring(ftp);
+    if (ring != NULL && ring->nslots < nstripes)
+	ring = NULL;
+    if (ring != NULL) {
+	for (i = 0; i < nstripes; i++) {
+	    len = ring->bufsiz;
+	    if (left[i] < (long long) len)
+		len = left[i];
+	    if (uring_recvwrite(ring, i, pfd[i].fd, localfd, offset[i],
+				len) == -1) {
+		errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	}
+    }
+    while (active > 0 && ring != NULL) {
+	if (uring_wait(ring, &i, &reslen) == -1) {
+	    errnum = EFTP_SYSTEM;
+	    goto fail;
+	}
+	if (reslen == 0) {
+	    errnum = EFTP_SHORT;
+	    goto fail;
+	}
+
+	offset[i] += reslen;
+	left[i] -= reslen;
+	total += reslen;
+	ftp->stats.datarecv += reslen;
+	ftp_uncache(&uc[i], offset[i], left[i] == 0);
+	ftp_throttle(ftp, reslen);
+
+	if (left[i] == 0) {
+	    ftp_dataclose(sess[i], pfd[i].fd, 0);
+	    pfd[i].fd = -1;
+	    active--;
+	    continue;
+	}
+
+	len = ring->bufsiz;
+	if (left[i] < (long long) len)
+	    len = left[i];
+	if (uring_recvwrite(ring, i, pfd[i].fd, localfd, offset[i], len)
+	    == -1) {
+	    errnum = EFTP_SYSTEM;
+	    goto fail;
 	}
-	ftp->recvline.buffer[0] = '\0';
-	ftp->recvline.end = ftp->recvline.buffer;
     }
+    if (ring != NULL)
+	uring_drain(ring);
+    ring = NULL;
+
+    while (active > 0) {
+	timeout = -1;
+	for (i = 0; i < nstripes; i++)
+	    if (pfd[i].fd != -1 && ftp_datapending(sess[i], pfd[i].fd))
+		timeout = 0;
+	if (poll(pfd, nstripes, timeout) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    errnum = EFTP_SYSTEM;
+	    goto fail;
+	}
+
+	for (i = 0; i < nstripes; i++) {
+	    if (pfd[i].fd == -1 || (pfd[i].revents == 0
+				    && !ftp_datapending(sess[i], pfd[i].fd)))
+		continue;
+
+	    len = ftp->net.bufsiz;
+	    if (left[i] < (long long) len)
+		len = left[i];
+	    reslen = ftp_datarecv(sess[i], pfd[i].fd, resbuf, len);
+	    if (reslen == 0)
+		errnum = EFTP_SHORT;
+	    if (reslen <= 0
+		|| pwrite(localfd, resbuf, reslen, offset[i]) != reslen) {
+		if (errnum == FTP_SUCCESS)
+		    errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+
+	    offset[i] += reslen;
+	    left[i] -= reslen;
+	    total += reslen;
+	    ftp->stats.datarecv += reslen;
+	    ftp_uncache(&uc[i], offset[i], left[i] == 0);
+	    ftp_throttle(ftp, reslen);
 
-    while ((pbufnl = strstr(ftp->recvline.buffer, "\r\n")) == NULL) {
-	recvlen = ftp_recv(ftp, recvbuf, sizeof(recvbuf), 0);
-	if (recvlen == -1) {
 	    /*
-	     * no line ready just yet
+	     * the range is done, the rest of the file is cut off
 	     */
-	    if (errno == EWOULDBLOCK) {
-		ftp->errnum = EFTP_WOULDBLOCK;
-		return 0;
-	    } else {
-		ftp->errnum = EFTP_SYSTEM;
-		return -1;
+	    if (left[i] == 0) {
+		ftp_dataclose(sess[i], pfd[i].fd, 0);
+		pfd[i].fd = -1;
+		active--;
 	    }
 	}
+    }
 
-	/*
-	 * realloc if needed
-	 */
-	while (ftp->recvline.end - ftp->recvline.buffer +
-	       recvlen >= (ssize_t) ftp->recvline.size) {
-	    ftp->recvline.size *= 2;
-	    ptmp = realloc(ftp->recvline.buffer, ftp->recvline.size);
-	    if (!ptmp) {
-		ftp->errnum = EFTP_SYSTEM;
-		return -1;
-	    }
-	    ftp->recvline.end =
-		ptmp + (ftp->recvline.end - ftp->recvline.buffer);
-	    ftp->recvline.buffer = ptmp;
-	}
+    for (i = 0; i < nstripes; i++)
+	if (ftp_retrend(sess[i]) == -1)
+	    goto fail;
 
-	strncpy(ftp->recvline.end, recvbuf, recvlen);
-	ftp->recvline.end[recvlen] = '\0';
-	ftp->recvline.end += recvlen;
+    if (total != size) {
+	errnum = EFTP_SHORT;
+	goto fail;
     }
 
-    nloffset = pbufnl - ftp->recvline.buffer;	/* CR NL */
-    if (nloffset + 1 > ressiz) {
-	ftp->errnum = EFTP_OVERFLOW;
-	return -1;
-    }
+    free(resbuf);
+    return 0;
 
-    strncpy(resbuf, ftp->recvline.buffer, nloffset);
-    resbuf[nloffset] = '\n';	/* CR */
-    resbuf[nloffset + 1] = '\0';	/* NL */
+  fail:
+    errno_ = errno;
+    if (errnum == FTP_SUCCESS)
+	errnum = sess[i]->errnum;
 
-    memmove(ftp->recvline.buffer, pbufnl + 2,
-	    ftp->recvline.end - (pbufnl + 1));
-    if (*ftp->recvline.buffer == '\0') {
-	free(ftp->recvline.buffer);
-	ftp->recvline.buffer = 0;
-    } else {
-	ftp->recvline.end =
-	    ftp->recvline.buffer + (ftp->recvline.end - (pbufnl + 2));
+    /*
+     * the state of the sessions is unknown, the extra ones are opened
+     * again by the next striped download
+     */
+    if (ring != NULL)
+	uring_drain(ring);
+    free(resbuf);
+    for (i = 0; i < nstripes; i++)
+	if (pfd[i].fd != -1)
+	    ftp_dataclose(sess[i], pfd[i].fd, 0);
+    for (i = 0; i < ftp->stripe.nsessions; i++) {
+	ftp_statsadd(&ftp->stats, &ftp->stripe.sessions[i].stats);
+	ftp_close(&ftp->stripe.sessions[i]);
     }
+    ftp->stripe.nsessions = 0;
 
-    print_debug(ftp, FTP_VERBOSE_SOME, "RECVLINE: %s", resbuf);
-    return nloffset + 1;
+    errno = errno_;
+    ftp->errnum = errnum;
+    return -1;
 }
 
 /*
- * store unique file on ftp server.
- * NOTE: remotename can be updated with the actual stored name
+ * receive "remotename" of "size" bytes from "*offset" into "localfd", the
+ * file "localname" or NULL. "*offset" is kept at the number of bytes in
+ * the file. data of MODE Z, or of a "packed" file compressed by gzip, is
+ * inflated as it arrives, "size" of a packed file is its compressed size
  */
-int
-ftp_put(struct ftp *ftp, char *localname, char *remotename)
+static int
+ftp_recvfile(struct ftp *ftp, int localfd, char *localname,
+	     char *remotename, long long size, long long *offset, int packed)
 {
     int             rc;
-    struct ftpansbuf ftpans;
-    int             hostp[4];	/* host IP */
-    int             portp[2];	/* host port */
     int             pasvfd;
-    int             localfd;
-    struct sockaddr_in addr;
-    char            buf[BUFSIZ];
-    char            resbuf[BUFSIZ];
+    unsigned char  *resbuf;
+    unsigned char  *zbuf;
     ssize_t         reslen;
+    long long       journaled;
+    struct ftpuncache uc;
+    struct ftpblock blk;
+    struct uring   *ring;
+    z_stream        zs;
+    int             inflating;
+    int             end;
     int             errno_;
 
-    memset(&ftpans, 0, sizeof(struct ftpansbuf));
-    rc = ftp_cmd_r(ftp, &ftpans, "PASV\r\n");
-    if (ftp_dfthandle_r(ftp, &ftpans, rc, 227) == -1)
+    /*
+     * bytes past the offset are from a transfer that was not journaled
+     */
+    journaled = *offset;
+    if (ftruncate(localfd, *offset) == -1
+	|| lseek(localfd, *offset, SEEK_SET) == -1) {
+	ftp->errnum = EFTP_SYSTEM;
+	return -1;
+    }
+    /*
+     * the size of a packed file says nothing of the size it inflates to
+     */
+    if (!packed && ftp_allocate(ftp, localfd, *offset, size) == -1)
 	return -1;
+    ftp_uncachestart(ftp, &uc, localfd, *offset, size, 1);
 
-    if (sscanf(ftpans.buffer,
-	       "Entering Passive Mode (%d,%d,%d,%d,%d,%d).",
-	       &hostp[0], &hostp[1], &hostp[2], &hostp[3], &portp[0],
-	       &portp[1]) != 6) {
-	ftp->errnum = EFTP_BADRESP;
+    if (*offset > 0 && ftp_stream(ftp) == -1)
 	return -1;
-    }
 
-    pasvfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (pasvfd == -1) {
+    /*
+     * a zlib or gzip header tells which it is
+     */
+    end = 0;
+    inflating = packed || ftp->deflate.on;
+    if (ftp_bufalloc(ftp, &resbuf, &zbuf, inflating) == -1)
+	return -1;
+    memset(&zs, 0, sizeof(z_stream));
+    if (inflating && inflateInit2(&zs, MAX_WBITS + 32) != Z_OK) {
+	free(resbuf);
+	free(zbuf);
+	errno = ENOMEM;
 	ftp->errnum = EFTP_SYSTEM;
 	return -1;
     }
 
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr =
-	(hostp[3] << 24) + (hostp[2] << 16) + (hostp[1] << 8) + hostp[0];
-    addr.sin_port = htons(portp[0] * 256 + portp[1]);
-
-    if (connect(pasvfd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
-	ftp->errnum = EFTP_SYSTEM;
+    pasvfd = ftp_pasv(ftp);
+    if (pasvfd == -1) {
+	free(resbuf);
+	free(zbuf);
+	inflateEnd(&zs);
 	return -1;
     }
 
-    snprintf(buf, sizeof(buf), "STOU %s\r\n", remotename);
-    rc = ftp_write(ftp, buf, strlen(buf));
-
-    localfd = open(localname, O_RDONLY);
-    if (localfd == -1) {
-	ftp->errnum = EFTP_SYSTEM;
-	return -1;
+    memset(&blk, 0, sizeof(struct ftpblock));
+    ring = NULL;
+    if (*offset > 0) {
+	rc = ftp_cmd(ftp, "REST %lld\r\n", *offset);
+	if (ftp_dfthandle(ftp, rc, 350) == -1)
+	    goto fail;
     }
 
     /*
-     * read STOU ack. reply
+     * read RETR ack. reply
      */
-    ftp->cmd.tries = 0;
-    memset(&ftpans, 0, sizeof(struct ftpansbuf));
-    rc = ftp_cmdcontinue_r(ftp, &ftpans);
-    if (ftp_dfthandle_r(ftp, &ftpans, rc, 150) == -1)
-	return -1;
-    if (sscanf(ftpans.buffer, "Sending file to %s", remotename) != 1) {
-	ftp->errnum = EFTP_BADRESP;
-	return -1;
+    rc = ftp_cmd(ftp, "RETR %s\r\n", remotename);
+    if (ftp_dfthandle(ftp, rc, 150) == -1)
+	goto fail;
+
+    /*
+     * io_uring receives on the socket itself and moves the bytes told by
+     * SIZE in stream mode, the end of the data, every block of block mode
+     * and all compressed data is read here
+     */
+    if (ftp_tlsdata(ftp, pasvfd) == -1)
+	goto fail;
+    if (!ftp->block.on && !inflating && *offset < size
+	&& ftp_dataraw(ftp, pasvfd, 1)) {
+	ring = ftp_uring(ftp);
+	if (ring != NULL
+	    && uring_stream(ring, 1, pasvfd, localfd, *offset,
+			    size - *offset) == -1)
+	    ring = NULL;
     }
 
-    do {
-	reslen = read(localfd, resbuf, sizeof(resbuf));
-	if (reslen == -1 || write(pasvfd, resbuf, reslen) != reslen) {
-	    errno_ = errno;
-	    close(pasvfd);
-	    close(localfd);
-	    errno = errno_;
-	    ftp->errnum = EFTP_SYSTEM;
-	    return -1;
+    for (;;) {
+	if (ring != NULL && *offset < size) {
+	    if (uring_next(ring, &reslen) == -1) {
+		ftp->errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	} else {
+	    /*
+	     * a packed file comes in blocks as well when block mode is on
+	     */
+	    if (ftp->block.on)
+		reslen = ftp_blockrecv(ftp, pasvfd, &blk, resbuf,
+				       ftp->net.bufsiz);
+	    else
+		reslen = ftp_datarecv(ftp, pasvfd, resbuf, ftp->net.bufsiz);
+	    if (reslen == -1) {
+		ftp->errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	    if (inflating) {
+		ftp->deflate.wire += reslen;
+		if (ftp_inflatewrite(ftp, &zs, localfd, resbuf, reslen, zbuf,
+				     ftp->net.bufsiz, offset, &end) == -1)
+		    goto fail;
+	    } else if (pwrite(localfd, resbuf, reslen, *offset) != reslen) {
+		ftp->errnum = EFTP_SYSTEM;
+		goto fail;
+	    }
+	}
+	if (reslen == 0)
+	    break;
+	if (!inflating)
+	    *offset += reslen;
+	ftp->stats.datarecv += reslen;
+	ftp_uncache(&uc, *offset, 0);
+	ftp_throttle(ftp, reslen);
+
+	if (*offset - journaled >= FTP_PARTSTEP) {
+	    ftp_partwrite(localname, "get", size, *offset, remotename);
+	    journaled = *offset;
 	}
-    } while (reslen != 0);
+    }
+    ftp_uncache(&uc, *offset, 1);
 
-    close(localfd);
-    close(pasvfd);
+    if (ring != NULL)
+	uring_drain(ring);
+    inflateEnd(&zs);
+    free(resbuf);
+    free(zbuf);
+    ftp_dataclose(ftp, pasvfd, 1);
 
     /*
-     * read STOR ok reply
+     * read RETR reply, a transfer aborted by the server is continued
      */
     ftp->cmd.tries = 0;
     rc = ftp_cmdcontinue(ftp);
+    if (rc > 0 && ((inflating && !end) || (!packed && *offset != size))) {
+	ftp_partwrite(localname, "get", size, *offset, remotename);
+	ftp->errnum = EFTP_SHORT;
+	return -1;
+    }
     if (ftp_dfthandle(ftp, rc, 226) == -1)
 	return -1;
 
     return 0;
+
+  fail:
+    errno_ = errno;
+    if (ring != NULL)
+	uring_drain(ring);
+    inflateEnd(&zs);
+    free(resbuf);
+    free(zbuf);
+    ftp_dataclose(ftp, pasvfd, 0);
+    if (*offset > journaled)
+	ftp_partwrite(localname, "get", size, *offset, remotename);
+    errno = errno_;
+    return -1;
 }
 
 /*
- * download file from server
+ * download "remotename" compressed by "deflate.helper" on the server, it
+ * is inflated into "localfd" as it arrives. the compressed file has no
+ * offsets in common with the local file, so a transfer that breaks off
+ * starts over.
+ * the return value is 0, -1 on error, or 1 when the helper is of no use
+ * and "remotename" is to be downloaded as it is
  */
-int
-ftp_get(struct ftp *ftp, char *localname, char *remotename)
+static int
+ftp_getpacked(struct ftp *ftp, int localfd, char *remotename)
 {
+    char            packed[PATH_MAX];
+    long long       offset;
+    long long       size;
+    int             tries;
     int             rc;
-    struct ftpansbuf ftpans;
-    int             hostp[4];	/* host IP */
-    int             portp[2];	/* host port */
-    int             pasvfd;
-    int             localfd;
-    struct sockaddr_in addr;
-    char            buf[BUFSIZ];
-    char            resbuf[BUFSIZ];
-    ssize_t         reslen;
     int             errno_;
+    int             errnum;
 
-    memset(&ftpans, 0, sizeof(struct ftpansbuf));
-    rc = ftp_cmd_r(ftp, &ftpans, "PASV\r\n");
-    if (ftp_dfthandle_r(ftp, &ftpans, rc, 227) == -1)
-	return -1;
+    /*
+     * only a stream file outside of the libraries is known to QSH
+     */
+    if (*remotename != '/' || strncasecmp(remotename, "/QSYS.LIB/", 10) == 0
+	|| (size_t) snprintf(packed, sizeof(packed), "%s.gz", remotename)
+	>= sizeof(packed))
+	return 1;
 
-    if (sscanf(ftpans.buffer,
-	       "Entering Passive Mode (%d,%d,%d,%d,%d,%d).",
-	       &hostp[0], &hostp[1], &hostp[2], &hostp[3], &portp[0],
-	       &portp[1]) != 6) {
-	ftp->errnum = EFTP_BADRESP;
+    /*
+     * the compressed file is only there when gzip succeeded, any reply of
+     * RCMD is taken as the server having been asked
+     */
+    rc = ftp_cmd(ftp,
+		 "RCMD QSH CMD('%s -c -1 %s >%s.tmp && mv %s.tmp %s')\r\n",
+		 ftp->deflate.helper, remotename, packed, packed, packed);
+    while (rc == 0)
+	rc = ftp_cmdcontinue(ftp);
+    if (rc == -1)
 	return -1;
+
+    size = ftp_size(ftp, packed);
+    if (size == -1) {
+	if (ftp->errnum != EFTP_NOFILE)
+	    return -1;
+	print_debug(ftp, FTP_VERBOSE_SOME, "DEFLATE: no helper %s\n",
+		    ftp->deflate.helper);
+	*ftp->deflate.helper = '\0';
+	return 1;
     }
 
-    pasvfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (pasvfd == -1) {
-	ftp->errnum = EFTP_SYSTEM;
-	return -1;
+    for (tries = 0;; tries++) {
+	offset = 0;
+	if (ftp_recvfile(ftp, localfd, NULL, packed, size, &offset, 1) == 0)
+	    break;
+
+	if (!ftp_resumable(ftp) || tries == FTP_RESUMEMAX
+	    || ftp_reconnect(ftp) == -1)
+	    goto error;
     }
 
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr =
-	(hostp[3] << 24) + (hostp[2] << 16) + (hostp[1] << 8) + hostp[0];
-    addr.sin_port = htons(portp[0] * 256 + portp[1]);
+    print_debug(ftp, FTP_VERBOSE_MORE,
+		"DEFLATE: %s, %lld bytes compressed to %lld bytes\n",
+		remotename, offset, size);
 
-    if (connect(pasvfd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
-	ftp->errnum = EFTP_SYSTEM;
+    rc = ftp_cmd(ftp, "DELE %s\r\n", packed);
+    return ftp_dfthandle(ftp, rc, 250);
+
+  error:
+    /*
+     * the compressed file is removed on the way out, unless the session
+     * is gone. the error of the transfer is the one reported
+     */
+    errno_ = errno;
+    errnum = ftp->errnum;
+    rc = ftp_cmd(ftp, "DELE %s\r\n", packed);
+    ftp_dfthandle(ftp, rc, 250);
+
+    errno = errno_;
+    ftp->errnum = errnum;
+    return -1;
+}
+
+/*
+ * download "remotename" into "localfd", see "ftp_get". only a transfer to
+ * a "localname" is journaled
+ */
+static int
+ftp_getfile(struct ftp *ftp, int localfd, char *localname, char *remotename)
+{
+    char            partremote[PATH_MAX];
+    long long       partsize;
+    long long       offset;
+    long long       size;
+    int             tries;
+    int             rc;
+
+    ftp->deflate.wire = 0;
+    if (ftp->deflate.use && !ftp->deflate.on
+	&& *ftp->deflate.helper != '\0') {
+	rc = ftp_getpacked(ftp, localfd, remotename);
+	if (rc != 1)
+	    return rc;
+    }
+
+    size = ftp_size(ftp, remotename);
+    if (size == -1)
 	return -1;
+
+    /*
+     * compressed data is cut down already, and has no byte ranges
+     */
+    if (ftp->stripe.count > 1 && size >= ftp->stripe.minsize
+	&& size >= ftp->stripe.count && !ftp->deflate.on)
+	return ftp_getstriped(ftp, localfd, remotename, size);
+
+    /*
+     * the journal is only good for the same file of the same size
+     */
+    if (ftp_partread(localname, "get", &partsize, &offset, partremote) != 0
+	|| partsize != size || strcmp(partremote, remotename) != 0
+	|| offset > size)
+	offset = 0;
+
+    for (tries = 0;; tries++) {
+	if (offset > 0)
+	    print_debug(ftp, FTP_VERBOSE_SOME, "RESUME: %s at %lld\n",
+			remotename, offset);
+
+	if (ftp_recvfile(ftp, localfd, localname, remotename, size,
+			 &offset, 0) == 0)
+	    break;
+
+	if (!ftp_resumable(ftp) || tries == FTP_RESUMEMAX
+	    || ftp_reconnect(ftp) == -1)
+	    return -1;
+    }
+
+    if (localname != NULL) {
+	ftp_partname(partremote, sizeof(partremote), localname);
+	unlink(partremote);
     }
+    return 0;
+}
 
-    snprintf(buf, sizeof(buf), "RETR %s\r\n", remotename);
-    rc = ftp_write(ftp, buf, strlen(buf));
+/*
+ * download file from server, a file of at least "stripe.minsize" bytes is
+ * downloaded over "stripe.count" sessions. a transfer that breaks off is
+ * continued with REST on a new session, also when it was left by an
+ * earlier call
+ */
+int
+ftp_get(struct ftp *ftp, char *localname, char *remotename)
+{
+    int             localfd;
+    int             rc;
+    int             errno_;
 
     localfd = open(localname, O_WRONLY);
     if (localfd == -1) {
@@ -718,38 +3660,59 @@ ftp_get(struct ftp *ftp, char *localname, char *remotename)
 	return -1;
     }
 
-    /*
-     * read RETR ack. reply
-     */
-    ftp->cmd.tries = 0;
-    rc = ftp_cmdcontinue(ftp);
-    if (ftp_dfthandle(ftp, rc, 150) == -1)
+    ftp_rateactive(ftp, 1);
+    rc = ftp_getfile(ftp, localfd, localname, remotename);
+    errno_ = errno;
+    ftp_rateactive(ftp, 0);
+    if (close(localfd) == -1 && rc == 0) {
+	ftp->errnum = EFTP_SYSTEM;
 	return -1;
+    }
+    errno = errno_;
+    return rc;
+}
 
-    do {
-	reslen = recv(pasvfd, resbuf, sizeof(resbuf), 0);
-	if (reslen == -1 || write(localfd, resbuf, reslen) != reslen) {
-	    errno_ = errno;
-	    close(pasvfd);
-	    close(localfd);
-	    errno = errno_;
-	    ftp->errnum = EFTP_SYSTEM;
-	    return -1;
-	}
-    } while (reslen != 0);
+/*
+ * like "ftp_get", but download into the empty open file "localfd". the
+ * file is not journaled, so it is only continued within the call
+ */
+int
+ftp_getfd(struct ftp *ftp, int localfd, char *remotename)
+{
+    int             rc;
 
-    close(localfd);
-    close(pasvfd);
+    ftp_rateactive(ftp, 1);
+    rc = ftp_getfile(ftp, localfd, NULL, remotename);
+    ftp_rateactive(ftp, 0);
+    return rc;
+}
 
-    /*
-     * read RETR reply
-     */
-    ftp->cmd.tries = 0;
-    rc = ftp_cmdcontinue(ftp);
-    if (ftp_dfthandle(ftp, rc, 226) == -1)
+/*
+ * get the size of a file on the server.
+ * the return value is the size, or -1 on error. "errnum" is set to
+ * EFTP_NOFILE if the file does not exist
+ */
+long long
+ftp_size(struct ftp *ftp, char *remotename)
+{
+    struct ftpansbuf ftpans;
+    long long       size;
+    int             rc;
+
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    rc = ftp_cmd_r(ftp, &ftpans, "SIZE %s\r\n", remotename);
+    if (ftp_dfthandle_r(ftp, &ftpans, rc, 213) == -1) {
+	if (ftpans.reply == 550)
+	    ftp->errnum = EFTP_NOFILE;
 	return -1;
+    }
 
-    return 0;
+    if (sscanf(ftpans.buffer, "%lld", &size) != 1) {
+	ftp->errnum = EFTP_BADRESP;
+	return -1;
+    }
+
+    return size;
 }
 
 /*
@@ -760,9 +3723,14 @@ ftp_get(struct ftp *ftp, char *localname, char *remotename)
 const char     *
 ftp_strerror(struct ftp *ftp)
 {
+    const char     *reason;
+
     switch (ftp->errnum) {
     case EFTP_SYSTEM:
-	return strerror(errno);
+	return strerror(ftp->syserr != 0 ? ftp->syserr : errno);
+    case EFTP_TLS:
+	reason = ERR_reason_error_string(ERR_peek_last_error());
+	return reason != NULL ? reason : ftp_error_messages[ftp->errnum];
     case EFTP_GAI_BADFLAGS:
 	return gai_strerror(EAI_BADFLAGS);
     case EFTP_GAI_NONAME:
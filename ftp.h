@@ -19,6 +19,12 @@ enum ftp_errors {
     EFTP_WOULDBLOCK,
     EFTP_BADVAR,
     EFTP_NOHOST,
+    EFTP_NOFILE,
+    EFTP_SHORT,
+    EFTP_DISCONNECTED,
+    EFTP_INFLATE,
+    EFTP_NOTLS,
+    EFTP_TLS,
 
     /*
      * system errors
@@ -51,12 +57,133 @@ enum ftp_variable {
     FTP_VAR_PASSWORD,
     FTP_VAR_VERBOSE,
     FTP_VAR_PORT,
-    FTP_VAR_MAXTRIES
+    FTP_VAR_MAXTRIES,
+    FTP_VAR_STRIPES,
+    FTP_VAR_STRIPEMIN,
+    FTP_VAR_UNCACHEDMIN,
+    FTP_VAR_BLOCKMODE,
+    FTP_VAR_DEFLATE,
+    FTP_VAR_DEFLATEHELPER,
+    FTP_VAR_TLS,
+    FTP_VAR_TLSCA,
+    FTP_VAR_TLSVERIFY,
+    FTP_VAR_PIPELINE,
+    FTP_VAR_NODELAY,
+    FTP_VAR_SNDBUF,
+    FTP_VAR_RCVBUF,
+    FTP_VAR_CONGESTION,
+    FTP_VAR_BUFSIZE,
+    FTP_VAR_RATELIMIT
+};
+
+enum ftp_deflate {
+    FTP_DEFLATE_NO = 0,
+    FTP_DEFLATE_YES,
+    FTP_DEFLATE_AUTO		/* the caller turns it on with "ftp_deflate" */
+};
+
+enum ftp_tls {
+    FTP_TLS_NO = 0,
+    FTP_TLS_TRY,		/* when the server agrees to AUTH TLS */
+    FTP_TLS_YES
+};
+
+/*
+ * classes of transfers sharing a "struct ftpshape", the lower the more
+ * urgent
+ */
+enum ftp_priority {
+    FTP_PRIORITY_URGENT = 0,
+    FTP_PRIORITY_BULK
 };
 
 #define FTP_HOSTSIZ	256
 #define FTP_USRSIZ	128
 #define FTP_PASSSIZ	128
+#define FTP_HELPERSIZ	256
+#define FTP_CAFILESIZ	256
+#define FTP_CONGESTIONSIZ	16	/* TCP_CA_NAME_MAX of Linux */
+#define FTP_BUFSIZ	(64 * 1024)	/* bytes moved per read or write of a
+					 * transfer */
+#define FTP_BUFMIN	1024
+#define FTP_BUFMAX	(16 * 1024 * 1024)
+#define FTP_STRIPEMAX	16
+#define FTP_URINGSLOTS	4	/* buffers of a transfer in flight through
+				 * io_uring */
+#define FTP_RESUMEMAX	3	/* new sessions per transfer */
+#define FTP_PARTSTEP	(1024 * 1024)	/* bytes between journal writes */
+#define FTP_UNCACHESTEP	(8 * 1024 * 1024)	/* bytes let out of the cache */
+#define FTP_BLOCKMAX	65535	/* bytes in a block of MODE B */
+#define FTP_BLOCKEOF	64	/* descriptor of the last block of a file */
+#define FTP_BLOCKMARK	16	/* descriptor of a restart marker */
+#define FTP_DEFLATELEVEL	1	/* of the data sent in MODE Z */
+#define FTP_DEFLATEHELPER	"/QOpenSys/pkgs/bin/gzip"
+#define FTP_TLSWAIT	30000	/* milliseconds for a TLS handshake */
+#define FTP_ADDRMAX	16	/* addresses of a host tried by a connect */
+#define FTP_EYEBALLWAIT	250	/* milliseconds before the next address is
+				 * tried as well */
+#define FTP_LOGINMAX	8	/* commands of a login */
+#define FTP_PIPELINEWAIT	5000	/* milliseconds for a reply to a
+					 * pipelined login */
+#define FTP_RECONNECTMAX	5	/* logins tried per reconnect */
+#define FTP_REPLAYMAX	5	/* replays without a reply in between */
+#define FTP_KEEPMAX	24	/* commands kept by "ftp_cmdkeep" */
+#define FTP_KEEPSIZ	256
+#define FTP_RATEBURST	100	/* milliseconds of the rate held by the
+				 * token bucket */
+#define FTP_SHAPEMAX	2	/* processes sharing a "struct ftpshape" */
+#define FTP_SHAPEWAIT	10	/* milliseconds between looks at the more
+				 * urgent transfers */
+#define FTP_VERBMAX	32	/* commands told apart by "struct ftpstats" */
+#define FTP_VERBSIZ	24	/* a command, or RCMD and its CL command */
+#define FTP_LATENCYMAX	16	/* buckets of a latency histogram */
+
+/*
+ * a rate limit shared by the processes of a run, in memory all of them
+ * map. a process only writes its own slot of "active"
+ */
+struct ftpshape {
+    long long       limit;	/* bytes per second, 0 is none */
+    volatile int    active[FTP_SHAPEMAX];	/* "enum ftp_priority" of the
+						 * transfer going on, or -1 */
+};
+
+/*
+ * a histogram of the time replies took. bucket 0 holds those under a
+ * millisecond, bucket i those under 2^i milliseconds, and the last one all
+ * that took longer
+ */
+struct ftplatency {
+    long long       count;
+    double          seconds;	/* of all of them */
+    long long       buckets[FTP_LATENCYMAX];
+};
+
+/*
+ * the replies to one command, timed from when it was sent. a reply can
+ * come in more than one line, and a transfer has a preliminary reply
+ * before its final one
+ */
+struct ftpverb {
+    char            name[FTP_VERBSIZ];	/* "CONNECT" for the greeting */
+    struct ftplatency first;	/* to the first line */
+    struct ftplatency final;	/* to the last line of the final reply */
+};
+
+/*
+ * what a session waited for, see "ftp_stats"
+ */
+struct ftpstats {
+    struct ftpverb  verbs[FTP_VERBMAX];
+    int             nverbs;
+    long long       polls;	/* looks for a reply */
+    long long       wouldblocks;	/* looks that found no line */
+    long long       reconnects;	/* logins tried by "ftp_reconnect" */
+    long long       cmdsent;	/* bytes of the control connection */
+    long long       cmdrecv;
+    long long       datasent;	/* bytes of the transfers */
+    long long       datarecv;
+};
 
 struct ftpserver {
     char            host[FTP_HOSTSIZ];
@@ -68,17 +195,105 @@ struct ftpserver {
 
 struct ftp {
     enum ftp_errors errnum;
+    int             syserr;	/* errno of a login that failed, as the
+				 * sessions log in at the same time */
     enum ftp_verbosity verbosity;
     int             sock;
     struct ftpserver server;
+    int             pipeline;	/* boolean, send the login as one */
+    char            sysname[FTP_HOSTSIZ];	/* empty when not told */
     struct {
 	int             tries;
+	int             verb;	/* in "stats.verbs" of the command waiting
+				 * for its reply, or -1 */
+	int             first;	/* boolean, the first line came */
+	double          since;	/* CLOCK_MONOTONIC seconds of the send */
     } cmd;
     struct {
 	char           *buffer;
 	char           *end;
 	size_t          size;
     } recvline;
+    struct {
+	int             count;	/* sessions per download, 1 is off */
+	long long       minsize;	/* smallest file striped */
+	struct ftp     *sessions;	/* the "count" - 1 extra sessions */
+	int             nsessions;
+    } stripe;
+    struct {
+	long long       minsize;	/* smallest file kept out of the page
+					 * cache, 0 is off */
+    } uncached;
+    struct {
+	int             want;	/* boolean, ask for MODE B at connect */
+	int             on;	/* boolean, the server agreed */
+	int             sock;	/* data connection kept open, or -1 */
+    } block;
+    struct {
+	enum ftp_deflate want;
+	int             use;	/* boolean, compress the transfers */
+	int             on;	/* boolean, the server agreed to MODE Z */
+	char            helper[FTP_HELPERSIZ];	/* gzip on the server,
+						 * empty when there is none */
+	long long       wire;	/* compressed bytes of the last download */
+    } deflate;
+
+    /*
+     * the SSL_CTX and SSL are kept as plain pointers so only ftp.c needs
+     * the OpenSSL headers
+     */
+    struct {
+	enum ftp_tls    want;
+	int             verify;	/* boolean, check the server certificate */
+	char            cafile[FTP_CAFILESIZ];	/* empty for the system CAs */
+	void           *ctx;
+	void           *ssl;	/* control connection, NULL in plain text */
+	void           *data;	/* data connection "datasock", or NULL */
+	int             datasock;
+	int             ktlssend;	/* boolean, the kernel encrypts "data" */
+	int             ktlsrecv;	/* boolean, the kernel decrypts "data" */
+    } tls;
+
+    /*
+     * options of the sockets, 0 or empty leaves the kernel default
+     */
+    struct {
+	int             nodelay;	/* boolean, TCP_NODELAY on the control
+					 * connection */
+	int             sndbuf;	/* SO_SNDBUF */
+	int             rcvbuf;	/* SO_RCVBUF */
+	char            congestion[FTP_CONGESTIONSIZ];	/* TCP_CONGESTION */
+	size_t          bufsiz;	/* bytes moved per read or write of a
+				 * transfer */
+    } net;
+
+    /*
+     * the io_uring of the transfers, set up by the first one and kept
+     * until "ftp_close", only ftp.c needs its header
+     */
+    struct uring   *ring;	/* NULL before the first transfer */
+
+    /*
+     * token bucket of the transfers, the bytes moved are taken out of it
+     */
+    struct {
+	long long       limit;	/* bytes per second of the host, 0 is none */
+	double          tokens;
+	double          last;	/* CLOCK_MONOTONIC seconds of the last
+				 * refill */
+	enum ftp_priority priority;	/* of the transfers that follow */
+	struct ftpshape *shape;	/* NULL when nothing is shared */
+	int             slot;	/* of this process in "shape" */
+    } rate;
+    struct ftpstats stats;
+    struct {
+	char            cmds[FTP_KEEPMAX][FTP_KEEPSIZ];	/* "ftp_cmdkeep" */
+	int             replies[FTP_KEEPMAX];
+	int             n;
+	int             replays;
+	int             logins;	/* logged in again by
+					 * "ftp_reconnect", QTEMP is new */
+    } keep;
 };
 
 /*
@@ -94,6 +309,16 @@ void            ftp_init(struct ftp *);
 void            ftp_close(struct ftp *);
 int             ftp_set_variable(struct ftp *, enum ftp_variable, char *);
 int             ftp_connect(struct ftp *);
+int             ftp_connectall(struct ftp **, int);
+int             ftp_cmdkeep(struct ftp *, int, char *, ...);
+int             ftp_deflate(struct ftp *, int);
+struct ftpshape *ftp_shapenew(long long);
+void            ftp_shapefree(struct ftpshape *);
+void            ftp_shape(struct ftp *, struct ftpshape *, int);
+void            ftp_priority(struct ftp *, enum ftp_priority);
+void            ftp_stats(struct ftp *, struct ftpstats *);
+int             ftp_reconnect(struct ftp *);
+int             ftp_replay(struct ftp *);
 ssize_t         ftp_recvline(struct ftp *, char *, size_t);
 int             ftp_recvans(struct ftp *, struct ftpansbuf *);
 ssize_t         ftp_recv(struct ftp *, void *, size_t, int);
@@ -105,7 +330,11 @@ int             ftp_dfthandle(struct ftp *, int, int);
 int             ftp_dfthandle_r(struct ftp *, struct ftpansbuf *, int,
 				int);
 int             ftp_put(struct ftp *ftp, char *, char *);
+int             ftp_putfd(struct ftp *ftp, int, char *);
 int             ftp_get(struct ftp *ftp, char *, char *);
+int             ftp_getfd(struct ftp *ftp, int, char *);
+int             ftp_unlink(char *);
+long long       ftp_size(struct ftp *, char *);
 ssize_t         ftp_write(struct ftp *, void *, size_t);
 const char     *ftp_strerror(struct ftp *);
 
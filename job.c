@@ -0,0 +1,201 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "job.h"
+
+/*
+ * batch jobs leave two marker files behind, "ok" when all commands
+ * succeeded and "end" when the job is done
+ */
+static void
+markername(char *buf, size_t bufsiz, char *name, char *marker)
+{
+    snprintf(buf, bufsiz, "/tmp/zs-%s.%s", name, marker);
+}
+
+/*
+ * put "n" into "buf" as "len" digits of base 36
+ */
+static void
+base36(char *buf, int len, unsigned long n)
+{
+    static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    while (len-- > 0) {
+	buf[len] = digits[n % 36];
+	n /= 36;
+    }
+}
+
+/*
+ * the tag of the names of this process, random so that the sessions of
+ * other runs, on this client or another, do not pick the same names in the
+ * shared work library and /tmp of the server. a forked process makes a tag
+ * of its own
+ */
+static char    *
+jobtag(void)
+{
+    static char     tag[JOB_TAGLEN + 1];
+    static pid_t    tagpid;
+    struct timespec now;
+    unsigned long   seed;
+    int             fd;
+
+    if (tagpid == getpid())
+	return tag;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    seed = (unsigned long) now.tv_nsec ^ (unsigned long) now.tv_sec
+	^ ((unsigned long) getpid() << 16);
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd != -1) {
+	if (read(fd, &seed, sizeof(seed)) != (ssize_t) sizeof(seed))
+	    seed ^= (unsigned long) now.tv_nsec;
+	close(fd);
+    }
+
+    base36(tag, JOB_TAGLEN, seed);
+    tag[JOB_TAGLEN] = '\0';
+    tagpid = getpid();
+    return tag;
+}
+
+/*
+ * name a job, the name is also used for the save file of the job and its
+ * marker files. the name is "ZS", the tag of the process and "n" in base
+ * 36, unique within the process for "n" below 36^JOB_SEQLEN
+ */
+void
+job_name(char *name, int n)
+{
+    snprintf(name, Z_OBJSIZ, "ZS%s", jobtag());
+    base36(name + 2 + JOB_TAGLEN, JOB_SEQLEN, (unsigned long) n);
+    name[2 + JOB_TAGLEN + JOB_SEQLEN] = '\0';
+}
+
+/*
+ * submit the NULL terminated list of CL commands "cmds" as a batch job to
+ * "jobq". the commands run in order until one of them fails
+ */
+int
+job_submit(struct ftp *ftp, char *jobq, char *name, char **cmds)
+{
+    char            script[BUFSIZ];
+    char            ok[PATH_MAX];
+    char            end[PATH_MAX];
+    size_t          len;
+    int             rc;
+    int             i;
+
+    markername(ok, sizeof(ok), name, "ok");
+    markername(end, sizeof(end), name, "end");
+
+    len = 0;
+    for (i = 0; cmds[i] != NULL; i++) {
+	len += snprintf(script + len, sizeof(script) - len,
+			"system \"%s\" && ", cmds[i]);
+	if (len >= sizeof(script))
+	    break;
+    }
+    if (len < sizeof(script))
+	len += snprintf(script + len, sizeof(script) - len,
+			"touch %s; touch %s", ok, end);
+    if (len >= sizeof(script)) {
+	ftp->errnum = EFTP_OVERFLOW;
+	return -1;
+    }
+
+    rc = ftp_cmd(ftp,
+		 "RCMD SBMJOB CMD(QSH CMD('%s')) JOB(%s) JOBQ(%s)\r\n",
+		 script, name, jobq);
+    return ftp_dfthandle(ftp, rc, 250);
+}
+
+/*
+ * check if the job "name" is done, only a SIZE command is sent.
+ * the return value is:
+ * - JOB_RUNNING, JOB_DONE, or JOB_FAILED
+ * - and -1 on error
+ */
+int
+job_poll(struct ftp *ftp, char *name)
+{
+    char            marker[PATH_MAX];
+
+    markername(marker, sizeof(marker), name, "end");
+    if (ftp_size(ftp, marker) == -1)
+	return ftp->errnum == EFTP_NOFILE ? JOB_RUNNING : -1;
+
+    markername(marker, sizeof(marker), name, "ok");
+    if (ftp_size(ftp, marker) == -1)
+	return ftp->errnum == EFTP_NOFILE ? JOB_FAILED : -1;
+
+    return JOB_DONE;
+}
+
+/*
+ * remove the marker files of a job that is done
+ */
+int
+job_cleanup(struct ftp *ftp, char *name)
+{
+    char            marker[PATH_MAX];
+    int             rc;
+
+    markername(marker, sizeof(marker), name, "ok");
+    rc = ftp_cmd(ftp, "DELETE %s\r\n", marker);
+    ftp_dfthandle(ftp, rc, 250);	/* missing when the job failed */
+
+    markername(marker, sizeof(marker), name, "end");
+    rc = ftp_cmd(ftp, "DELETE %s\r\n", marker);
+    return ftp_dfthandle(ftp, rc, 250);
+}
+
+/*
+ * wait for the next running job in "jobs" to end, its state is updated and
+ * its marker files removed. the return value is the index of the job, or
+ * -1 on error. at least one job must be running
+ */
+int
+job_next(struct ftp *ftp, struct job *jobs, int njobs)
+{
+    int             rc;
+    int             i;
+
+    for (;;) {
+	for (i = 0; i < njobs; i++) {
+	    if (jobs[i].state != JOB_RUNNING)
+		continue;
+
+	    /*
+	     * the jobs run on whether the session is there or not
+	     */
+	    rc = job_poll(ftp, jobs[i].name);
+	    if (rc == -1 && ftp_replay(ftp))
+		rc = job_poll(ftp, jobs[i].name);
+	    if (rc == -1)
+		return -1;
+	    if (rc == JOB_RUNNING)
+		continue;
+
+	    jobs[i].state = rc;
+	    if (job_cleanup(ftp, jobs[i].name) == -1 && !ftp_replay(ftp))
+		return -1;
+	    return i;
+	}
+
+	sleep(1);
+    }
+}
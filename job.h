@@ -0,0 +1,31 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef JOB_H
+#define JOB_H 1
+
+#define JOB_TAGLEN	5	/* base 36 digits of the tag of a process */
+#define JOB_SEQLEN	3	/* base 36 digits of the number of a name */
+
+enum job_state {
+    JOB_RUNNING = 0,
+    JOB_DONE,
+    JOB_FAILED
+};
+
+struct job {
+    char            name[Z_OBJSIZ];	/* job and save file name */
+    char            lib[Z_LIBSIZ];	/* library saved from */
+    char            obj[Z_OBJSIZ];
+    enum job_state  state;
+};
+
+void            job_name(char *, int);
+int             job_submit(struct ftp *, char *, char *, char **);
+int             job_poll(struct ftp *, char *);
+int             job_cleanup(struct ftp *, char *);
+int             job_next(struct ftp *, struct job *, int);
+
+#endif
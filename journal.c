@@ -0,0 +1,254 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "util.h"
+#include "journal.h"
+
+/*
+ * the names follow the index of "enum journal_phase"
+ */
+static char    *journal_phases[] = {
+    [JOURNAL_NONE] = "none",
+    [JOURNAL_SAVED] = "saved",
+    [JOURNAL_FETCHED] = "fetched",
+    [JOURNAL_PUSHED] = "pushed",
+    [JOURNAL_RESTORED] = "restored"
+};
+
+static enum journal_phase
+parsephase(char *name)
+{
+    int             i;
+
+    for (i = JOURNAL_SAVED; i <= JOURNAL_RESTORED; i++)
+	if (strcmp(journal_phases[i], name) == 0)
+	    return i;
+
+    return JOURNAL_NONE;
+}
+
+/*
+ * set the entry of "key" in memory, an object not seen before is added
+ * while there is room
+ */
+static void
+setentry(struct journal *journal, enum journal_phase phase, char *key,
+	 char *lib, char *path, char *part)
+{
+    struct journalentry *ent;
+
+    ent = journal_find(journal, key);
+    if (ent == NULL) {
+	if (journal->n == Z_OBJMAX)
+	    return;
+	ent = &journal->entries[journal->n++];
+	strcpy(ent->key, key);
+    }
+    ent->phase = phase;
+    strcpy(ent->lib, lib);
+    strcpy(ent->path, path);
+    strcpy(ent->part, part);
+}
+
+/*
+ * read the journal of an earlier run, every line is
+ *   <phase> <key> <lib> <path>
+ * and the last line of an object tells its phase. the path is the rest of
+ * the line. a saved object has the local file its download goes to after
+ * the stream file, which zs names without spaces:
+ *   saved <key> <lib> <path> <part>
+ * an empty lib, path or part is written as "-"
+ */
+static int
+readjournal(struct journal *journal)
+{
+    FILE           *fp;
+    char            line[BUFSIZ];
+    char            phase[16];
+    char            key[JOURNAL_KEYSIZ];
+    char            lib[Z_LIBSIZ];
+    char           *path;
+    char           *part;
+    int             n;
+
+    fp = fopen(journal->path, "r");
+    if (fp == NULL)
+	return errno == ENOENT ? 0 : -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "%15s %33s %10s %n", phase, key, lib, &n) != 3
+	    || parsephase(phase) == JOURNAL_NONE)
+	    continue;
+
+	path = line + n;
+	path[strcspn(path, "\n")] = '\0';
+	part = parsephase(phase) == JOURNAL_SAVED ? strchr(path, ' ') : NULL;
+	if (part != NULL)
+	    *part++ = '\0';
+	else
+	    part = "-";
+	if (*path == '\0' || strlen(path) >= PATH_MAX
+	    || strlen(part) >= PATH_MAX)
+	    continue;
+
+	setentry(journal, parsephase(phase), key,
+		 strcmp(lib, "-") == 0 ? "" : lib,
+		 strcmp(path, "-") == 0 ? "" : path,
+		 strcmp(part, "-") == 0 ? "" : part);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * open the journal of the copy from "sourceftp" to "targetlib" on
+ * "targetftp" in the state directory. the journal of an earlier run is
+ * read and continued when "resume" is set, else it is started over
+ */
+int
+journal_open(struct journal *journal, struct ftp *sourceftp,
+	     struct ftp *targetftp, char *targetlib, int resume)
+{
+    char            dir[PATH_MAX];
+    int             rc;
+
+    memset(journal, 0, sizeof(struct journal));
+    journal->fd = -1;
+
+    rc = util_statedir(dir, sizeof(dir));
+    if (rc != 0)
+	return rc;
+
+    if ((size_t) snprintf(journal->path, sizeof(journal->path),
+			  "%s/copy-%s-%s-%s", dir, sourceftp->server.host,
+			  targetftp->server.host, targetlib)
+	>= sizeof(journal->path)) {
+	errno = ENAMETOOLONG;
+	return EUTIL_SYSTEM;
+    }
+
+    if (resume && readjournal(journal) != 0)
+	return EUTIL_SYSTEM;
+
+    /*
+     * the source and target process append to the same file, a line is
+     * written with a single write
+     */
+    journal->fd = open(journal->path, O_WRONLY | O_CREAT | O_APPEND
+		       | (resume ? 0 : O_TRUNC), 0644);
+    if (journal->fd == -1)
+	return EUTIL_SYSTEM;
+
+    return 0;
+}
+
+/*
+ * the key of an object as given on the command line, an object without a
+ * library is "*LIBL/OBJ"
+ */
+void
+journal_key(char *key, struct object *obj)
+{
+    snprintf(key, JOURNAL_KEYSIZ, "%s/%s%s", *obj->lib ? obj->lib : "*LIBL",
+	     obj->obj, obj->type);
+}
+
+struct journalentry *
+journal_find(struct journal *journal, char *key)
+{
+    int             i;
+
+    for (i = 0; i < journal->n; i++)
+	if (strcmp(journal->entries[i].key, key) == 0)
+	    return &journal->entries[i];
+
+    return NULL;
+}
+
+/*
+ * write a line of the journal, and keep the entry of "key" in memory
+ */
+static int
+writeentry(struct journal *journal, enum journal_phase phase, char *key,
+	   char *lib, char *path, char *part)
+{
+    char            line[BUFSIZ];
+    int             len;
+
+    if (journal == NULL || *key == '\0')
+	return 0;
+
+    if (path == NULL)
+	path = "";
+    if (part == NULL)
+	part = "";
+    if (phase == JOURNAL_SAVED)
+	len = snprintf(line, sizeof(line), "%s %s %s %s %s\n",
+		       journal_phases[phase], key, *lib ? lib : "-",
+		       *path ? path : "-", *part ? part : "-");
+    else
+	len = snprintf(line, sizeof(line), "%s %s %s %s\n",
+		       journal_phases[phase], key, *lib ? lib : "-",
+		       *path ? path : "-");
+    if (len < 0 || (size_t) len >= sizeof(line) || strlen(path) >= PATH_MAX
+	|| strlen(part) >= PATH_MAX) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+
+    if (write(journal->fd, line, len) != len)
+	return -1;
+
+    setentry(journal, phase, key, lib, path, part);
+    return 0;
+}
+
+/*
+ * record that the object "key" reached "phase", "path" is where its save
+ * file is now. nothing is recorded without a journal or a key
+ */
+int
+journal_record(struct journal *journal, enum journal_phase phase,
+	       char *key, char *lib, char *path)
+{
+    return writeentry(journal, phase, key, lib, path, NULL);
+}
+
+/*
+ * record that the save file of "key" is the stream file "path" on the
+ * source, and is downloaded into the local file "part" or in memory when
+ * it is NULL. a download that broke off goes on from "part"
+ */
+int
+journal_saved(struct journal *journal, char *key, char *lib, char *path,
+	      char *part)
+{
+    return writeentry(journal, JOURNAL_SAVED, key, lib, path, part);
+}
+
+/*
+ * close the journal, it is removed when "done" is set as there is nothing
+ * left to resume
+ */
+void
+journal_close(struct journal *journal, int done)
+{
+    if (journal->fd != -1)
+	close(journal->fd);
+    journal->fd = -1;
+
+    if (done)
+	unlink(journal->path);
+}
@@ -0,0 +1,51 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H 1
+
+#define JOURNAL_KEYSIZ	(Z_LIBSIZ + Z_OBJSIZ + Z_TYPESIZ + 1)
+
+/*
+ * the phases of an object in order, an object is done once it is restored
+ */
+enum journal_phase {
+    JOURNAL_NONE = 0,
+    JOURNAL_SAVED,		/* save file is a stream file on the source */
+    JOURNAL_FETCHED,		/* save file is a local file */
+    JOURNAL_PUSHED,		/* save file is a stream file on the target */
+    JOURNAL_RESTORED
+};
+
+struct journalentry {
+    char            key[JOURNAL_KEYSIZ];
+    enum journal_phase phase;
+    char            lib[Z_LIBSIZ];	/* library the objects are saved from */
+    char            path[PATH_MAX];	/* where the save file is */
+    char            part[PATH_MAX];	/* local file a saved one goes to */
+};
+
+/*
+ * the append-only record of a "zs copy" run, "entries" holds the last phase
+ * of every object as read by "journal_open" and recorded since
+ */
+struct journal {
+    char            path[PATH_MAX];
+    int             fd;
+    struct journalentry entries[Z_OBJMAX];
+    int             n;
+};
+
+int             journal_open(struct journal *, struct ftp *, struct ftp *,
+			     char *, int);
+void            journal_key(char *, struct object *);
+struct journalentry *journal_find(struct journal *, char *);
+int             journal_record(struct journal *, enum journal_phase, char *,
+			       char *, char *);
+int             journal_saved(struct journal *, char *, char *, char *,
+			      char *);
+void            journal_close(struct journal *, int);
+
+#endif
@@ -13,6 +13,8 @@ char           *program_name;
 
 int             main_copy(int, char **);
 int             main_analyze(int, char **);
+int             main_sync(int, char **);
+int             main_diff(int, char **);
 
 static void
 print_version(void)
@@ -29,6 +31,8 @@ print_help(FILE * fp)
 	    "Available subcommands are:\n"
 	    "  copy     copy objects from one AS/400 to another\n"
 	    "  analyze  print depends and dependencies for objects\n"
+	    "  sync     copy objects changed since the last sync\n"
+	    "  diff     compare the objects of a library on two AS/400s\n"
 	    "\n"
 	    "Available options are:\n"
 	    "  -V       print version information and exit\n"
@@ -98,6 +102,14 @@ main(int argc, char **argv)
 	return main_analyze(argc - 1, argv + 1);
     }
 
+    if (strcmp(argv[1], "sync") == 0) {
+	return main_sync(argc - 1, argv + 1);
+    }
+
+    if (strcmp(argv[1], "diff") == 0) {
+	return main_diff(argc - 1, argv + 1);
+    }
+
     print_help(stderr);
 
     return 2;
@@ -0,0 +1,101 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "job.h"
+#include "qsh.h"
+#include "pool.h"
+
+void
+pool_init(struct pool *pool, char *lib)
+{
+    memset(pool, 0, sizeof(struct pool));
+    strcpy(pool->lib, lib);
+}
+
+/*
+ * get a save file that is not in use, the pool grows by one when all of
+ * them are. the save file is only created on the server when "created" is
+ * not set. NULL is returned when the pool is full
+ */
+struct poolsavf *
+pool_get(struct pool *pool)
+{
+    struct poolsavf *savf;
+    int             i;
+
+    for (i = 0; i < pool->n; i++) {
+	if (!pool->savf[i].busy) {
+	    pool->savf[i].busy = 1;
+	    return &pool->savf[i];
+	}
+    }
+
+    if (pool->n == POOL_MAX)
+	return NULL;
+
+    savf = &pool->savf[pool->n];
+    job_name(savf->name, pool->n);
+    savf->created = 0;
+    savf->busy = 1;
+    pool->n++;
+
+    return savf;
+}
+
+/*
+ * give a save file back to the pool
+ */
+void
+pool_put(struct poolsavf *savf)
+{
+    savf->busy = 0;
+}
+
+/*
+ * delete every save file the pool created, the deletes are sent as a few
+ * scripts instead of one command each
+ */
+int
+pool_free(struct ftp *ftp, struct pool *pool)
+{
+    struct qsh      qsh;
+    int             pending;
+    int             i;
+
+    pending = 0;
+    for (i = 0; i < pool->n; i++) {
+	if (!pool->savf[i].created)
+	    continue;
+
+	if (pending == POOL_DLTFMAX) {
+	    while (qsh_run(ftp, &qsh, 0) == -1)
+		if (!ftp_replay(ftp))
+		    return -1;
+	    pending = 0;
+	}
+	if (pending == 0)
+	    qsh_init(&qsh, pool->savf[i].name);
+
+	qsh_cleanup(&qsh, "DLTF FILE(%s/%s)", pool->lib,
+		    pool->savf[i].name);
+	pending++;
+    }
+
+    /*
+     * a script only deletes, so it can run again in a new session
+     */
+    while (pending > 0 && qsh_run(ftp, &qsh, 0) == -1)
+	if (!ftp_replay(ftp))
+	    return -1;
+
+    pool->n = 0;
+    return 0;
+}
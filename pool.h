@@ -0,0 +1,32 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef POOL_H
+#define POOL_H 1
+
+#define POOL_MAX	Z_OBJMAX
+#define POOL_DLTFMAX	32	/* deletes per script */
+
+struct poolsavf {
+    char            name[Z_OBJSIZ];
+    int             created;	/* boolean */
+    int             busy;	/* boolean */
+};
+
+/*
+ * save files in a work library reused for the whole session
+ */
+struct pool {
+    char            lib[Z_LIBSIZ];
+    struct poolsavf savf[POOL_MAX];
+    int             n;
+};
+
+void            pool_init(struct pool *, char *);
+struct poolsavf *pool_get(struct pool *);
+void            pool_put(struct poolsavf *);
+int             pool_free(struct ftp *, struct pool *);
+
+#endif
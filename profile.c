@@ -0,0 +1,263 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "util.h"
+#include "profile.h"
+
+#define PROFILE_WEIGHT	0.3	/* of a new measurement */
+
+/*
+ * the order is the order levels are tried in, *HIGH first as that was the
+ * only level before
+ */
+static char    *profile_levels[PROFILE_NLEVELS] = {
+    "*HIGH", "*MEDIUM", "*LOW", "*NO"
+};
+
+static struct profilelevel *
+findlevel(struct profile *profile, char *dtacpr)
+{
+    int             i;
+
+    for (i = 0; i < PROFILE_NLEVELS; i++)
+	if (strcmp(profile->levels[i].dtacpr, dtacpr) == 0)
+	    return &profile->levels[i];
+
+    return NULL;
+}
+
+static double
+average(double old, double new, int samples)
+{
+    if (samples == 0 || old <= 0)
+	return new;
+
+    return old * (1 - PROFILE_WEIGHT) + new * PROFILE_WEIGHT;
+}
+
+/*
+ * load the profile of "host" from the state directory, a missing profile
+ * is empty
+ */
+int
+profile_load(struct profile *profile, char *host)
+{
+    struct profilelevel *level;
+    FILE           *fp;
+    char            line[BUFSIZ];
+    char            dtacpr[16];
+    double          saverate,
+                    ratio;
+    int             samples;
+    int             rc;
+    int             i;
+
+    memset(profile, 0, sizeof(struct profile));
+    for (i = 0; i < PROFILE_NLEVELS; i++)
+	profile->levels[i].dtacpr = profile_levels[i];
+
+    rc = util_statedir(profile->path, sizeof(profile->path));
+    if (rc != 0)
+	return rc;
+    i = strlen(profile->path);
+    if ((size_t) snprintf(profile->path + i, sizeof(profile->path) - i,
+			  "/profile-%s", host) >= sizeof(profile->path) - i) {
+	errno = ENAMETOOLONG;
+	return EUTIL_SYSTEM;
+    }
+
+    fp = fopen(profile->path, "r");
+    if (fp == NULL)
+	return errno == ENOENT ? 0 : EUTIL_SYSTEM;
+
+    /*
+     * link RATE
+     * dtacpr LEVEL SAVERATE RATIO SAMPLES
+     */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "link %lf", &profile->linkrate) == 1)
+	    continue;
+	if (sscanf(line, "dtacpr %15s %lf %lf %d", dtacpr, &saverate,
+		   &ratio, &samples) != 4)
+	    continue;
+	level = findlevel(profile, dtacpr);
+	if (level == NULL || saverate <= 0 || ratio <= 0)
+	    continue;
+	level->saverate = saverate;
+	level->ratio = ratio;
+	level->samples = samples;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * replace the stored profile
+ */
+int
+profile_save(struct profile *profile)
+{
+    struct profilelevel *level;
+    FILE           *fp;
+    char            tmppath[PATH_MAX];
+    int             i;
+
+    if ((size_t) snprintf(tmppath, sizeof(tmppath), "%s.tmp", profile->path)
+	>= sizeof(tmppath)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+
+    fp = fopen(tmppath, "w");
+    if (fp == NULL)
+	return -1;
+
+    fprintf(fp, "link %.0f\n", profile->linkrate);
+    for (i = 0; i < PROFILE_NLEVELS; i++) {
+	level = &profile->levels[i];
+	if (level->samples > 0)
+	    fprintf(fp, "dtacpr %s %.0f %.4f %d\n", level->dtacpr,
+		    level->saverate, level->ratio, level->samples);
+    }
+
+    if (fclose(fp) == EOF) {
+	unlink(tmppath);
+	return -1;
+    }
+
+    if (rename(tmppath, profile->path) == -1) {
+	unlink(tmppath);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * choose the DTACPR level with the shortest expected time to save an
+ * object and move it to the target, the save file crosses the network
+ * twice. a level that has not been measured enough is tried first
+ */
+char           *
+profile_choose(struct profile *profile)
+{
+    struct profilelevel *level;
+    char           *best;
+    double          besttime;
+    double          cost;
+    int             i;
+
+    for (i = 0; i < PROFILE_NLEVELS; i++)
+	if (profile->levels[i].samples < PROFILE_MINSAMPLES)
+	    return profile->levels[i].dtacpr;
+
+    if (profile->linkrate <= 0)
+	return profile_levels[0];
+
+    best = NULL;
+    besttime = 0;
+    for (i = 0; i < PROFILE_NLEVELS; i++) {
+	level = &profile->levels[i];
+
+	/*
+	 * seconds per object byte
+	 */
+	cost = 1 / level->saverate + 2 * level->ratio / profile->linkrate;
+	if (best == NULL || cost < besttime) {
+	    best = level->dtacpr;
+	    besttime = cost;
+	}
+    }
+
+    return best;
+}
+
+/*
+ * count an object about to be saved with "dtacpr" and check if the save
+ * should be measured, which needs the size of the object. every level is
+ * measured until it is trusted and then once in a while
+ */
+int
+profile_sample(struct profile *profile, char *dtacpr)
+{
+    struct profilelevel *level;
+
+    profile->nobjs++;
+    level = findlevel(profile, dtacpr);
+    if (level == NULL)
+	return 0;
+
+    return level->samples < PROFILE_MINSAMPLES
+	|| profile->nobjs >= PROFILE_RESAMPLE;
+}
+
+/*
+ * record that an object of "size" bytes was saved with "dtacpr" into a save
+ * file of "savfsize" bytes in "seconds"
+ */
+void
+profile_savesample(struct profile *profile, char *dtacpr, long long size,
+		   long long savfsize, double seconds)
+{
+    struct profilelevel *level;
+
+    level = findlevel(profile, dtacpr);
+    if (level == NULL || size <= 0 || savfsize <= 0 || seconds <= 0)
+	return;
+
+    level->saverate = average(level->saverate, size / seconds,
+			      level->samples);
+    level->ratio = average(level->ratio, (double) savfsize / size,
+			   level->samples);
+    level->samples++;
+    profile->nobjs = 0;
+}
+
+/*
+ * record that "bytes" of a save file were transferred in "seconds"
+ */
+void
+profile_linksample(struct profile *profile, long long bytes, double seconds)
+{
+    if (bytes <= 0 || seconds <= 0)
+	return;
+
+    profile->linkrate = average(profile->linkrate, bytes / seconds,
+				profile->linkrate > 0);
+}
+
+/*
+ * check if the link is measured and slow enough for the transfers to be
+ * compressed, "profile" may be NULL
+ */
+int
+profile_slowlink(struct profile *profile)
+{
+    return profile != NULL && profile->linkrate > 0
+	&& profile->linkrate < PROFILE_SLOWLINK;
+}
+
+/*
+ * get the seconds elapsed since "start" on the monotonic clock
+ */
+double
+profile_elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+	+ (now.tv_nsec - start->tv_nsec) / 1e9;
+}
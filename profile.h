@@ -0,0 +1,41 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef PROFILE_H
+#define PROFILE_H 1
+
+#define PROFILE_NLEVELS		4
+#define PROFILE_MINSAMPLES	2	/* per level before it is trusted */
+#define PROFILE_RESAMPLE	16	/* objects between samples */
+#define PROFILE_SLOWLINK	(4.0 * 1024 * 1024)	/* bytes a second */
+
+/*
+ * what a DTACPR level costs on a host, rates are in bytes a second
+ */
+struct profilelevel {
+    char           *dtacpr;
+    double          saverate;	/* object bytes saved */
+    double          ratio;	/* save file size / object size */
+    int             samples;
+};
+
+struct profile {
+    char            path[PATH_MAX];
+    double          linkrate;	/* save file bytes transferred */
+    struct profilelevel levels[PROFILE_NLEVELS];
+    int             nobjs;	/* objects since the last sample */
+};
+
+int             profile_load(struct profile *, char *);
+int             profile_save(struct profile *);
+char           *profile_choose(struct profile *);
+int             profile_sample(struct profile *, char *);
+void            profile_savesample(struct profile *, char *, long long,
+				   long long, double);
+void            profile_linksample(struct profile *, long long, double);
+int             profile_slowlink(struct profile *);
+double          profile_elapsed(struct timespec *);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "qsh.h"
+
+/*
+ * a script runs its steps in order until one of them fails, a step is one
+ * or more CL commands that are tried in order until one of them succeeds.
+ * every step writes the line "zs: <step> <rc> <command>" to the log of the
+ * script, everything else in the log are the messages from the commands.
+ * the cleanup commands always run last
+ */
+static char     qsh_prologue[] =
+    "L=%s; rm -f $L; "
+    "s() { n=$1; shift; a=0; for c in \"$@\"; do a=$((a+1)); "
+    "system \"$c\" >>$L 2>&1; r=$?; test $r = 0 && break; done; "
+    "echo \"zs: $n $r $a\" >>$L; return $r; }; ";
+
+static void
+vappend(struct qsh *qsh, char *buf, size_t *len, char *format, va_list ap)
+{
+    int             rc;
+
+    if (qsh->overflow)
+	return;
+
+    rc = vsnprintf(buf + *len, QSH_CMDMAX - *len, format, ap);
+    if (rc < 0 || (size_t) rc >= QSH_CMDMAX - *len) {
+	qsh->overflow = 1;
+	return;
+    }
+    *len += rc;
+}
+
+static void
+append(struct qsh *qsh, char *buf, size_t *len, char *format, ...)
+{
+    va_list         ap;
+
+    va_start(ap, format);
+    vappend(qsh, buf, len, format, ap);
+    va_end(ap);
+}
+
+/*
+ * start an empty script, "name" makes the log unique
+ */
+void
+qsh_init(struct qsh *qsh, char *name)
+{
+    memset(qsh, 0, sizeof(struct qsh));
+    snprintf(qsh->log, sizeof(qsh->log), "/tmp/zs-%s.log", name);
+}
+
+/*
+ * add a step running the CL command given by "format"
+ */
+void
+qsh_step(struct qsh *qsh, char *format, ...)
+{
+    va_list         ap;
+
+    if (qsh->nsteps == QSH_STEPMAX) {
+	qsh->overflow = 1;
+	return;
+    }
+    qsh->nsteps++;
+
+    append(qsh, qsh->body, &qsh->bodylen, "%ss %d \"",
+	   qsh->nsteps > 1 ? " && " : "", qsh->nsteps);
+    va_start(ap, format);
+    vappend(qsh, qsh->body, &qsh->bodylen, format, ap);
+    va_end(ap);
+    append(qsh, qsh->body, &qsh->bodylen, "\"");
+}
+
+/*
+ * add a CL command to the last step, it is tried when the commands before
+ * it in the step failed
+ */
+void
+qsh_alt(struct qsh *qsh, char *format, ...)
+{
+    va_list         ap;
+
+    append(qsh, qsh->body, &qsh->bodylen, " \"");
+    va_start(ap, format);
+    vappend(qsh, qsh->body, &qsh->bodylen, format, ap);
+    va_end(ap);
+    append(qsh, qsh->body, &qsh->bodylen, "\"");
+}
+
+/*
+ * add a CL command run after the steps, whether they succeeded or not
+ */
+void
+qsh_cleanup(struct qsh *qsh, char *format, ...)
+{
+    va_list         ap;
+
+    append(qsh, qsh->cleanup, &qsh->cleanuplen, "system \"");
+    va_start(ap, format);
+    vappend(qsh, qsh->cleanup, &qsh->cleanuplen, format, ap);
+    va_end(ap);
+    append(qsh, qsh->cleanup, &qsh->cleanuplen, "\" >/dev/null 2>&1; ");
+}
+
+/*
+ * add a CL command run after the steps, only when they all succeeded
+ */
+void
+qsh_cleanupok(struct qsh *qsh, char *format, ...)
+{
+    va_list         ap;
+
+    append(qsh, qsh->cleanup, &qsh->cleanuplen, "test $r = 0 && system \"");
+    va_start(ap, format);
+    vappend(qsh, qsh->cleanup, &qsh->cleanuplen, format, ap);
+    va_end(ap);
+    append(qsh, qsh->cleanup, &qsh->cleanuplen, "\" >/dev/null 2>&1; ");
+}
+
+/*
+ * make QSH end with an escape message when a script fails, so the failure
+ * is seen in the reply to RCMD. this is done once per session, and again
+ * when the session is logged in again
+ */
+int
+qsh_setup(struct ftp *ftp)
+{
+    return ftp_cmdkeep(ftp, 250,
+		       "RCMD ADDENVVAR ENVVAR(QIBM_QSH_CMD_ESCAPE_MSG) VALUE(Y) REPLACE(*YES)\r\n");
+}
+
+/*
+ * run the script with one RCMD, the log is removed when the script
+ * succeeded unless "keeplog" is set.
+ * the return value is:
+ * - 0 when every step succeeded,
+ * - 1 when a step failed, see "qsh_status",
+ * - and -1 on error
+ */
+int
+qsh_run(struct ftp *ftp, struct qsh *qsh, int keeplog)
+{
+    struct ftpansbuf ftpans;
+    char            script[QSH_CMDMAX];
+    char            cmd[QSH_CMDMAX];
+    size_t          len;
+    size_t          i,
+                    j;
+    int             rc;
+
+    len = 0;
+    append(qsh, script, &len, qsh_prologue, qsh->log);
+    append(qsh, script, &len, "%s; r=$?; %s",
+	   qsh->nsteps > 0 ? qsh->body : ":", qsh->cleanup);
+    if (!keeplog)
+	append(qsh, script, &len, "test $r = 0 && rm -f $L; ");
+    append(qsh, script, &len, "exit $r");
+
+    /*
+     * the script is a CL string, quotes are doubled
+     */
+    for (i = 0, j = 0; i < len && j < sizeof(cmd) - 2; i++) {
+	if (script[i] == '\'')
+	    cmd[j++] = '\'';
+	cmd[j++] = script[i];
+    }
+    if (qsh->overflow || i < len) {
+	ftp->errnum = EFTP_OVERFLOW;
+	return -1;
+    }
+    cmd[j] = '\0';
+
+    memset(&ftpans, 0, sizeof(struct ftpansbuf));
+    rc = ftp_cmd_r(ftp, &ftpans, "RCMD QSH CMD('%s')\r\n", cmd);
+    if (ftp_dfthandle_r(ftp, &ftpans, rc, 250) == -1)
+	return ftpans.reply == 550 ? 1 : -1;
+
+    return 0;
+}
+
+/*
+ * read the log of a script that has run, the status of every step that ran
+ * is put in "status" and the messages in "msgs". the log is removed.
+ * the return value is the number of steps that ran, or -1 on error
+ */
+int
+qsh_status(struct ftp *ftp, struct qsh *qsh, struct qshstatus *status,
+	   char *msgs, size_t msgsiz)
+{
+    struct qshstatus st;
+    FILE           *fp;
+    char            localname[PATH_MAX];
+    char            line[BUFSIZ];
+    size_t          len;
+    int             fd;
+    int             n;
+    int             rc;
+
+    strcpy(localname, "/tmp/zs-XXXXXX");
+    fd = mkstemp(localname);
+    if (fd == -1) {
+	print_error("failed to create output file: %s\n", strerror(errno));
+	return -1;
+    }
+    close(fd);
+
+    if (ftp_get(ftp, localname, qsh->log) != 0) {
+	print_error("failed to get script log: %s\n", ftp_strerror(ftp));
+	ftp_unlink(localname);
+	return -1;
+    }
+
+    rc = ftp_cmd(ftp, "DELETE %s\r\n", qsh->log);
+    if (ftp_dfthandle(ftp, rc, 250) != 0) {
+	print_error("failed to remove script log: %s\n", ftp_strerror(ftp));
+	unlink(localname);
+	return -1;
+    }
+
+    fp = fopen(localname, "r");
+    unlink(localname);
+    if (fp == NULL) {
+	print_error("failed to open script log: %s\n", strerror(errno));
+	return -1;
+    }
+
+    n = 0;
+    len = 0;
+    if (msgsiz > 0)
+	*msgs = '\0';
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "zs: %d %d %d", &st.step, &st.rc, &st.alt) == 3) {
+	    if (st.step >= 1 && st.step <= QSH_STEPMAX) {
+		status[st.step - 1] = st;
+		if (st.step > n)
+		    n = st.step;
+	    }
+	} else if (len + strlen(line) < msgsiz) {
+	    strcpy(msgs + len, line);
+	    len += strlen(line);
+	}
+    }
+
+    fclose(fp);
+    return n;
+}
@@ -0,0 +1,41 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef QSH_H
+#define QSH_H 1
+
+#define QSH_CMDMAX	5000	/* maximum length of QSH CMD(...) */
+#define QSH_STEPMAX	8
+
+/*
+ * the status line written by a script for each step it ran
+ */
+struct qshstatus {
+    int             step;	/* starting at 1 */
+    int             rc;		/* exit status of the last command tried */
+    int             alt;	/* the command that ended the step, at 1 */
+};
+
+struct qsh {
+    char            log[PATH_MAX];	/* remote log of the script */
+    char            body[QSH_CMDMAX];
+    size_t          bodylen;
+    char            cleanup[QSH_CMDMAX];
+    size_t          cleanuplen;
+    int             nsteps;
+    int             overflow;	/* boolean */
+};
+
+void            qsh_init(struct qsh *, char *);
+void            qsh_step(struct qsh *, char *, ...);
+void            qsh_alt(struct qsh *, char *, ...);
+void            qsh_cleanup(struct qsh *, char *, ...);
+void            qsh_cleanupok(struct qsh *, char *, ...);
+int             qsh_setup(struct ftp *);
+int             qsh_run(struct ftp *, struct qsh *, int);
+int             qsh_status(struct ftp *, struct qsh *, struct qshstatus *,
+			   char *, size_t);
+
+#endif
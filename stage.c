@@ -0,0 +1,343 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * for memfd_create, the save files are kept on disk where it is missing
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "stage.h"
+
+void
+stage_init(struct stage *stage)
+{
+    memset(stage, 0, sizeof(struct stage));
+    stage->ack = -1;
+}
+
+/*
+ * add a directory to spread the save files over, the return value is -1
+ * when there are too many
+ */
+int
+stage_adddir(struct stage *stage, char *dir)
+{
+    if (stage->ndirs == STAGE_DIRMAX) {
+	errno = E2BIG;
+	return -1;
+    }
+
+    snprintf(stage->dirs[stage->ndirs], PATH_MAX, "%s", dir);
+    stage->ndirs++;
+    return 0;
+}
+
+/*
+ * wait for the target process to be done with a save file.
+ * the return value is 0, or -1 when the target process is gone
+ */
+static int
+waitack(struct stage *stage)
+{
+    char            line[32];
+    size_t          len;
+    ssize_t         rc;
+    long long       size;
+    int             inmem;
+
+    if (stage->ack == -1)
+	return -1;
+
+    for (len = 0; len < sizeof(line) - 1; len++) {
+	do
+	    rc = read(stage->ack, line + len, 1);
+	while (rc == -1 && errno == EINTR);
+	if (rc != 1) {
+	    stage->ack = -1;
+	    return -1;
+	}
+	if (line[len] == '\n')
+	    break;
+    }
+    line[len] = '\0';
+
+    /*
+     * the sizes are only counted while save files are pending, so a size
+     * that is off cannot hold up the source for good
+     */
+    if (sscanf(line, "%lld %d", &size, &inmem) != 2)
+	size = inmem = 0;
+    if (inmem)
+	stage->memused -= size;
+    else
+	stage->used -= size;
+    if (--stage->pending <= 0 || stage->used < 0 || stage->memused < 0) {
+	stage->pending = 0;
+	stage->used = 0;
+	stage->memused = 0;
+    }
+    return 0;
+}
+
+/*
+ * take in the acks already sent by the target process, without waiting
+ */
+static void
+drainacks(struct stage *stage)
+{
+    struct pollfd   pfd;
+
+    while (stage->pending > 0 && stage->ack != -1) {
+	pfd.fd = stage->ack;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) != 1 || waitack(stage) == -1)
+	    break;
+    }
+}
+
+/*
+ * the next directory in turn with room for "size" bytes, or NULL
+ */
+static char    *
+pickdir(struct stage *stage, long long size)
+{
+    struct statvfs st;
+    char           *dir;
+    int             i;
+
+    if (stage->ndirs == 0)
+	return STAGE_DIR;
+
+    for (i = 0; i < stage->ndirs; i++) {
+	dir = stage->dirs[(stage->next + i) % stage->ndirs];
+	if (statvfs(dir, &st) == -1)
+	    continue;
+	if ((long long) st.f_bavail * (long long) st.f_frsize < size)
+	    continue;
+
+	stage->next = (stage->next + i + 1) % stage->ndirs;
+	return dir;
+    }
+
+    return NULL;
+}
+
+/*
+ * create an empty local file for a save file of "size" bytes, its name is
+ * put in "localname". this blocks while the save files not yet done by the
+ * target process leave no room in the budget, or on any of the
+ * directories. a save file larger than the budget is let through once
+ * there is nothing else.
+ * the return value is 0, or -1 on error
+ */
+int
+stage_create(struct stage *stage, char *localname, size_t localsiz,
+	     long long size)
+{
+    char           *dir;
+    int             fd;
+
+    drainacks(stage);
+    for (;;) {
+	if (stage->budget == 0 || stage->pending == 0
+	    || stage->used + size <= stage->budget) {
+	    dir = pickdir(stage, size);
+	    if (dir != NULL)
+		break;
+
+	    /*
+	     * the directories are full of something else
+	     */
+	    if (stage->pending == 0) {
+		errno = ENOSPC;
+		return -1;
+	    }
+	}
+
+	/*
+	 * nothing is freed once the target process is gone
+	 */
+	if (waitack(stage) == -1) {
+	    stage->pending = 0;
+	    stage->used = 0;
+	}
+    }
+
+    if ((size_t) snprintf(localname, localsiz, "%s/zs-XXXXXX", dir)
+	>= localsiz) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+
+    /*
+     * only the guarantee that "localname" is unique is important
+     */
+    fd = mkstemp(localname);
+    if (fd == -1)
+	return -1;
+    close(fd);
+
+    return 0;
+}
+
+/*
+ * create a file in memory for a save file of "size" bytes, when it fits in
+ * what is left of "memsize". this never waits, the save file goes to disk
+ * instead.
+ * the return value is the file descriptor, or -1 when the save file is not
+ * kept in memory
+ */
+int
+stage_memfd(struct stage *stage, long long size)
+{
+#ifdef MFD_CLOEXEC
+    drainacks(stage);
+    if (stage->memused + size > stage->memsize)
+	return -1;
+
+    return memfd_create("zs-savf", MFD_CLOEXEC);
+#else
+    (void) stage;
+    (void) size;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * count the save file "localname", or the one in memory "fd" when it is
+ * not -1, as handed to the target process
+ */
+void
+stage_handoff(struct stage *stage, char *localname, int fd)
+{
+    struct stat     st;
+
+    stage->pending++;
+    if (fd != -1) {
+	if (fstat(fd, &st) == 0)
+	    stage->memused += st.st_size;
+    } else if (stat(localname, &st) == 0) {
+	stage->used += st.st_size;
+    }
+}
+
+/*
+ * send the line "buf" of "len" bytes to the other process on the socket
+ * "sock", along with the file descriptor "fd" unless it is -1
+ */
+int
+stage_send(int sock, char *buf, size_t len, int fd)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    union {
+	char            buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr  align;
+    } ctl;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd != -1) {
+	memset(&ctl, 0, sizeof(ctl));
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t) len)
+	return -1;
+
+    return 0;
+}
+
+/*
+ * receive a line sent with "stage_send" into "buf", it is terminated. "fd"
+ * is set to the file descriptor sent along, or -1.
+ * the return value is the length of the line, 0 when the other process is
+ * done, or -1 on error
+ */
+ssize_t
+stage_recv(int sock, char *buf, size_t bufsiz, int *fd)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    ssize_t         len;
+    union {
+	char            buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr  align;
+    } ctl;
+
+    *fd = -1;
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov.iov_base = buf;
+    iov.iov_len = bufsiz - 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    do
+	len = recvmsg(sock, &msg, 0);
+    while (len == -1 && errno == EINTR);
+    if (len == -1)
+	return -1;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	 cmsg = CMSG_NXTHDR(&msg, cmsg))
+	if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+	if (*fd != -1)
+	    close(*fd);
+	*fd = -1;
+	errno = EMSGSIZE;
+	return -1;
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+/*
+ * tell the source process the target process is done with a save file of
+ * "size" bytes, "inmem" is set when it was in memory
+ */
+int
+stage_ack(int ack, long long size, int inmem)
+{
+    char            line[32];
+    int             len;
+
+    len = snprintf(line, sizeof(line), "%lld %d\n", size, inmem);
+    if (write(ack, line, len) != len)
+	return -1;
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef STAGE_H
+#define STAGE_H 1
+
+#define STAGE_DIRMAX	8
+#define STAGE_DIR	"/tmp"	/* when no directory is given */
+
+/*
+ * the local save files handed to the target process, they are kept in
+ * memory while they fit in "memsize" bytes, else they are spread over
+ * "dirs" in turn and take up at most "budget" bytes at once. the target
+ * process tells when it is done with a save file on the pipe "ack"
+ */
+struct stage {
+    char            dirs[STAGE_DIRMAX][PATH_MAX];
+    int             ndirs;
+    int             next;	/* directory of the next save file */
+    long long       budget;	/* bytes, 0 = unbounded */
+    long long       used;	/* bytes handed over and not done yet */
+    long long       memsize;	/* bytes, 0 = never in memory */
+    long long       memused;	/* bytes in memory and not done yet */
+    int             pending;	/* save files handed over and not done yet */
+    int             ack;	/* -1 once the target process is gone */
+};
+
+void            stage_init(struct stage *);
+int             stage_adddir(struct stage *, char *);
+int             stage_create(struct stage *, char *, size_t, long long);
+int             stage_memfd(struct stage *, long long);
+void            stage_handoff(struct stage *, char *, int);
+int             stage_send(int, char *, size_t, int);
+ssize_t         stage_recv(int, char *, size_t, int *);
+int             stage_ack(int, long long, int);
+
+#endif
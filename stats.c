@@ -0,0 +1,354 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * for MAP_ANONYMOUS
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "ftp.h"
+#include "zs.h"
+#include "profile.h"
+#include "stats.h"
+
+/*
+ * the names of "enum stats_phase" in the statistics written
+ */
+static char    *stats_phases[STATS_NPHASES] = {
+    [STATS_SAVE] = "save",
+    [STATS_DSPPGMREF] = "dsppgmref",
+    [STATS_CPYTOSTMF] = "cpytostmf",
+    [STATS_CPYTOIMPF] = "cpytoimpf",
+    [STATS_DOWNLOAD] = "download",
+    [STATS_UPLOAD] = "upload",
+    [STATS_RESTORE] = "restore",
+    [STATS_CLEANUP] = "cleanup"
+};
+
+/*
+ * start the statistics of a run, to be written to "path". the records are
+ * shared with the processes forked after, each takes a slot of its own.
+ * the return value is 0, or -1 on error
+ */
+int
+stats_open(struct stats *stats, char *path)
+{
+    memset(stats, 0, sizeof(struct stats));
+    if (strlen(path) >= sizeof(stats->path)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    strcpy(stats->path, path);
+
+    stats->shared = mmap(NULL, sizeof(struct statsshared),
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			 -1, 0);
+    if (stats->shared == MAP_FAILED) {
+	stats->shared = NULL;
+	return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stats->start);
+    return 0;
+}
+
+void
+stats_close(struct stats *stats)
+{
+    if (stats->shared != NULL)
+	munmap(stats->shared, sizeof(struct statsshared));
+    stats->shared = NULL;
+}
+
+/*
+ * find the record of "name" in "recs", it is added when it is missing and
+ * there is room for "max"
+ */
+static struct statsrec *
+findrec(struct statsrec *recs, int *nrecs, int max, char *name)
+{
+    int             i;
+
+    for (i = *nrecs - 1; i >= 0; i--)
+	if (strcmp(recs[i].name, name) == 0)
+	    return &recs[i];
+
+    if (*nrecs == max)
+	return NULL;
+
+    memset(&recs[*nrecs], 0, sizeof(struct statsrec));
+    snprintf(recs[*nrecs].name, STATS_NAMESIZ, "%s", name);
+    return &recs[(*nrecs)++];
+}
+
+/*
+ * add a run of "phase" for the object "name" that took "seconds" and moved
+ * "bytes". nothing is recorded when "stats" is NULL
+ */
+void
+stats_record(struct stats *stats, char *name, enum stats_phase phase,
+	     double seconds, long long bytes)
+{
+    struct statsrec *rec;
+
+    if (stats == NULL || stats->shared == NULL)
+	return;
+
+    rec = findrec(stats->shared->recs[stats->slot],
+		  &stats->shared->nrecs[stats->slot], STATS_RECMAX, name);
+    if (rec == NULL)
+	return;
+
+    rec->seconds[phase] += seconds;
+    rec->bytes[phase] += bytes;
+    rec->runs[phase]++;
+}
+
+/*
+ * keep the statistics of the ftp session of this process, taken from
+ * "ftp" as it is now. nothing is kept when "stats" is NULL
+ */
+void
+stats_ftp(struct stats *stats, struct ftp *ftp)
+{
+    if (stats == NULL || stats->shared == NULL)
+	return;
+
+    snprintf(stats->shared->hosts[stats->slot], FTP_HOSTSIZ, "%s",
+	     ftp->server.host);
+    ftp_stats(ftp, &stats->shared->ftp[stats->slot]);
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+    double          x = *(const double *) a;
+    double          y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * the "pct" percentile of the sorted "vals", by the nearest rank
+ */
+static double
+percentile(double *vals, int n, int pct)
+{
+    int             rank;
+
+    rank = (n * pct + 99) / 100;
+    return vals[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * print "s" as a JSON string
+ */
+static void
+jsonstr(FILE *fp, char *s)
+{
+    putc('"', fp);
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\')
+	    putc('\\', fp);
+	if ((unsigned char) *s >= 0x20)
+	    putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * print the latency histogram "lat" of a command as "name"
+ */
+static void
+jsonlatency(FILE *fp, char *name, struct ftplatency *lat)
+{
+    int             b;
+
+    fprintf(fp, "\"%s\": {\"count\": %lld, \"seconds\": %.6f, "
+	    "\"buckets\": [", name, lat->count, lat->seconds);
+    for (b = 0; b < FTP_LATENCYMAX; b++)
+	fprintf(fp, "%s%lld", b > 0 ? ", " : "", lat->buckets[b]);
+    fprintf(fp, "]}");
+}
+
+/*
+ * print the statistics of the ftp sessions of the slots that have one
+ */
+static void
+jsonsessions(FILE *fp, struct statsshared *shared)
+{
+    struct ftpstats *ftp;
+    char           *sep;
+    int             slot;
+    int             i;
+
+    fprintf(fp, "  \"sessions\": [");
+    for (slot = 0, sep = ""; slot < STATS_SLOTMAX; slot++) {
+	if (shared->hosts[slot][0] == '\0')
+	    continue;
+	ftp = &shared->ftp[slot];
+
+	fprintf(fp, "%s\n    {\"host\": ", sep);
+	jsonstr(fp, shared->hosts[slot]);
+	fprintf(fp, ", \"polls\": %lld, \"wouldblocks\": %lld, "
+		"\"reconnects\": %lld,\n     \"cmdsent\": %lld, "
+		"\"cmdrecv\": %lld, \"datasent\": %lld, \"datarecv\": %lld,"
+		"\n     \"commands\": {", ftp->polls, ftp->wouldblocks,
+		ftp->reconnects, ftp->cmdsent, ftp->cmdrecv, ftp->datasent,
+		ftp->datarecv);
+	for (i = 0; i < ftp->nverbs; i++) {
+	    fprintf(fp, "%s\n       ", i > 0 ? "," : "");
+	    jsonstr(fp, ftp->verbs[i].name);
+	    fprintf(fp, ": {");
+	    jsonlatency(fp, "first", &ftp->verbs[i].first);
+	    fprintf(fp, ", ");
+	    jsonlatency(fp, "final", &ftp->verbs[i].final);
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "%s}}", ftp->nverbs > 0 ? "\n     " : "");
+	sep = ",";
+    }
+    fprintf(fp, "%s],\n", *sep != '\0' ? "\n  " : "");
+}
+
+/*
+ * print a record of every object, a summary of every phase that ran and
+ * the ftp sessions
+ */
+static void
+writejson(FILE *fp, char *command, double seconds, struct statsrec *recs,
+	  int nrecs, double *vals, struct statsshared *shared)
+{
+    double          total;
+    long long       bytes;
+    long long       allbytes;
+    int             n;
+    int             i,
+                    p;
+    char           *sep;
+
+    fprintf(fp, "{\n  \"command\": ");
+    jsonstr(fp, command);
+    fprintf(fp, ",\n  \"objects\": [");
+    for (i = 0; i < nrecs; i++) {
+	fprintf(fp, "%s\n    {\"name\": ", i > 0 ? "," : "");
+	jsonstr(fp, recs[i].name);
+	fprintf(fp, ", \"phases\": {");
+	for (p = 0, sep = ""; p < STATS_NPHASES; p++) {
+	    if (recs[i].runs[p] == 0)
+		continue;
+	    fprintf(fp, "%s\"%s\": {\"runs\": %d, \"seconds\": %.6f, "
+		    "\"bytes\": %lld}", sep, stats_phases[p],
+		    recs[i].runs[p], recs[i].seconds[p], recs[i].bytes[p]);
+	    sep = ", ";
+	}
+	fprintf(fp, "}}");
+    }
+    fprintf(fp, "%s],\n  \"phases\": {", nrecs > 0 ? "\n  " : "");
+
+    /*
+     * the save file of an object is the same bytes in every phase that
+     * moves it, the run counts them once
+     */
+    allbytes = 0;
+    for (i = 0; i < nrecs; i++) {
+	bytes = 0;
+	for (p = 0; p < STATS_NPHASES; p++)
+	    if (recs[i].bytes[p] > bytes)
+		bytes = recs[i].bytes[p];
+	allbytes += bytes;
+    }
+
+    for (p = 0, sep = ""; p < STATS_NPHASES; p++) {
+	total = 0;
+	bytes = 0;
+	for (i = 0, n = 0; i < nrecs; i++) {
+	    if (recs[i].runs[p] == 0)
+		continue;
+	    vals[n++] = recs[i].seconds[p];
+	    total += recs[i].seconds[p];
+	    bytes += recs[i].bytes[p];
+	}
+	if (n == 0)
+	    continue;
+	qsort(vals, n, sizeof(double), cmpdouble);
+
+	fprintf(fp, "%s\n    \"%s\": {\"count\": %d, \"total\": %.6f, "
+		"\"p50\": %.6f, \"p95\": %.6f, \"max\": %.6f, "
+		"\"bytes\": %lld, \"throughput\": %.0f}", sep,
+		stats_phases[p], n, total, percentile(vals, n, 50),
+		percentile(vals, n, 95), vals[n - 1], bytes,
+		total > 0 ? bytes / total : 0);
+	sep = ",";
+    }
+    fprintf(fp, "%s},\n", *sep != '\0' ? "\n  " : "");
+    jsonsessions(fp, shared);
+
+    fprintf(fp, "  \"seconds\": %.6f,\n  \"bytes\": %lld,\n"
+	    "  \"throughput\": %.0f\n}\n", seconds, allbytes,
+	    seconds > 0 ? allbytes / seconds : 0);
+}
+
+/*
+ * write the statistics of the run "command" to "stats->path" as JSON, the
+ * records of all slots are joined by object. throughputs are in bytes a
+ * second.
+ * the return value is 0, or -1 on error
+ */
+int
+stats_write(struct stats *stats, char *command)
+{
+    struct statsrec *recs;
+    struct statsrec *rec;
+    double         *vals;
+    FILE           *fp;
+    int             nrecs;
+    int             slot;
+    int             rc;
+    int             i,
+                    p;
+
+    recs = malloc(sizeof(struct statsrec) * STATS_SLOTMAX * STATS_RECMAX);
+    vals = malloc(sizeof(double) * STATS_SLOTMAX * STATS_RECMAX);
+    if (recs == NULL || vals == NULL) {
+	free(recs);
+	free(vals);
+	return -1;
+    }
+
+    nrecs = 0;
+    for (slot = 0; slot < STATS_SLOTMAX; slot++) {
+	for (i = 0; i < stats->shared->nrecs[slot]; i++) {
+	    rec = findrec(recs, &nrecs, STATS_SLOTMAX * STATS_RECMAX,
+			  stats->shared->recs[slot][i].name);
+	    for (p = 0; p < STATS_NPHASES; p++) {
+		rec->seconds[p] += stats->shared->recs[slot][i].seconds[p];
+		rec->bytes[p] += stats->shared->recs[slot][i].bytes[p];
+		rec->runs[p] += stats->shared->recs[slot][i].runs[p];
+	    }
+	}
+    }
+
+    rc = -1;
+    fp = fopen(stats->path, "w");
+    if (fp != NULL) {
+	writejson(fp, command, profile_elapsed(&stats->start), recs, nrecs,
+		  vals, stats->shared);
+	rc = fclose(fp) == 0 ? 0 : -1;
+    }
+
+    free(recs);
+    free(vals);
+    return rc;
+}
@@ -0,0 +1,65 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef STATS_H
+#define STATS_H 1
+
+#define STATS_SLOTMAX	2	/* processes of a run */
+#define STATS_RECMAX	1024	/* objects per process */
+#define STATS_NAMESIZ	(Z_LIBSIZ + Z_OBJSIZ + Z_TYPESIZ + 1)
+
+/*
+ * the phases an object goes through, see "stats_phases" for their names
+ */
+enum stats_phase {
+    STATS_SAVE = 0,		/* SAVOBJ, with CPYTOSTMF when in one script */
+    STATS_DSPPGMREF,
+    STATS_CPYTOSTMF,
+    STATS_CPYTOIMPF,
+    STATS_DOWNLOAD,		/* RETR */
+    STATS_UPLOAD,		/* STOU, with CPYFRMSTMF for a batch restore */
+    STATS_RESTORE,		/* CPYFRMSTMF and RSTOBJ */
+    STATS_CLEANUP,		/* DLTF of an outfile */
+    STATS_NPHASES
+};
+
+/*
+ * the time and bytes of the phases of one object, a phase can run more
+ * than once
+ */
+struct statsrec {
+    char            name[STATS_NAMESIZ];
+    double          seconds[STATS_NPHASES];
+    long long       bytes[STATS_NPHASES];
+    int             runs[STATS_NPHASES];
+};
+
+/*
+ * the records of a run, in memory all of its processes map. a process only
+ * writes the records of its own slot, and the statistics of its ftp
+ * session, "hosts" is empty for a slot without one
+ */
+struct statsshared {
+    struct statsrec recs[STATS_SLOTMAX][STATS_RECMAX];
+    int             nrecs[STATS_SLOTMAX];
+    char            hosts[STATS_SLOTMAX][FTP_HOSTSIZ];
+    struct ftpstats ftp[STATS_SLOTMAX];
+};
+
+struct stats {
+    char            path[PATH_MAX];	/* written by "stats_write" */
+    struct statsshared *shared;
+    int             slot;	/* of this process */
+    struct timespec start;
+};
+
+int             stats_open(struct stats *, char *);
+void            stats_close(struct stats *);
+void            stats_record(struct stats *, char *, enum stats_phase,
+			     double, long long);
+void            stats_ftp(struct stats *, struct ftp *);
+int             stats_write(struct stats *, char *);
+
+#endif
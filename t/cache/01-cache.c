@@ -0,0 +1,184 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include "../config.h"
+#include "../../cache.h"
+
+#define KEYA	"HOST:21|LIB/OBJA*PGM|2018-01-01-00.00.00.000000|V7R1M0"
+#define KEYB	"HOST:21|LIB/OBJB*PGM|2018-01-01-00.00.00.000000|V7R1M0"
+#define KEYC	"HOST:21|LIB/OBJC*PGM|2018-01-01-00.00.00.000000|V7R1M0"
+
+static char     tmpdir[] = "/tmp/zs-test-XXXXXX";
+
+/*
+ * write "len" bytes of "c" to "path"
+ */
+static void
+writefile(char *path, int c, size_t len)
+{
+    char            buf[100];
+    int             fd;
+
+    assert(len <= sizeof(buf));
+    memset(buf, c, len);
+
+    /*
+     * a hit is a link to the cache, it is not written through
+     */
+    unlink(path);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert(fd != -1);
+    assert(write(fd, buf, len) == (ssize_t) len);
+    close(fd);
+}
+
+/*
+ * whether "path" holds "len" bytes of "c"
+ */
+static int
+isfile(char *path, int c, size_t len)
+{
+    char            buf[200];
+    ssize_t         got;
+    ssize_t         i;
+    int             fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+	return 0;
+    got = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    if (got != (ssize_t) len)
+	return 0;
+    for (i = 0; i < got; i++)
+	if (buf[i] != c)
+	    return 0;
+    return 1;
+}
+
+/*
+ * the number of save files in the cache, each is set "age" seconds old
+ * unless it is 0
+ */
+static int
+cachefiles(struct cache *cache, time_t age)
+{
+    struct timespec times[2];
+    struct dirent  *dent;
+    char            path[PATH_MAX + NAME_MAX + 2];
+    DIR            *dir;
+    size_t          len;
+    int             n;
+
+    dir = opendir(cache->dir);
+    assert(dir != NULL);
+    n = 0;
+    while ((dent = readdir(dir)) != NULL) {
+	len = strlen(dent->d_name);
+	if (len < 5 || strcmp(dent->d_name + len - 5, ".savf") != 0)
+	    continue;
+
+	/*
+	 * the name is the hash of the key
+	 */
+	assert(len == 16 + 5);
+	n++;
+	if (age == 0)
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", cache->dir, dent->d_name);
+	times[0].tv_sec = times[1].tv_sec = time(NULL) - age;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+    }
+    closedir(dir);
+    return n;
+}
+
+int
+main(void)
+{
+    struct cache    cache;
+    char            localname[PATH_MAX];
+    char            cmd[PATH_MAX + 16];
+    int             fd;
+
+    assert(mkdtemp(tmpdir) != NULL);
+    snprintf(localname, sizeof(localname), "%s/savf", tmpdir);
+    memset(&cache, 0, sizeof(cache));
+    snprintf(cache.dir, sizeof(cache.dir), "%s/cache", tmpdir);
+    cache.maxsize = 250;
+
+    /*
+     * a miss, the cache directory is made by the first store
+     */
+    assert(cache_lookup(&cache, KEYA, localname) == 1);
+
+    writefile(localname, 'a', 100);
+    assert(cache_store(&cache, KEYA, localname) == 0);
+    writefile(localname, 'b', 100);
+    assert(cache_store(&cache, KEYB, localname) == 0);
+    assert(cachefiles(&cache, 0) == 2);
+
+    /*
+     * a hit replaces the local file with the save file of the key
+     */
+    unlink(localname);
+    assert(cache_lookup(&cache, KEYA, localname) == 0);
+    assert(isfile(localname, 'a', 100));
+    assert(cache_lookup(&cache, KEYB, localname) == 0);
+    assert(isfile(localname, 'b', 100));
+
+    /*
+     * the same key stores over the entry before it
+     */
+    writefile(localname, 'B', 100);
+    assert(cache_store(&cache, KEYB, localname) == 0);
+    assert(cachefiles(&cache, 0) == 2);
+    assert(cache_lookup(&cache, KEYB, localname) == 0);
+    assert(isfile(localname, 'B', 100));
+
+    /*
+     * the least recently used entry is evicted once the cache is too
+     * large, a lookup counts as a use
+     */
+    assert(cachefiles(&cache, 1000) == 2);
+    assert(cache_lookup(&cache, KEYA, localname) == 0);
+    writefile(localname, 'c', 100);
+    fd = open(localname, O_RDONLY);
+    assert(fd != -1);
+    assert(cache_storefd(&cache, KEYC, fd) == 0);
+    close(fd);
+    assert(cachefiles(&cache, 0) == 2);
+    assert(cache_lookup(&cache, KEYB, localname) == 1);
+    assert(cache_lookup(&cache, KEYA, localname) == 0);
+    assert(isfile(localname, 'a', 100));
+    assert(cache_lookup(&cache, KEYC, localname) == 0);
+    assert(isfile(localname, 'c', 100));
+
+    /*
+     * no limit keeps everything
+     */
+    cache.maxsize = 0;
+    writefile(localname, 'b', 100);
+    assert(cache_store(&cache, KEYB, localname) == 0);
+    assert(cachefiles(&cache, 0) == 3);
+
+    snprintf(cmd, sizeof(cmd), "rm -r %s", tmpdir);
+    assert(system(cmd) == 0);
+
+    return 0;
+}
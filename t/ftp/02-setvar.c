@@ -6,6 +6,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 #include "../config.h"
 #include "../../ftp.h"
@@ -41,5 +42,114 @@ main(void)
     assert(ftp_set_variable(&ftp, FTP_VAR_MAXTRIES, "500") == 0);
     assert(ftp.server.maxtries == 500);
 
+    assert(ftp.stripe.count == 1);
+    assert(ftp_set_variable(&ftp, FTP_VAR_STRIPES, "4") == 0);
+    assert(ftp.stripe.count == 4);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_STRIPES, "0") == 0);
+    assert(ftp.stripe.count == 1);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_STRIPES, "100") == 0);
+    assert(ftp.stripe.count == FTP_STRIPEMAX);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_STRIPEMIN, "1048576") == 0);
+    assert(ftp.stripe.minsize == 1048576);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_UNCACHEDMIN, "0") == 0);
+    assert(ftp.uncached.minsize == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_UNCACHEDMIN, "1073741824") == 0);
+    assert(ftp.uncached.minsize == 1073741824);
+
+    assert(ftp.block.want == 1);
+    assert(ftp_set_variable(&ftp, FTP_VAR_BLOCKMODE, "no") == 0);
+    assert(ftp.block.want == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_BLOCKMODE, "yes") == 0);
+    assert(ftp.block.want == 1);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_BLOCKMODE, "0") == 0);
+    assert(ftp.block.want == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_BLOCKMODE, "1") == 0);
+    assert(ftp.block.want == 1);
+
+    assert(ftp.deflate.want == FTP_DEFLATE_AUTO);
+    assert(ftp_set_variable(&ftp, FTP_VAR_DEFLATE, "yes") == 0);
+    assert(ftp.deflate.want == FTP_DEFLATE_YES);
+    assert(ftp.deflate.use == 1);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_DEFLATE, "no") == 0);
+    assert(ftp.deflate.want == FTP_DEFLATE_NO);
+    assert(ftp.deflate.use == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_DEFLATE, "1") == 0);
+    assert(ftp.deflate.want == FTP_DEFLATE_YES);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_DEFLATE, "auto") == 0);
+    assert(ftp.deflate.want == FTP_DEFLATE_AUTO);
+    assert(ftp.deflate.use == 0);
+
+    assert(strcmp(ftp.deflate.helper, FTP_DEFLATEHELPER) == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_DEFLATEHELPER,
+			    "/usr/bin/gzip") == 0);
+    assert(strcmp(ftp.deflate.helper, "/usr/bin/gzip") == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_DEFLATEHELPER, "") == 0);
+    assert(strcmp(ftp.deflate.helper, "") == 0);
+
+    assert(ftp.pipeline == 1);
+    assert(ftp_set_variable(&ftp, FTP_VAR_PIPELINE, "no") == 0);
+    assert(ftp.pipeline == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_PIPELINE, "yes") == 0);
+    assert(ftp.pipeline == 1);
+
+    assert(ftp.net.nodelay == 1);
+    assert(ftp_set_variable(&ftp, FTP_VAR_NODELAY, "no") == 0);
+    assert(ftp.net.nodelay == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_NODELAY, "1") == 0);
+    assert(ftp.net.nodelay == 1);
+
+    assert(ftp.net.sndbuf == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_SNDBUF, "4194304") == 0);
+    assert(ftp.net.sndbuf == 4194304);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_SNDBUF, "99999999999") == 0);
+    assert(ftp.net.sndbuf == INT_MAX);
+
+    assert(ftp.net.rcvbuf == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_RCVBUF, "4194304") == 0);
+    assert(ftp.net.rcvbuf == 4194304);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_RCVBUF, "99999999999") == 0);
+    assert(ftp.net.rcvbuf == INT_MAX);
+
+    assert(ftp.net.bufsiz == FTP_BUFSIZ);
+    assert(ftp_set_variable(&ftp, FTP_VAR_BUFSIZE, "262144") == 0);
+    assert(ftp.net.bufsiz == 262144);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_BUFSIZE, "1") == 0);
+    assert(ftp.net.bufsiz == FTP_BUFMIN);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_BUFSIZE, "1073741824") == 0);
+    assert(ftp.net.bufsiz == FTP_BUFMAX);
+
+    assert(strcmp(ftp.net.congestion, "") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_CONGESTION, "bbr") == 0);
+    assert(strcmp(ftp.net.congestion, "bbr") == 0);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_CONGESTION,
+			    "abcdefghijklmnopqrstuvwxyz") == 0);
+    assert(strlen(ftp.net.congestion) == FTP_CONGESTIONSIZ - 1);
+
+    assert(ftp.rate.limit == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_RATELIMIT, "1048576") == 0);
+    assert(ftp.rate.limit == 1048576);
+
+    assert(ftp_set_variable(&ftp, FTP_VAR_RATELIMIT, "-5") == 0);
+    assert(ftp.rate.limit == 0);
+
     return 0;
 }
@@ -0,0 +1,292 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * explicit TLS against a local stand-in for the server, which needs no
+ * AS/400. the stand-in runs in a child process with a certificate made up
+ * for the test
+ */
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+#include "../config.h"
+#include "../../ftp.h"
+
+#define DATASIZ	(300 * 1024)
+
+static SSL_CTX *ctx;
+static char     stored[DATASIZ];
+static size_t   storedlen;
+
+/*
+ * a self signed certificate for 127.0.0.1, written to "certname" for the
+ * client to check against
+ */
+static void
+makecert(char *certname)
+{
+    EVP_PKEY       *key;
+    X509           *cert;
+    X509_EXTENSION *ext;
+    X509V3_CTX      v3;
+    FILE           *fp;
+    int             fd;
+
+    assert((key = EVP_EC_gen("P-256")) != NULL);
+    assert((cert = X509_new()) != NULL);
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN",
+			       MBSTRING_ASC, (unsigned char *) "zstest",
+			       -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    X509V3_set_ctx(&v3, cert, cert, NULL, NULL, 0);
+    assert((ext = X509V3_EXT_conf_nid(NULL, &v3, NID_subject_alt_name,
+				      "IP:127.0.0.1")) != NULL);
+    X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+    assert(X509_sign(cert, key, EVP_sha256()) > 0);
+
+    assert((ctx = SSL_CTX_new(TLS_server_method())) != NULL);
+    assert(SSL_CTX_use_certificate(ctx, cert) == 1);
+    assert(SSL_CTX_use_PrivateKey(ctx, key) == 1);
+
+    strcpy(certname, "/tmp/zstest-XXXXXX");
+    assert((fd = mkstemp(certname)) != -1);
+    assert((fp = fdopen(fd, "w")) != NULL);
+    assert(PEM_write_X509(fp, cert) == 1);
+    assert(fclose(fp) == 0);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+static int
+listenlocal(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t       len;
+    int             fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(fd, 1) == 0);
+    len = sizeof(addr);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &len) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void
+reply(int fd, SSL *ssl, char *line)
+{
+    if (ssl != NULL)
+	SSL_write(ssl, line, strlen(line));
+    else
+	write(fd, line, strlen(line));
+}
+
+static int
+readline(int fd, SSL *ssl, char *line, size_t siz)
+{
+    size_t          len;
+
+    for (len = 0; len < siz - 1; len++) {
+	if ((ssl != NULL ? SSL_read(ssl, line + len, 1)
+	     : read(fd, line + len, 1)) != 1)
+	    return -1;
+	if (line[len] == '\n')
+	    break;
+    }
+    line[len] = '\0';
+    return 0;
+}
+
+/*
+ * accept the data connection and protect it, as the server does after the
+ * 150 reply
+ */
+static SSL     *
+acceptdata(int pasvfd)
+{
+    SSL            *ssl;
+    int             fd;
+
+    assert((fd = accept(pasvfd, NULL, NULL)) != -1);
+    close(pasvfd);
+    assert((ssl = SSL_new(ctx)) != NULL);
+    SSL_set_fd(ssl, fd);
+    assert(SSL_accept(ssl) == 1);
+    return ssl;
+}
+
+static void
+closedata(SSL *ssl)
+{
+    int             fd;
+
+    fd = SSL_get_fd(ssl);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+static void
+standin(int ctlfd)
+{
+    char            line[BUFSIZ];
+    char            buf[BUFSIZ];
+    SSL            *ssl;
+    SSL            *data;
+    int             fd;
+    int             pasvfd;
+    int             port;
+    int             rc;
+
+    assert((fd = accept(ctlfd, NULL, NULL)) != -1);
+    ssl = NULL;
+    pasvfd = -1;
+    reply(fd, ssl, "220 zs test stand-in\r\n");
+
+    while (readline(fd, ssl, line, sizeof(line)) == 0) {
+	if (strncmp(line, "AUTH TLS", 8) == 0) {
+	    reply(fd, ssl, "234 Security environment established.\r\n");
+	    assert((ssl = SSL_new(ctx)) != NULL);
+	    SSL_set_fd(ssl, fd);
+	    assert(SSL_accept(ssl) == 1);
+	} else if (ssl == NULL) {
+	    reply(fd, ssl, "530 TLS first.\r\n");
+	} else if (strncmp(line, "USER", 4) == 0) {
+	    reply(fd, ssl, "331 Enter password.\r\n");
+	} else if (strncmp(line, "PASS", 4) == 0) {
+	    reply(fd, ssl, "230 logged on.\r\n");
+	} else if (strncmp(line, "PBSZ", 4) == 0
+		   || strncmp(line, "PROT P", 6) == 0
+		   || strncasecmp(line, "TYPE", 4) == 0) {
+	    reply(fd, ssl, "200 OK.\r\n");
+	} else if (strncmp(line, "SIZE", 4) == 0) {
+	    snprintf(buf, sizeof(buf), "213 %zu\r\n", storedlen);
+	    reply(fd, ssl, buf);
+	} else if (strncmp(line, "PASV", 4) == 0) {
+	    pasvfd = listenlocal(&port);
+	    snprintf(buf, sizeof(buf),
+		     "227 Entering Passive Mode (127,0,0,1,%d,%d).\r\n",
+		     port >> 8, port & 0xff);
+	    reply(fd, ssl, buf);
+	} else if (strncmp(line, "STOU", 4) == 0) {
+	    reply(fd, ssl, "150 Sending file to /tmp/zstest1\r\n");
+	    data = acceptdata(pasvfd);
+	    storedlen = 0;
+	    while ((rc = SSL_read(data, stored + storedlen,
+				 sizeof(stored) - storedlen)) > 0)
+		storedlen += rc;
+	    closedata(data);
+	    reply(fd, ssl, "226 File transfer completed successfully.\r\n");
+	} else if (strncmp(line, "RETR", 4) == 0) {
+	    reply(fd, ssl, "150 Retrieving file.\r\n");
+	    data = acceptdata(pasvfd);
+	    assert(SSL_write(data, stored, storedlen) == (int) storedlen);
+	    closedata(data);
+	    reply(fd, ssl, "226 File transfer completed successfully.\r\n");
+	} else {
+	    reply(fd, ssl, "504 Not supported.\r\n");
+	}
+    }
+
+    exit(0);
+}
+
+int
+main(void)
+{
+    struct ftp      ftp;
+    char            certname[PATH_MAX];
+    char            localname[PATH_MAX];
+    char            remotename[PATH_MAX];
+    char            sport[16];
+    char            got[DATASIZ];
+    int             ctlfd;
+    int             port;
+    int             fd;
+    int             status;
+    pid_t           pid;
+    size_t          i;
+
+    makecert(certname);
+    ctlfd = listenlocal(&port);
+    assert((pid = fork()) != -1);
+    if (pid == 0) {
+	signal(SIGPIPE, SIG_IGN);
+	standin(ctlfd);
+    }
+    close(ctlfd);
+
+    ftp_init(&ftp);
+    snprintf(sport, sizeof(sport), "%d", port);
+    assert(ftp_set_variable(&ftp, FTP_VAR_HOST, "127.0.0.1") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_PORT, sport) == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_USER, "zstest") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_PASSWORD, "zstest") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_VERBOSE, AS400_VERBOSITY) == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_TLS, "yes") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_TLSCA, certname) == 0);
+
+    assert(ftp_connect(&ftp) == 0);
+    assert(ftp.tls.ssl != NULL);
+
+    /*
+     * a file through both directions of the data connection
+     */
+    strcpy(localname, "/tmp/zstest-XXXXXX");
+    assert((fd = mkstemp(localname)) != -1);
+    for (i = 0; i < DATASIZ; i++)
+	got[i] = (char) (i * 7 + i / 251);
+    assert(write(fd, got, DATASIZ) == DATASIZ);
+    assert(close(fd) == 0);
+
+    strcpy(remotename, "/tmp/zstest");
+    assert(ftp_put(&ftp, localname, remotename) == 0);
+    assert(strcmp(remotename, "/tmp/zstest1") == 0);
+
+    assert(truncate(localname, 0) == 0);
+    assert(ftp_get(&ftp, localname, remotename) == 0);
+
+    memset(got, 0, sizeof(got));
+    assert((fd = open(localname, O_RDONLY)) != -1);
+    assert(read(fd, got, DATASIZ) == DATASIZ);
+    assert(close(fd) == 0);
+    for (i = 0; i < DATASIZ; i++)
+	assert(got[i] == (char) (i * 7 + i / 251));
+
+    ftp_close(&ftp);
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    assert(unlink(localname) == 0);
+    assert(unlink(certname) == 0);
+
+    return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * block mode against a local stand-in for the server, which needs no
+ * AS/400. the stand-in checks the blocks it is sent, and sends its own
+ * with a restart marker in between. a server that refuses MODE B is
+ * spoken to in stream mode
+ */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../config.h"
+#include "../../ftp.h"
+
+#define DATASIZ	(300 * 1024)
+
+static unsigned char stored[DATASIZ];
+static size_t   storedlen;
+
+static int
+listenlocal(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t       len;
+    int             fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(fd, 1) == 0);
+    len = sizeof(addr);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &len) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void
+reply(int fd, char *line)
+{
+    assert(write(fd, line, strlen(line)) == (ssize_t) strlen(line));
+}
+
+static int
+readline(int fd, char *line, size_t siz)
+{
+    size_t          len;
+
+    for (len = 0; len < siz - 1; len++) {
+	if (read(fd, line + len, 1) != 1)
+	    return -1;
+	if (line[len] == '\n')
+	    break;
+    }
+    line[len] = '\0';
+    return 0;
+}
+
+static void
+readall(int fd, void *buf, size_t len)
+{
+    ssize_t         rc;
+    size_t          got;
+
+    for (got = 0; got < len; got += rc)
+	assert((rc = read(fd, (char *) buf + got, len - got)) > 0);
+}
+
+static void
+sendblock(int fd, int desc, unsigned char *buf, size_t len)
+{
+    unsigned char   hdr[3];
+
+    hdr[0] = desc;
+    hdr[1] = len >> 8;
+    hdr[2] = len & 0xff;
+    assert(write(fd, hdr, sizeof(hdr)) == sizeof(hdr));
+    if (len > 0)
+	assert(write(fd, buf, len) == (ssize_t) len);
+}
+
+/*
+ * the blocks of a file sent by zs: data blocks of at most FTP_BLOCKMAX
+ * bytes, and an empty one with the EOF descriptor to end the file
+ */
+static void
+recvblocks(int fd)
+{
+    unsigned char   hdr[3];
+    size_t          len;
+
+    storedlen = 0;
+    for (;;) {
+	readall(fd, hdr, sizeof(hdr));
+	len = (hdr[1] << 8) | hdr[2];
+	if (hdr[0] == FTP_BLOCKEOF) {
+	    assert(len == 0);
+	    return;
+	}
+	assert(hdr[0] == 0);
+	assert(len > 0 && len <= FTP_BLOCKMAX);
+	assert(storedlen + len <= sizeof(stored));
+	readall(fd, stored + storedlen, len);
+	storedlen += len;
+    }
+}
+
+/*
+ * a short block, a restart marker, full blocks and a last block that
+ * holds data and the EOF descriptor both
+ */
+static void
+sendblocks(int fd)
+{
+    unsigned char   mark[8];
+    size_t          off;
+    size_t          len;
+
+    sendblock(fd, 0, stored, 1000);
+    memset(mark, '0', sizeof(mark));
+    sendblock(fd, FTP_BLOCKMARK, mark, sizeof(mark));
+    for (off = 1000; off < storedlen; off += len) {
+	len = storedlen - off < FTP_BLOCKMAX ? storedlen - off : FTP_BLOCKMAX;
+	sendblock(fd, off + len == storedlen ? FTP_BLOCKEOF : 0,
+		  stored + off, len);
+    }
+}
+
+/*
+ * serve one session, "blockmode" tells whether MODE B is agreed to. the
+ * data connection of block mode is kept, so only one PASV is expected
+ */
+static void
+standin(int ctlfd, int blockmode)
+{
+    char            line[BUFSIZ];
+    char            buf[BUFSIZ];
+    int             fd;
+    int             pasvfd;
+    int             datafd;
+    int             npasv;
+    int             block;
+    int             port;
+    ssize_t         rc;
+
+    assert((fd = accept(ctlfd, NULL, NULL)) != -1);
+    pasvfd = -1;
+    datafd = -1;
+    npasv = 0;
+    block = 0;
+    reply(fd, "220 zs test stand-in\r\n");
+
+    while (readline(fd, line, sizeof(line)) == 0) {
+	if (strncmp(line, "USER", 4) == 0) {
+	    reply(fd, "331 Enter password.\r\n");
+	} else if (strncmp(line, "PASS", 4) == 0) {
+	    reply(fd, "230 logged on.\r\n");
+	} else if (strncasecmp(line, "TYPE", 4) == 0) {
+	    reply(fd, "200 OK.\r\n");
+	} else if (strncmp(line, "MODE B", 6) == 0 && blockmode) {
+	    block = 1;
+	    reply(fd, "200 Data transfer mode is block.\r\n");
+	} else if (strncmp(line, "MODE S", 6) == 0) {
+	    block = 0;
+	    reply(fd, "200 Data transfer mode is stream.\r\n");
+	} else if (strncmp(line, "SIZE", 4) == 0) {
+	    snprintf(buf, sizeof(buf), "213 %zu\r\n", storedlen);
+	    reply(fd, buf);
+	} else if (strncmp(line, "PASV", 4) == 0) {
+	    assert(!block || npasv == 0);
+	    npasv++;
+	    pasvfd = listenlocal(&port);
+	    snprintf(buf, sizeof(buf),
+		     "227 Entering Passive Mode (127,0,0,1,%d,%d).\r\n",
+		     port >> 8, port & 0xff);
+	    reply(fd, buf);
+	} else if (strncmp(line, "STOU", 4) == 0) {
+	    reply(fd, "150 Sending file to /tmp/zstest1\r\n");
+	    if (datafd == -1) {
+		assert((datafd = accept(pasvfd, NULL, NULL)) != -1);
+		close(pasvfd);
+	    }
+	    if (block) {
+		recvblocks(datafd);
+	    } else {
+		storedlen = 0;
+		while ((rc = read(datafd, stored + storedlen,
+				  sizeof(stored) - storedlen)) > 0)
+		    storedlen += rc;
+		close(datafd);
+		datafd = -1;
+	    }
+	    reply(fd, "226 File transfer completed successfully.\r\n");
+	} else if (strncmp(line, "RETR", 4) == 0) {
+	    reply(fd, "150 Retrieving file.\r\n");
+	    if (datafd == -1) {
+		assert((datafd = accept(pasvfd, NULL, NULL)) != -1);
+		close(pasvfd);
+	    }
+	    if (block) {
+		sendblocks(datafd);
+	    } else {
+		assert(write(datafd, stored, storedlen)
+		       == (ssize_t) storedlen);
+		close(datafd);
+		datafd = -1;
+	    }
+	    reply(fd, "226 File transfer completed successfully.\r\n");
+	} else {
+	    reply(fd, "504 Not supported.\r\n");
+	}
+    }
+
+    exit(0);
+}
+
+/*
+ * put a file and get it back twice over a session with a stand-in that
+ * does or does not agree to block mode
+ */
+static void
+testsession(int blockmode)
+{
+    struct ftp      ftp;
+    char            localname[PATH_MAX];
+    char            remotename[PATH_MAX];
+    char            sport[16];
+    char            got[DATASIZ];
+    int             ctlfd;
+    int             port;
+    int             fd;
+    int             status;
+    int             n;
+    pid_t           pid;
+    size_t          i;
+
+    ctlfd = listenlocal(&port);
+    assert((pid = fork()) != -1);
+    if (pid == 0) {
+	signal(SIGPIPE, SIG_IGN);
+	standin(ctlfd, blockmode);
+    }
+    close(ctlfd);
+
+    ftp_init(&ftp);
+    snprintf(sport, sizeof(sport), "%d", port);
+    assert(ftp_set_variable(&ftp, FTP_VAR_HOST, "127.0.0.1") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_PORT, sport) == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_USER, "zstest") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_PASSWORD, "zstest") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_VERBOSE, AS400_VERBOSITY) == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_BLOCKMODE, "yes") == 0);
+
+    assert(ftp_connect(&ftp) == 0);
+    assert(ftp.block.on == blockmode);
+
+    strcpy(localname, "/tmp/zstest-XXXXXX");
+    assert((fd = mkstemp(localname)) != -1);
+    for (i = 0; i < DATASIZ; i++)
+	got[i] = (char) (i * 7 + i / 251);
+    assert(write(fd, got, DATASIZ) == DATASIZ);
+    assert(close(fd) == 0);
+
+    strcpy(remotename, "/tmp/zstest");
+    assert(ftp_put(&ftp, localname, remotename) == 0);
+    assert(strcmp(remotename, "/tmp/zstest1") == 0);
+
+    /*
+     * the restart marker is not part of the file
+     */
+    for (n = 0; n < 2; n++) {
+	assert(truncate(localname, 0) == 0);
+	assert(ftp_get(&ftp, localname, remotename) == 0);
+
+	memset(got, 0, sizeof(got));
+	assert((fd = open(localname, O_RDONLY)) != -1);
+	assert(read(fd, got, DATASIZ) == DATASIZ);
+	assert(read(fd, got, 1) == 0);
+	assert(close(fd) == 0);
+	for (i = 0; i < DATASIZ; i++)
+	    assert(got[i] == (char) (i * 7 + i / 251));
+    }
+    assert(ftp.block.on == blockmode);
+    assert((ftp.block.sock != -1) == blockmode);
+
+    ftp_close(&ftp);
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(unlink(localname) == 0);
+}
+
+int
+main(void)
+{
+    testsession(1);
+    testsession(0);
+
+    return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * MODE Z against a local stand-in for the server, which needs no AS/400.
+ * the stand-in inflates what it is sent with zlib and compresses what it
+ * sends, so a file makes the round trip through both
+ */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include "../config.h"
+#include "../../ftp.h"
+
+#define DATASIZ	(300 * 1024)
+
+static unsigned char stored[DATASIZ];
+static size_t   storedlen;
+
+static int
+listenlocal(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t       len;
+    int             fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(fd, 1) == 0);
+    len = sizeof(addr);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &len) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void
+reply(int fd, char *line)
+{
+    assert(write(fd, line, strlen(line)) == (ssize_t) strlen(line));
+}
+
+static int
+readline(int fd, char *line, size_t siz)
+{
+    size_t          len;
+
+    for (len = 0; len < siz - 1; len++) {
+	if (read(fd, line + len, 1) != 1)
+	    return -1;
+	if (line[len] == '\n')
+	    break;
+    }
+    line[len] = '\0';
+    return 0;
+}
+
+/*
+ * the compressed data of a put is one zlib stream up to the end of the
+ * data connection, it is smaller than the file
+ */
+static void
+recvdeflated(int fd)
+{
+    static unsigned char wire[DATASIZ];
+    size_t          wirelen;
+    uLongf          len;
+    ssize_t         rc;
+
+    wirelen = 0;
+    while ((rc = read(fd, wire + wirelen, sizeof(wire) - wirelen)) > 0)
+	wirelen += rc;
+    assert(rc == 0);
+    assert(wirelen > 0 && wirelen < sizeof(wire));
+
+    len = sizeof(stored);
+    assert(uncompress(stored, &len, wire, wirelen) == Z_OK);
+    storedlen = len;
+}
+
+static void
+senddeflated(int fd)
+{
+    static unsigned char wire[DATASIZ + 1024];
+    uLongf          len;
+
+    len = sizeof(wire);
+    assert(compress2(wire, &len, stored, storedlen, 6) == Z_OK);
+    assert(write(fd, wire, len) == (ssize_t) len);
+}
+
+static void
+standin(int ctlfd)
+{
+    char            line[BUFSIZ];
+    char            buf[BUFSIZ];
+    int             fd;
+    int             pasvfd;
+    int             datafd;
+    int             deflate;
+    int             port;
+
+    assert((fd = accept(ctlfd, NULL, NULL)) != -1);
+    pasvfd = -1;
+    deflate = 0;
+    reply(fd, "220 zs test stand-in\r\n");
+
+    while (readline(fd, line, sizeof(line)) == 0) {
+	if (strncmp(line, "USER", 4) == 0) {
+	    reply(fd, "331 Enter password.\r\n");
+	} else if (strncmp(line, "PASS", 4) == 0) {
+	    reply(fd, "230 logged on.\r\n");
+	} else if (strncasecmp(line, "TYPE", 4) == 0) {
+	    reply(fd, "200 OK.\r\n");
+	} else if (strncmp(line, "MODE Z", 6) == 0) {
+	    deflate = 1;
+	    reply(fd, "200 Data transfer mode is deflate.\r\n");
+	} else if (strncmp(line, "SIZE", 4) == 0) {
+	    snprintf(buf, sizeof(buf), "213 %zu\r\n", storedlen);
+	    reply(fd, buf);
+	} else if (strncmp(line, "PASV", 4) == 0) {
+	    pasvfd = listenlocal(&port);
+	    snprintf(buf, sizeof(buf),
+		     "227 Entering Passive Mode (127,0,0,1,%d,%d).\r\n",
+		     port >> 8, port & 0xff);
+	    reply(fd, buf);
+	} else if (strncmp(line, "STOU", 4) == 0) {
+	    assert(deflate);
+	    reply(fd, "150 Sending file to /tmp/zstest1\r\n");
+	    assert((datafd = accept(pasvfd, NULL, NULL)) != -1);
+	    close(pasvfd);
+	    recvdeflated(datafd);
+	    close(datafd);
+	    reply(fd, "226 File transfer completed successfully.\r\n");
+	} else if (strncmp(line, "RETR", 4) == 0) {
+	    assert(deflate);
+	    reply(fd, "150 Retrieving file.\r\n");
+	    assert((datafd = accept(pasvfd, NULL, NULL)) != -1);
+	    close(pasvfd);
+	    senddeflated(datafd);
+	    close(datafd);
+	    reply(fd, "226 File transfer completed successfully.\r\n");
+	} else {
+	    reply(fd, "504 Not supported.\r\n");
+	}
+    }
+
+    exit(0);
+}
+
+int
+main(void)
+{
+    struct ftp      ftp;
+    char            localname[PATH_MAX];
+    char            remotename[PATH_MAX];
+    char            sport[16];
+    char            got[DATASIZ];
+    int             ctlfd;
+    int             port;
+    int             fd;
+    int             status;
+    pid_t           pid;
+    size_t          i;
+
+    ctlfd = listenlocal(&port);
+    assert((pid = fork()) != -1);
+    if (pid == 0) {
+	signal(SIGPIPE, SIG_IGN);
+	standin(ctlfd);
+    }
+    close(ctlfd);
+
+    ftp_init(&ftp);
+    snprintf(sport, sizeof(sport), "%d", port);
+    assert(ftp_set_variable(&ftp, FTP_VAR_HOST, "127.0.0.1") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_PORT, sport) == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_USER, "zstest") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_PASSWORD, "zstest") == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_VERBOSE, AS400_VERBOSITY) == 0);
+    assert(ftp_set_variable(&ftp, FTP_VAR_DEFLATE, "yes") == 0);
+
+    assert(ftp_connect(&ftp) == 0);
+    assert(ftp.deflate.on);
+
+    /*
+     * a file that compresses, of more than one buffer
+     */
+    strcpy(localname, "/tmp/zstest-XXXXXX");
+    assert((fd = mkstemp(localname)) != -1);
+    for (i = 0; i < DATASIZ; i++)
+	got[i] = "QSYS.LIB/"[(i * 7 + i / 251) % 9];
+    assert(write(fd, got, DATASIZ) == DATASIZ);
+    assert(close(fd) == 0);
+
+    strcpy(remotename, "/tmp/zstest");
+    assert(ftp_put(&ftp, localname, remotename) == 0);
+    assert(strcmp(remotename, "/tmp/zstest1") == 0);
+
+    assert(truncate(localname, 0) == 0);
+    assert(ftp_get(&ftp, localname, remotename) == 0);
+    assert(ftp.deflate.wire > 0 && ftp.deflate.wire < DATASIZ);
+
+    memset(got, 0, sizeof(got));
+    assert((fd = open(localname, O_RDONLY)) != -1);
+    assert(read(fd, got, DATASIZ) == DATASIZ);
+    assert(read(fd, got, 1) == 0);
+    assert(close(fd) == 0);
+    for (i = 0; i < DATASIZ; i++)
+	assert(got[i] == "QSYS.LIB/"[(i * 7 + i / 251) % 9]);
+
+    ftp_close(&ftp);
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(unlink(localname) == 0);
+
+    return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * the rate limit against a local stand-in for the server, which needs no
+ * AS/400. a download is held to the limit of its session, and a bulk
+ * download sharing a limit with an urgent one waits while the urgent one
+ * goes on. the stand-in sends as fast as it can, the pace is set by zs
+ */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../config.h"
+#include "../../ftp.h"
+
+#define LIMIT	(1024 * 1024)	/* bytes per second */
+#define BIGSIZ	(1024 * 1024)	/* bytes of /tmp/big */
+#define SMALLSIZ	(512 * 1024)	/* bytes of /tmp/small */
+
+static char     data[BIGSIZ];
+
+static int
+listenlocal(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t       len;
+    int             fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(fd, 4) == 0);
+    len = sizeof(addr);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &len) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void
+reply(int fd, char *line)
+{
+    assert(write(fd, line, strlen(line)) == (ssize_t) strlen(line));
+}
+
+static int
+readline(int fd, char *line, size_t siz)
+{
+    size_t          len;
+
+    for (len = 0; len < siz - 1; len++) {
+	if (read(fd, line + len, 1) != 1)
+	    return -1;
+	if (line[len] == '\n')
+	    break;
+    }
+    line[len] = '\0';
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * the size of the file "name" the stand-in has
+ */
+static size_t
+filesize(char *name)
+{
+    return strstr(name, "/tmp/small") != NULL ? SMALLSIZ : BIGSIZ;
+}
+
+static void
+session(int fd)
+{
+    char            line[BUFSIZ];
+    char            buf[BUFSIZ];
+    int             pasvfd;
+    int             datafd;
+    int             port;
+
+    pasvfd = -1;
+    reply(fd, "220 zs test stand-in\r\n");
+
+    while (readline(fd, line, sizeof(line)) == 0) {
+	if (strncmp(line, "USER", 4) == 0) {
+	    reply(fd, "331 Enter password.\r\n");
+	} else if (strncmp(line, "PASS", 4) == 0) {
+	    reply(fd, "230 logged on.\r\n");
+	} else if (strncasecmp(line, "TYPE", 4) == 0) {
+	    reply(fd, "200 OK.\r\n");
+	} else if (strncmp(line, "SIZE", 4) == 0) {
+	    snprintf(buf, sizeof(buf), "213 %zu\r\n", filesize(line));
+	    reply(fd, buf);
+	} else if (strncmp(line, "PASV", 4) == 0) {
+	    pasvfd = listenlocal(&port);
+	    snprintf(buf, sizeof(buf),
+		     "227 Entering Passive Mode (127,0,0,1,%d,%d).\r\n",
+		     port >> 8, port & 0xff);
+	    reply(fd, buf);
+	} else if (strncmp(line, "RETR", 4) == 0) {
+	    reply(fd, "150 Retrieving file.\r\n");
+	    assert((datafd = accept(pasvfd, NULL, NULL)) != -1);
+	    close(pasvfd);
+	    assert(write(datafd, data, filesize(line))
+		   == (ssize_t) filesize(line));
+	    close(datafd);
+	    reply(fd, "226 File transfer completed successfully.\r\n");
+	} else {
+	    reply(fd, "504 Not supported.\r\n");
+	}
+    }
+
+    exit(0);
+}
+
+/*
+ * serve every session in a process of its own
+ */
+static void
+standin(int ctlfd)
+{
+    int             fd;
+
+    for (;;) {
+	assert((fd = accept(ctlfd, NULL, NULL)) != -1);
+	if (fork() == 0) {
+	    close(ctlfd);
+	    session(fd);
+	}
+	close(fd);
+    }
+}
+
+static void
+login(struct ftp *ftp, int port, char *limit)
+{
+    char            sport[16];
+
+    ftp_init(ftp);
+    snprintf(sport, sizeof(sport), "%d", port);
+    assert(ftp_set_variable(ftp, FTP_VAR_HOST, "127.0.0.1") == 0);
+    assert(ftp_set_variable(ftp, FTP_VAR_PORT, sport) == 0);
+    assert(ftp_set_variable(ftp, FTP_VAR_USER, "zstest") == 0);
+    assert(ftp_set_variable(ftp, FTP_VAR_PASSWORD, "zstest") == 0);
+    assert(ftp_set_variable(ftp, FTP_VAR_VERBOSE, AS400_VERBOSITY) == 0);
+    assert(ftp_set_variable(ftp, FTP_VAR_RATELIMIT, limit) == 0);
+    assert(ftp_connect(ftp) == 0);
+}
+
+/*
+ * download "remotename" into a new local file, the return value is when
+ * the download ended
+ */
+static double
+download(struct ftp *ftp, char *remotename)
+{
+    char            localname[PATH_MAX];
+    struct stat     st;
+    double          end;
+    int             fd;
+
+    strcpy(localname, "/tmp/zstest-XXXXXX");
+    assert((fd = mkstemp(localname)) != -1);
+    assert(close(fd) == 0);
+
+    assert(ftp_get(ftp, localname, remotename) == 0);
+    end = now();
+
+    assert(stat(localname, &st) == 0);
+    assert((size_t) st.st_size == filesize(remotename));
+    assert(unlink(localname) == 0);
+    return end;
+}
+
+/*
+ * the token bucket of a session holds a download of a second at the limit
+ * to about a second, less the burst it starts with
+ */
+static void
+testbucket(int port)
+{
+    struct ftp      ftp;
+    char            limit[32];
+    double          start;
+    double          secs;
+
+    snprintf(limit, sizeof(limit), "%d", LIMIT);
+    login(&ftp, port, limit);
+    start = now();
+    secs = download(&ftp, "/tmp/big") - start;
+    assert(secs >= (double) BIGSIZ / LIMIT - FTP_RATEBURST / 1000.0 - 0.05);
+    assert(secs < 5);
+    ftp_close(&ftp);
+}
+
+/*
+ * an urgent download that starts after a bulk one ends first, the bulk one
+ * waits for it and takes as much longer
+ */
+static void
+testurgent(int port)
+{
+    struct ftpshape *shape;
+    struct ftp      ftp;
+    struct timespec sleeper;
+    double          start;
+    double          end;
+    double          urgentend;
+    int             pfd[2];
+    int             status;
+    pid_t           pid;
+
+    assert((shape = ftp_shapenew(LIMIT)) != NULL);
+    assert(pipe(pfd) == 0);
+    assert((pid = fork()) != -1);
+    if (pid == 0) {
+	close(pfd[0]);
+	login(&ftp, port, "0");
+	ftp_shape(&ftp, shape, 1);
+	ftp_priority(&ftp, FTP_PRIORITY_URGENT);
+
+	/*
+	 * the bulk download is well on its way
+	 */
+	sleeper.tv_sec = 0;
+	sleeper.tv_nsec = 200 * 1000L * 1000L;
+	nanosleep(&sleeper, NULL);
+
+	urgentend = download(&ftp, "/tmp/small");
+	assert(write(pfd[1], &urgentend, sizeof(urgentend))
+	       == sizeof(urgentend));
+	ftp_close(&ftp);
+	exit(0);
+    }
+    close(pfd[1]);
+
+    login(&ftp, port, "0");
+    ftp_shape(&ftp, shape, 0);
+    ftp_priority(&ftp, FTP_PRIORITY_BULK);
+    start = now();
+    end = download(&ftp, "/tmp/big");
+    ftp_close(&ftp);
+
+    assert(read(pfd[0], &urgentend, sizeof(urgentend))
+	   == sizeof(urgentend));
+    close(pfd[0]);
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    assert(urgentend < end);
+    assert(end - start >= (double) (BIGSIZ + SMALLSIZ) / LIMIT
+	   - 2 * FTP_RATEBURST / 1000.0 - 0.05);
+    assert(end - start < 10);
+    ftp_shapefree(shape);
+}
+
+int
+main(void)
+{
+    int             ctlfd;
+    int             port;
+    int             status;
+    pid_t           pid;
+    size_t          i;
+
+    for (i = 0; i < sizeof(data); i++)
+	data[i] = (char) (i * 7 + i / 251);
+
+    ctlfd = listenlocal(&port);
+    assert((pid = fork()) != -1);
+    if (pid == 0) {
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);
+	standin(ctlfd);
+    }
+    close(ctlfd);
+
+    testbucket(port);
+    testurgent(port);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+
+    return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include "../config.h"
+#include "../../ftp.h"
+#include "../../zs.h"
+#include "../../util.h"
+#include "../../journal.h"
+
+static char     tmpdir[] = "/tmp/zs-test-XXXXXX";
+static char     path[PATH_MAX + NAME_MAX + 2];
+static struct ftp sourceftp;
+static struct ftp targetftp;
+static struct journal journal;
+
+/*
+ * the journal of an earlier run
+ */
+static void
+writejournal(char *text)
+{
+    FILE           *fp;
+
+    fp = fopen(path, "w");
+    assert(fp != NULL);
+    assert(fputs(text, fp) != EOF);
+    fclose(fp);
+}
+
+static void
+testkey(void)
+{
+    struct object   obj;
+    char            key[JOURNAL_KEYSIZ];
+
+    memset(&obj, 0, sizeof(struct object));
+    strcpy(obj.obj, "ORDPGM1");
+    journal_key(key, &obj);
+    assert(strcmp(key, "*LIBL/ORDPGM1") == 0);
+
+    strcpy(obj.lib, "LIB");
+    strcpy(obj.type, "*PGM");
+    journal_key(key, &obj);
+    assert(strcmp(key, "LIB/ORDPGM1*PGM") == 0);
+
+    strcpy(obj.lib, "ABCDEFGHIJ");
+    strcpy(obj.obj, "ABCDEFGHIJ");
+    strcpy(obj.type, "*ABCDEFGHI");
+    journal_key(key, &obj);
+    assert(strcmp(key, "ABCDEFGHIJ/ABCDEFGHIJ*ABCDEFGHI") == 0);
+}
+
+static void
+testmissing(void)
+{
+    assert(access(path, F_OK) == -1);
+    assert(journal_open(&journal, &sourceftp, &targetftp, "LIB", 1) == 0);
+    assert(journal.n == 0);
+    assert(journal.fd != -1);
+    journal_close(&journal, 1);
+    assert(access(path, F_OK) == -1);
+}
+
+static void
+testread(void)
+{
+    struct journalentry *ent;
+
+    writejournal("saved LIB/A*PGM LIB /tmp/a.savf\n"
+		 "this is not a journal line\n"
+		 "fetched LIB/A*PGM LIB /home/a.savf\n"
+		 "unknown LIB/B*PGM LIB /tmp/b.savf\n"
+		 "none LIB/B*PGM LIB /tmp/b.savf\n"
+		 "saved LIB/C*PGM - -\n"
+		 "pushed *LIBL/D LIB\n"
+		 "\n"
+		 "\x01\x02\xff garbage\n"
+		 "restored LIB/E*FILE LIB -\n"
+		 "saved LIB/E*FILE LIB /tmp/e.savf\n"
+		 "saved LIB/F*PGM LIB /tmp/f.savf /home/my dir/zs-f\n"
+		 "fetched LIB/G*PGM LIB /home/my dir/zs-g\n");
+
+    assert(journal_open(&journal, &sourceftp, &targetftp, "LIB", 1) == 0);
+    assert(journal.n == 5);
+
+    /*
+     * the last phase of an object wins, also an earlier one
+     */
+    ent = journal_find(&journal, "LIB/A*PGM");
+    assert(ent != NULL);
+    assert(ent->phase == JOURNAL_FETCHED);
+    assert(strcmp(ent->lib, "LIB") == 0);
+    assert(strcmp(ent->path, "/home/a.savf") == 0);
+
+    ent = journal_find(&journal, "LIB/E*FILE");
+    assert(ent != NULL);
+    assert(ent->phase == JOURNAL_SAVED);
+    assert(strcmp(ent->path, "/tmp/e.savf") == 0);
+    assert(strcmp(ent->part, "") == 0);
+
+    /*
+     * the local file is the rest of the line, spaces and all
+     */
+    ent = journal_find(&journal, "LIB/F*PGM");
+    assert(ent != NULL);
+    assert(ent->phase == JOURNAL_SAVED);
+    assert(strcmp(ent->path, "/tmp/f.savf") == 0);
+    assert(strcmp(ent->part, "/home/my dir/zs-f") == 0);
+
+    ent = journal_find(&journal, "LIB/G*PGM");
+    assert(ent != NULL);
+    assert(ent->phase == JOURNAL_FETCHED);
+    assert(strcmp(ent->path, "/home/my dir/zs-g") == 0);
+
+    /*
+     * an empty lib and path are written as "-"
+     */
+    ent = journal_find(&journal, "LIB/C*PGM");
+    assert(ent != NULL);
+    assert(ent->phase == JOURNAL_SAVED);
+    assert(strcmp(ent->lib, "") == 0);
+    assert(strcmp(ent->path, "") == 0);
+
+    assert(journal_find(&journal, "LIB/B*PGM") == NULL);
+    assert(journal_find(&journal, "*LIBL/D") == NULL);
+    journal_close(&journal, 0);
+}
+
+static void
+testrecord(void)
+{
+    struct journalentry *ent;
+    struct stat     st;
+
+    /*
+     * a run that is not resumed starts over
+     */
+    assert(journal_open(&journal, &sourceftp, &targetftp, "LIB", 0) == 0);
+    assert(journal.n == 0);
+    assert(stat(path, &st) == 0);
+    assert(st.st_size == 0);
+
+    assert(journal_record(&journal, JOURNAL_SAVED, "LIB/A*PGM", "LIB",
+			  "/tmp/a.savf") == 0);
+    assert(journal_record(&journal, JOURNAL_PUSHED, "LIB/A*PGM", "", NULL)
+	   == 0);
+    assert(journal_record(&journal, JOURNAL_RESTORED, "", "LIB",
+			  "/tmp/x.savf") == 0);
+    assert(journal_record(NULL, JOURNAL_SAVED, "LIB/X*PGM", "LIB", "")
+	   == 0);
+    assert(journal_saved(&journal, "LIB/B*PGM", "LIB", "/tmp/b.savf",
+			 "/home/my dir/zs-b") == 0);
+    assert(journal_saved(&journal, "LIB/C*PGM", "LIB", "/tmp/c.savf", NULL)
+	   == 0);
+
+    /*
+     * what is recorded is there before the journal is read again
+     */
+    assert(journal.n == 3);
+    ent = journal_find(&journal, "LIB/B*PGM");
+    assert(ent != NULL);
+    assert(strcmp(ent->part, "/home/my dir/zs-b") == 0);
+    journal_close(&journal, 0);
+
+    assert(journal_open(&journal, &sourceftp, &targetftp, "LIB", 1) == 0);
+    assert(journal.n == 3);
+    ent = journal_find(&journal, "LIB/A*PGM");
+    assert(ent != NULL);
+    assert(ent->phase == JOURNAL_PUSHED);
+    assert(strcmp(ent->lib, "") == 0);
+    assert(strcmp(ent->path, "") == 0);
+
+    ent = journal_find(&journal, "LIB/B*PGM");
+    assert(ent != NULL);
+    assert(ent->phase == JOURNAL_SAVED);
+    assert(strcmp(ent->path, "/tmp/b.savf") == 0);
+    assert(strcmp(ent->part, "/home/my dir/zs-b") == 0);
+
+    ent = journal_find(&journal, "LIB/C*PGM");
+    assert(ent != NULL);
+    assert(strcmp(ent->path, "/tmp/c.savf") == 0);
+    assert(strcmp(ent->part, "") == 0);
+    journal_close(&journal, 1);
+    assert(access(path, F_OK) == -1);
+}
+
+/*
+ * a journal that cannot be written fails the open
+ */
+static void
+testunwritable(void)
+{
+    assert(mkdir(path, 0700) == 0);
+    assert(journal_open(&journal, &sourceftp, &targetftp, "LIB", 1)
+	   == EUTIL_SYSTEM);
+    assert(rmdir(path) == 0);
+}
+
+int
+main(void)
+{
+    assert(mkdtemp(tmpdir) != NULL);
+    assert(setenv("ZS_STATEDIR", tmpdir, 1) == 0);
+    strcpy(sourceftp.server.host, "SRC");
+    strcpy(targetftp.server.host, "TGT");
+    snprintf(path, sizeof(path), "%s/copy-SRC-TGT-LIB", tmpdir);
+
+    testkey();
+    testmissing();
+    testread();
+    testrecord();
+    testunwritable();
+
+    assert(rmdir(tmpdir) == 0);
+    return 0;
+}
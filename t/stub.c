@@ -0,0 +1,26 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * what main.c gives the modules of zs, for the tests that link them
+ * without it
+ */
+#include <stdio.h>
+#include <stdarg.h>
+
+void            print_error(char *format, ...);
+
+void
+print_error(char *format, ...)
+{
+    va_list         ap;
+
+    va_start(ap, format);
+    fputs("zs: ", stderr);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
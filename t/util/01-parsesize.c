@@ -0,0 +1,62 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "../config.h"
+#include "../../ftp.h"
+#include "../../zs.h"
+#include "../../util.h"
+
+int
+main(void)
+{
+    long long       size;
+
+    assert(util_parsesize(&size, "0") == 0);
+    assert(size == 0);
+
+    assert(util_parsesize(&size, "512") == 0);
+    assert(size == 512);
+
+    assert(util_parsesize(&size, "4k") == 0);
+    assert(size == 4LL * 1024);
+
+    assert(util_parsesize(&size, "4K") == 0);
+    assert(size == 4LL * 1024);
+
+    assert(util_parsesize(&size, "64M") == 0);
+    assert(size == 64LL * 1024 * 1024);
+
+    assert(util_parsesize(&size, "1G") == 0);
+    assert(size == 1024LL * 1024 * 1024);
+
+    assert(util_parsesize(&size, "2T") == 0);
+    assert(size == 2LL * 1024 * 1024 * 1024 * 1024);
+
+    /*
+     * the largest size that fits, and the smallest that does not
+     */
+    assert(util_parsesize(&size, "8388607T") == 0);
+    assert(size == 8388607LL * 1024 * 1024 * 1024 * 1024);
+    assert(util_parsesize(&size, "8388608T") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "9000000000T") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "9223372036854775807K") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "99999999999999999999") == EUTIL_BADSIZE);
+
+    size = 42;
+    assert(util_parsesize(&size, "") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "K") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "-1") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "1X") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "1KB") == EUTIL_BADSIZE);
+    assert(util_parsesize(&size, "1.5G") == EUTIL_BADSIZE);
+    assert(size == 42);
+
+    return 0;
+}
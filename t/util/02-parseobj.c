@@ -0,0 +1,78 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "../config.h"
+#include "../../ftp.h"
+#include "../../zs.h"
+#include "../../util.h"
+
+static struct {
+    char           *optobj;
+    char           *lib;
+    char           *obj;
+    char           *type;
+    int             generic;
+} tests[] = {
+    {"ORDPGM1", "", "ORDPGM1", "", 0},
+    {"ORDPGM1*PGM", "", "ORDPGM1", "*PGM", 0},
+    {"LIB/ORDPGM1", "LIB", "ORDPGM1", "", 0},
+    {"LIB/ORDPGM1*PGM", "LIB", "ORDPGM1", "*PGM", 0},
+    {"LIB/ORDPGM1*SRVPGM", "LIB", "ORDPGM1", "*SRVPGM", 0},
+
+    /*
+     * generic names, the asterisk of the name is followed by the one of
+     * the type
+     */
+    {"ORD*", "", "ORD*", "", 1},
+    {"LIB/ORD*", "LIB", "ORD*", "", 1},
+    {"ORD**PGM", "", "ORD*", "*PGM", 1},
+    {"LIB/ORD**PGM", "LIB", "ORD*", "*PGM", 1},
+    {"ORD**", "", "ORD*", "", 1},
+
+    /*
+     * special values
+     */
+    {"*ALL", "", "*ALL", "", 1},
+    {"*ALL*PGM", "", "*ALL", "*PGM", 1},
+    {"LIB/*ALL*FILE", "LIB", "*ALL", "*FILE", 1},
+
+    /*
+     * a library alone, and an asterisk that starts the type
+     */
+    {"LIB/", "LIB", "", "", 0},
+    {"LIB/*PGM", "LIB", "*PGM", "", 1},
+    {"A*B", "", "A", "*B", 0},
+
+    /*
+     * too long parts are cut to the size of a name
+     */
+    {"LIBRARY12345/OBJECT12345*PROGRAM12345", "LIBRARY123", "OBJECT1234",
+     "*PROGRAM12", 0},
+};
+
+int
+main(void)
+{
+    struct object   obj;
+    char            optobj[64];
+    size_t          i;
+
+    for (i = 0; i < sizeof(tests) / sizeof(*tests); i++) {
+	strcpy(optobj, tests[i].optobj);
+	printf("%s\n", optobj);
+	assert(util_parseobj(&obj, optobj) == 0);
+	assert(strcmp(obj.lib, tests[i].lib) == 0);
+	assert(strcmp(obj.obj, tests[i].obj) == 0);
+	assert(strcmp(obj.type, tests[i].type) == 0);
+	assert(util_isgeneric(&obj) == tests[i].generic);
+    }
+
+    return 0;
+}
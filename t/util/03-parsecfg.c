@@ -0,0 +1,189 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+#include "../config.h"
+#include "../../ftp.h"
+#include "../../zs.h"
+#include "../../util.h"
+
+static char     path[] = "/tmp/zs-test-XXXXXX";
+
+/*
+ * parse "text" as a config file into "ftp", which is set up first
+ */
+static int
+parsecfg(struct ftp *ftp, char *text)
+{
+    FILE           *fp;
+
+    fp = fopen(path, "w");
+    assert(fp != NULL);
+    assert(fputs(text, fp) != EOF);
+    fclose(fp);
+
+    ftp_init(ftp);
+    return util_parsecfg(ftp, path);
+}
+
+static void
+testserver(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "# comment\n"
+		    "; comment\n"
+		    "host HOST\n"
+		    "user USER\n"
+		    "password PASS\n"
+		    "port 8000\n" "tries 500\n") == 0);
+    assert(strcmp(ftp.server.host, "HOST") == 0);
+    assert(strcmp(ftp.server.user, "USER") == 0);
+    assert(strcmp(ftp.server.password, "PASS") == 0);
+    assert(ftp.server.port == 8000);
+    assert(ftp.server.maxtries == 500);
+
+    assert(parsecfg(&ftp, "server HOST\n" "username USER\n"
+		    "maxtries 5\n") == 0);
+    assert(strcmp(ftp.server.host, "HOST") == 0);
+    assert(strcmp(ftp.server.user, "USER") == 0);
+    assert(ftp.server.maxtries == 5);
+
+    assert(parsecfg(&ftp, "host HOST\n" "nokey 1\n") == EUTIL_BADKEY);
+    assert(strcmp(ftp.server.host, "HOST") == 0);
+}
+
+static void
+teststripes(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "stripes 4\n" "stripesize 64M\n") == 0);
+    assert(ftp.stripe.count == 4);
+    assert(ftp.stripe.minsize == 64LL * 1024 * 1024);
+
+    assert(parsecfg(&ftp, "stripes 100\n") == 0);
+    assert(ftp.stripe.count == FTP_STRIPEMAX);
+
+    assert(parsecfg(&ftp, "stripesize 1X\n") == EUTIL_BADSIZE);
+}
+
+static void
+testuncached(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "uncachedsize 1G\n") == 0);
+    assert(ftp.uncached.minsize == 1024LL * 1024 * 1024);
+
+    assert(parsecfg(&ftp, "uncachedsize 0\n") == 0);
+    assert(ftp.uncached.minsize == 0);
+
+    assert(parsecfg(&ftp, "uncachedsize -1\n") == EUTIL_BADSIZE);
+}
+
+static void
+testblockmode(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "blockmode no\n") == 0);
+    assert(ftp.block.want == 0);
+
+    assert(parsecfg(&ftp, "blockmode yes\n") == 0);
+    assert(ftp.block.want == 1);
+}
+
+static void
+testdeflate(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "deflate yes\n"
+		    "deflatehelper /usr/bin/gzip\n") == 0);
+    assert(ftp.deflate.want == FTP_DEFLATE_YES);
+    assert(ftp.deflate.use == 1);
+    assert(strcmp(ftp.deflate.helper, "/usr/bin/gzip") == 0);
+
+    assert(parsecfg(&ftp, "deflate no\n") == 0);
+    assert(ftp.deflate.want == FTP_DEFLATE_NO);
+    assert(strcmp(ftp.deflate.helper, FTP_DEFLATEHELPER) == 0);
+
+    assert(parsecfg(&ftp, "deflate auto\n") == 0);
+    assert(ftp.deflate.want == FTP_DEFLATE_AUTO);
+}
+
+static void
+testpipeline(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "pipeline no\n") == 0);
+    assert(ftp.pipeline == 0);
+
+    assert(parsecfg(&ftp, "pipeline yes\n") == 0);
+    assert(ftp.pipeline == 1);
+}
+
+static void
+testnet(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "nodelay no\n"
+		    "sndbuf 4M\n"
+		    "rcvbuf 8M\n" "bufsize 256K\n" "congestion bbr\n") == 0);
+    assert(ftp.net.nodelay == 0);
+    assert(ftp.net.sndbuf == 4 * 1024 * 1024);
+    assert(ftp.net.rcvbuf == 8 * 1024 * 1024);
+    assert(ftp.net.bufsiz == 256 * 1024);
+    assert(strcmp(ftp.net.congestion, "bbr") == 0);
+
+    assert(parsecfg(&ftp, "sndbuf 1X\n") == EUTIL_BADSIZE);
+    assert(parsecfg(&ftp, "rcvbuf -1\n") == EUTIL_BADSIZE);
+    assert(parsecfg(&ftp, "bufsize 1.5M\n") == EUTIL_BADSIZE);
+}
+
+static void
+testratelimit(void)
+{
+    struct ftp      ftp;
+
+    assert(parsecfg(&ftp, "ratelimit 10M\n") == 0);
+    assert(ftp.rate.limit == 10 * 1024 * 1024);
+
+    assert(parsecfg(&ftp, "ratelimit 0\n") == 0);
+    assert(ftp.rate.limit == 0);
+
+    assert(parsecfg(&ftp, "ratelimit 10MB\n") == EUTIL_BADSIZE);
+}
+
+int
+main(void)
+{
+    int             fd;
+
+    fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    testserver();
+    teststripes();
+    testuncached();
+    testblockmode();
+    testdeflate();
+    testpipeline();
+    testnet();
+    testratelimit();
+
+    unlink(path);
+    return 0;
+}
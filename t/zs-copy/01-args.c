@@ -8,6 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include "../config.h"
 #include "util.h"
@@ -18,6 +21,9 @@ main(void)
     int             exit_status;
     char           *stdout;
     char           *stderr;
+    char            statedir[] = "/tmp/zs-test-XXXXXX";
+    char            journal[PATH_MAX];
+    FILE           *fp;
 
     assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
 		  ZS_PATH, "copy", NULL}) == 0);
@@ -26,6 +32,68 @@ main(void)
     free(stdout);
     free(stderr);
 
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--cache", NULL}) == 0);
+    assert(exit_status == 2);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--cache-size", "1X", "obj", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: failed to parse cache size: Invalid size\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--cache-size", "9000000000T", "obj",
+		  NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: failed to parse cache size: Invalid size\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--rate-limit", "10MB", "obj", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: failed to parse rate limit: Invalid size\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--stage-size", "1X", "obj", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: failed to parse staging size: Invalid size\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--stage-memory", "1X", "obj", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: failed to parse staging memory: Invalid size\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--stage-dir", "/tmp", "--stage-dir", "/tmp",
+		  "--stage-dir", "/tmp", "--stage-dir", "/tmp",
+		  "--stage-dir", "/tmp", "--stage-dir", "/tmp",
+		  "--stage-dir", "/tmp", "--stage-dir", "/tmp",
+		  "--stage-dir", "/tmp", "obj", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr,
+		  "zs: maximum of 8 staging directories reached\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--cache", "/tmp", "--cache-size", "1G",
+		  NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: missing object\n") == 0);
+    free(stdout);
+    free(stderr);
+
     assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
 		  ZS_PATH, "copy", "obj", NULL}) == 0);
     assert(exit_status == 1);
@@ -48,5 +116,45 @@ main(void)
     free(stdout);
     free(stderr);
 
+    /*
+     * a missing or corrupt journal is a run from the start
+     */
+    assert(mkdtemp(statedir) != NULL);
+    assert(setenv("ZS_STATEDIR", statedir, 1) == 0);
+    snprintf(journal, sizeof(journal), "%s/copy-%s-%s-", statedir,
+	     AS400_HOST, AS400_HOST);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--resume", "-s", AS400_HOST,
+		  "-S", AS400_HOST, "obj", NULL}) == 0);
+    assert(exit_status == 1);
+    assert(strcmp(stderr, "zs: failed to create save file: Not Logged In\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    fp = fopen(journal, "w");
+    assert(fp != NULL);
+    fputs("restored\nsaved *LIBL/OBJ\n\x01\xff garbage - -\n", fp);
+    fclose(fp);
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--resume", "-s", AS400_HOST,
+		  "-S", AS400_HOST, "obj", NULL}) == 0);
+    assert(exit_status == 1);
+    assert(strcmp(stderr, "zs: failed to create save file: Not Logged In\n") == 0);
+    free(stdout);
+    free(stderr);
+    unlink(journal);
+
+    assert(mkdir(journal, 0700) == 0);
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "copy", "--resume", "-s", AS400_HOST,
+		  "-S", AS400_HOST, "obj", NULL}) == 0);
+    assert(exit_status == 1);
+    assert(strcmp(stderr, "zs: failed to open journal: Is a directory\n") == 0);
+    free(stdout);
+    free(stderr);
+    rmdir(journal);
+    rmdir(statedir);
+
     return 0;
 }
@@ -42,9 +42,9 @@ readpartfd(struct file *f)
 	return 0;
 
     /*
-     * realloc 
+     * realloc, with room for the terminating NUL
      */
-    if (f->size == f->length) {
+    if (f->size == f->length + 1) {
 	f->size *= 2;
 	f->buffer = realloc(f->buffer, f->size);
 	if (f->buffer == NULL) {
@@ -52,7 +52,7 @@ readpartfd(struct file *f)
 	}
     }
 
-    readlen = read(f->fd, f->buffer + f->length, f->size - f->length);
+    readlen = read(f->fd, f->buffer + f->length, f->size - f->length - 1);
 
     switch (readlen) {
     case -1:
@@ -66,8 +66,9 @@ readpartfd(struct file *f)
 	f->done = 1;
 	return 0;
     default:
-	dprintf(f->origfd, "%*s", (int) readlen, f->buffer + f->length);
+	dprintf(f->origfd, "%.*s", (int) readlen, f->buffer + f->length);
 	f->length += readlen;
+	f->buffer[f->length] = '\0';
     }
     return readlen;
 }
@@ -86,6 +87,7 @@ readfiles(char **pstdout, char **pstderr, int outfd, int errfd)
     if (stdout.buffer == NULL) {
 	err(1, "alloc");
     }
+    *stdout.buffer = '\0';
 
     /*
      * allocate stderr 
@@ -95,6 +97,7 @@ readfiles(char **pstdout, char **pstderr, int outfd, int errfd)
     if (stderr.buffer == NULL) {
 	err(1, "alloc");
     }
+    *stderr.buffer = '\0';
 
     while (readpartfd(&stdout) != 0 || readpartfd(&stderr) != 0);
 
@@ -0,0 +1,78 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * file is used for testing zs
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "../config.h"
+#include "../zs-copy/util.h"
+
+int
+main(void)
+{
+    int             exit_status;
+    char           *stdout;
+    char           *stderr;
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "diff", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: missing library\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "diff", "LIB1", "LIB2", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr, "zs: too many libraries\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "diff", "-i", "added,moved", "LIB", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr,
+		  "zs: failed to parse sets: unknown set 'moved'\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "diff", "-t", ",", "LIB", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr,
+		  "zs: failed to parse types: Missing value for option\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "diff", "-t",
+		  "A,B,C,D,E,F,G,H,I,J,K,L,M,N,O,P,Q", "LIB", NULL}) == 0);
+    assert(exit_status == 2);
+    assert(strcmp(stderr,
+		  "zs: failed to parse types: Maximum types reached\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "diff", "LIB", NULL}) == 0);
+    assert(exit_status == 1);
+    assert(strcmp(stderr,
+		  "zs: failed to connect to source: Missing host\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    assert(runcmd(&exit_status, &stdout, &stderr, (char *const[]) {
+		  ZS_PATH, "diff", "-s", AS400_HOST, "LIB", NULL}) == 0);
+    assert(exit_status == 1);
+    assert(strcmp(stderr,
+		  "zs: failed to connect to target: Missing host\n") == 0);
+    free(stdout);
+    free(stderr);
+
+    return 0;
+}
@@ -0,0 +1,708 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+
+/*
+ * for syscall, io_uring has no wrappers in the C library
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "uring.h"
+
+#ifdef ZS_IOURING
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define URING_PROBEMAX	256
+
+static int
+setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+enter(int fd, unsigned tosubmit, unsigned minwait, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, tosubmit, minwait, flags,
+			 NULL, 0);
+}
+
+static int
+registerring(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+/*
+ * whether the kernel has every operation used, RECV and SEND came after
+ * io_uring itself
+ */
+static int
+probe(int fd)
+{
+    static const int ops[] = {
+	IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READ, IORING_OP_WRITE,
+	IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED
+    };
+    struct io_uring_probe *pr;
+    size_t          i;
+    int             ok;
+
+    pr = calloc(1, sizeof(struct io_uring_probe)
+		+ URING_PROBEMAX * sizeof(struct io_uring_probe_op));
+    if (pr == NULL)
+	return 0;
+
+    ok = registerring(fd, IORING_REGISTER_PROBE, pr, URING_PROBEMAX) == 0;
+    for (i = 0; ok && i < sizeof(ops) / sizeof(*ops); i++)
+	ok = ops[i] <= pr->last_op
+	    && (pr->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+
+    free(pr);
+    return ok;
+}
+
+static void    *
+mapring(int fd, size_t size, off_t offset)
+{
+    void           *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ * set up a ring for "nslots" transfers at once of up to "bufsiz" bytes per
+ * operation.
+ * the return value is 0, or -1 when io_uring cannot be used and the
+ * caller is to move the data itself
+ */
+int
+uring_init(struct uring *ring, int nslots, size_t bufsiz)
+{
+    struct io_uring_params p;
+    struct iovec    iov;
+    char           *sq;
+    char           *cq;
+    int             errno_;
+
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+    if (nslots < 1 || nslots > URING_SLOTMAX || bufsiz == 0) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    memset(&p, 0, sizeof(struct io_uring_params));
+    ring->fd = setup(2 * nslots, &p);
+    if (ring->fd == -1)
+	return -1;
+    if (!probe(ring->fd)) {
+	errno = ENOSYS;
+	goto fail;
+    }
+
+    ring->sqringsiz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqringsiz = p.cq_off.cqes
+	+ p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqessiz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqring = mapring(ring->fd, ring->sqringsiz, IORING_OFF_SQ_RING);
+    ring->cqring = mapring(ring->fd, ring->cqringsiz, IORING_OFF_CQ_RING);
+    ring->sqes = mapring(ring->fd, ring->sqessiz, IORING_OFF_SQES);
+    if (ring->sqring == NULL || ring->cqring == NULL || ring->sqes == NULL)
+	goto fail;
+
+    sq = ring->sqring;
+    cq = ring->cqring;
+    ring->sqhead = (unsigned *) (sq + p.sq_off.head);
+    ring->sqtail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sqmask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sqarray = (unsigned *) (sq + p.sq_off.array);
+    ring->cqhead = (unsigned *) (cq + p.cq_off.head);
+    ring->cqtail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cqmask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = cq + p.cq_off.cqes;
+
+    ring->bufs = malloc((size_t) nslots * bufsiz);
+    if (ring->bufs == NULL)
+	goto fail;
+
+    /*
+     * registered buffers are not mapped for every operation, older
+     * kernels count them against the locked memory limit though
+     */
+    iov.iov_base = ring->bufs;
+    iov.iov_len = (size_t) nslots * bufsiz;
+    ring->fixed = registerring(ring->fd, IORING_REGISTER_BUFFERS, &iov,
+			       1) == 0;
+
+    ring->nslots = nslots;
+    ring->bufsiz = bufsiz;
+    return 0;
+
+  fail:
+    errno_ = errno;
+    uring_free(ring);
+    errno = errno_;
+    return -1;
+}
+
+static void
+push(struct uring *ring, struct io_uring_sqe *sqe)
+{
+    struct io_uring_sqe *sqes = ring->sqes;
+    unsigned        tail;
+    unsigned        idx;
+
+    tail = *ring->sqtail;
+    idx = tail & *ring->sqmask;
+    memcpy(&sqes[idx], sqe, sizeof(struct io_uring_sqe));
+    ring->sqarray[idx] = idx;
+    __atomic_store_n(ring->sqtail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+}
+
+/*
+ * fill in the first operation of the slot "slot", or the second one when
+ * "second" is set. the first receives or reads "len" bytes into the buffer
+ * of the slot, the second writes or sends them
+ */
+static void
+prep(struct uring *ring, int slot, int second, size_t len,
+     struct io_uring_sqe *sqe)
+{
+    struct uringslot *s;
+
+    s = &ring->slots[slot];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    if (!second && s->recv) {
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = s->sock;
+	sqe->msg_flags = MSG_WAITALL;
+    } else if (!second) {
+	sqe->opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = s->fd;
+	sqe->off = s->offset;
+    } else if (s->recv) {
+	sqe->opcode = ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = s->fd;
+	sqe->off = s->offset;
+    } else {
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = s->sock;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    }
+    sqe->addr = (uintptr_t) (ring->bufs + (size_t) slot * ring->bufsiz);
+    sqe->len = len;
+    sqe->user_data = slot * 2 + (second != 0);
+}
+
+/*
+ * set up the slot "slot" to move "len" bytes from the socket to the file,
+ * or the other way
+ */
+static void
+setslot(struct uring *ring, int slot, int recv, int sock, int fd,
+	long long offset, size_t len)
+{
+    struct uringslot *s;
+
+    s = &ring->slots[slot];
+    s->sock = sock;
+    s->fd = fd;
+    s->recv = recv;
+    s->offset = offset;
+    s->len = len;
+    s->moved = 0;
+    s->second = 0;
+    s->error = 0;
+}
+
+/*
+ * queue the linked operations moving "len" bytes of the slot's buffer
+ * from the socket to the file, or the other way
+ */
+static int
+queue(struct uring *ring, int slot, int recv, int sock, int fd,
+      long long offset, size_t len)
+{
+    struct uringslot *s;
+    struct io_uring_sqe sqe;
+
+    if (ring->fd == -1 || slot < 0 || slot >= ring->nslots
+	|| ring->slots[slot].pending > 0 || len > ring->bufsiz) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    s = &ring->slots[slot];
+    setslot(ring, slot, recv, sock, fd, offset, len);
+    s->pending = 2;
+    s->onsock = 1;
+
+    /*
+     * a short first operation breaks the link, the rest is moved by
+     * "uring_wait"
+     */
+    prep(ring, slot, 0, len, &sqe);
+    sqe.flags = IOSQE_IO_LINK;
+    push(ring, &sqe);
+
+    prep(ring, slot, 1, len, &sqe);
+    push(ring, &sqe);
+
+    return 0;
+}
+
+/*
+ * receive up to "len" bytes from "sock" and write them to "fd" at
+ * "offset", on the slot "slot"
+ */
+int
+uring_recvwrite(struct uring *ring, int slot, int sock, int fd,
+		long long offset, size_t len)
+{
+    return queue(ring, slot, 1, sock, fd, offset, len);
+}
+
+/*
+ * read up to "len" bytes from "fd" at "offset" and send them to "sock", on
+ * the slot "slot"
+ */
+int
+uring_readsend(struct uring *ring, int slot, int fd, long long offset,
+	       int sock, size_t len)
+{
+    return queue(ring, slot, 0, sock, fd, offset, len);
+}
+
+/*
+ * submit what is queued and take in completions until the operations of a
+ * slot are done.
+ * the return value is the slot, or -1 on error
+ */
+static int
+reap(struct uring *ring)
+{
+    struct io_uring_cqe *cqes = ring->cqes;
+    struct uringslot *s;
+    unsigned        head;
+    unsigned long long data;
+    int             res;
+    int             rc;
+
+    for (;;) {
+	head = *ring->cqhead;
+	if (head == __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE)) {
+	    rc = enter(ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+	    if (rc == -1) {
+		if (errno == EINTR)
+		    continue;
+		return -1;
+	    }
+	    ring->queued -= rc;
+	    continue;
+	}
+
+	data = cqes[head & *ring->cqmask].user_data;
+	res = cqes[head & *ring->cqmask].res;
+	__atomic_store_n(ring->cqhead, head + 1, __ATOMIC_RELEASE);
+
+	if (data / 2 >= (unsigned long long) ring->nslots)
+	    continue;
+	s = &ring->slots[data / 2];
+	s->pending--;
+	if (data % 2 == 0) {
+	    if (res < 0)
+		s->error = -res;
+	    else
+		s->moved = res;
+	} else {
+	    if (res < 0 && res != -ECANCELED && s->error == 0)
+		s->error = -res;
+	    else if (res >= 0)
+		s->second = res;
+	}
+
+	if (s->pending == 0)
+	    return data / 2;
+    }
+}
+
+/*
+ * wait for a slot to be done, it is set in "slot" unless it is NULL and
+ * the number of bytes moved in "moved", 0 is the end of the socket or
+ * file.
+ * the return value is 0, or -1 on error
+ */
+int
+uring_wait(struct uring *ring, int *slot, ssize_t *moved)
+{
+    struct uringslot *s;
+    char           *buf;
+    int             i;
+
+    i = reap(ring);
+    if (i == -1)
+	return -1;
+    if (slot != NULL)
+	*slot = i;
+
+    s = &ring->slots[i];
+    if (s->error != 0) {
+	errno = s->error;
+	return -1;
+    }
+
+    /*
+     * the first operation came up short and the second was cancelled,
+     * this is the end of the socket or file
+     */
+    buf = ring->bufs + (size_t) i * ring->bufsiz;
+    if ((size_t) s->moved < s->len && s->moved > 0) {
+	if ((s->recv ? pwrite(s->fd, buf, s->moved, s->offset)
+	     : send(s->sock, buf, s->moved, MSG_NOSIGNAL)) != s->moved)
+	    return -1;
+    } else if ((size_t) s->moved == s->len && s->second != s->moved) {
+	errno = EIO;
+	return -1;
+    }
+
+    *moved = s->moved;
+    return 0;
+}
+
+/*
+ * start a stream of "len" bytes at "offset" of "fd", received from "sock"
+ * when "recv" is set, else sent to it. the buffers are taken in order by
+ * "uring_next".
+ * the return value is 0, or -1 on error
+ */
+int
+uring_stream(struct uring *ring, int recv, int sock, int fd,
+	     long long offset, long long len)
+{
+    int             i;
+
+    if (ring->fd == -1 || len < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    for (i = 0; i < ring->nslots; i++) {
+	if (ring->slots[i].pending > 0) {
+	    errno = EBUSY;
+	    return -1;
+	}
+	ring->slots[i].stage = URING_FREE;
+    }
+
+    memset(&ring->stream, 0, sizeof(ring->stream));
+    ring->stream.recv = recv;
+    ring->stream.sock = sock;
+    ring->stream.fd = fd;
+    ring->stream.offset = offset;
+    ring->stream.end = offset + len;
+    return 0;
+}
+
+/*
+ * queue the first operation of every free slot of the stream in order, a
+ * receive only when no other is in flight
+ */
+static void
+fill(struct uring *ring)
+{
+    struct uringslot *s;
+    struct io_uring_sqe sqe;
+    size_t          len;
+    int             i;
+
+    while (!ring->stream.eof && ring->stream.offset < ring->stream.end
+	   && !(ring->stream.recv && ring->stream.onsock)) {
+	i = ring->stream.tail;
+	s = &ring->slots[i];
+	if (s->stage != URING_FREE)
+	    break;
+
+	len = ring->bufsiz;
+	if (ring->stream.end - ring->stream.offset < (long long) len)
+	    len = ring->stream.end - ring->stream.offset;
+	setslot(ring, i, ring->stream.recv, ring->stream.sock,
+		ring->stream.fd, ring->stream.offset, len);
+	s->pending = 1;
+	s->onsock = ring->stream.recv;
+	s->stage = URING_FIRST;
+	prep(ring, i, 0, len, &sqe);
+	push(ring, &sqe);
+
+	ring->stream.onsock |= ring->stream.recv;
+	ring->stream.offset += len;
+	ring->stream.tail = (i + 1) % ring->nslots;
+    }
+}
+
+/*
+ * queue the second operation of the slot "slot" of the stream
+ */
+static void
+fillsecond(struct uring *ring, int slot)
+{
+    struct uringslot *s;
+    struct io_uring_sqe sqe;
+
+    s = &ring->slots[slot];
+    s->pending = 1;
+    s->onsock = !s->recv;
+    s->stage = URING_SECOND;
+    prep(ring, slot, 1, s->moved, &sqe);
+    push(ring, &sqe);
+
+    ring->stream.onsock |= !s->recv;
+}
+
+/*
+ * wait for the next buffer of the stream to be moved, the number of bytes
+ * is set in "moved", 0 is the end of the socket or file.
+ * the return value is 0, or -1 on error
+ */
+int
+uring_next(struct uring *ring, ssize_t *moved)
+{
+    struct uringslot *head;
+    struct uringslot *s;
+    int             i;
+
+    for (;;) {
+	fill(ring);
+
+	/*
+	 * the socket is sent to in order, from the buffer at the head
+	 */
+	head = &ring->slots[ring->stream.head];
+	if (!ring->stream.recv && head->stage == URING_READY
+	    && !ring->stream.onsock)
+	    fillsecond(ring, ring->stream.head);
+
+	if (head->stage == URING_FREE) {
+	    *moved = 0;
+	    return 0;
+	}
+	if (head->stage == URING_DONE) {
+	    *moved = head->moved;
+	    head->stage = URING_FREE;
+	    if (head->moved > 0)
+		ring->stream.head = (ring->stream.head + 1) % ring->nslots;
+	    return 0;
+	}
+
+	i = reap(ring);
+	if (i == -1)
+	    return -1;
+	s = &ring->slots[i];
+	if (s->error != 0) {
+	    errno = s->error;
+	    return -1;
+	}
+
+	if (s->stage == URING_FIRST) {
+	    ring->stream.onsock &= !s->recv;
+
+	    /*
+	     * a short receive or read is the end of the socket or file
+	     */
+	    if ((size_t) s->moved < s->len)
+		ring->stream.eof = 1;
+	    if (s->moved == 0)
+		s->stage = URING_DONE;
+	    else if (s->recv)
+		fillsecond(ring, i);
+	    else
+		s->stage = URING_READY;
+	} else {
+	    ring->stream.onsock &= s->recv;
+	    if (s->second != s->moved) {
+		errno = EIO;
+		return -1;
+	    }
+	    s->stage = URING_DONE;
+	}
+    }
+}
+
+/*
+ * wait for the operations in flight, one on a socket is cut short first as
+ * it may never complete.
+ * the return value is 0, or -1 when the ring cannot be waited on
+ */
+static int
+drain(struct uring *ring)
+{
+    int             i;
+    int             pending;
+
+    for (i = 0; i < ring->nslots; i++)
+	if (ring->slots[i].pending > 0 && ring->slots[i].onsock)
+	    shutdown(ring->slots[i].sock, SHUT_RDWR);
+
+    for (;;) {
+	pending = 0;
+	for (i = 0; i < ring->nslots; i++)
+	    pending += ring->slots[i].pending;
+	if (pending == 0)
+	    break;
+	if (reap(ring) == -1)
+	    return -1;
+    }
+
+    for (i = 0; i < ring->nslots; i++)
+	ring->slots[i].stage = URING_FREE;
+    memset(&ring->stream, 0, sizeof(ring->stream));
+    return 0;
+}
+
+/*
+ * make the ring ready for the next transfer once the one before ended, also
+ * by an error. a ring that cannot be waited on is torn down
+ */
+void
+uring_drain(struct uring *ring)
+{
+    if (ring->fd != -1 && drain(ring) == -1)
+	uring_free(ring);
+}
+
+/*
+ * tear down the ring, operations still in flight are cut short first as
+ * they use the buffers. a ring with "fd" -1 is left alone
+ */
+void
+uring_free(struct uring *ring)
+{
+    if (ring->fd != -1) {
+	drain(ring);
+
+	close(ring->fd);
+	if (ring->sqring != NULL)
+	    munmap(ring->sqring, ring->sqringsiz);
+	if (ring->cqring != NULL)
+	    munmap(ring->cqring, ring->cqringsiz);
+	if (ring->sqes != NULL)
+	    munmap(ring->sqes, ring->sqessiz);
+	free(ring->bufs);
+    }
+
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+}
+
+#else
+
+/*
+ * built without io_uring, the callers move the data themselves
+ */
+int
+uring_init(struct uring *ring, int nslots, size_t bufsiz)
+{
+    (void) nslots;
+    (void) bufsiz;
+
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+void
+uring_free(struct uring *ring)
+{
+    ring->fd = -1;
+}
+
+int
+uring_recvwrite(struct uring *ring, int slot, int sock, int fd,
+		long long offset, size_t len)
+{
+    (void) ring;
+    (void) slot;
+    (void) sock;
+    (void) fd;
+    (void) offset;
+    (void) len;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_readsend(struct uring *ring, int slot, int fd, long long offset,
+	       int sock, size_t len)
+{
+    (void) ring;
+    (void) slot;
+    (void) fd;
+    (void) offset;
+    (void) sock;
+    (void) len;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_wait(struct uring *ring, int *slot, ssize_t *moved)
+{
+    (void) ring;
+    (void) slot;
+    (void) moved;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_stream(struct uring *ring, int recv, int sock, int fd,
+	     long long offset, long long len)
+{
+    (void) ring;
+    (void) recv;
+    (void) sock;
+    (void) fd;
+    (void) offset;
+    (void) len;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_next(struct uring *ring, ssize_t *moved)
+{
+    (void) ring;
+    (void) moved;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+void
+uring_drain(struct uring *ring)
+{
+    (void) ring;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * zs - work with, and move objects from one AS/400 to another.
+ * Copyright (C) 2018  Andreas Louv <andreas@louv.dk>
+ * See LICENSE
+ */
+#ifndef URING_H
+#define URING_H 1
+
+#define URING_SLOTMAX	16
+
+/*
+ * where the buffer of a slot of a stream is
+ */
+enum uringstage {
+    URING_FREE = 0,
+    URING_FIRST,		/* the first operation is in flight */
+    URING_READY,		/* the first is done, the second not queued */
+    URING_SECOND,		/* the second operation is in flight */
+    URING_DONE
+};
+
+/*
+ * a slot moves one buffer at a time between a socket and a file, as two
+ * linked operations. a slot of a stream queues them one after the other
+ */
+struct uringslot {
+    int             sock;
+    int             fd;
+    int             recv;	/* boolean, socket to file */
+    long long       offset;
+    size_t          len;
+    int             pending;	/* operations not completed */
+    int             onsock;	/* boolean, one pending is on the socket */
+    enum uringstage stage;	/* of a stream */
+    ssize_t         moved;	/* result of the first operation */
+    ssize_t         second;	/* result of the second operation */
+    int             error;	/* errno of the first failed operation */
+};
+
+/*
+ * an io_uring with a registered buffer per slot, "fd" is -1 when it is not
+ * set up. the rings are kept as plain pointers so only uring.c needs the
+ * kernel headers
+ */
+struct uring {
+    int             fd;
+    void           *sqring;
+    size_t          sqringsiz;
+    void           *cqring;
+    size_t          cqringsiz;
+    void           *sqes;
+    size_t          sqessiz;
+    unsigned       *sqhead;
+    unsigned       *sqtail;
+    unsigned       *sqmask;
+    unsigned       *sqarray;
+    unsigned       *cqhead;
+    unsigned       *cqtail;
+    unsigned       *cqmask;
+    void           *cqes;
+    unsigned        queued;	/* entries not yet submitted */
+    char           *bufs;
+    size_t          bufsiz;	/* bytes moved per operation */
+    int             fixed;	/* boolean, "bufs" is registered */
+    int             nslots;
+    struct uringslot slots[URING_SLOTMAX];
+
+    /*
+     * a stream moves the buffers of its slots in order over one socket,
+     * the file side of every slot is in flight at once but only one
+     * operation on the socket
+     */
+    struct {
+	int             recv;	/* boolean, socket to file */
+	int             sock;
+	int             fd;
+	long long       offset;	/* of the next buffer queued */
+	long long       end;
+	int             head;	/* slot of the next buffer in order */
+	int             tail;	/* next slot queued */
+	int             onsock;	/* boolean, a socket operation is queued */
+	int             eof;	/* boolean, nothing is queued after it */
+    } stream;
+};
+
+int             uring_init(struct uring *, int, size_t);
+void            uring_free(struct uring *);
+int             uring_recvwrite(struct uring *, int, int, int, long long,
+				size_t);
+int             uring_readsend(struct uring *, int, int, long long, int,
+			       size_t);
+int             uring_wait(struct uring *, int *, ssize_t *);
+int             uring_stream(struct uring *, int, int, int, long long,
+			     long long);
+int             uring_next(struct uring *, ssize_t *);
+void            uring_drain(struct uring *);
+
+#endif
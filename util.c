@@ -8,10 +8,16 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "ftp.h"
 #include "zs.h"
 #include "util.h"
+#include "job.h"
+#include "profile.h"
 
 /*
  * error message follow the index of "enum util_errors"
@@ -21,7 +27,8 @@ static const char *util_error_messages[] = {
     [EUTIL_NOVAL] = "Missing value for option",
     [EUTIL_BADKEY] = "Unknown option",
     [EUTIL_LIBOVERFLOW] = "Maximum libraries reached",
-    [EUTIL_TYPEOVERFLOW] = "Maximum types reached"
+    [EUTIL_TYPEOVERFLOW] = "Maximum types reached",
+    [EUTIL_BADSIZE] = "Invalid size"
 };
 
 /*
@@ -46,6 +53,8 @@ util_parsecfg(struct ftp *ftp, char *filename)
     char           *saveptr;
     size_t          linesiz;
     char            filenamebuf[BUFSIZ];
+    long long       size;
+    char            sizebuf[32];
 
     line = NULL;
     linesiz = 0;
@@ -91,6 +100,68 @@ util_parsecfg(struct ftp *ftp, char *filename)
 	} else if (strcmp(key, "tries") == 0
 		   || strcmp(key, "maxtries") == 0) {
 	    ftp_set_variable(ftp, FTP_VAR_MAXTRIES, val);
+	} else if (strcmp(key, "stripes") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_STRIPES, val);
+	} else if (strcmp(key, "stripesize") == 0) {
+	    if (util_parsesize(&size, val) != 0) {
+		returncode = EUTIL_BADSIZE;
+		goto exit;
+	    }
+	    snprintf(sizebuf, sizeof(sizebuf), "%lld", size);
+	    ftp_set_variable(ftp, FTP_VAR_STRIPEMIN, sizebuf);
+	} else if (strcmp(key, "uncachedsize") == 0) {
+	    if (util_parsesize(&size, val) != 0) {
+		returncode = EUTIL_BADSIZE;
+		goto exit;
+	    }
+	    snprintf(sizebuf, sizeof(sizebuf), "%lld", size);
+	    ftp_set_variable(ftp, FTP_VAR_UNCACHEDMIN, sizebuf);
+	} else if (strcmp(key, "blockmode") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_BLOCKMODE, val);
+	} else if (strcmp(key, "deflate") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_DEFLATE, val);
+	} else if (strcmp(key, "deflatehelper") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_DEFLATEHELPER, val);
+	} else if (strcmp(key, "tls") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_TLS, val);
+	} else if (strcmp(key, "tlsca") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_TLSCA, val);
+	} else if (strcmp(key, "tlsverify") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_TLSVERIFY, val);
+	} else if (strcmp(key, "pipeline") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_PIPELINE, val);
+	} else if (strcmp(key, "nodelay") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_NODELAY, val);
+	} else if (strcmp(key, "sndbuf") == 0) {
+	    if (util_parsesize(&size, val) != 0) {
+		returncode = EUTIL_BADSIZE;
+		goto exit;
+	    }
+	    snprintf(sizebuf, sizeof(sizebuf), "%lld", size);
+	    ftp_set_variable(ftp, FTP_VAR_SNDBUF, sizebuf);
+	} else if (strcmp(key, "rcvbuf") == 0) {
+	    if (util_parsesize(&size, val) != 0) {
+		returncode = EUTIL_BADSIZE;
+		goto exit;
+	    }
+	    snprintf(sizebuf, sizeof(sizebuf), "%lld", size);
+	    ftp_set_variable(ftp, FTP_VAR_RCVBUF, sizebuf);
+	} else if (strcmp(key, "bufsize") == 0) {
+	    if (util_parsesize(&size, val) != 0) {
+		returncode = EUTIL_BADSIZE;
+		goto exit;
+	    }
+	    snprintf(sizebuf, sizeof(sizebuf), "%lld", size);
+	    ftp_set_variable(ftp, FTP_VAR_BUFSIZE, sizebuf);
+	} else if (strcmp(key, "ratelimit") == 0) {
+	    if (util_parsesize(&size, val) != 0) {
+		returncode = EUTIL_BADSIZE;
+		goto exit;
+	    }
+	    snprintf(sizebuf, sizeof(sizebuf), "%lld", size);
+	    ftp_set_variable(ftp, FTP_VAR_RATELIMIT, sizebuf);
+	} else if (strcmp(key, "congestion") == 0) {
+	    ftp_set_variable(ftp, FTP_VAR_CONGESTION, val);
 	} else {
 	    returncode = EUTIL_BADKEY;
 	    goto exit;
@@ -144,6 +215,8 @@ util_parsetypes(struct sourceopt *sourceopt, char *opttypes)
 
     i = 0;
     p = strtok_r(opttypes, ",", &saveptr);
+    if (p == NULL)
+	return EUTIL_NOVAL;
     do {
 	if (i == Z_TYPEMAX) {
 	    return EUTIL_TYPEOVERFLOW;
@@ -170,47 +243,245 @@ util_parsetypes(struct sourceopt *sourceopt, char *opttypes)
  * parse object
  * obj   = ( $libl "/" )? $obj ( "*" $type )?
  * $libl = \w{1,10}
- * $obj  = \w{1,10}
+ * $obj  = \w{1,10} | \w{1,9} "*" | "*ALL"
  * $type = \w{1,10}
+ * a trailing asterisk makes $obj a generic name, i.e. "ORD*" or "ORD**PGM"
  */
 int
 util_parseobj(struct object *obj, char *optobj)
 {
-    char           *saveptr;
     char           *p;
+    size_t          len;
+
+    memset(obj, 0, sizeof(struct object));
 
     /*
      * $libl
      */
-    if (strchr(optobj, '/')) {
-	p = strtok_r(optobj, "/", &saveptr);
-	strncpy(obj->lib, p, Z_LIBSIZ);
-	obj->lib[Z_LIBSIZ - 1] = '\0';
-
-	p = strtok_r(NULL, "*", &saveptr);
-    } else {
-	p = strtok_r(optobj, "*", &saveptr);
+    if ((p = strchr(optobj, '/')) != NULL) {
+	len = p - optobj;
+	if (len > Z_LIBSIZ - 1)
+	    len = Z_LIBSIZ - 1;
+	memcpy(obj->lib, optobj, len);
+	optobj = p + 1;
     }
 
     /*
-     * $obj
+     * $obj, a leading asterisk is a special value such as "*ALL"
+     */
+    p = optobj;
+    if (*p == '*')
+	p++;
+    p += strcspn(p, "*");
+
+    /*
+     * generic name
      */
-    strncpy(obj->obj, p, Z_OBJSIZ);
-    obj->obj[Z_OBJSIZ - 1] = '\0';
+    if (*optobj != '*' && p != optobj && *p == '*'
+	&& (p[1] == '*' || p[1] == '\0'))
+	p++;
+
+    len = p - optobj;
+    if (len > Z_OBJSIZ - 1)
+	len = Z_OBJSIZ - 1;
+    memcpy(obj->obj, optobj, len);
 
     /*
      * $type
      */
-    p = strtok_r(NULL, "?", &saveptr);
-    if (p != NULL) {
+    if (*p == '*' && p[1] != '\0') {
 	*obj->type = '*';
-	strncpy(obj->type + 1, p, Z_TYPESIZ - 1);
-	obj->type[Z_TYPESIZ - 2] = '\0';
+	strncpy(obj->type + 1, p + 1, Z_TYPESIZ - 2);
+	obj->type[Z_TYPESIZ - 1] = '\0';
     }
 
     return 0;
 }
 
+/*
+ * check if the object name is a generic name or a special value, such names
+ * are expanded by the server
+ */
+int
+util_isgeneric(struct object *obj)
+{
+    return strchr(obj->obj, '*') != NULL;
+}
+
+/*
+ * parse size
+ * $size   = \d+ $suffix?
+ * $suffix = K | M | G | T
+ */
+int
+util_parsesize(long long *size, char *optsize)
+{
+    char           *end;
+    long long       val;
+    int             scale;
+
+    errno = 0;
+    val = strtoll(optsize, &end, 10);
+    if (errno != 0 || end == optsize || val < 0)
+	return EUTIL_BADSIZE;
+
+    scale = 0;
+    switch (toupper(*end)) {
+    case 'T':
+	scale++;
+	/* FALLTHROUGH */
+    case 'G':
+	scale++;
+	/* FALLTHROUGH */
+    case 'M':
+	scale++;
+	/* FALLTHROUGH */
+    case 'K':
+	scale++;
+	end++;
+	break;
+    }
+
+    if (*end != '\0')
+	return EUTIL_BADSIZE;
+
+    /*
+     * a size too large for a long long is not a size
+     */
+    for (; scale > 0; scale--) {
+	if (val > LLONG_MAX / 1024)
+	    return EUTIL_BADSIZE;
+	val *= 1024;
+    }
+
+    *size = val;
+    return 0;
+}
+
+/*
+ * get fd with output of cmd, returns -1 on error.
+ * it all starts over when the connection is lost, as the file "cmd" wrote
+ * to in QTEMP is gone with the session.
+ * the seconds of "cmd", of CPYTOIMPF and of the download are added to
+ * "seconds" unless it is NULL
+ */
+int
+util_freadcmd(struct ftp *ftp, char *cmd, char *fromfile, double *seconds)
+{
+    int             rc;
+    int             fd;
+    char            localname[PATH_MAX];
+    char            remotename[PATH_MAX];
+    char            name[Z_OBJSIZ];
+    struct timespec start;
+
+    /*
+     * the name is unique to the session, as other runs may read a command
+     * on the same server at the same time
+     */
+    job_name(name, 0);
+    snprintf(remotename, sizeof(remotename), "/tmp/zs-readcmd-%s", name);
+
+  again:
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = ftp_cmd(ftp, cmd);
+    if (seconds != NULL)
+	seconds[0] += profile_elapsed(&start);
+    if (ftp_dfthandle(ftp, rc, 250) != 0) {
+	if (ftp_replay(ftp))
+	    goto again;
+	print_error("failed to run command: %s\n", ftp_strerror(ftp));
+	return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = ftp_cmd(ftp,
+		 "RCMD CPYTOIMPF FROMFILE(%s) TOSTMF('%s') MBROPT(*REPLACE) STMFCCSID(1208) RCDDLM(*LF) DTAFMT(*FIXED)\r\n",
+		 fromfile, remotename);
+    if (seconds != NULL)
+	seconds[1] += profile_elapsed(&start);
+    if (ftp_dfthandle(ftp, rc, 250) != 0) {
+	if (ftp_replay(ftp))
+	    goto again;
+	print_error("failed to copy to import-file: %s\n",
+		    ftp_strerror(ftp));
+	return -1;
+    }
+
+    /*
+     * create local file
+     */
+    strcpy(localname, "/tmp/zs-XXXXXX");
+    fd = mkstemp(localname);
+    if (fd == -1) {
+	print_error("failed to create output file: %s\n", strerror(errno));
+	return -1;
+    }
+
+    /*
+     * download
+     */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = ftp_get(ftp, localname, remotename);
+    if (seconds != NULL)
+	seconds[2] += profile_elapsed(&start);
+    if (rc != 0) {
+	ftp_unlink(localname);
+	close(fd);
+	if (ftp_replay(ftp))
+	    goto again;
+	print_error("failed to get file: %s\n", ftp_strerror(ftp));
+	return -1;
+    }
+
+    /*
+     * delete the "localname"-file already,
+     * as it is then GC'd when "close(fd)" is called
+     */
+    unlink(localname);
+
+    /*
+     * delete remote
+     */
+    rc = ftp_cmd(ftp, "DELETE %s\n", remotename);
+    if (ftp_dfthandle(ftp, rc, 250) != 0 && !ftp_replay(ftp)) {
+	print_error("failed to remove tempfile: %s\n", ftp_strerror(ftp));
+	close(fd);
+	return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * get the directory where state is kept between runs, that is
+ * "$ZS_STATEDIR" or "$HOME/.zs". the directory is created if it is missing
+ */
+int
+util_statedir(char *dir, size_t dirsiz)
+{
+    char           *env;
+    size_t          len;
+
+    env = getenv("ZS_STATEDIR");
+    if (env != NULL && *env != '\0') {
+	len = snprintf(dir, dirsiz, "%s", env);
+    } else {
+	env = getenv("HOME");
+	len = snprintf(dir, dirsiz, "%s/.zs", env ? env : "");
+    }
+
+    if (len >= dirsiz) {
+	errno = ENAMETOOLONG;
+	return EUTIL_SYSTEM;
+    }
+
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+	return EUTIL_SYSTEM;
+
+    return 0;
+}
+
 /*
  * print errors.
  * should always be called immediately after an error occurred as the value of
@@ -12,6 +12,7 @@ enum util_errors {
     EUTIL_BADKEY,
     EUTIL_LIBOVERFLOW,
     EUTIL_TYPEOVERFLOW,
+    EUTIL_BADSIZE,
     EUTIL_SYSTEM = 99
 };
 
@@ -19,6 +20,10 @@ int             util_parsecfg(struct ftp *, char *);
 int             util_parselibl(char[Z_LIBLMAX][Z_LIBSIZ], char *);
 int             util_parsetypes(struct sourceopt *, char *);
 int             util_parseobj(struct object *, char *);
+int             util_isgeneric(struct object *);
+int             util_parsesize(long long *, char *);
+int             util_freadcmd(struct ftp *, char *, char *, double *);
+int             util_statedir(char *, size_t);
 const char     *util_strerror(int errnum);
 void            util_guessrelease(char *release, struct ftp *sourceftp,
 				  struct ftp *targetftp);
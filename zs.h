@@ -14,6 +14,9 @@
 #define Z_OBJSIZ	11
 #define Z_TYPESIZ	11
 #define Z_RLSSIZ	11
+#define Z_TSSIZ		27	/* YYYY-MM-DD-HH.MM.SS.NNNNNN */
+#define Z_JOBQSIZ	22	/* LIB/JOBQ */
+#define Z_DTACPRSIZ	8
 
 struct object {
     char            lib[Z_LIBSIZ];
@@ -23,15 +26,36 @@ struct object {
 
 struct sourceopt {
     int             pipe;
+    struct cache   *cache;	/* NULL when caching is off */
     char            release[Z_RLSSIZ];
     char            libl[Z_LIBLMAX][Z_LIBSIZ];
     struct object   objects[Z_OBJMAX];
+    int             nurgent;	/* the first objects are urgent */
+    int             priority;	/* "enum ftp_priority" of the object being
+				 * copied */
     char            types[Z_TYPEMAX][Z_TYPESIZ];
+    char            synclib[Z_LIBSIZ];	/* "zs sync" */
+    char            refts[Z_TSSIZ];	/* empty for a full save */
+    char            jobq[Z_JOBQSIZ];	/* empty to save interactively */
+    char            worklib[Z_LIBSIZ];
+    struct pool    *pool;	/* save files in "worklib" */
+    char            dtacpr[Z_DTACPRSIZ];	/* empty to choose per save */
+    struct profile *profile;	/* NULL when "dtacpr" is given */
+    struct journal *journal;	/* NULL for "zs sync" */
+    char            restorelib[Z_LIBSIZ];	/* target on the same system */
+    struct stage   *stage;	/* local save files */
+    struct stats   *stats;	/* NULL without "--stats" */
 };
 
 struct targetopt {
     int             pipe;
+    int             ack;	/* tells the source a save file is done */
     char            lib[Z_LIBSIZ];
+    char            jobq[Z_JOBQSIZ];	/* empty to restore interactively */
+    char            worklib[Z_LIBSIZ];
+    struct pool    *pool;	/* save files in "worklib" */
+    struct journal *journal;	/* NULL for "zs sync" */
+    struct stats   *stats;	/* NULL without "--stats" */
 };
 
 void            print_error(char *format, ...);